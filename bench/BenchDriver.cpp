@@ -0,0 +1,207 @@
+//========================= End-to-End Benchmark Driver =======================//
+//
+// Runs the persistent memory workloads built plain and instrumented by PMCheck,
+// and reports for every workload and configuration:
+//
+//   ops/s      inserts per second of the best run
+//   slowdown   time of the best run over that of the best plain run
+//   peak RSS   largest resident set of all the runs
+//
+// Configurations:
+//   plain           <workload>.plain, not instrumented
+//   pmcheck         <workload>.pmcheck with the default engine of the runtime
+//   pmcheck-shadow  <workload>.pmcheck with PMCHECK_ENGINE=shadow
+//
+// Other PMCHECK_* variables in the environment are passed on to the runs.
+//
+//=============================================================================//
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define DEFAULT_NUM_OPS 100000
+#define DEFAULT_POOL_SIZE_MB 256
+#define DEFAULT_NUM_RUNS 3
+
+static const char *DefaultWorkloads[] = {
+	"btree_map", "ctree_map", "hashmap", "rbtree_map", "append_log"
+};
+
+struct BenchConfig {
+	const char *Name;
+	const char *Suffix;
+
+// Engine of the runtime, or null to leave it to the runtime
+	const char *Engine;
+};
+
+static const BenchConfig Configs[] = {
+	{"plain", ".plain", nullptr},
+	{"pmcheck", ".pmcheck", nullptr},
+	{"pmcheck-shadow", ".pmcheck", "shadow"}
+};
+
+struct RunResult {
+	bool Succeeded;
+	double Seconds;
+	uint64_t PeakRSSKB;
+};
+
+// Runs a workload and reads the time of its inserts from the line it prints
+static RunResult runWorkload(const std::string &Binary, const BenchConfig &Config,
+														 const std::vector<std::string> &Args, bool Verbose) {
+	RunResult Result = {false, 0, 0};
+	int Pipe[2];
+	if(pipe(Pipe))
+		return Result;
+	pid_t Pid = fork();
+	if(Pid < 0)
+		return Result;
+	if(!Pid) {
+		dup2(Pipe[1], STDOUT_FILENO);
+		close(Pipe[0]);
+		close(Pipe[1]);
+		if(!Verbose) {
+		// Findings of the runtime are not of interest here
+			int Null = open("/dev/null", O_WRONLY);
+			dup2(Null, STDERR_FILENO);
+		}
+		if(Config.Engine)
+			setenv("PMCHECK_ENGINE", Config.Engine, 1);
+		else
+			unsetenv("PMCHECK_ENGINE");
+		std::vector<char *> ArgVect;
+		ArgVect.push_back((char *)Binary.c_str());
+		for(auto &Arg : Args)
+			ArgVect.push_back((char *)Arg.c_str());
+		ArgVect.push_back(nullptr);
+		execv(Binary.c_str(), ArgVect.data());
+		_exit(127);
+	}
+
+	close(Pipe[1]);
+	std::string Output;
+	char Buffer[4096];
+	ssize_t Size;
+	while((Size = read(Pipe[0], Buffer, sizeof(Buffer))) > 0)
+		Output.append(Buffer, Size);
+	close(Pipe[0]);
+
+	int Status;
+	struct rusage Usage;
+	if(wait4(Pid, &Status, 0, &Usage) != Pid || !WIFEXITED(Status) || WEXITSTATUS(Status))
+		return Result;
+	auto Pos = Output.find("seconds=");
+	if(Pos == std::string::npos)
+		return Result;
+	Result.Succeeded = true;
+	Result.Seconds = strtod(Output.c_str() + Pos + strlen("seconds="), nullptr);
+	Result.PeakRSSKB = Usage.ru_maxrss;
+	return Result;
+}
+
+static void printUsage(const char *Name) {
+	std::cerr << "Usage: " << Name << " [-n <ops>] [-s <pool size in MB>] [-r <runs>] "
+						<< "[-dir <pool directory>] [-bin <workload directory>] [-v] [workloads...]\n";
+}
+
+int main(int argc, char **argv) {
+	uint64_t NumOps = DEFAULT_NUM_OPS;
+	uint64_t PoolSizeMB = DEFAULT_POOL_SIZE_MB;
+	uint32_t NumRuns = DEFAULT_NUM_RUNS;
+	std::string PoolDir = "/dev/shm";
+	std::string BinDir = "workloads";
+	bool Verbose = false;
+	std::vector<std::string> WorkloadsVect;
+	for(int Index = 1; Index < argc; ++Index) {
+		std::string Arg = argv[Index];
+		if(Arg == "-v") {
+			Verbose = true;
+			continue;
+		}
+		if(Arg[0] != '-') {
+			WorkloadsVect.push_back(Arg);
+			continue;
+		}
+		if(Index + 1 == argc) {
+			printUsage(argv[0]);
+			return 1;
+		}
+		const char *Value = argv[++Index];
+		if(Arg == "-n") {
+			NumOps = strtoull(Value, nullptr, 0);
+		} else if(Arg == "-s") {
+			PoolSizeMB = strtoull(Value, nullptr, 0);
+		} else if(Arg == "-r") {
+			NumRuns = strtoul(Value, nullptr, 0);
+		} else if(Arg == "-dir") {
+			PoolDir = Value;
+		} else if(Arg == "-bin") {
+			BinDir = Value;
+		} else {
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+	if(WorkloadsVect.empty())
+		WorkloadsVect.assign(std::begin(DefaultWorkloads), std::end(DefaultWorkloads));
+	if(!NumRuns)
+		NumRuns = 1;
+
+	std::cout << std::left << std::setw(14) << "workload" << std::setw(16) << "config"
+						<< std::right << std::setw(14) << "ops/s" << std::setw(12) << "seconds"
+						<< std::setw(10) << "slowdown" << std::setw(14) << "peak RSS MB" << "\n";
+	bool AllSucceeded = true;
+	for(auto &Workload : WorkloadsVect) {
+		double PlainSeconds = 0;
+		for(auto &Config : Configs) {
+			std::string Binary = BinDir + "/" + Workload + Config.Suffix;
+			std::string Pool = PoolDir + "/pmbench." + Workload + "." + std::to_string(getpid());
+			std::vector<std::string> Args = {"-n", std::to_string(NumOps),
+																			 "-s", std::to_string(PoolSizeMB), "-f", Pool};
+			RunResult Best = {false, 0, 0};
+			uint64_t PeakRSSKB = 0;
+			for(uint32_t Run = 0; Run != NumRuns; ++Run) {
+				auto Result = runWorkload(Binary, Config, Args, Verbose);
+				unlink(Pool.c_str());
+				if(!Result.Succeeded) {
+					Best.Succeeded = false;
+					break;
+				}
+				if(!Best.Succeeded || Result.Seconds < Best.Seconds)
+					Best = Result;
+				if(Result.PeakRSSKB > PeakRSSKB)
+					PeakRSSKB = Result.PeakRSSKB;
+			}
+
+			std::cout << std::left << std::setw(14) << Workload << std::setw(16) << Config.Name
+								<< std::right;
+			if(!Best.Succeeded) {
+				std::cout << std::setw(14) << "failed" << std::endl;
+				AllSucceeded = false;
+				continue;
+			}
+			if(!strcmp(Config.Name, "plain"))
+				PlainSeconds = Best.Seconds;
+			double OpsPerSecond = Best.Seconds > 0 ? NumOps / Best.Seconds : 0;
+			std::cout << std::fixed << std::setprecision(0) << std::setw(14) << OpsPerSecond
+								<< std::setprecision(3) << std::setw(12) << Best.Seconds;
+			if(PlainSeconds > 0)
+				std::cout << std::setprecision(2) << std::setw(9) << Best.Seconds / PlainSeconds << "x";
+			else
+				std::cout << std::setw(10) << "-";
+			std::cout << std::setprecision(1) << std::setw(14) << PeakRSSKB / 1024.0 << std::endl;
+		}
+	}
+	return AllSucceeded ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+//============================ Append Log Workload ============================//
+//
+// Log of key-value records, like pmemlog. A record is written after the end of
+// the log, flushed and drained before the end is moved past it. Lookups find the
+// latest record of a key through an index in volatile memory, so that checking
+// the log does not take quadratic time.
+//
+//=============================================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pmbench.h"
+
+#define APPEND_LOG_MAX_CAPACITY ((uint64_t)1 << 22)
+#define INITIAL_INDEX_SIZE 1024
+
+struct append_log_record {
+	uint64_t key;
+	uint64_t value;
+	uint64_t checksum;
+	uint64_t padding;
+};
+
+struct append_log {
+	uint64_t end;
+	uint64_t capacity;
+	struct append_log_record records[];
+};
+
+const char *workload_name = "append_log";
+
+// Volatile index from the keys to one past their latest records. It is an open
+// addressing table that is doubled when it is half full.
+static uint64_t *log_index;
+static uint64_t log_index_size;
+static uint64_t log_index_count;
+
+static inline uint64_t *log_index_find(struct append_log *log, uint64_t key) {
+	uint64_t mask = log_index_size - 1;
+	uint64_t slot = (key * 0x9e3779b97f4a7c15ULL) >> 32 & mask;
+	while(log_index[slot] && log->records[log_index[slot] - 1].key != key)
+		slot = (slot + 1) & mask;
+	return &log_index[slot];
+}
+
+static void log_index_grow(struct append_log *log) {
+	uint64_t *old = log_index;
+	uint64_t old_size = log_index_size;
+	log_index_size *= 2;
+	log_index = calloc(log_index_size, sizeof(uint64_t));
+	for(uint64_t slot = 0; slot != old_size; ++slot) {
+		if(old[slot])
+			*log_index_find(log, log->records[old[slot] - 1].key) = old[slot];
+	}
+	free(old);
+}
+
+// The log takes the rest of the pool
+void *workload_create(struct pm_pool *pool) {
+	uint64_t capacity = (pool->size - pool->used - sizeof(struct append_log))
+										/ sizeof(struct append_log_record) - 1;
+	if(capacity > APPEND_LOG_MAX_CAPACITY)
+		capacity = APPEND_LOG_MAX_CAPACITY;
+	struct append_log *log = pm_alloc(pool, sizeof(struct append_log)
+																		+ capacity * sizeof(struct append_log_record));
+	log->capacity = capacity;
+	pm_persist(log, sizeof(struct append_log));
+	log_index_size = INITIAL_INDEX_SIZE;
+	log_index = calloc(log_index_size, sizeof(uint64_t));
+	return log;
+}
+
+void workload_insert(struct pm_pool *pool, void *root, uint64_t key, uint64_t value) {
+	struct append_log *log = root;
+	if(log->end == log->capacity) {
+		fprintf(stderr, "%s: log of %llu records is full\n", workload_name,
+						(unsigned long long)log->capacity);
+		exit(1);
+	}
+	struct append_log_record *record = &log->records[log->end];
+	record->key = key;
+	record->value = value;
+	record->checksum = key ^ value;
+	pmem_flush(record, sizeof(struct append_log_record));
+	pmem_drain();
+	log->end++;
+	pmem_flush(&log->end, sizeof(log->end));
+	pmem_drain();
+
+	uint64_t *entry = log_index_find(log, key);
+	if(!*entry)
+		log_index_count++;
+	*entry = log->end;
+	if(2 * log_index_count > log_index_size)
+		log_index_grow(log);
+}
+
+uint64_t workload_lookup(void *root, uint64_t key) {
+	struct append_log *log = root;
+	uint64_t *entry = log_index_find(log, key);
+	if(!*entry)
+		return 0;
+	struct append_log_record *record = &log->records[*entry - 1];
+	return record->checksum == (record->key ^ record->value) ? record->value : 0;
+}
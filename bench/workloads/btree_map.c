@@ -0,0 +1,126 @@
+//============================= B-Tree Map Workload ===========================//
+//
+// B-tree of order 8 that splits full nodes on the way down, like btree_map of
+// PMDK examples. A new node is persisted before it is linked into the tree.
+//
+//=============================================================================//
+
+#include <string.h>
+
+#include "pmbench.h"
+
+#define BTREE_ORDER 8
+#define BTREE_MIN ((BTREE_ORDER / 2) - 1)
+
+struct tree_map_node_item {
+	uint64_t key;
+	uint64_t value;
+};
+
+struct tree_map_node {
+	uint64_t n;
+	struct tree_map_node_item items[BTREE_ORDER - 1];
+	struct tree_map_node *slots[BTREE_ORDER];
+};
+
+struct btree_map {
+	struct tree_map_node *root;
+};
+
+const char *workload_name = "btree_map";
+
+void *workload_create(struct pm_pool *pool) {
+	struct btree_map *map = pm_alloc(pool, sizeof(struct btree_map));
+	map->root = pm_alloc(pool, sizeof(struct tree_map_node));
+	pm_persist(map, sizeof(struct btree_map));
+	return map;
+}
+
+// Moves the upper half of a full node to a new node and returns the median
+static struct tree_map_node *
+btree_map_create_split_node(struct pm_pool *pool, struct tree_map_node *node,
+														struct tree_map_node_item *median) {
+	struct tree_map_node *right = pm_alloc(pool, sizeof(struct tree_map_node));
+	int c = BTREE_ORDER / 2;
+	*median = node->items[c - 1];
+	right->n = BTREE_MIN;
+	memcpy(right->items, &node->items[c], sizeof(struct tree_map_node_item) * BTREE_MIN);
+	memcpy(right->slots, &node->slots[c], sizeof(struct tree_map_node *) * (BTREE_MIN + 1));
+	pm_persist(right, sizeof(struct tree_map_node));
+
+	node->n = c - 1;
+	memset(&node->items[c - 1], 0, sizeof(struct tree_map_node_item) * (BTREE_MIN + 1));
+	memset(&node->slots[c], 0, sizeof(struct tree_map_node *) * (BTREE_MIN + 1));
+	pm_persist(node, sizeof(struct tree_map_node));
+	return right;
+}
+
+// Inserts an item into a node that is not full at the given position
+static void btree_map_insert_item_at(struct tree_map_node *node, int pos,
+																		 struct tree_map_node_item item,
+																		 struct tree_map_node *right) {
+	memmove(&node->items[pos + 1], &node->items[pos],
+					sizeof(struct tree_map_node_item) * (node->n - pos));
+	memmove(&node->slots[pos + 2], &node->slots[pos + 1],
+					sizeof(struct tree_map_node *) * (node->n - pos));
+	node->items[pos] = item;
+	node->slots[pos + 1] = right;
+	node->n++;
+	pm_persist(node, sizeof(struct tree_map_node));
+}
+
+static void btree_map_split_child(struct pm_pool *pool, struct tree_map_node *parent,
+																	int pos) {
+	struct tree_map_node_item median;
+	struct tree_map_node *right =
+									btree_map_create_split_node(pool, parent->slots[pos], &median);
+	btree_map_insert_item_at(parent, pos, median, right);
+}
+
+void workload_insert(struct pm_pool *pool, void *root, uint64_t key, uint64_t value) {
+	struct btree_map *map = root;
+	struct tree_map_node *node = map->root;
+	if(node->n == BTREE_ORDER - 1) {
+		struct tree_map_node *up = pm_alloc(pool, sizeof(struct tree_map_node));
+		up->slots[0] = node;
+		pm_persist(up, sizeof(struct tree_map_node));
+		map->root = up;
+		pm_persist(&map->root, sizeof(map->root));
+		btree_map_split_child(pool, up, 0);
+		node = up;
+	}
+	for(;;) {
+		int pos = 0;
+		while(pos < (int)node->n && node->items[pos].key < key)
+			pos++;
+		if(pos < (int)node->n && node->items[pos].key == key) {
+			node->items[pos].value = value;
+			pm_persist(&node->items[pos].value, sizeof(uint64_t));
+			return;
+		}
+		struct tree_map_node *child = node->slots[pos];
+		if(!child) {
+			struct tree_map_node_item item = {key, value};
+			btree_map_insert_item_at(node, pos, item, NULL);
+			return;
+		}
+		if(child->n == BTREE_ORDER - 1) {
+			btree_map_split_child(pool, node, pos);
+			continue;
+		}
+		node = child;
+	}
+}
+
+uint64_t workload_lookup(void *root, uint64_t key) {
+	struct tree_map_node *node = ((struct btree_map *)root)->root;
+	while(node) {
+		int pos = 0;
+		while(pos < (int)node->n && node->items[pos].key < key)
+			pos++;
+		if(pos < (int)node->n && node->items[pos].key == key)
+			return node->items[pos].value;
+		node = node->slots[pos];
+	}
+	return 0;
+}
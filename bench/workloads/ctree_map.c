@@ -0,0 +1,86 @@
+//============================ Crit-Bit Tree Workload =========================//
+//
+// Crit-bit tree, like ctree_map of PMDK examples. Inner nodes test the highest
+// bit in which the keys below them differ. An insert persists the new leaf and
+// inner node before it links them into the tree with a single pointer store.
+//
+//=============================================================================//
+
+#include "pmbench.h"
+
+// Leaves have no bit to test
+#define CTREE_LEAF -1
+
+struct ctree_map_node {
+	int64_t diff;
+	uint64_t key;
+	uint64_t value;
+	struct ctree_map_node *slots[2];
+};
+
+struct ctree_map {
+	struct ctree_map_node *root;
+};
+
+const char *workload_name = "ctree_map";
+
+static inline int ctree_map_bit(uint64_t key, int64_t diff) {
+	return (key >> diff) & 1;
+}
+
+void *workload_create(struct pm_pool *pool) {
+	return pm_alloc(pool, sizeof(struct ctree_map));
+}
+
+static struct ctree_map_node *
+ctree_map_new_leaf(struct pm_pool *pool, uint64_t key, uint64_t value) {
+	struct ctree_map_node *leaf = pm_alloc(pool, sizeof(struct ctree_map_node));
+	leaf->diff = CTREE_LEAF;
+	leaf->key = key;
+	leaf->value = value;
+	pm_persist(leaf, sizeof(struct ctree_map_node));
+	return leaf;
+}
+
+void workload_insert(struct pm_pool *pool, void *root, uint64_t key, uint64_t value) {
+	struct ctree_map *map = root;
+	if(!map->root) {
+		map->root = ctree_map_new_leaf(pool, key, value);
+		pm_persist(&map->root, sizeof(map->root));
+		return;
+	}
+
+// Find the leaf the key would be in and the first bit the keys differ in
+	struct ctree_map_node *node = map->root;
+	while(node->diff != CTREE_LEAF)
+		node = node->slots[ctree_map_bit(key, node->diff)];
+	if(node->key == key) {
+		node->value = value;
+		pm_persist(&node->value, sizeof(node->value));
+		return;
+	}
+	int64_t diff = 63 - __builtin_clzll(node->key ^ key);
+
+// Inner nodes above the new one test higher bits
+	struct ctree_map_node **dest = &map->root;
+	while((*dest)->diff > diff)
+		dest = &(*dest)->slots[ctree_map_bit(key, (*dest)->diff)];
+
+	struct ctree_map_node *leaf = ctree_map_new_leaf(pool, key, value);
+	struct ctree_map_node *inner = pm_alloc(pool, sizeof(struct ctree_map_node));
+	inner->diff = diff;
+	inner->slots[ctree_map_bit(key, diff)] = leaf;
+	inner->slots[!ctree_map_bit(key, diff)] = *dest;
+	pm_persist(inner, sizeof(struct ctree_map_node));
+	*dest = inner;
+	pm_persist(dest, sizeof(*dest));
+}
+
+uint64_t workload_lookup(void *root, uint64_t key) {
+	struct ctree_map_node *node = ((struct ctree_map *)root)->root;
+	if(!node)
+		return 0;
+	while(node->diff != CTREE_LEAF)
+		node = node->slots[ctree_map_bit(key, node->diff)];
+	return node->key == key ? node->value : 0;
+}
@@ -0,0 +1,113 @@
+//============================= Hash Map Workload =============================//
+//
+// Chained hash map, like hashmap_atomic of PMDK examples. Entries are persisted
+// before they are linked at the head of their bucket, and the table is rebuilt
+// with twice the buckets when it holds twice as many entries as buckets.
+//
+//=============================================================================//
+
+#include "pmbench.h"
+
+#define HASHMAP_INITIAL_BUCKETS 1024
+
+struct hashmap_entry {
+	uint64_t key;
+	uint64_t value;
+	struct hashmap_entry *next;
+};
+
+struct hashmap_buckets {
+	uint64_t num_buckets;
+	struct hashmap_entry *bucket[];
+};
+
+struct hashmap {
+	uint64_t count;
+	struct hashmap_buckets *buckets;
+};
+
+const char *workload_name = "hashmap";
+
+static inline uint64_t hashmap_hash(uint64_t key, uint64_t num_buckets) {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return key & (num_buckets - 1);
+}
+
+static struct hashmap_buckets *hashmap_new_buckets(struct pm_pool *pool,
+																									 uint64_t num_buckets) {
+	size_t size = sizeof(struct hashmap_buckets)
+							+ num_buckets * sizeof(struct hashmap_entry *);
+	struct hashmap_buckets *buckets = pm_alloc(pool, size);
+	buckets->num_buckets = num_buckets;
+	return buckets;
+}
+
+void *workload_create(struct pm_pool *pool) {
+	struct hashmap *map = pm_alloc(pool, sizeof(struct hashmap));
+	map->buckets = hashmap_new_buckets(pool, HASHMAP_INITIAL_BUCKETS);
+	pm_persist(map->buckets, sizeof(struct hashmap_buckets)
+						 + HASHMAP_INITIAL_BUCKETS * sizeof(struct hashmap_entry *));
+	pm_persist(map, sizeof(struct hashmap));
+	return map;
+}
+
+// Moves the entries to a new table, which replaces the old one once it is
+// persisted. The entries of the old table are left alone.
+static void hashmap_rebuild(struct pm_pool *pool, struct hashmap *map) {
+	struct hashmap_buckets *old = map->buckets;
+	uint64_t num_buckets = old->num_buckets * 2;
+	struct hashmap_buckets *buckets = hashmap_new_buckets(pool, num_buckets);
+	for(uint64_t index = 0; index != old->num_buckets; ++index) {
+		for(struct hashmap_entry *entry = old->bucket[index]; entry; entry = entry->next) {
+			struct hashmap_entry *copy = pm_alloc(pool, sizeof(struct hashmap_entry));
+			uint64_t hash = hashmap_hash(entry->key, num_buckets);
+			copy->key = entry->key;
+			copy->value = entry->value;
+			copy->next = buckets->bucket[hash];
+			pm_persist(copy, sizeof(struct hashmap_entry));
+			buckets->bucket[hash] = copy;
+		}
+	}
+	pm_persist(buckets, sizeof(struct hashmap_buckets)
+						 + num_buckets * sizeof(struct hashmap_entry *));
+	map->buckets = buckets;
+	pm_persist(&map->buckets, sizeof(map->buckets));
+}
+
+void workload_insert(struct pm_pool *pool, void *root, uint64_t key, uint64_t value) {
+	struct hashmap *map = root;
+	struct hashmap_buckets *buckets = map->buckets;
+	uint64_t hash = hashmap_hash(key, buckets->num_buckets);
+	for(struct hashmap_entry *entry = buckets->bucket[hash]; entry; entry = entry->next) {
+		if(entry->key == key) {
+			entry->value = value;
+			pm_persist(&entry->value, sizeof(entry->value));
+			return;
+		}
+	}
+
+	struct hashmap_entry *entry = pm_alloc(pool, sizeof(struct hashmap_entry));
+	entry->key = key;
+	entry->value = value;
+	entry->next = buckets->bucket[hash];
+	pm_persist(entry, sizeof(struct hashmap_entry));
+	buckets->bucket[hash] = entry;
+	pm_persist(&buckets->bucket[hash], sizeof(struct hashmap_entry *));
+	map->count++;
+	pm_persist(&map->count, sizeof(map->count));
+
+	if(map->count > 2 * buckets->num_buckets)
+		hashmap_rebuild(pool, map);
+}
+
+uint64_t workload_lookup(void *root, uint64_t key) {
+	struct hashmap_buckets *buckets = ((struct hashmap *)root)->buckets;
+	uint64_t hash = hashmap_hash(key, buckets->num_buckets);
+	for(struct hashmap_entry *entry = buckets->bucket[hash]; entry; entry = entry->next) {
+		if(entry->key == key)
+			return entry->value;
+	}
+	return 0;
+}
@@ -0,0 +1,136 @@
+//======================== Persistent Memory Workloads ========================//
+//
+// Runs a workload on a pool in a file, which is on /dev/shm by default so that
+// tmpfs stands in for persistent memory. Random keys are inserted into the data
+// structure of the workload, timed, and looked up again to check the data
+// structure. The result is printed as a single line for the benchmark driver:
+//
+//   workload=<name> ops=<inserts> seconds=<time taken by the inserts>
+//
+//=============================================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pmbench.h"
+
+#define PM_POOL_MAGIC 0x504d42454e4348ULL
+#define DEFAULT_NUM_OPS 100000
+#define DEFAULT_POOL_SIZE ((size_t)256 << 20)
+
+// Pools are registered with PMCheck runtime when the workload is instrumented.
+// The plain build is not linked with the runtime, so the symbol is weak.
+extern void AllocatePM(uint64_t Addr, uint64_t Size) __attribute__((weak));
+
+void *pm_alloc(struct pm_pool *pool, size_t size) {
+	size = (size + 15) & ~(size_t)15;
+	if(pool->used + size > pool->size) {
+		fprintf(stderr, "%s: pool of %llu bytes is full\n", workload_name,
+						(unsigned long long)pool->size);
+		exit(1);
+	}
+	void *ptr = (char *)pool + pool->used;
+	pool->used += size;
+	pm_persist(&pool->used, sizeof(pool->used));
+	return ptr;
+}
+
+static struct pm_pool *pm_pool_create(const char *path, size_t size) {
+	size_t mapped_len;
+	int is_pmem;
+	struct pm_pool *pool = pmem_map_file(path, size, PMEM_FILE_CREATE, 0666,
+																			 &mapped_len, &is_pmem);
+	if(!pool)
+		return NULL;
+	if(AllocatePM)
+		AllocatePM((uint64_t)pool, mapped_len);
+	pool->magic = PM_POOL_MAGIC;
+	pool->size = mapped_len;
+	pool->used = sizeof(struct pm_pool);
+	pool->root = 0;
+	pm_persist(pool, sizeof(struct pm_pool));
+	return pool;
+}
+
+// xorshift64*, so that runs of all the builds insert the same keys
+static uint64_t next_key(uint64_t *state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545f4914f6cdd1dULL;
+}
+
+static double now(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [-n <ops>] [-s <pool size in MB>] [-f <pool file>] "
+									"[-seed <seed>]\n", name);
+}
+
+int main(int argc, char **argv) {
+	uint64_t num_ops = DEFAULT_NUM_OPS;
+	size_t pool_size = DEFAULT_POOL_SIZE;
+	uint64_t seed = 1;
+	char path[256];
+	snprintf(path, sizeof(path), "/dev/shm/pmbench.%s.%d", workload_name, (int)getpid());
+	for(int index = 1; index < argc; ++index) {
+		if(!strcmp(argv[index], "-n") && index + 1 < argc) {
+			num_ops = strtoull(argv[++index], NULL, 0);
+			continue;
+		}
+		if(!strcmp(argv[index], "-s") && index + 1 < argc) {
+			pool_size = (size_t)strtoull(argv[++index], NULL, 0) << 20;
+			continue;
+		}
+		if(!strcmp(argv[index], "-f") && index + 1 < argc) {
+			snprintf(path, sizeof(path), "%s", argv[++index]);
+			continue;
+		}
+		if(!strcmp(argv[index], "-seed") && index + 1 < argc) {
+			seed = strtoull(argv[++index], NULL, 0) | 1;
+			continue;
+		}
+		usage(argv[0]);
+		return 1;
+	}
+
+	struct pm_pool *pool = pm_pool_create(path, pool_size);
+	if(!pool) {
+		fprintf(stderr, "%s: could not map %s\n", workload_name, path);
+		return 1;
+	}
+	void *root = workload_create(pool);
+	pool->root = (char *)root - (char *)pool;
+	pm_persist(&pool->root, sizeof(pool->root));
+
+	uint64_t state = seed;
+	double start = now();
+	for(uint64_t op = 0; op != num_ops; ++op) {
+		uint64_t key = next_key(&state);
+		workload_insert(pool, root, key, key | 1);
+	}
+	double seconds = now() - start;
+
+	state = seed;
+	for(uint64_t op = 0; op != num_ops; ++op) {
+		uint64_t key = next_key(&state);
+		if(workload_lookup(root, key) != (key | 1)) {
+			fprintf(stderr, "%s: key %llu is missing\n", workload_name,
+							(unsigned long long)key);
+			return 1;
+		}
+	}
+
+	printf("workload=%s ops=%llu seconds=%.6f\n", workload_name,
+				 (unsigned long long)num_ops, seconds);
+	pmem_unmap(pool, pool->size);
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,45 @@
+//======================== Persistent Memory Workloads ========================//
+//
+// Common interface of the end-to-end workloads. Every workload keeps a data
+// structure in a pool mapped from a file with libpmem, allocates its nodes from
+// the pool and persists its updates the way PMDK examples do. The workload only
+// provides the operations on its data structure; pmbench.c times them.
+//
+//=============================================================================//
+
+#ifndef PMBENCH_H_
+#define PMBENCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libpmem.h>
+
+// Header at the start of every pool
+struct pm_pool {
+	uint64_t magic;
+	uint64_t size;
+	uint64_t used;
+	uint64_t root;
+};
+
+// Allocates zeroed memory from the pool. Allocations are never freed.
+void *pm_alloc(struct pm_pool *pool, size_t size);
+
+static inline void pm_persist(const void *addr, size_t len) {
+	pmem_persist(addr, len);
+}
+
+// Implemented by every workload
+extern const char *workload_name;
+
+// Creates the data structure in the pool and returns its root
+void *workload_create(struct pm_pool *pool);
+
+// Inserts the key, or updates its value if it is already there
+void workload_insert(struct pm_pool *pool, void *root, uint64_t key, uint64_t value);
+
+// Returns the value of the key, or 0 if it is not there
+uint64_t workload_lookup(void *root, uint64_t key);
+
+#endif  // PMBENCH_H_
@@ -0,0 +1,136 @@
+//=========================== Red-Black Tree Workload =========================//
+//
+// Red-black tree with a sentinel, like rbtree_map of PMDK examples. Every field
+// an insert or a rotation changes is persisted right after it is stored.
+//
+//=============================================================================//
+
+#include "pmbench.h"
+
+enum rb_color {
+	COLOR_BLACK,
+	COLOR_RED
+};
+
+enum rb_children {
+	RB_LEFT,
+	RB_RIGHT
+};
+
+struct tree_map_node {
+	uint64_t key;
+	uint64_t value;
+	uint64_t color;
+	struct tree_map_node *parent;
+	struct tree_map_node *slots[2];
+};
+
+struct rbtree_map {
+	struct tree_map_node *sentinel;
+	struct tree_map_node *root;
+};
+
+const char *workload_name = "rbtree_map";
+
+#define PM_SET(field, value) do {\
+	(field) = (value);\
+	pm_persist(&(field), sizeof(field));\
+} while(0)
+
+#define NODE_P(node) ((node)->parent)
+#define NODE_IS(node, dir) ((node) == NODE_P(node)->slots[dir])
+#define NODE_LOCATION(node) NODE_P(node)->slots[NODE_IS(node, RB_RIGHT)]
+
+void *workload_create(struct pm_pool *pool) {
+	struct rbtree_map *map = pm_alloc(pool, sizeof(struct rbtree_map));
+	struct tree_map_node *sentinel = pm_alloc(pool, sizeof(struct tree_map_node));
+	sentinel->color = COLOR_BLACK;
+	sentinel->parent = sentinel;
+	sentinel->slots[RB_LEFT] = sentinel;
+	sentinel->slots[RB_RIGHT] = sentinel;
+	pm_persist(sentinel, sizeof(struct tree_map_node));
+
+// The root is the left child of a node that stands above the whole tree
+	struct tree_map_node *root = pm_alloc(pool, sizeof(struct tree_map_node));
+	root->color = COLOR_BLACK;
+	root->parent = sentinel;
+	root->slots[RB_LEFT] = sentinel;
+	root->slots[RB_RIGHT] = sentinel;
+	pm_persist(root, sizeof(struct tree_map_node));
+
+	map->sentinel = sentinel;
+	map->root = root;
+	pm_persist(map, sizeof(struct rbtree_map));
+	return map;
+}
+
+static void rbtree_map_rotate(struct rbtree_map *map, struct tree_map_node *node,
+															enum rb_children c) {
+	struct tree_map_node *child = node->slots[!c];
+	PM_SET(node->slots[!c], child->slots[c]);
+	if(child->slots[c] != map->sentinel)
+		PM_SET(child->slots[c]->parent, node);
+	PM_SET(NODE_P(child), NODE_P(node));
+	PM_SET(NODE_LOCATION(node), child);
+	PM_SET(child->slots[c], node);
+	PM_SET(NODE_P(node), child);
+}
+
+static void rbtree_map_recolor(struct rbtree_map *map, struct tree_map_node **node,
+															 enum rb_children c) {
+	struct tree_map_node *uncle = NODE_P(NODE_P(*node))->slots[!c];
+	if(uncle->color == COLOR_RED) {
+		PM_SET(uncle->color, COLOR_BLACK);
+		PM_SET(NODE_P(*node)->color, COLOR_BLACK);
+		PM_SET(NODE_P(NODE_P(*node))->color, COLOR_RED);
+		*node = NODE_P(NODE_P(*node));
+		return;
+	}
+	if(NODE_IS(*node, !c)) {
+		*node = NODE_P(*node);
+		rbtree_map_rotate(map, *node, c);
+	}
+	PM_SET(NODE_P(*node)->color, COLOR_BLACK);
+	PM_SET(NODE_P(NODE_P(*node))->color, COLOR_RED);
+	rbtree_map_rotate(map, NODE_P(NODE_P(*node)), !c);
+}
+
+void workload_insert(struct pm_pool *pool, void *root, uint64_t key, uint64_t value) {
+	struct rbtree_map *map = root;
+	struct tree_map_node *sentinel = map->sentinel;
+	struct tree_map_node *parent = map->root;
+	struct tree_map_node *node = map->root->slots[RB_LEFT];
+	while(node != sentinel) {
+		if(node->key == key) {
+			PM_SET(node->value, value);
+			return;
+		}
+		parent = node;
+		node = node->slots[key > node->key];
+	}
+
+	node = pm_alloc(pool, sizeof(struct tree_map_node));
+	node->key = key;
+	node->value = value;
+	node->color = COLOR_RED;
+	node->parent = parent;
+	node->slots[RB_LEFT] = sentinel;
+	node->slots[RB_RIGHT] = sentinel;
+	pm_persist(node, sizeof(struct tree_map_node));
+	PM_SET(parent->slots[parent == map->root ? RB_LEFT : key > parent->key], node);
+
+	while(NODE_P(node)->color == COLOR_RED)
+		rbtree_map_recolor(map, &node, (enum rb_children)NODE_IS(NODE_P(node), RB_RIGHT));
+	PM_SET(map->root->slots[RB_LEFT]->color, COLOR_BLACK);
+}
+
+uint64_t workload_lookup(void *root, uint64_t key) {
+	struct rbtree_map *map = root;
+	struct tree_map_node *node = map->root->slots[RB_LEFT];
+	while(node != map->sentinel) {
+		if(node->key == key)
+			return node->value;
+		node = node->slots[key > node->key];
+	}
+	return 0;
+}
@@ -5,6 +5,7 @@
 #include "llvm/IR/Verifier.h"
 #include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/ADT/StringSet.h"
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/Support/ToolOutputFile.h"
@@ -17,9 +18,16 @@
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/ADT/PostOrderIterator.h"
 #include "llvm/Analysis/PostDominators.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/GraphTraits.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/MapVector.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/Instructions.h"
@@ -64,83 +72,120 @@ static cl::opt<bool> PMAnalysis("PersistencyAnalysis", cl::Hidden,
 								"implementatioon of persistency model"), cl::init(true));
 */
 
-// The higher order two bytes of the reference IDs for instructions are computed
-// using function name and multiplicative hashing technique, more specifically,
-// Kernighan and Ritchie's function. One could also use Bernstein's function, in
-// which case INITIAL_VALUE below is set to 5381 and MULTIPLIER is set to 33.
-//
-// For reference, check out https://www.strchr.com/hash_functions.
-#define MAX_PREFIX 		((uint32_t)1 << 16)  // Prefix should not exceed 2-bytes
-#define INITIAL_VALUE	0   // Because of Kernighan and Ritchie's function
-#define MULTIPLIER 		31  // Because of Kernighan and Ritchie's function
-
-static uint32_t ComputeRefIDPrefix(const std::string FuncName) {
-	const char *Key = FuncName.c_str();
-	uint32_t Hash = INITIAL_VALUE;
-	for(unsigned Index = 0; Index != FuncName.size(); ++Index)
-		Hash = MULTIPLIER * Hash + Key[Index];
-	return ((Hash % MAX_PREFIX) << 16);
+// Number of the bounds of the pools that the runtime publishes, as pairs of
+// 64-bit start and end. This matches PMCheckPoolBounds in the runtime.
+#define PMCHECK_NUM_POOL_BOUNDS 4
+
+// Layout of the op buffer that every thread appends its operations to. This
+// matches OpBuffer.h in the runtime.
+#define PMCHECK_OP_BUFFER_CAPACITY 1024
+#define PMCHECK_BUFFERED_WRITE 0
+#define PMCHECK_BUFFERED_FLUSH 1
+#define PMCHECK_BUFFERED_WRITE_GROUP 4
+
+// Most stores that are appended as one operation, one for every bit of its size
+#define PMCHECK_MAX_GROUP_MEMBERS 64
+
+// Check whether the write is within the bounds of the pools. The runtime widens
+// the bounds while other threads run, so they are loaded atomically. Only the
+// address is checked since the runtime checks the size.
+static Value *CheckInPoolBounds(Instruction *I, LLVMContext &Context,
+																Value *AddrInt, GlobalVariable *PoolBounds) {
+	auto *Int64Ty = Type::getInt64Ty(Context);
+	auto *BoundsTy = PoolBounds->getValueType();
+	Value *InPM = nullptr;
+	for(uint64_t Index = 0; Index != 2 * PMCHECK_NUM_POOL_BOUNDS; Index += 2) {
+		std::vector<Constant *> StartIndexVect;
+		StartIndexVect.push_back(ConstantInt::get(Int64Ty, 0));
+		StartIndexVect.push_back(ConstantInt::get(Int64Ty, Index));
+		auto *StartPtr = ConstantExpr::getInBoundsGetElementPtr(BoundsTy, PoolBounds,
+																														StartIndexVect);
+		std::vector<Constant *> EndIndexVect;
+		EndIndexVect.push_back(ConstantInt::get(Int64Ty, 0));
+		EndIndexVect.push_back(ConstantInt::get(Int64Ty, Index + 1));
+		auto *EndPtr = ConstantExpr::getInBoundsGetElementPtr(BoundsTy, PoolBounds,
+																													EndIndexVect);
+		auto *Start = new LoadInst(Int64Ty, StartPtr, "", I);
+		Start->setAlignment(8);
+		Start->setAtomic(AtomicOrdering::Monotonic);
+		auto *End = new LoadInst(Int64Ty, EndPtr, "", I);
+		End->setAlignment(8);
+		End->setAtomic(AtomicOrdering::Monotonic);
+		auto *AboveStart = new ICmpInst(I, ICmpInst::ICMP_UGE, AddrInt, Start);
+		auto *BelowEnd = new ICmpInst(I, ICmpInst::ICMP_ULT, AddrInt, End);
+		auto *InBounds =
+					BinaryOperator::Create(Instruction::And, AboveStart, BelowEnd, "", I);
+		InPM = InPM ? BinaryOperator::Create(Instruction::Or, InPM, InBounds, "", I)
+								: InBounds;
+	}
+	return InPM;
 }
 
-static void InstrumentWrite(Instruction *I, LLVMContext &Context,
-	 													const PMInterfaces<> &PMI, const DataLayout &DL,
-														TargetLibraryInfo &TLI, Function *Strlen,
-														AllocaInst *WriteIdArray, AllocaInst *WriteAddrArray,
-														AllocaInst *WriteSizeArray, AllocaInst *TimeStamp,
-														AllocaInst *WriteTimeStampArray, uint64_t &WriteIndex,
-														DenseMap<const Instruction *, uint32_t>  &InstToIdMap,
-													  uint32_t RefIDPrefix, uint32_t &InstCounter) {
-	errs() << "INSTRUMENTING WRITE: ";
-	I->print(errs());
-	errs() << "\n";
-
-	auto *One = ConstantInt::get(Type::getInt64Ty(Context), 1);
-	auto *Zero = ConstantInt::get(Type::getInt64Ty(Context), 0);
-	auto &PMMI = PMI.getPmemInterface();
-
-// Increment the index
-	auto *Index = ConstantInt::get(Type::getInt64Ty(Context), WriteIndex++);
-	auto *CurTimeStamp = new LoadInst(Type::getInt64Ty(Context), TimeStamp, "", I);
-	auto *NewTimeStamp =
-					BinaryOperator::Create(Instruction::Add, CurTimeStamp, One, "", I);
-	new StoreInst(NewTimeStamp, TimeStamp, I);
-
-// Compute the ID for this instruction
-	auto Id = RefIDPrefix + InstCounter++;
-	//InstToIdMap[I] = Id;
-	InstToIdMap.insert(std::make_pair(I, Id));
-	errs() << "MAP UPDATED\n";
-	errs() << "MAP SIZE: " << InstToIdMap.size() << "\n";
-
-// Index the ID into the write arrays
+// Append an operation to the op buffer of the thread. The count of the buffer
+// only advances if InPM is true or not given, so a write that is not to
+// persistent memory is overwritten by the next operation. The runtime is only
+// called when the buffer holds as many operations as the limit it publishes.
+static void AppendOp(Instruction *I, LLVMContext &Context, GlobalVariable *OpBuffer,
+										 GlobalVariable *OpBufferLimit, Function *DrainOpBuffer,
+										 uint32_t Kind, Value *Id, Value *AddrInt, Value *Size,
+										 Value *InPM) {
+	auto *Int32Ty = Type::getInt32Ty(Context);
+	auto *Int64Ty = Type::getInt64Ty(Context);
+	auto *Zero = ConstantInt::get(Int32Ty, 0);
+	auto *BufferTy = OpBuffer->getValueType();
+
+// Load the number of operations in the buffer
 	std::vector<Value *> IndexVect;
 	IndexVect.push_back(Zero);
-	IndexVect.push_back(Index);
-	auto *IdArrayPtr =
-					GetElementPtrInst::CreateInBounds(WriteIdArray->getAllocatedType(),
-														WriteIdArray, ArrayRef<Value *>(IndexVect), "", I);
-	auto *AddrArrayPtr =
-					GetElementPtrInst::CreateInBounds(WriteAddrArray->getAllocatedType(),
-													WriteAddrArray, ArrayRef<Value *>(IndexVect), "", I);
-	auto *SizeArrayPtr =
-					GetElementPtrInst::CreateInBounds(WriteSizeArray->getAllocatedType(),
-													WriteSizeArray, ArrayRef<Value *>(IndexVect), "", I);
-	auto *TimeStampArrayPtr =
-					GetElementPtrInst::CreateInBounds(WriteTimeStampArray->getAllocatedType(),
-													WriteTimeStampArray, ArrayRef<Value *>(IndexVect), "", I);
-	new StoreInst(CurTimeStamp, TimeStampArrayPtr, I);
-
-// Write to the arrays
-	auto *IdValue = ConstantInt::get(Type::getInt32Ty(Context), Id);
-	new StoreInst(IdValue, IdArrayPtr, I);
+	IndexVect.push_back(Zero);
+	auto *NumOpsPtr = GetElementPtrInst::CreateInBounds(BufferTy, OpBuffer,
+																						ArrayRef<Value *>(IndexVect), "", I);
+	auto *NumOps = new LoadInst(Int32Ty, NumOpsPtr, "", I);
+	auto *OpIndex = new ZExtInst(NumOps, Int64Ty, "", I);
+
+// Write the fields of the operation in the next slot
+	auto StoreField = [&](Value *FieldValue, uint32_t Field) {
+		std::vector<Value *> IndexVect;
+		IndexVect.push_back(Zero);
+		IndexVect.push_back(ConstantInt::get(Int32Ty, 2));
+		IndexVect.push_back(OpIndex);
+		IndexVect.push_back(ConstantInt::get(Int32Ty, Field));
+		auto *FieldPtr = GetElementPtrInst::CreateInBounds(BufferTy, OpBuffer,
+																						ArrayRef<Value *>(IndexVect), "", I);
+		new StoreInst(FieldValue, FieldPtr, I);
+	};
+	StoreField(AddrInt, 0);
+	StoreField(CastInst::CreateIntegerCast(Size, Int64Ty, false, "", I), 1);
+	StoreField(Id, 2);
+	StoreField(ConstantInt::get(Int32Ty, Kind), 3);
+
+// Advance the count
+	Value *Increment = ConstantInt::get(Int32Ty, 1);
+	if(InPM)
+		Increment = new ZExtInst(InPM, Int32Ty, "", I);
+	auto *NewNumOps =
+					BinaryOperator::Create(Instruction::Add, NumOps, Increment, "", I);
+	new StoreInst(NewNumOps, NumOpsPtr, I);
+
+// Drain the buffer if it is full. This is rare, so the call is put in a block
+// of its own. The runtime sets the limit once when it starts.
+	auto *Limit = new LoadInst(Int32Ty, OpBufferLimit, "", I);
+	auto *Full = new ICmpInst(I, ICmpInst::ICMP_UGE, NewNumOps, Limit);
+	auto *Weights = MDBuilder(Context).createBranchWeights(1, PMCHECK_OP_BUFFER_CAPACITY);
+	auto *Term = SplitBlockAndInsertIfThen(Full, I, false, Weights);
+	CallInst::Create(DrainOpBuffer->getFunctionType(), DrainOpBuffer, "", Term);
+}
+
+// Get the address and the size of a write. The size is null for the string
+// functions that have no size operand.
+static void GetWriteRange(Instruction *I, const PMInterfaces<> &PMI,
+													const DataLayout &DL, TargetLibraryInfo &TLI,
+													Value *&Addr, Value *&Size) {
+	auto &PMMI = PMI.getPmemInterface();
 	if(auto *SI = dyn_cast<StoreInst>(I)) {
-		auto *AddrInt = new PtrToIntInst(SI->getPointerOperand(),
-																		 Type::getInt64Ty(Context), "", I);
-		new StoreInst(AddrInt, AddrArrayPtr, I);
-		auto *Size = ConstantInt::get(Type::getInt64Ty(Context),
-											DL.getTypeStoreSize(SI->getValueOperand()->getType()));
-		new StoreInst(Size, SizeArrayPtr, I);
-		I->getParent()->getParent()->print(errs());
+		Addr = SI->getPointerOperand();
+		Size = ConstantInt::get(Type::getInt64Ty(I->getContext()),
+										DL.getTypeStoreSize(SI->getValueOperand()->getType()));
 		return;
 	}
 
@@ -150,20 +195,15 @@ static void InstrumentWrite(Instruction *I, LLVMContext &Context,
 
 // Check if it is an memory intrinsic or PMDK interface
 	if(AnyMemIntrinsic *MI = dyn_cast<AnyMemIntrinsic>(CI)) {
-		auto *AddrInt = new PtrToIntInst(MI->getRawDest(),
-																		 Type::getInt64Ty(Context), "", I);
-		new StoreInst(AddrInt, AddrArrayPtr, I);
-		new StoreInst(MI->getLength(), SizeArrayPtr, I);
-		I->getParent()->getParent()->print(errs());
+		Addr = MI->getRawDest();
+		Size = MI->getLength();
 		return;
 	}
 
 // It is a persistent write
 	if(PMMI.isValidInterfaceCall(CI)) {
-		auto *AddrInt = new PtrToIntInst(PMMI.getDestOperand(CI),
-																		 Type::getInt64Ty(Context), "", I);
-		new StoreInst(AddrInt, AddrArrayPtr, I);
-		new StoreInst(PMMI.getLengthOperand(CI), SizeArrayPtr, I);
+		Addr = PMMI.getDestOperand(CI);
+		Size = PMMI.getLengthOperand(CI);
 		return;
 	}
 
@@ -174,278 +214,483 @@ static void InstrumentWrite(Instruction *I, LLVMContext &Context,
 	assert(TLI.getLibFunc(*Callee, TLIFn)
 			&& IsValidLibMemoryOperation(*(Callee->getFunctionType()), TLIFn, DL)
 			&& "Unknown function in set.");
-	auto *AddrInt = new PtrToIntInst(CI->getArgOperand(0),
-																	 Type::getInt64Ty(Context), "", I);
-	new StoreInst(AddrInt, AddrArrayPtr, I);
+	Addr = CI->getArgOperand(0);
 
 // Check if the library function being called has a size operand
-	if(Callee->getFunctionType()->getNumParams() >= 3) {
-		new StoreInst(CI->getArgOperand(2), SizeArrayPtr, I);
-	} else {
+	Size = nullptr;
+	if(Callee->getFunctionType()->getNumParams() >= 3)
+		Size = CI->getArgOperand(2);
+}
+
+// Get the address and the size of a flush. This fails if the flush is not a
+// call to the flush or persist interface.
+static bool GetFlushRange(Instruction *I, const PMInterfaces<> &PMI,
+													Value *&Addr, Value *&Size) {
+	auto *CI = dyn_cast<CallInst>(I);
+	if(!CI)
+		return false;
+	auto &FI = PMI.getFlushInterface();
+	auto &PI = PMI.getPersistInterface();
+	if(FI.isValidInterfaceCall(CI)) {
+		Addr = FI.getPMemAddrOperand(CI);
+		Size = FI.getPMemLenOperand(CI);
+		return true;
+	}
+	if(PI.isValidInterfaceCall(CI)) {
+		Addr = PI.getPMemAddrOperand(CI);
+		Size = PI.getPMemLenOperand(CI);
+		return true;
+	}
+	return false;
+}
+
+// Assign an ID to the instruction and compute it before the given instruction.
+// It is offset by the base of the module at runtime.
+static Value *GetIdValue(Instruction *I, Instruction *InsertBefore,
+												 DenseMap<const Instruction *, uint32_t>  &InstToIdMap,
+												 Value *IdBase, uint32_t &NumInstIds) {
+	auto Id = NumInstIds++;
+	//InstToIdMap[I] = Id;
+	InstToIdMap.insert(std::make_pair(I, Id));
+	errs() << "MAP UPDATED\n";
+	errs() << "MAP SIZE: " << InstToIdMap.size() << "\n";
+	return BinaryOperator::Create(Instruction::Add, IdBase,
+							ConstantInt::get(Type::getInt32Ty(I->getContext()), Id), "",
+							InsertBefore);
+}
+
+static void InstrumentWrite(Instruction *I, LLVMContext &Context,
+	 													const PMInterfaces<> &PMI, const DataLayout &DL,
+														TargetLibraryInfo &TLI, Function *Strlen,
+														GlobalVariable *OpBuffer, GlobalVariable *OpBufferLimit,
+														Function *DrainOpBuffer, GlobalVariable *PoolBounds,
+														DenseMap<const Instruction *, uint32_t>  &InstToIdMap,
+														Value *IdBase, uint32_t &NumInstIds) {
+	errs() << "INSTRUMENTING WRITE: ";
+	I->print(errs());
+	errs() << "\n";
+
+	auto *IdValue = GetIdValue(I, I, InstToIdMap, IdBase, NumInstIds);
+	Value *Addr;
+	Value *Size;
+	GetWriteRange(I, PMI, DL, TLI, Addr, Size);
+	if(!Size) {
 	// We do not have a size operand to work with. This is characteristically
 	// common for string library functions operating on strings. So we can insert
 	// strlen function to get string length. Now, if the string is not null
 	// terminated, any operation might cause undefined behaviour. Same is true for
 	// strlen on src operand, therefore, it really would not make a huge difference.
 		std::vector<Value *> ArgVect;
-		ArgVect.push_back(CI->getArgOperand(1));
-		auto *StringSize = CallInst::Create(Strlen->getFunctionType(),
-									 	 										Strlen, ArrayRef<Value *>(ArgVect), "", I);
-		new StoreInst(StringSize, SizeArrayPtr, I);
+		ArgVect.push_back(cast<CallInst>(I)->getArgOperand(1));
+		Size = CallInst::Create(Strlen->getFunctionType(),
+									 	 				Strlen, ArrayRef<Value *>(ArgVect), "", I);
 	}
+
+// Only writes that may be to persistent memory are kept in the buffer
+	auto *AddrInt = new PtrToIntInst(Addr, Type::getInt64Ty(Context), "", I);
+	auto *InPM = CheckInPoolBounds(I, Context, AddrInt, PoolBounds);
+	AppendOp(I, Context, OpBuffer, OpBufferLimit, DrainOpBuffer, PMCHECK_BUFFERED_WRITE,
+					 IdValue, AddrInt, Size, InPM);
 }
 
 static void InstrumentFlush(Instruction *I, LLVMContext &Context,
 	 													const PMInterfaces<> &PMI, const DataLayout &DL,
-														AllocaInst *FlushIdArray, AllocaInst *FlushAddrArray,
-														AllocaInst *FlushSizeArray, AllocaInst *TimeStamp,
-														AllocaInst *FlushTimeStampArray, uint64_t &FlushIndex,
-														DenseMap<const Instruction *, uint32_t>  &InstToIdMap,
-														uint32_t RefIDPrefix, uint32_t &InstCounter) {
+														GlobalVariable *OpBuffer, GlobalVariable *OpBufferLimit,
+														Function *DrainOpBuffer, DenseMap<const Instruction *, uint32_t>  &InstToIdMap,
+														Value *IdBase, uint32_t &NumInstIds) {
 	errs() << "INSTRUMENTING FLUSH: ";
 	I->print(errs());
 	errs() << "\n";
 
-// This has to be a call instruction
-	auto *CI = dyn_cast<CallInst>(I);
-	assert(CI && "Error in PM Analysis record results.");
+	Value *Addr;
+	Value *Size;
+	if(!GetFlushRange(I, PMI, Addr, Size))
+		return;
+	auto *IdValue = GetIdValue(I, I, InstToIdMap, IdBase, NumInstIds);
 
-	auto *One = ConstantInt::get(Type::getInt64Ty(Context), 1);
-	auto *Zero = ConstantInt::get(Type::getInt64Ty(Context), 0);
-	auto &FI = PMI.getFlushInterface();
-	auto &PI = PMI.getPersistInterface();
+// The runtime records flushes whatever memory they are to, so they are all kept
+	auto *AddrInt = new PtrToIntInst(Addr, Type::getInt64Ty(Context), "", I);
+	AppendOp(I, Context, OpBuffer, OpBufferLimit, DrainOpBuffer, PMCHECK_BUFFERED_FLUSH,
+					 IdValue, AddrInt, Size, nullptr);
+}
 
-// Increment the index
-	auto *Index = ConstantInt::get(Type::getInt64Ty(Context), FlushIndex++);
-	auto *CurTimeStamp = new LoadInst(Type::getInt64Ty(Context), TimeStamp, "", I);
-	auto *NewTimeStamp =
-					BinaryOperator::Create(Instruction::Add, CurTimeStamp, One, "", I);
-	new StoreInst(NewTimeStamp, TimeStamp, I);
+// An operation in a loop that is recorded once where the loop exits, as the
+// range it covers in all the iterations of the loop
+struct LoopSummary {
+	Instruction *I;
+	uint32_t Kind;
+	Value *Addr;
+	Value *Size;
+	Instruction *InsertBefore;
+};
+
+// Operations of a loop along with the recurrences of their addresses
+struct LoopOp {
+	Instruction *I;
+	uint32_t Kind;
+	const SCEVAddRecExpr *AddrRec;
+	uint64_t Size;
+};
+
+// Check whether the operation covers the next range of memory in every
+// iteration of the loop, so the ranges of all iterations are one range.
+static bool GetAffineRange(LoopOp &Op, Value *Addr, Value *Size, Loop *L,
+													 ScalarEvolution &SE) {
+	auto *ConstSize = dyn_cast_or_null<ConstantInt>(Size);
+	if(!ConstSize || !ConstSize->getZExtValue())
+		return false;
+	auto *AddrRec = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(Addr));
+	if(!AddrRec || AddrRec->getLoop() != L || !AddrRec->isAffine())
+		return false;
+	auto *Step = dyn_cast<SCEVConstant>(AddrRec->getStepRecurrence(SE));
+	if(!Step || Step->getAPInt().abs() != ConstSize->getZExtValue())
+		return false;
+	Op.AddrRec = AddrRec;
+	Op.Size = ConstSize->getZExtValue();
+	return true;
+}
 
-// Compute the ID for this instruction
-	auto Id = RefIDPrefix + InstCounter++;
-	//InstToIdMap[I] = Id;
-	InstToIdMap.insert(std::make_pair(I, Id));
-	errs() << "MAP UPDATED\n";
-	errs() << "MAP SIZE: " << InstToIdMap.size() << "\n";
+// Summarize the operations in loops whose addresses advance by their sizes in
+// every iteration. Such loops initialize or copy persistent memory in bulk, so
+// recording them once at the exit of the loop cuts most of their operations.
+// The operations of a loop are only summarized if all of them can be, and
+// nothing else in the loop may be ordered with them, so that the runtime sees
+// the same writes and flushes in the same order. Summarized operations are
+// added to the given set.
+static void SummarizeLoops(Function *F,
+									SmallVector<std::pair<Instruction *, uint32_t>, 16> &OpsVect,
+									SmallVector<Instruction *, 4> &FencesVect,
+									const PMInterfaces<> &PMI, const DataLayout &DL,
+									TargetLibraryInfo &TLI, LoopInfo &LI, ScalarEvolution &SE,
+									DominatorTree &DT, SmallVector<LoopSummary, 8> &SummariesVect,
+									SmallPtrSet<Instruction *, 16> &SummarizedOpsSet) {
+// Group the operations by their innermost loops
+	MapVector<Loop *, SmallVector<LoopOp, 4>> LoopToOpsMap;
+	for(auto &OpPair : OpsVect) {
+		auto *L = LI.getLoopFor(OpPair.first->getParent());
+		if(L && L->empty())
+			LoopToOpsMap[L].push_back(LoopOp{OpPair.first, OpPair.second, nullptr, 0});
+	}
 
-// Index the ID into the write arrays
-	std::vector<Value *> IndexVect;
-	IndexVect.push_back(Zero);
-	IndexVect.push_back(Index);
-	auto *IdArrayPtr =
-						GetElementPtrInst::CreateInBounds(FlushIdArray->getAllocatedType(),
-														FlushIdArray, ArrayRef<Value *>(IndexVect), "", I);
-	auto *AddrArrayPtr =
-					GetElementPtrInst::CreateInBounds(FlushAddrArray->getAllocatedType(),
-													FlushAddrArray, ArrayRef<Value *>(IndexVect), "", I);
-	auto *SizeArrayPtr =
-					GetElementPtrInst::CreateInBounds(FlushSizeArray->getAllocatedType(),
-													FlushSizeArray, ArrayRef<Value *>(IndexVect), "", I);
-	auto *TimeStampArrayPtr =
-					GetElementPtrInst::CreateInBounds(FlushTimeStampArray->getAllocatedType(),
-													FlushTimeStampArray, ArrayRef<Value *>(IndexVect), "", I);
-	new StoreInst(CurTimeStamp, TimeStampArrayPtr, I);
-
-// Write to the arrays
-	auto *IdValue = ConstantInt::get(Type::getInt32Ty(Context), Id);
-	new StoreInst(IdValue, IdArrayPtr, I);
-	if(FI.isValidInterfaceCall(CI)) {
-		auto *AddrInt = new PtrToIntInst(FI.getPMemAddrOperand(CI),
-																		 Type::getInt64Ty(Context), "", I);
-		new StoreInst(AddrInt, AddrArrayPtr, I);
-		new StoreInst(FI.getPMemLenOperand(CI), SizeArrayPtr, I);
-		return;
+	SCEVExpander Expander(SE, DL, "pmcheck.summary");
+	for(auto &LoopToOpsPair : LoopToOpsMap) {
+		auto *L = LoopToOpsPair.first;
+		auto &LoopOpsVect = LoopToOpsPair.second;
+
+	// The loop must exit only from its latch, after a number of iterations
+	// that is known when it exits
+		auto *Latch = L->getLoopLatch();
+		auto *Exit = L->getExitBlock();
+		if(!L->isLoopSimplifyForm() || !Exit || L->getExitingBlock() != Latch)
+			continue;
+		const SCEV *BackedgeTakenCount = SE.getBackedgeTakenCount(L);
+		if(isa<SCEVCouldNotCompute>(BackedgeTakenCount))
+			continue;
+
+	// Nothing in the loop may call into code that records operations or ends
+	// an epoch
+		SmallPtrSet<Instruction *, 8> LoopOpsSet;
+		for(auto &Op : LoopOpsVect)
+			LoopOpsSet.insert(Op.I);
+		bool Summarizable = true;
+		for(auto *Fence : FencesVect)
+			Summarizable &= !L->contains(Fence);
+		for(auto *BB : L->blocks()) {
+			for(auto &Inst : *BB) {
+				if(isa<CallInst>(&Inst) && !isa<DbgInfoIntrinsic>(&Inst)
+				&& !LoopOpsSet.count(&Inst)) {
+					Summarizable = false;
+				}
+			}
+		}
+
+	// Every operation has to run once in every iteration and cover the next range
+		for(auto &Op : LoopOpsVect) {
+			if(!Summarizable)
+				break;
+			Value *Addr;
+			Value *Size;
+			if(Op.Kind == PMCHECK_BUFFERED_WRITE)
+				GetWriteRange(Op.I, PMI, DL, TLI, Addr, Size);
+			else if(!GetFlushRange(Op.I, PMI, Addr, Size))
+				Summarizable = false;
+			Summarizable = Summarizable && DT.dominates(Op.I->getParent(), Latch)
+										&& GetAffineRange(Op, Addr, Size, L, SE);
+		}
+		if(!Summarizable)
+			continue;
+
+	// All the writes are recorded before all the flushes, so a flush in the loop
+	// must flush exactly what a write before it in the same iteration wrote
+		bool HasWrites = false;
+		for(auto &Op : LoopOpsVect)
+			HasWrites |= (Op.Kind == PMCHECK_BUFFERED_WRITE);
+		for(auto &Op : LoopOpsVect) {
+			if(Op.Kind != PMCHECK_BUFFERED_FLUSH || !HasWrites)
+				continue;
+			bool FlushesWrite = false;
+			for(auto &OtherOp : LoopOpsVect) {
+				FlushesWrite |= (OtherOp.Kind == PMCHECK_BUFFERED_WRITE
+											&& OtherOp.AddrRec == Op.AddrRec && OtherOp.Size == Op.Size
+											&& DT.dominates(OtherOp.I, Op.I));
+			}
+			Summarizable &= FlushesWrite;
+		}
+		if(!Summarizable)
+			continue;
+
+	// Compute the ranges where the loop exits. If the addresses go down, the
+	// range starts at the address of the last iteration.
+		auto *Int64Ty = Type::getInt64Ty(F->getContext());
+		auto *InsertBefore = &*Exit->getFirstInsertionPt();
+		auto *NumIterations =
+					SE.getAddExpr(SE.getTruncateOrZeroExtend(BackedgeTakenCount, Int64Ty),
+												SE.getConstant(Int64Ty, 1));
+		for(auto &Op : LoopOpsVect) {
+			auto *Step = cast<SCEVConstant>(Op.AddrRec->getStepRecurrence(SE));
+			const SCEV *Start = Op.AddrRec->getStart();
+			if(Step->getAPInt().isNegative())
+				Start = Op.AddrRec->evaluateAtIteration(BackedgeTakenCount, SE);
+			auto *Size = SE.getMulExpr(SE.getConstant(Int64Ty, Op.Size), NumIterations);
+			auto *AddrValue = Expander.expandCodeFor(Start, Start->getType(), InsertBefore);
+			auto *SizeValue = Expander.expandCodeFor(Size, Int64Ty, InsertBefore);
+			SummariesVect.push_back(LoopSummary{Op.I, Op.Kind, AddrValue,
+																					SizeValue, InsertBefore});
+			SummarizedOpsSet.insert(Op.I);
+		}
 	}
-	if(PI.isValidInterfaceCall(CI)) {
-		auto *AddrInt = new PtrToIntInst(PI.getPMemAddrOperand(CI),
-																		 Type::getInt64Ty(Context), "", I);
-		new StoreInst(AddrInt, AddrArrayPtr, I);
-		new StoreInst(PI.getPMemLenOperand(CI), SizeArrayPtr, I);
+}
+
+// Stores that are appended to the op buffer as one operation, along with the
+// offsets of their addresses from the address of the first store
+struct StoreGroup {
+	SmallVector<StoreInst *, 8> MembersVect;
+	SmallVector<int64_t, 8> OffsetsVect;
+	Value *Base;
+	int64_t BaseOffset;
+};
+
+// Group the stores that run one after the other to constant offsets of the
+// same address. Nothing between the stores of a group may record operations,
+// change the context or end an epoch, so appending the group after its last
+// store gives the runtime the same operations in the same order. Stores that
+// have no store to group with are left alone.
+static void GroupStores(Function *F,
+									SmallVector<std::pair<Instruction *, uint32_t>, 16> &OpsVect,
+									SmallPtrSet<Instruction *, 16> &SummarizedOpsSet,
+									const DataLayout &DL, SmallVector<StoreGroup, 8> &GroupsVect,
+									SmallPtrSet<Instruction *, 16> &GroupedOpsSet) {
+	SmallPtrSet<Instruction *, 16> OpsSet;
+	SmallPtrSet<Instruction *, 16> StoresSet;
+	for(auto &OpPair : OpsVect) {
+		OpsSet.insert(OpPair.first);
+		if(OpPair.second == PMCHECK_BUFFERED_WRITE && isa<StoreInst>(OpPair.first)
+		&& !SummarizedOpsSet.count(OpPair.first)) {
+			StoresSet.insert(OpPair.first);
+		}
+	}
+	if(StoresSet.size() < 2)
 		return;
+
+	StoreGroup Group;
+	auto EndGroup = [&]() {
+		if(Group.MembersVect.size() > 1) {
+			for(auto *SI : Group.MembersVect)
+				GroupedOpsSet.insert(SI);
+			GroupsVect.push_back(Group);
+		}
+		Group.MembersVect.clear();
+		Group.OffsetsVect.clear();
+	};
+	for(auto &BB : *F) {
+		for(auto &I : BB) {
+			auto *SI = dyn_cast<StoreInst>(&I);
+			if(SI && StoresSet.count(SI)) {
+				int64_t Offset = 0;
+				auto *Base = GetPointerBaseWithConstantOffset(SI->getPointerOperand(),
+																											Offset, DL);
+				if(Group.MembersVect.empty() || Group.Base != Base
+				|| Group.MembersVect.size() == PMCHECK_MAX_GROUP_MEMBERS) {
+					EndGroup();
+					Group.Base = Base;
+					Group.BaseOffset = Offset;
+				}
+				Group.MembersVect.push_back(SI);
+				Group.OffsetsVect.push_back(Offset - Group.BaseOffset);
+				continue;
+			}
+			if(OpsSet.count(&I) || (isa<CallInst>(&I) && !isa<DbgInfoIntrinsic>(&I))
+			|| isa<InvokeInst>(&I) || isa<FenceInst>(&I)) {
+				EndGroup();
+			}
+		}
+		EndGroup();
 	}
 }
 
+// Instrument a group of stores. The group is appended before its last store,
+// where all the addresses are known, with the ID and the address of its first
+// store and a mask of the stores that may be to persistent memory for its size.
+// The stores get consecutive IDs, and the runtime finds their offsets and sizes
+// in the tables of the module.
+static void InstrumentStoreGroup(StoreGroup &Group, LLVMContext &Context,
+									const DataLayout &DL, GlobalVariable *OpBuffer,
+									GlobalVariable *OpBufferLimit, Function *DrainOpBuffer,
+									GlobalVariable *PoolBounds,
+									DenseMap<const Instruction *, uint32_t>  &InstToIdMap,
+									Value *IdBase, uint32_t &NumInstIds,
+									std::vector<InstrumentationPass::StoreGroupInfo> &StoreGroupsVect,
+									std::vector<InstrumentationPass::GroupMemberInfo> &GroupMembersVect) {
+	auto *Int64Ty = Type::getInt64Ty(Context);
+	auto *I = Group.MembersVect.back();
+	StoreGroupsVect.push_back(InstrumentationPass::StoreGroupInfo{NumInstIds,
+											(uint32_t)GroupMembersVect.size(),
+											(uint32_t)Group.MembersVect.size()});
+	auto *IdValue = BinaryOperator::Create(Instruction::Add, IdBase,
+							ConstantInt::get(Type::getInt32Ty(Context), NumInstIds), "", I);
+
+	Value *AddrInt = nullptr;
+	Value *Mask = ConstantInt::get(Int64Ty, 0);
+	for(unsigned Index = 0; Index != Group.MembersVect.size(); ++Index) {
+		auto *SI = Group.MembersVect[Index];
+		InstToIdMap.insert(std::make_pair(SI, NumInstIds++));
+		GroupMembersVect.push_back(InstrumentationPass::GroupMemberInfo{
+								Group.OffsetsVect[Index],
+								DL.getTypeStoreSize(SI->getValueOperand()->getType())});
+
+		auto *MemberAddrInt = new PtrToIntInst(SI->getPointerOperand(), Int64Ty, "", I);
+		if(!AddrInt)
+			AddrInt = MemberAddrInt;
+		Value *InBounds = new ZExtInst(CheckInPoolBounds(I, Context, MemberAddrInt,
+																										 PoolBounds), Int64Ty, "", I);
+		if(Index) {
+			InBounds = BinaryOperator::Create(Instruction::Shl, InBounds,
+																				ConstantInt::get(Int64Ty, Index), "", I);
+		}
+		Mask = BinaryOperator::Create(Instruction::Or, Mask, InBounds, "", I);
+	}
+	auto *InPM = new ICmpInst(I, ICmpInst::ICMP_NE, Mask, ConstantInt::get(Int64Ty, 0));
+	AppendOp(I, Context, OpBuffer, OpBufferLimit, DrainOpBuffer,
+					 PMCHECK_BUFFERED_WRITE_GROUP, IdValue, AddrInt, Mask, InPM);
+}
+
 static void InstrumentForPMModelVerifier(Function *F,
-									SmallVector<Instruction *, 4> &RetsVect,
-									SmallVector<Instruction *, 4> &CallsVect,
 									SmallVector<Instruction *, 4> &FencesVect,
+									SmallVector<Instruction *, 4> &DecidedFencesVect,
 									PerfCheckerInfo<> &PerfCheckerWriteInfo,
 									PerfCheckerInfo<> &PerfCheckerFlushInfo,
 									DenseMap<const Instruction *, uint32_t>  &InstToIdMap,
 									const PMInterfaces<> &PMI, TargetLibraryInfo &TLI,
-									GenCondBlockSetLoopInfo &GI, Function *FenceEncountered,
-									Function *RecordNonStrictWrites, Function *RecordFlushes,
-									Function *Strlen) {
+									Function *FenceEncountered, Function *DrainOpBuffer,
+									Function *Strlen, GlobalVariable *IdBaseVar,
+									uint32_t &NumInstIds, GlobalVariable *PoolBounds,
+									GlobalVariable *OpBuffer, GlobalVariable *OpBufferLimit,
+									std::vector<InstrumentationPass::StoreGroupInfo> &StoreGroupsVect,
+									std::vector<InstrumentationPass::GroupMemberInfo> &GroupMembersVect,
+									LoopInfo &LI,
+									ScalarEvolution &SE, DominatorTree &DT) {
 	errs() << "START INSTRUMENTING FUNCTION: " << F->getName() << "\n";
-// Get the reference ID prefix for the given function
-	uint32_t RefIDPrefix = ComputeRefIDPrefix(std::string(F->getName()));
 
 	auto &Context = F->getContext();
-	auto *One = ConstantInt::get(Type::getInt64Ty(Context), 1);
-	auto *Zero = ConstantInt::get(Type::getInt64Ty(Context), 0);
 	auto &DL = F->getParent()->getDataLayout();
-	auto &PMMI = PMI.getPmemInterface();
-
-// Allocate the variables to record instruction IDs, operation addresses, size, etc.
-	AllocaInst *WriteIdArray;
-	AllocaInst *WriteAddrArray;
-	AllocaInst *WriteSizeArray;
-	AllocaInst *WriteTimeStampArray;
-	AllocaInst *FlushIdArray;
-	AllocaInst *FlushAddrArray;
-	AllocaInst *FlushSizeArray;
-	AllocaInst *TimeStampArray;
-	AllocaInst *FlushTimeStampArray;
-	AllocaInst *TimeStamp;
 	auto *FirstInstInEntryBlock = F->getEntryBlock().getFirstNonPHI();
 	uint64_t NumWriteInfoSets = PerfCheckerWriteInfo.size(F);
 	uint64_t NumFlushInfoSets = PerfCheckerFlushInfo.size(F);
-	uint64_t MaxNumWritesInSets = PerfCheckerWriteInfo.maxSetSize(F);
-	uint64_t MaxNumFlushesInSets = PerfCheckerFlushInfo.maxSetSize(F);
-	if(NumWriteInfoSets) {
-		auto *WriteArray32Ty = ArrayType::get(Type::getInt32Ty(Context),
-																					MaxNumWritesInSets);
-		auto *WriteArray64Ty = ArrayType::get(Type::getInt64Ty(Context),
-																					MaxNumWritesInSets);
-		WriteIdArray = new AllocaInst(WriteArray32Ty, 0, One, 0,
-	 																"", FirstInstInEntryBlock);
-		WriteAddrArray = new AllocaInst(WriteArray64Ty, 0, One,
-																		0, "", FirstInstInEntryBlock);
-		WriteSizeArray = new AllocaInst(WriteArray64Ty, 0, One,
-																		0, "", FirstInstInEntryBlock);
-		WriteTimeStampArray = new AllocaInst(WriteArray64Ty, 0, One,
-																				 0, "", FirstInstInEntryBlock);
-	}
-	if(NumFlushInfoSets) {
-		auto *FlushArray32Ty = ArrayType::get(Type::getInt32Ty(Context),
-																					MaxNumFlushesInSets);
-		auto *FlushArray64Ty = ArrayType::get(Type::getInt64Ty(Context),
-																					MaxNumFlushesInSets);
-		FlushIdArray = new AllocaInst(FlushArray32Ty, 0, One, 0,
-																	"", FirstInstInEntryBlock);
-		FlushAddrArray = new AllocaInst(FlushArray64Ty, 0, One,
-																		0, "", FirstInstInEntryBlock);
-		FlushSizeArray = new AllocaInst(FlushArray64Ty, 0, One,
-																		0, "", FirstInstInEntryBlock);
-		FlushTimeStampArray = new AllocaInst(FlushArray64Ty, 0, One,
-																				 0, "", FirstInstInEntryBlock);
-	}
-	if(NumWriteInfoSets || NumFlushInfoSets) {
-		//auto *Array64Ty = ArrayType::get(Type::getInt64Ty(Context),
-			//														 	 MaxNumWritesInSets + MaxNumFlushesInSets);
-		TimeStamp = new AllocaInst(Type::getInt64Ty(Context), 0, One,
-															 0, "", FirstInstInEntryBlock);
-		new StoreInst(Zero, TimeStamp, FirstInstInEntryBlock);
-	}
-	errs() << "ALL ALLOCAS ARE INSERTED\n";
-	F->print(errs());
 
-// Instrument to record persist operations
-	auto RecordOpsBefore = [&](Instruction *I, AllocaInst *OpIdArray,
-														 AllocaInst *OpAddrArray, AllocaInst *OpSizeArray,
-														 AllocaInst *OpTimeStampArray, uint64_t &OpIndex,
-														 Function *RecordFunc) {
-	// Instrument the write
-		auto *IdPtrToInt = new PtrToIntInst(OpIdArray,
-																				Type::getInt64Ty(Context), "", I);
-		auto *AddrPtrToInt = new PtrToIntInst(OpAddrArray,
-																					Type::getInt64Ty(Context), "", I);
-		auto *SizePtrToInt = new PtrToIntInst(OpSizeArray,
-																					Type::getInt64Ty(Context), "", I);
-		auto *TimeStampPtrToInt =  new PtrToIntInst(OpTimeStampArray,
-																					Type::getInt64Ty(Context), "", I);
-		auto *ArraysSize = ConstantInt::get(Type::getInt64Ty(Context), OpIndex);
-							//	new LoadInst(Type::getInt64Ty(Context), OpIndex, "", I);
-		std::vector<Value *> ArgVect;
-		ArgVect.push_back(IdPtrToInt);
-		ArgVect.push_back(AddrPtrToInt);
-		ArgVect.push_back(SizePtrToInt);
-		ArgVect.push_back(TimeStampPtrToInt);
-		ArgVect.push_back(ArraysSize);
-		CallInst::Create(RecordFunc->getFunctionType(),
-										 RecordFunc, ArrayRef<Value *>(ArgVect), "", I);
-		//new StoreInst(Zero, OpIndex, I);
-		OpIndex = 0;
-		F->print(errs());
-	};
+// Load the base of the IDs of the module once for the function
+	Value *IdBase = nullptr;
+	if(NumWriteInfoSets || NumFlushInfoSets || FencesVect.size()) {
+		IdBase = new LoadInst(Type::getInt32Ty(Context), IdBaseVar, "",
+													FirstInstInEntryBlock);
+	}
 
-// Instrument Writes
-	uint32_t InstCounter = 0;
-	uint64_t WriteIndex = 0;
+// Gather the writes and the flushes. The sets that the model verifier already
+// decided at compile time are not checked again at runtime.
+	SmallVector<std::pair<Instruction *, uint32_t>, 16> OpsVect;
 	for(PerfCheckerInfo<>::iterator It = PerfCheckerWriteInfo.begin(F);
 			It != PerfCheckerWriteInfo.end(F); ++It) {
-		auto SerialInsts = *It;
-		Instruction *PrevInst = SerialInsts[0];
-		GenLoop *L = GI.getLoopFor(SerialInsts[0]->getParent());
-		Instruction *PrevInstrumentedInst = nullptr;
-		for(auto *I : SerialInsts) {
-			InstrumentWrite(I, Context, PMI, DL, TLI, Strlen, WriteIdArray,
-											WriteAddrArray, WriteSizeArray, TimeStamp,
-											WriteTimeStampArray, WriteIndex, InstToIdMap,
-											RefIDPrefix, InstCounter);
-			errs() << "--MAP SIZE: " << InstToIdMap.size() << "\n";
-			if(L != GI.getLoopFor(I->getParent())) {
-			// Since this is a different loop, record the write
-				PrevInstrumentedInst = I;
-				RecordOpsBefore(I, WriteIdArray, WriteAddrArray, WriteSizeArray,
-												WriteTimeStampArray, WriteIndex, RecordNonStrictWrites);
-			}
-		}
-
-	// Instrument the rest of set if it has not been yet
-		auto *LastInstInSet = SerialInsts[SerialInsts.size() - 1];
-		if(!PrevInstrumentedInst || PrevInstrumentedInst != LastInstInSet) {
-			RecordOpsBefore(LastInstInSet, WriteIdArray, WriteAddrArray,
-				 							WriteSizeArray, WriteTimeStampArray, WriteIndex,
-											RecordNonStrictWrites);
-		}
+		if(!It->needsRuntimeCheck())
+			continue;
+		for(auto *I : *It)
+			OpsVect.push_back(std::make_pair(I, PMCHECK_BUFFERED_WRITE));
 	}
-
-// Instrument Flushes
-	uint64_t FlushIndex = 0;
 	for(PerfCheckerInfo<>::iterator It = PerfCheckerFlushInfo.begin(F);
 			It != PerfCheckerFlushInfo.end(F); ++It) {
-		auto SerialInsts = *It;
-		Instruction *PrevInst = SerialInsts[0];
-		GenLoop *L = GI.getLoopFor(SerialInsts[0]->getParent());
-		Instruction *PrevInstrumentedInst = nullptr;
-		for(auto *I : SerialInsts) {
-			InstrumentFlush(I, Context, PMI, DL, FlushIdArray, FlushAddrArray,
-											FlushSizeArray, TimeStamp, FlushTimeStampArray,
-											FlushIndex, InstToIdMap, RefIDPrefix, InstCounter);
-			errs() << "--MAP SIZE: " << InstToIdMap.size() << "\n";
-			if(L != GI.getLoopFor(I->getParent())) {
-			// Since this is a different loop, record the write
-				PrevInstrumentedInst = I;
-				RecordOpsBefore(I, FlushIdArray, FlushAddrArray, FlushSizeArray,
-												FlushTimeStampArray, FlushIndex, RecordFlushes);
-			}
-		}
+		if(!It->needsRuntimeCheck())
+			continue;
+		for(auto *I : *It)
+			OpsVect.push_back(std::make_pair(I, PMCHECK_BUFFERED_FLUSH));
+	}
+
+// Summarize the operations of the loops that can be before anything changes
+// the loops
+	SmallVector<LoopSummary, 8> SummariesVect;
+	SmallPtrSet<Instruction *, 16> SummarizedOpsSet;
+	SummarizeLoops(F, OpsVect, FencesVect, PMI, DL, TLI, LI, SE, DT,
+								 SummariesVect, SummarizedOpsSet);
+
+// Group the stores before anything changes the blocks either
+	SmallVector<StoreGroup, 8> GroupsVect;
+	SmallPtrSet<Instruction *, 16> GroupedOpsSet;
+	GroupStores(F, OpsVect, SummarizedOpsSet, DL, GroupsVect, GroupedOpsSet);
+
+	for(auto &Summary : SummariesVect) {
+		auto *InsertBefore = Summary.InsertBefore;
+		auto *IdValue = GetIdValue(Summary.I, InsertBefore, InstToIdMap,
+															 IdBase, NumInstIds);
+		auto *AddrInt = new PtrToIntInst(Summary.Addr, Type::getInt64Ty(Context),
+																		 "", InsertBefore);
+		Value *InPM = nullptr;
+		if(Summary.Kind == PMCHECK_BUFFERED_WRITE)
+			InPM = CheckInPoolBounds(InsertBefore, Context, AddrInt, PoolBounds);
+		AppendOp(InsertBefore, Context, OpBuffer, OpBufferLimit, DrainOpBuffer, Summary.Kind,
+						 IdValue, AddrInt, Summary.Size, InPM);
+	}
 
-	// Instrument the rest of set if it has not been yet
-		auto *LastInstInSet = SerialInsts[SerialInsts.size() - 1];
-		if(!PrevInstrumentedInst || PrevInstrumentedInst != LastInstInSet) {
-			RecordOpsBefore(LastInstInSet, FlushIdArray, FlushAddrArray,
-											FlushSizeArray, FlushTimeStampArray, FlushIndex,
-											RecordFlushes);
+	for(auto &Group : GroupsVect) {
+		InstrumentStoreGroup(Group, Context, DL, OpBuffer, OpBufferLimit, DrainOpBuffer,
+												 PoolBounds, InstToIdMap, IdBase, NumInstIds,
+												 StoreGroupsVect, GroupMembersVect);
+	}
+
+// Instrument the rest of the writes and flushes. They are appended to the op
+// buffer of the thread as they run, and the runtime records them when it
+// drains the buffer.
+	for(auto &OpPair : OpsVect) {
+		auto *I = OpPair.first;
+		if(SummarizedOpsSet.count(I) || GroupedOpsSet.count(I))
+			continue;
+		if(OpPair.second == PMCHECK_BUFFERED_WRITE) {
+			InstrumentWrite(I, Context, PMI, DL, TLI, Strlen, OpBuffer, OpBufferLimit,
+											DrainOpBuffer, PoolBounds, InstToIdMap, IdBase, NumInstIds);
+		} else {
+			InstrumentFlush(I, Context, PMI, DL, OpBuffer, OpBufferLimit, DrainOpBuffer,
+											InstToIdMap, IdBase, NumInstIds);
 		}
+		errs() << "--MAP SIZE: " << InstToIdMap.size() << "\n";
 	}
 
-// Iterate over the fences and instrument them
+// Iterate over the fences and instrument them. The runtime drains the op
+// buffer at every fence. Fences that end only decided sets have nothing for
+// the runtime to check, and it would take them for redundant fences.
+	SmallPtrSet<Instruction *, 4> DecidedFencesSet(DecidedFencesVect.begin(),
+																								 DecidedFencesVect.end());
 	for(auto *Fence : FencesVect) {
+		if(DecidedFencesSet.count(Fence))
+			continue;
 		errs() << "INSTRUMENTING FENCE: ";
 		Fence->print(errs());
 		errs() << "\n";
 	// Assign a static ID to the fence
-		auto Id = RefIDPrefix + InstCounter++;
+		auto Id = NumInstIds++;
 		InstToIdMap.insert(std::make_pair(Fence, Id));
 		errs() << "MAP SIZE: " << InstToIdMap.size() << "\n";
 		errs() << "FENCE ID: " << Id << "\n";
 
 	// Instrument now
 		std::vector<Value *> ArgVect;
-		ArgVect.push_back(ConstantInt::get(Type::getInt32Ty(Context), Id));
+		ArgVect.push_back(BinaryOperator::Create(Instruction::Add, IdBase,
+								ConstantInt::get(Type::getInt32Ty(Context), Id), "", Fence));
 		CallInst::Create(FenceEncountered->getFunctionType(),
 						 				 FenceEncountered, ArrayRef<Value *>(ArgVect), "", Fence);
 		errs() << "FENCE INSTRUMENTED\n";
@@ -453,104 +698,116 @@ static void InstrumentForPMModelVerifier(Function *F,
 	errs() << "ALL FENCES INSTRUMENTED\n";
 	errs() << "+++MAP SIZE: " << InstToIdMap.size() << "\n";
 
-// Instrument call and return instructions
-	for(auto *Call : CallsVect) {
-	// Update the time stamp before the call instruction.
-		std::vector<Value *> ArgVect;
-		auto *LoadedTimeStamp =
-									new LoadInst(Type::getInt64Ty(Context), TimeStamp, "", Call);
-		ArgVect.push_back(LoadedTimeStamp);
-		CallInst::Create(UpdateTimeStamp->getFunctionType(),
-						 				 UpdateTimeStamp, ArrayRef<Value *>(ArgVect), "", Call);
+	F->print(errs());
+}
 
-	// Load the time stamp again after the call instruction.
+// Name of the section that the tables of the modules are put in. It is a valid
+// C identifier so that the linker defines symbols for the start and the end of
+// the section, which the runtime uses to find the tables.
+#define MODULE_INFO_SECTION "pmcheck_modules"
+
+// Emit the sites of the instructions and the groups of stores as constant
+// tables, and a record of the module in the module info section that points to
+// them. Nothing runs at startup
+// for them; the runtime only gives the module its base ID and reads the tables
+// when it prints a report.
+static void DefineModuleInfo(Module &M, LLVMContext &Context,
+							 std::vector<InstrumentationPass::SiteInfo> &InstIdToSiteVect,
+							 std::string &SiteNames,
+							 std::vector<InstrumentationPass::StoreGroupInfo> &StoreGroupsVect,
+							 std::vector<InstrumentationPass::GroupMemberInfo> &GroupMembersVect,
+							 GlobalVariable *IdBase) {
+	if(InstIdToSiteVect.empty())
+		return;
 
+// The sites are laid out as an array of triples of line number, file name offset
+// and function name offset.
+	std::vector<uint32_t> SitesVect;
+	SitesVect.reserve(InstIdToSiteVect.size() * 3);
+	for(auto &Site : InstIdToSiteVect) {
+		SitesVect.push_back(Site.LineNo);
+		SitesVect.push_back(Site.FileNameOffset);
+		SitesVect.push_back(Site.FuncNameOffset);
 	}
-	for(auto *Ret : RetsVect) {
-		std::vector<Value *> ArgVect;
-		auto *LoadedTimeStamp =
-									new LoadInst(Type::getInt64Ty(Context), TimeStamp, "", Ret);
-		ArgVect.push_back(LoadedTimeStamp);
-		CallInst::Create(UpdateTimeStamp->getFunctionType(),
-						 				 UpdateTimeStamp, ArrayRef<Value *>(ArgVect), "", Ret);
+	auto *Int32Ty = Type::getInt32Ty(Context);
+	auto *Zero = ConstantInt::get(Int32Ty, 0);
+	std::vector<Constant *> IndexVect;
+	IndexVect.push_back(Zero);
+	IndexVect.push_back(Zero);
+	auto *SitesInit = ConstantDataArray::get(Context, ArrayRef<uint32_t>(SitesVect));
+	auto *Sites = new GlobalVariable(M, SitesInit->getType(), true,
+																	 GlobalValue::PrivateLinkage, SitesInit,
+																	 "PMCheckSites");
+	auto *NamesInit = ConstantDataArray::getString(Context, SiteNames, false);
+	auto *Names = new GlobalVariable(M, NamesInit->getType(), true,
+																	 GlobalValue::PrivateLinkage, NamesInit,
+																	 "PMCheckSiteNames");
+
+// The groups are laid out as triples of the ID of the first member, the index
+// of the first member and the number of members, and the members as pairs of
+// offset and size
+	auto *Int64Ty = Type::getInt64Ty(Context);
+	Constant *StoreGroups = ConstantPointerNull::get(PointerType::get(Int32Ty, 0));
+	Constant *GroupMembers = ConstantPointerNull::get(PointerType::get(Int64Ty, 0));
+	if(!StoreGroupsVect.empty()) {
+		std::vector<uint32_t> GroupFieldsVect;
+		for(auto &Group : StoreGroupsVect) {
+			GroupFieldsVect.push_back(Group.FirstId);
+			GroupFieldsVect.push_back(Group.FirstMember);
+			GroupFieldsVect.push_back(Group.NumMembers);
+		}
+		std::vector<uint64_t> MemberFieldsVect;
+		for(auto &Member : GroupMembersVect) {
+			MemberFieldsVect.push_back(Member.Offset);
+			MemberFieldsVect.push_back(Member.Size);
+		}
+		auto *GroupsInit = ConstantDataArray::get(Context,
+																				ArrayRef<uint32_t>(GroupFieldsVect));
+		auto *Groups = new GlobalVariable(M, GroupsInit->getType(), true,
+																			GlobalValue::PrivateLinkage, GroupsInit,
+																			"PMCheckStoreGroups");
+		auto *MembersInit = ConstantDataArray::get(Context,
+																				ArrayRef<uint64_t>(MemberFieldsVect));
+		auto *Members = new GlobalVariable(M, MembersInit->getType(), true,
+																			 GlobalValue::PrivateLinkage, MembersInit,
+																			 "PMCheckGroupMembers");
+		StoreGroups = ConstantExpr::getInBoundsGetElementPtr(GroupsInit->getType(),
+																												 Groups, IndexVect);
+		GroupMembers = ConstantExpr::getInBoundsGetElementPtr(MembersInit->getType(),
+																													Members, IndexVect);
 	}
 
-	F->print(errs());
+// The record of the module matches PMCheckModuleInfo in the runtime
+	std::vector<Constant *> FieldVect;
+	FieldVect.push_back(IdBase);
+	FieldVect.push_back(ConstantInt::get(Int32Ty, InstIdToSiteVect.size()));
+	FieldVect.push_back(ConstantInt::get(Int32Ty, StoreGroupsVect.size()));
+	FieldVect.push_back(ConstantExpr::getInBoundsGetElementPtr(SitesInit->getType(),
+																														 Sites, IndexVect));
+	FieldVect.push_back(ConstantExpr::getInBoundsGetElementPtr(NamesInit->getType(),
+																														 Names, IndexVect));
+	FieldVect.push_back(StoreGroups);
+	FieldVect.push_back(GroupMembers);
+	auto *ModuleInfoInit = ConstantStruct::getAnon(Context, FieldVect);
+	auto *ModuleInfo = new GlobalVariable(M, ModuleInfoInit->getType(), true,
+																				GlobalValue::InternalLinkage, ModuleInfoInit,
+																				"PMCheckModuleInfo");
+	ModuleInfo->setSection(MODULE_INFO_SECTION);
+	ModuleInfo->setAlignment(8);
+
+// Nothing refers to the record, so keep the linker from dropping it
+	appendToUsed(M, ModuleInfo);
 }
 
-static void DefineConstructor(Module &M, LLVMContext &Context,
-							 								DenseMap<uint32_t, uint64_t> &InstIdToLineNoMap) {
-	errs() << "DEFINING CONSTRUCTOR NOW\n";
-// Add constructor
-	std::vector<Type *> TypeVect;
-	auto *FuncType = FunctionType::get(Type::getVoidTy(Context),
-										   ArrayRef<Type *>(TypeVect), 0);
-	auto *PMConstructor = Function::Create(FuncType, GlobalValue::ExternalLinkage,
-										   "RuntimeInit", &M);
-	llvm::appendToGlobalCtors(M, PMConstructor, 0);
-
-// Add a runtime library function to check if the constructor is supposed
-// to execute.
-	auto *RuntimeConsructorCheck = Function::Create(FuncType,
-																									GlobalValue::ExternalLinkage,
-																									"RuntimeConsructorCheck", &M);
-
-// Define the constructor now
-	auto *EntryBlock = BasicBlock::Create(Context, "", PMConstructor);
-
-// The condblock registers all instruction IDs and their line numbers with the runtime.
-// First allocate two arrays: one to put instruction IDs and another for line numbers.
-	errs() << "ENTRY BLOCK ADDED\n";
-	auto *Zero = ConstantInt::get(Type::getInt8Ty(Context), 0);
-	auto *One = ConstantInt::get(Type::getInt8Ty(Context), 1);
-	uint64_t NumInsts = InstIdToLineNoMap.size();
-	auto *ArraySize = ConstantInt::get(Type::getInt64Ty(Context), NumInsts);
-	auto *Array32Ty = ArrayType::get(Type::getInt32Ty(Context), NumInsts);
-	auto *Array64Ty = ArrayType::get(Type::getInt64Ty(Context), NumInsts);
-	auto *IdArray = new AllocaInst(Array32Ty, 0, One, 0, "", EntryBlock);
-	auto *LineArray = new AllocaInst(Array64Ty, 0, One, 0, "", EntryBlock);
-	errs() << "ALLOCAS INSERTED\n";
-	uint64_t Index = 0;
-	std::vector<Value *> IndexVect;
-	IndexVect.push_back(Zero);
-	for(auto &Pair : InstIdToLineNoMap) {
-	// Index into the arrays
-		auto ConstantIndex = ConstantInt::get(Type::getInt64Ty(Context), Index++);
-		IndexVect.push_back(ConstantIndex);
-		auto *IdIndexedPtr =
-				GetElementPtrInst::CreateInBounds(IdArray->getAllocatedType(),
-								IdArray, ArrayRef<Value *>(IndexVect), "", EntryBlock);
-		auto *LineIndexedPtr =
-				GetElementPtrInst::CreateInBounds(LineArray->getAllocatedType(),
-								LineArray, ArrayRef<Value *>(IndexVect), "", EntryBlock);
-		IndexVect.pop_back();
-
-	// Insert IDs and corresponding line numbers
-		auto ConstantId = ConstantInt::get(Type::getInt64Ty(Context), Pair.getFirst());
-		auto ConstantLine = ConstantInt::get(Type::getInt64Ty(Context), Pair.getSecond());
-		new StoreInst(ConstantId, IdIndexedPtr, EntryBlock);
-		new StoreInst(ConstantLine, LineIndexedPtr, EntryBlock);
-	}
-	errs() << "ARRAYS INDEXED\n";
-
-// Pass the arrays to the runtime function. Create the function first.
-	TypeVect.push_back(ArrayType::get(Type::getInt32Ty(Context), NumInsts));
-	TypeVect.push_back(ArrayType::get(Type::getInt64Ty(Context), NumInsts));
-	TypeVect.push_back(Type::getInt64Ty(Context));
-	FuncType = FunctionType::get(Type::getVoidTy(Context),
-											   ArrayRef<Type *>(TypeVect), 0);
-	auto *RegisterInstructionsInfo = Function::Create(FuncType, GlobalValue::ExternalLinkage,
-													  												"RegisterInstructionsInfo", &M);
-
-// Insert a call to register the instructions with the runtime
-	std::vector<Value *> ArgVect;
-	ArgVect.push_back(IdArray);
-	ArgVect.push_back(LineArray);
-	ArgVect.push_back(ArraySize);
-	CallInst::Create(RegisterInstructionsInfo, ArrayRef<Value *>(ArgVect), "", EntryBlock);
-
-// Create return
-	ReturnInst::Create(Context, EntryBlock);
+uint32_t InstrumentationPass::getSiteNameOffset(StringRef Name) {
+	auto It = SiteNameToOffsetMap.find(Name);
+	if(It != SiteNameToOffsetMap.end())
+		return It->getValue();
+	uint32_t Offset = SiteNames.size();
+	SiteNames.append(Name.begin(), Name.end());
+	SiteNames.push_back('\0');
+	SiteNameToOffsetMap[Name] = Offset;
+	return Offset;
 }
 
 bool InstrumentationPass::doInitialization(Module &M) {
@@ -558,6 +815,47 @@ bool InstrumentationPass::doInitialization(Module &M) {
 
 // Define the functions that we need to insert for recording persists
 	auto &Context = M.getContext();
+
+// The base of the IDs of the module is set by its constructor
+	NumInstIds = 0;
+	InstIdToSiteVect.clear();
+	SiteNames.assign(1, '\0');
+	SiteNameToOffsetMap.clear();
+	StoreGroupsVect.clear();
+	GroupMembersVect.clear();
+	IdBase = new GlobalVariable(M, Type::getInt32Ty(Context), false,
+															GlobalValue::InternalLinkage,
+															ConstantInt::get(Type::getInt32Ty(Context), 0),
+															"PMCheckIdBase");
+
+// The runtime defines the bounds of the pools
+	auto *BoundsTy = ArrayType::get(Type::getInt64Ty(Context),
+																	2 * PMCHECK_NUM_POOL_BOUNDS);
+	PoolBounds = new GlobalVariable(M, BoundsTy, false, GlobalValue::ExternalLinkage,
+																	nullptr, "PMCheckPoolBounds");
+
+// The runtime also defines the op buffer of every thread. It is linked into the
+// application, so the buffer is in the static TLS block.
+	std::vector<Type *> FieldVect;
+	FieldVect.push_back(Type::getInt64Ty(Context));
+	FieldVect.push_back(Type::getInt64Ty(Context));
+	FieldVect.push_back(Type::getInt32Ty(Context));
+	FieldVect.push_back(Type::getInt32Ty(Context));
+	auto *OpTy = StructType::create(Context, FieldVect, "PMCheckBufferedOp");
+	FieldVect.clear();
+	FieldVect.push_back(Type::getInt32Ty(Context));
+	FieldVect.push_back(Type::getInt32Ty(Context));
+	FieldVect.push_back(ArrayType::get(OpTy, PMCHECK_OP_BUFFER_CAPACITY));
+	auto *OpBufferTy = StructType::create(Context, FieldVect, "PMCheckOpBuffer");
+	OpBuffer = new GlobalVariable(M, OpBufferTy, false, GlobalValue::ExternalLinkage,
+																nullptr, "PMCheckOps", nullptr,
+																GlobalValue::InitialExecTLSModel);
+
+// The runtime defines how many operations the buffer holds before it is drained
+	OpBufferLimit = new GlobalVariable(M, Type::getInt32Ty(Context), false,
+																		 GlobalValue::ExternalLinkage, nullptr,
+																		 "PMCheckOpBufferLimit");
+
 	std::vector<Type *> TypeVect;
 	TypeVect.push_back(Type::getInt32Ty(Context));
 	auto *FuncType = FunctionType::get(Type::getVoidTy(Context),
@@ -565,24 +863,14 @@ bool InstrumentationPass::doInitialization(Module &M) {
 	FenceEncountered = Function::Create(FuncType, GlobalValue::ExternalLinkage,
 																					"FenceEncountered", &M);
 	FenceEncountered->setOnlyAccessesInaccessibleMemory();
+
+// The runtime reads the op buffer when it drains it, so this may not be marked
+// to only access inaccessible memory
 	TypeVect.clear();
-	TypeVect.push_back(Type::getInt64Ty(Context));
-	TypeVect.push_back(Type::getInt64Ty(Context));
-	TypeVect.push_back(Type::getInt64Ty(Context));
-	TypeVect.push_back(Type::getInt64Ty(Context));
-	TypeVect.push_back(Type::getInt64Ty(Context));
-	//TypeVect.push_back(Type::getInt32Ty(Context));
 	FuncType = FunctionType::get(Type::getVoidTy(Context),
 															 ArrayRef<Type *>(TypeVect), 0);
-	RecordNonStrictWrites = Function::Create(FuncType, GlobalValue::ExternalLinkage,
-																					 "RecordNonStrictWrites", &M);
-	RecordNonStrictWrites->setOnlyAccessesInaccessibleMemory();
-	RecordStrictWrites = Function::Create(FuncType, GlobalValue::ExternalLinkage,
-																				"RecordStrictWrites", &M);
-	RecordStrictWrites->setOnlyAccessesInaccessibleMemory();
-	RecordFlushes = Function::Create(FuncType, GlobalValue::ExternalLinkage,
-																	 "RecordFlushes", &M);
-	RecordFlushes->setOnlyAccessesInaccessibleMemory();
+	DrainOpBuffer = Function::Create(FuncType, GlobalValue::ExternalLinkage,
+																	 "DrainOpBuffer", &M);
 
 // We might been strlen function in the string library
 	TypeVect.clear();
@@ -596,20 +884,6 @@ bool InstrumentationPass::doInitialization(Module &M) {
 		Strlen = cast<Function>(StrlenCallee->stripPointerCasts());
 		assert(Strlen && "Error in getting strlen declaration.");
 	}
-
-// Functions for time stamp
-	TypeVect.clear();
-	FuncType = FunctionType::get(Type::getVoidTy(Context),,
-															 ArrayRef<Type *>(TypeVect), 0);
-	GetTimeStamp = Function::Create(FuncType, GlobalValue::ExternalLinkage,
-																	 "GetTimeStamp", &M);
-	GetTimeStamp->setOnlyAccessesInaccessibleMemory();
-	TypeVect.push_back(Type::getInt64Ty(Context));
-	FuncType = FunctionType::get(Type::getVoidTy(Context),
-															 ArrayRef<Type *>(TypeVect), 0);
-	UpdateTimeStamp = Function::Create(FuncType, GlobalValue::ExternalLinkage,
-																	 "UpdateTimeStamp", &M);
-	UpdateTimeStamp->setOnlyAccessesInaccessibleMemory();
 	errs() << "PASS INITIALIZED\n";
 	return false;
 }
@@ -617,10 +891,9 @@ bool InstrumentationPass::doInitialization(Module &M) {
 bool InstrumentationPass::doFinalization(Module &M) {
 	errs() << "PRINTING MODULE: ";
 	M.print(errs(), nullptr);
-// Now define the constructors and destructors
-	errs() << "FINAL MAP SIZE: " << InstIdToLineNoMap.size() << "\n";
-	DefineConstructor(M, M.getContext(), InstIdToLineNoMap);
-	//DefineDestructor(M, Context);
+// Now define the tables of the sites
+	DefineModuleInfo(M, M.getContext(), InstIdToSiteVect, SiteNames, StoreGroupsVect,
+									 GroupMembersVect, IdBase);
 	errs() << "PRINTING MODULE AGAIN:";
 	M.print(errs(), nullptr);
 	return false;
@@ -643,37 +916,38 @@ bool InstrumentationPass::runOnFunction(Function &F) {
 	errs() << "GOT PERF CHECKER FLUSH INFO\n";
 	auto &PMI = getAnalysis<ModelVerifierWrapperPass>().getPmemInterfaces();
 	errs() << "GOT MODEL VERIFIER RESULTS\n";
-	auto &GI =
-		getAnalysis<GenCondBlockSetLoopInfoWrapperPass>().getGenCondInfoWrapperPassInfo();
 	auto &TLI = getAnalysis<TargetLibraryInfoWrapperPass>().getTLI();
-	errs() << "GOT CONDBLOCK SET AND LOOP INFO\n";
+	auto &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+	auto &SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+	auto &DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
 
 	auto FencesVect = getAnalysis<ModelVerifierWrapperPass>().getFencesInfoFor(&F);
-	auto CallsVect = getAnalysis<ModelVerifierWrapperPass>().getCallsInfoFor(&F);
-	auto RetsVect = getAnalysis<ModelVerifierWrapperPass>().getRetsInfoFor(&F);
-
-	InstrumentForPMModelVerifier(&F, RetsVect, CallsVect, FencesVect,
-															 PerfCheckerWriteInfo, PerfCheckerFlushInfo,
-															 InstToIdMap, PMI, TLI, GI, FenceEncountered,
-															 RecordNonStrictWrites, RecordFlushes, Strlen);
-
-// Get line number of an instruction
-	LLVMContext &Context = F.getContext();
-	auto GetLineNumber = [&Context](const Instruction *I) {
-		if(MDNode *N = I->getMetadata("dbg")) {
-		if(DILocation *Loc = dyn_cast<DILocation>(N))
-			return ConstantInt::get(Type::getInt32Ty(Context), Loc->getLine());
-		}
-		return (ConstantInt *)nullptr;
-	};
-
+	auto DecidedFencesVect =
+					getAnalysis<ModelVerifierWrapperPass>().getDecidedFencesInfoFor(&F);
+
+	InstrumentForPMModelVerifier(&F, FencesVect, DecidedFencesVect,
+															 PerfCheckerWriteInfo,
+															 PerfCheckerFlushInfo, InstToIdMap, PMI, TLI,
+															 FenceEncountered, DrainOpBuffer, Strlen,
+															 IdBase, NumInstIds, PoolBounds, OpBuffer,
+															 OpBufferLimit, StoreGroupsVect, GroupMembersVect,
+															 LI, SE, DT);
+
+// Record the sites of the instrumented instructions
 	errs() << "MAP SIZE: " << InstToIdMap.size() << "\n";
+	InstIdToSiteVect.resize(NumInstIds);
+	auto FuncNameOffset = getSiteNameOffset(F.getName());
 	for(auto &InstToIdPair : InstToIdMap) {
-		ConstantInt *CI = GetLineNumber(InstToIdPair.getFirst());
-		InstIdToLineNoMap.insert(std::make_pair(InstToIdPair.getSecond(),
-																						CI->getSExtValue()));
+		auto &Site = InstIdToSiteVect[InstToIdPair.getSecond()];
+		Site.LineNo = 0;
+		Site.FileNameOffset = 0;
+		Site.FuncNameOffset = FuncNameOffset;
+		if(DILocation *Loc = InstToIdPair.getFirst()->getDebugLoc().get()) {
+			Site.LineNo = Loc->getLine();
+			Site.FileNameOffset = getSiteNameOffset(Loc->getFilename());
+		}
 		errs() << "ID: " << InstToIdPair.getSecond() << " ";
-		errs() << "Line: " << CI->getSExtValue() << "\n";
+		errs() << "Line: " << Site.LineNo << "\n";
 	}
 
 	errs() << "DONE\n";
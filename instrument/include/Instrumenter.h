@@ -20,24 +20,77 @@ namespace llvm {
 void initializeInstrumentationPassPass(PassRegistry &);
 
 class InstrumentationPass : public FunctionPass {
+public:
+// Line number of an instruction, and the offsets of the names of its file and
+// function in the names table of the module
+	struct SiteInfo {
+		uint32_t LineNo;
+		uint32_t FileNameOffset;
+		uint32_t FuncNameOffset;
+	};
+
+// Stores that are recorded together as one operation. The members have
+// consecutive IDs from the ID of the first, and their entries are consecutive
+// in the members table of the module.
+	struct StoreGroupInfo {
+		uint32_t FirstId;
+		uint32_t FirstMember;
+		uint32_t NumMembers;
+	};
+
+// Offset of the address of a member from the address of the first member of
+// its group, and the size of the store
+	struct GroupMemberInfo {
+		int64_t Offset;
+		uint64_t Size;
+	};
+
+private:
 // Function for instrumntation
 	Function *FenceEncountered;
-	Function *RecordStrictWrites;
-	Function *RecordNonStrictWrites;
-	Function *RecordFlushes;
+	Function *DrainOpBuffer;
 	Function *Strlen;
 
-// Map for mapping instruction IDs and their line numbers
-	std::map<uint32_t, uint64_t> InstIdToLineNoMap;
+// Instructions are numbered densely from zero across the module, and the
+// runtime offsets the IDs by the base of the range it gives the module at
+// startup. The base is kept in a global of the module.
+	uint32_t NumInstIds;
+	GlobalVariable *IdBase;
+
+// Coarse bounds of the persistent memory pools that the runtime publishes.
+// Writes are checked against them before they are recorded.
+	GlobalVariable *PoolBounds;
+
+// Buffer of every thread that writes and flushes are appended to. The runtime
+// defines it as a thread local variable.
+	GlobalVariable *OpBuffer;
+
+// Number of operations the runtime lets the buffer hold before it is drained
+	GlobalVariable *OpBufferLimit;
+
+// Sites of the instructions, indexed by their IDs in the module
+	std::vector<SiteInfo> InstIdToSiteVect;
+
+// Names of the files and functions of the sites, each ending in a null. The
+// table starts with an empty name for sites without debug info.
+	std::string SiteNames;
+	StringMap<uint32_t> SiteNameToOffsetMap;
+
+// Groups of stores of the module, ordered by the IDs of their first members,
+// and the members of all the groups
+	std::vector<StoreGroupInfo> StoreGroupsVect;
+	std::vector<GroupMemberInfo> GroupMembersVect;
+
+	uint32_t getSiteNameOffset(StringRef Name);
 
 public:
 	static char ID;
 
-	InstrumentationPass() : FunctionPass(ID) {
+	InstrumentationPass() : FunctionPass(ID), NumInstIds(0), IdBase(nullptr),
+															PoolBounds(nullptr), OpBuffer(nullptr) {
 		//initializeModelVerififierWrapperPassPass(
 			//					*PassRegistry::getPassRegistry());
 		//initializeInstrumentationPassPass(*PassRegistry::getPassRegistry());
-		initializeGenCondBlockSetLoopInfoWrapperPassPass(*PassRegistry::getPassRegistry());
 		errs() << "INITIALIZING MODEL VERIFIER WRAPPER PASS\n";
 		initializeModelVerifierWrapperPassPass(*PassRegistry::getPassRegistry());
 		errs() << "MODEL VERIFIER WRAPPER PASS INITIALIZED\n";
@@ -47,7 +100,8 @@ public:
 
 	void getAnalysisUsage(AnalysisUsage &AU) const {
 		AU.addRequired<DominatorTreeWrapperPass>();
-		AU.addRequired<GenCondBlockSetLoopInfoWrapperPass>();
+		AU.addRequired<LoopInfoWrapperPass>();
+		AU.addRequired<ScalarEvolutionWrapperPass>();
 		AU.addRequired<ModelVerifierWrapperPass>();
 		//AU.addRequired<CFLSteensAAWrapperPass>();
 		//AU.addRequired<CFLAndersAAWrapperPass>();
@@ -60,8 +114,6 @@ public:
 		//AU.addRequired<AAResultsWrapperPass>();
 		//AU.addRequired<ModelVerifierWrapperPass>();
 		AU.addRequired<AAResultsWrapperPass>();
-		AU.setPreservesCFG();
-		AU.setPreservesAll();
 	}
 
 	bool doInitialization(Module &M);
@@ -7,14 +7,36 @@
 
 namespace llvm {
 
+// What the model verifier could decide about a set of instructions at compile
+// time. Only the sets it could not decide need to be checked at runtime.
+enum SerialInstsSetStatus {
+	NeedsRuntimeCheck,
+	StaticallyVerified,
+	StaticallyFlagged
+};
+
 // This holds sets of "consecutive" instructions of a kind
 template<typename T = Instruction>
 class SerialInstsSet : public std::vector<T *> {
+	SerialInstsSetStatus Status = NeedsRuntimeCheck;
+
 public:
 	using iterator = typename std::vector<T *>::iterator;
 	using reverse_iterator = typename std::vector<T *>::reverse_iterator;
 	using const_iterator = typename std::vector<T *>::const_iterator;
 
+	SerialInstsSetStatus getStatus() const {
+		return Status;
+	}
+
+	void setStatus(SerialInstsSetStatus NewStatus) {
+		Status = NewStatus;
+	}
+
+	bool needsRuntimeCheck() const {
+		return Status == NeedsRuntimeCheck;
+	}
+
 	void printSerialInsts() const {
 		errs() << "PRINTING SERIAL INSTS\n";
 		for(auto &I : *this) {
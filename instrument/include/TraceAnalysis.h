@@ -25,13 +25,26 @@ class TempPersistencyRecord {
 // Vector of temporary writes and flushes
 	std::vector<InstVectPairTy> PairVect;
 
+// Fences that end the writes and flushes at the same indices
+	std::vector<T *> EndFencesVect;
+
 // Vector of redundant flushes
 	std::vector<SerialInstsSet<T>> RedFencesVectVect;
 
 public:
-	void addWritesAndFlushes(SerialInstsSet<T> &SW, SerialInstsSet<T> &SF) {
+	void addWritesAndFlushes(SerialInstsSet<T> &SW, SerialInstsSet<T> &SF,
+													 T *EndFence) {
 		auto Pair = std::make_pair(SW, SF);
 		PairVect.push_back(Pair);
+		EndFencesVect.push_back(EndFence);
+	}
+
+	const std::vector<InstVectPairTy> &getWritesAndFlushes() const {
+		return PairVect;
+	}
+
+	T *getEndFence(unsigned Index) const {
+		return EndFencesVect[Index];
 	}
 
 	void addRedFences(SerialInstsSet<T> &SFC) {
@@ -40,6 +53,7 @@ public:
 
 	void clear() {
 		PairVect.clear();
+		EndFencesVect.clear();
 		RedFencesVectVect.clear();
 	}
 
@@ -110,6 +124,7 @@ class ModelVerifierPass : public FunctionPass {
 	DenseMap<const Function *, SmallVector<Instruction *, 4>> FencesVectMap;
 	DenseMap<const Function *, SmallVector<Instruction *, 4>> CallsVectMap;
 	DenseMap<const Function *, SmallVector<Instruction *, 4>> RetsVectMap;
+	DenseMap<const Function *, SmallVector<Instruction *, 4>> DecidedFencesVectMap;
 
 	SmallVector<Value *, 16> GlobalVarVect;
 
@@ -163,6 +178,9 @@ class ModelVerifierWrapperPass : public FunctionPass {
 	DenseMap<const Function *, SmallVector<Instruction *, 4>> CallsVectMap;
 	DenseMap<const Function *, SmallVector<Instruction *, 4>> RetsVectMap;
 
+// Fences that end only sets that were decided at compile time
+	DenseMap<const Function *, SmallVector<Instruction *, 4>> DecidedFencesVectMap;
+
 	SmallVector<Value *, 16> GlobalVarVect;
 
 public:
@@ -231,6 +249,13 @@ public:
 		return RetsVect;
 	}
 
+	SmallVector<Instruction *, 4> getDecidedFencesInfoFor(Function *F) const {
+		SmallVector<Instruction *, 4> DecidedFencesVect;
+		for(auto *Fence : DecidedFencesVectMap.lookup(F))
+			DecidedFencesVect.push_back(Fence);
+		return DecidedFencesVect;
+	}
+
 	const PerfCheckerInfo<> &getPerfCheckerWriteInfo() const {
 		return WritePCI;
 	}
@@ -13,6 +13,7 @@
 #include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/IR/Dominators.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
 
 #include "CondBlockBase.h"
 #include "CondBlockBaseImpl.h"
@@ -708,7 +709,7 @@ static void GetGlobalsAndStackVarsAndTPR(Function *F, GenCondBlockSetLoopInfo &G
 					errs() << "PURE FENCE\n";
 					// Ignore the first fence
 					if(StartFence) {
-						TPR.addWritesAndFlushes(SW, SF);
+						TPR.addWritesAndFlushes(SW, SF, CI);
 						if(!SW.size() && !SF.size()) {
 							// Redundant flush
 							SFC.push_back(CI);
@@ -732,7 +733,7 @@ static void GetGlobalsAndStackVarsAndTPR(Function *F, GenCondBlockSetLoopInfo &G
 					errs() << "FENCE AND FLUSH HERE\n";
 					if(StartFence) {
 						SF.push_back(CI);
-						TPR.addWritesAndFlushes(SW, SF);
+						TPR.addWritesAndFlushes(SW, SF, CI);
 						if(!InterveningWriteOrFlush) {
 							// Commit the vector of fences
 							TPR.addRedFences(SFC);
@@ -787,6 +788,225 @@ static void GetGlobalsAndStackVarsAndTPR(Function *F, GenCondBlockSetLoopInfo &G
 	}
 }
 
+// Check that the writes and flushes are all that runs between the end fence and
+// the fence before it. The record follows the layout of the blocks rather than
+// the CFG, so this walks back from the end fence through blocks that have no
+// other predecessor until it finds the fence before it. Calls on the way that
+// are not in the record must not write memory.
+static bool IsStraightLineEpoch(const SerialInstsSet<> &SW,
+		const SerialInstsSet<> &SF, Instruction *EndFence, PMInterfaces<> &PMI) {
+	auto &FI = PMI.getFlushInterface();
+	auto &DI = PMI.getDrainInterface();
+	auto &PI = PMI.getPersistInterface();
+	SmallPtrSet<Instruction *, 16> EpochInstsSet;
+	EpochInstsSet.insert(SW.begin(), SW.end());
+	EpochInstsSet.insert(SF.begin(), SF.end());
+	EpochInstsSet.erase(EndFence);
+
+	SmallPtrSet<BasicBlock *, 8> VisitedSet;
+	auto *BB = EndFence->getParent();
+	auto It = ++EndFence->getReverseIterator();
+	while(true) {
+		for(; It != BB->rend(); ++It) {
+			Instruction *I = &*It;
+			if(EpochInstsSet.erase(I))
+				continue;
+			if(isa<InvokeInst>(I))
+				return false;
+			auto *CI = dyn_cast<CallInst>(I);
+			if(!CI)
+				continue;
+			if(DI.isValidInterfaceCall(CI) || PI.isValidInterfaceCall(CI))
+				return EpochInstsSet.empty();
+			if(FI.isValidInterfaceCall(CI))
+				return false;
+			if(isa<IntrinsicInst>(CI) && !isa<AnyMemIntrinsic>(CI))
+				continue;
+			auto *Callee = CI->getCalledFunction();
+			if(!Callee || !Callee->onlyReadsMemory())
+				return false;
+		}
+		VisitedSet.insert(BB);
+		BB = BB->getSinglePredecessor();
+		if(!BB || VisitedSet.count(BB))
+			return false;
+		It = BB->rbegin();
+	}
+}
+
+// Get the range of a store or of a flush with a constant length, as an offset
+// from a base pointer
+static bool GetConstantRange(Instruction *I, PMInterfaces<> &PMI,
+		Value *&Base, int64_t &Start, int64_t &End) {
+	const DataLayout &DL = I->getModule()->getDataLayout();
+	if(auto *SI = dyn_cast<StoreInst>(I)) {
+		Base = GetPointerBaseWithConstantOffset(SI->getPointerOperand(), Start, DL);
+		End = Start + DL.getTypeStoreSize(SI->getValueOperand()->getType());
+		return true;
+	}
+
+	auto &FI = PMI.getFlushInterface();
+	auto &PI = PMI.getPersistInterface();
+	auto *CI = dyn_cast<CallInst>(I);
+	if(!CI)
+		return false;
+	Value *FlushAddr = nullptr;
+	Value *FlushLen = nullptr;
+	if(FI.isValidInterfaceCall(CI)) {
+		FlushAddr = FI.getPMemAddrOperand(CI);
+		FlushLen = FI.getPMemLenOperand(CI);
+	} else if(PI.isValidInterfaceCall(CI)) {
+		FlushAddr = PI.getPMemAddrOperand(CI);
+		FlushLen = PI.getPMemLenOperand(CI);
+	}
+	auto *FlushLenConst = dyn_cast_or_null<ConstantInt>(FlushLen);
+	if(!FlushAddr || !FlushLenConst)
+		return false;
+	Base = GetPointerBaseWithConstantOffset(FlushAddr, Start, DL);
+	End = Start + (int64_t)FlushLenConst->getZExtValue();
+	return true;
+}
+
+// Decide the writes and flushes between two fences in straight-line code. They
+// are flagged if the writes have no flushes or the flushes have no writes,
+// which is what the temporary record reports. They are verified only if the
+// runtime would find nothing wrong with them byte for byte. So the writes must
+// be stores that do not overlap, at constant offsets from one pointer, and
+// every run of adjacent stores must be flushed by exactly one flush of the same
+// range after all of them. Everything else is left to the runtime.
+static SerialInstsSetStatus ClassifyWritesAndFlushes(const SerialInstsSet<> &SW,
+		const SerialInstsSet<> &SF, Instruction *EndFence, DominatorTree &DT,
+		PMInterfaces<> &PMI) {
+	if(!SW.size() && !SF.size())
+		return NeedsRuntimeCheck;
+	if(!IsStraightLineEpoch(SW, SF, EndFence, PMI))
+		return NeedsRuntimeCheck;
+	if(!SW.size() || !SF.size())
+		return StaticallyFlagged;
+
+	struct StaticRange {
+		Instruction *I;
+		int64_t Start;
+		int64_t End;
+	};
+	Value *EpochBase = nullptr;
+	auto GetRanges = [&](const SerialInstsSet<> &SI,
+											 SmallVector<StaticRange, 8> &RangesVect) {
+		for(auto *I : SI) {
+			Value *Base;
+			int64_t Start = 0;
+			int64_t End = 0;
+			if(!GetConstantRange(I, PMI, Base, Start, End) || Start >= End)
+				return false;
+			if(EpochBase && Base != EpochBase)
+				return false;
+			EpochBase = Base;
+			RangesVect.push_back(StaticRange{I, Start, End});
+		}
+		return true;
+	};
+	SmallVector<StaticRange, 8> StoresVect;
+	SmallVector<StaticRange, 8> FlushesVect;
+	for(auto *I : SW) {
+		if(!isa<StoreInst>(I))
+			return NeedsRuntimeCheck;
+	}
+	if(!GetRanges(SW, StoresVect) || !GetRanges(SF, FlushesVect))
+		return NeedsRuntimeCheck;
+
+	auto StartsBefore = [](const StaticRange &A, const StaticRange &B) {
+		return A.Start < B.Start;
+	};
+	std::sort(StoresVect.begin(), StoresVect.end(), StartsBefore);
+	std::sort(FlushesVect.begin(), FlushesVect.end(), StartsBefore);
+
+	// Match the runs of stores with the flushes in order
+	unsigned FlushIndex = 0;
+	for(unsigned Index = 0; Index != StoresVect.size();) {
+		if(FlushIndex == FlushesVect.size())
+			return NeedsRuntimeCheck;
+		auto &Flush = FlushesVect[FlushIndex++];
+		if(StoresVect[Index].Start != Flush.Start)
+			return NeedsRuntimeCheck;
+		int64_t RunEnd = StoresVect[Index].Start;
+		for(; Index != StoresVect.size() && StoresVect[Index].Start == RunEnd; ++Index) {
+			if(!DT.dominates(StoresVect[Index].I, Flush.I))
+				return NeedsRuntimeCheck;
+			RunEnd = StoresVect[Index].End;
+		}
+		if(RunEnd != Flush.End)
+			return NeedsRuntimeCheck;
+		if(Index != StoresVect.size() && StoresVect[Index].Start < RunEnd)
+			return NeedsRuntimeCheck;
+	}
+	if(FlushIndex != FlushesVect.size())
+		return NeedsRuntimeCheck;
+	return StaticallyVerified;
+}
+
+// Mark the serial sets whose instructions were all decided at compile time so
+// that only the rest are instrumented. Most of these are in straight-line code,
+// while the sets in loops and condblock sets are left to the runtime. Fences
+// that end only decided sets are recorded too, since the runtime would find
+// nothing to check at them.
+static void ClassifySerialInstsSets(TempPersistencyRecord<> &TPR,
+		DominatorTree &DT, PMInterfaces<> &PMI,
+		SCCToInstsPairVectTy &SCCToWritesPairVect,
+		SCCToInstsPairVectTy &SCCToFlushesPairVect,
+		SmallVector<Instruction *, 4> &DecidedFencesVect) {
+	DenseMap<const Instruction *, SerialInstsSetStatus> InstToStatusMap;
+	const auto &PairVect = TPR.getWritesAndFlushes();
+	for(unsigned Index = 0; Index != PairVect.size(); ++Index) {
+		auto &SW = std::get<0>(PairVect[Index]);
+		auto &SF = std::get<1>(PairVect[Index]);
+		auto Status = ClassifyWritesAndFlushes(SW, SF, TPR.getEndFence(Index),
+				DT, PMI);
+		for(auto *I : SW)
+			InstToStatusMap[I] = Status;
+		for(auto *I : SF)
+			InstToStatusMap[I] = Status;
+	}
+
+	// A set is decided only if all of its instructions are
+	auto ClassifySet = [&](SerialInstsSet<> &SI) {
+		if(!SI.size())
+			return;
+		auto SetStatus = StaticallyVerified;
+		for(auto *I : SI) {
+			auto It = InstToStatusMap.find(I);
+			if(It == InstToStatusMap.end() || (*It).second == NeedsRuntimeCheck)
+				return;
+			if((*It).second == StaticallyFlagged)
+				SetStatus = StaticallyFlagged;
+		}
+		SI.setStatus(SetStatus);
+	};
+	DenseSet<const Instruction *> RuntimeInstsSet;
+	for(auto *InstsPairVect : {&SCCToWritesPairVect, &SCCToFlushesPairVect}) {
+		for(auto &Pair : *InstsPairVect) {
+			auto &SI = std::get<1>(Pair);
+			ClassifySet(SI);
+			if(SI.needsRuntimeCheck())
+				RuntimeInstsSet.insert(SI.begin(), SI.end());
+		}
+	}
+
+	// The fence can go unchecked if nothing before it is left to the runtime
+	for(unsigned Index = 0; Index != PairVect.size(); ++Index) {
+		auto &SW = std::get<0>(PairVect[Index]);
+		auto &SF = std::get<1>(PairVect[Index]);
+		if(!SW.size() && !SF.size())
+			continue;
+		bool Decided = true;
+		for(auto *I : SW)
+			Decided &= !RuntimeInstsSet.count(I);
+		for(auto *I : SF)
+			Decided &= !RuntimeInstsSet.count(I);
+		if(Decided)
+			DecidedFencesVect.push_back(TPR.getEndFence(Index));
+	}
+}
+
 static void PopulateSerialInstsInfo(Function *F, GenCondBlockSetLoopInfo &GI,
 		DominatorTree &DT, AAResults &AA,
 		TargetLibraryInfo &TLI,
@@ -794,6 +1014,7 @@ static void PopulateSerialInstsInfo(Function *F, GenCondBlockSetLoopInfo &GI,
 		SmallVector<Instruction *, 4> &RetsVect,
 		SmallVector<Instruction *, 4> &CallsVect,
 		SmallVector<Instruction *, 4> &FencesVect,
+		SmallVector<Instruction *, 4> &DecidedFencesVect,
 		PMInterfaces<> &PMI,
 		PerfCheckerInfo<> &WritePCI,
 		PerfCheckerInfo<> &FlushPCI) {
@@ -943,6 +1164,10 @@ static void PopulateSerialInstsInfo(Function *F, GenCondBlockSetLoopInfo &GI,
 	// print all of them.
 	TPR.printRecord();
 
+	// Only the sets that could not be decided above need to be checked at runtime
+	ClassifySerialInstsSets(TPR, DT, PMI, SCCToWritesPairVect,
+			SCCToFlushesPairVect, DecidedFencesVect);
+
 	// Record all the serial persist instructions sets
 	for(auto &Pair : SCCToWritesPairVect)
 		WritePCI.addSerialInstsSet(F, std::get<1>(Pair));
@@ -981,7 +1206,7 @@ INITIALIZE_PASS_DEPENDENCY(AAResultsWrapperPass)
 		auto &TLI = getAnalysis<TargetLibraryInfoWrapperPass>().getTLI();
 
 		PopulateSerialInstsInfo(&F, GI, DT, AA, TLI, GlobalVarVect, RetsVectMap[&F],
-				CallsVectMap[&F], FencesVectMap[&F], PMI,
+				CallsVectMap[&F], FencesVectMap[&F], DecidedFencesVectMap[&F], PMI,
 				WritePCI, FlushPCI);
 		errs() << "PRINTING WRITES:\n";
 		WritePCI.printFuncToSerialInstsSetMap();
@@ -1024,7 +1249,7 @@ bool ModelVerifierPass::runOnFunction(Function &F) {
 	auto &TLI = getAnalysis<TargetLibraryInfoWrapperPass>().getTLI();
 
 	PopulateSerialInstsInfo(&F, GI, DT, AA, TLI, GlobalVarVect, RetsVectMap[&F],
-			CallsVectMap[&F], FencesVectMap[&F], PMI,
+			CallsVectMap[&F], FencesVectMap[&F], DecidedFencesVectMap[&F], PMI,
 			WritePCI, FlushPCI);
 	errs() << "PRINTING WRITES:\n";
 	WritePCI.printFuncToSerialInstsSetMap();
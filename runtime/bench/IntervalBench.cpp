@@ -0,0 +1,346 @@
+//=========================== Interval Set Benchmarks ========================//
+//
+//============================================================================//
+//
+// This measures the interval sets and the op records of PMCheck runtime on the
+// access patterns persistent memory programs produce. For every set, pattern and
+// size it reports the time and the heap allocations per operation.
+//
+// Patterns:
+//   sequential   appends to a log, so every write extends the previous one
+//   strided      writes to one field of consecutive records
+//   random       small writes to random addresses
+//   overlapping  writes that mostly overlap earlier writes
+//
+// Operations:
+//   insert       inserting all the intervals into a new set
+//   epoch        inserting the intervals into a set cleared at every fence
+//   search<F/T>  searching for every interval in a full set
+//   details      getSearchDetails for every interval in a full set
+//   remove<F/T>  removing every interval from a full set
+//   intervals    getIntervals of a full set, per interval returned
+//   record       OpRecord::insert of every interval and clear at every fence
+//   lookup       OpRecord::getIdAndContextAndTimeStampFor every interval
+//
+//============================================================================//
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "IntervalTree.h"
+#include "FlatIntervalSet.h"
+#include "OpRecord.h"
+
+// Number of operations every measurement aims for, so small sizes are repeated
+#define BENCH_TARGET_OPS ((uint64_t)1 << 20)
+
+// Inserting random intervals into the sorted array moves half of it on average,
+// so larger sizes of that would take hours.
+#define FLAT_RANDOM_MAX_SIZE ((uint64_t)1 << 16)
+
+// Removing from the front of the sorted array moves all of it, so sets of a
+// million intervals take long to run and are only measured when asked for.
+#define DEFAULT_MAX_SIZE ((uint64_t)1 << 16)
+
+// Number of copies of a set made ahead of timing removals from them
+#define REMOVE_CHUNK_SIZE 4096
+
+// Count the heap allocations of the benchmarks. All allocations of the standard
+// library go through malloc as well.
+static uint64_t NumAllocations;
+
+extern "C" {
+void *__libc_malloc(size_t Size);
+void *__libc_calloc(size_t Num, size_t Size);
+void *__libc_realloc(void *Ptr, size_t Size);
+
+void *malloc(size_t Size) {
+	NumAllocations++;
+	return __libc_malloc(Size);
+}
+
+void *calloc(size_t Num, size_t Size) {
+	NumAllocations++;
+	return __libc_calloc(Num, Size);
+}
+
+void *realloc(void *Ptr, size_t Size) {
+	NumAllocations++;
+	return __libc_realloc(Ptr, Size);
+}
+}
+
+// Results are added to this so the compiler cannot drop the operations
+static volatile uint64_t Sink;
+
+enum PatternKind {
+	SequentialPattern,
+	StridedPattern,
+	RandomPattern,
+	OverlappingPattern
+};
+
+static const char *getPatternName(PatternKind Pattern) {
+	switch(Pattern) {
+		case SequentialPattern:
+			return "sequential";
+		case StridedPattern:
+			return "strided";
+		case RandomPattern:
+			return "random";
+		case OverlappingPattern:
+			return "overlapping";
+	}
+	return "unknown";
+}
+
+struct BenchInterval {
+	uint64_t Start;
+	uint64_t End;
+};
+
+static std::vector<BenchInterval> makePattern(PatternKind Pattern, uint64_t Size) {
+	std::vector<BenchInterval> IntervalsVect(Size);
+	std::mt19937_64 Random(Size * 4 + Pattern);
+	for(uint64_t Index = 0; Index != Size; ++Index) {
+		auto &I = IntervalsVect[Index];
+		switch(Pattern) {
+			case SequentialPattern:
+				I.Start = Index * 64;
+				I.End = I.Start + 64;
+				break;
+
+			case StridedPattern:
+				I.Start = Index * 256 + 16;
+				I.End = I.Start + 8;
+				break;
+
+			case RandomPattern:
+				I.Start = (Random() % (Size * 1024)) & ~(uint64_t)7;
+				I.End = I.Start + 8;
+				break;
+
+			case OverlappingPattern:
+				I.Start = Random() % (Size * 4 + 64);
+				I.End = I.Start + 64;
+				break;
+		}
+	}
+	return IntervalsVect;
+}
+
+// Time and allocations of some operations, which may be measured in parts
+class Measurement {
+	std::chrono::steady_clock::time_point StartTime;
+	uint64_t StartAllocations;
+	uint64_t Nanoseconds;
+	uint64_t Allocations;
+	uint64_t NumOps;
+
+public:
+	Measurement() : StartAllocations(0), Nanoseconds(0), Allocations(0), NumOps(0) {}
+
+	void start() {
+		StartAllocations = NumAllocations;
+		StartTime = std::chrono::steady_clock::now();
+	}
+
+	void stop(uint64_t Ops) {
+		auto EndTime = std::chrono::steady_clock::now();
+		Allocations += NumAllocations - StartAllocations;
+		Nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+																						EndTime - StartTime).count();
+		NumOps += Ops;
+	}
+
+	void print(const char *SetName, PatternKind Pattern, uint64_t Size, const char *Op) const {
+		std::cout << std::left << std::setw(27) << SetName << std::setw(13)
+							<< getPatternName(Pattern) << std::right << std::setw(9) << Size
+							<< "  " << std::left << std::setw(12) << Op << std::right << std::fixed
+							<< std::setprecision(1) << std::setw(12)
+							<< (NumOps ? (double)Nanoseconds / NumOps : 0) << std::setprecision(3)
+							<< std::setw(12) << (NumOps ? (double)Allocations / NumOps : 0) << std::endl;
+	}
+};
+
+static uint64_t getRepetitions(uint64_t Size) {
+	return std::max<uint64_t>(1, BENCH_TARGET_OPS / Size);
+}
+
+template<typename SetTy>
+static void fillSet(SetTy &Set, const std::vector<BenchInterval> &IntervalsVect) {
+	for(auto &I : IntervalsVect)
+		Sink += Set.insert(I.Start, I.End).getOverlapResult();
+}
+
+template<typename SetTy, bool SearchInParts>
+static void benchSearch(const char *SetName, PatternKind Pattern, const SetTy &Set,
+												const std::vector<BenchInterval> &IntervalsVect, const char *Op) {
+	Measurement M;
+	uint64_t Reps = getRepetitions(IntervalsVect.size());
+	M.start();
+	for(uint64_t Rep = 0; Rep != Reps; ++Rep) {
+		for(auto &I : IntervalsVect)
+			Sink += Set.template search<SearchInParts>(I.Start, I.End);
+	}
+	M.stop(Reps * IntervalsVect.size());
+	M.print(SetName, Pattern, IntervalsVect.size(), Op);
+}
+
+template<typename SetTy, bool SearchInParts>
+static void benchRemove(const char *SetName, PatternKind Pattern, const SetTy &Set,
+												const std::vector<BenchInterval> &IntervalsVect, const char *Op) {
+	Measurement M;
+	uint64_t Reps = getRepetitions(IntervalsVect.size());
+
+// Copies of the set are made ahead in chunks, so that only the removals are timed
+	std::vector<SetTy> CopiesVect;
+	for(uint64_t Rep = 0; Rep < Reps; Rep += REMOVE_CHUNK_SIZE) {
+		CopiesVect.assign(std::min<uint64_t>(REMOVE_CHUNK_SIZE, Reps - Rep), Set);
+		M.start();
+		for(auto &Copy : CopiesVect) {
+			for(auto &I : IntervalsVect)
+				Sink += Copy.template remove<SearchInParts>(I.Start, I.End);
+		}
+		M.stop(CopiesVect.size() * IntervalsVect.size());
+	}
+	M.print(SetName, Pattern, IntervalsVect.size(), Op);
+}
+
+template<typename SetTy>
+static void benchSet(const char *SetName, PatternKind Pattern,
+										 const std::vector<BenchInterval> &IntervalsVect) {
+	uint64_t Size = IntervalsVect.size();
+	uint64_t Reps = getRepetitions(Size);
+
+	Measurement Insert;
+	Insert.start();
+	for(uint64_t Rep = 0; Rep != Reps; ++Rep) {
+		SetTy Set;
+		fillSet(Set, IntervalsVect);
+		Sink += Set.size();
+	}
+	Insert.stop(Reps * Size);
+	Insert.print(SetName, Pattern, Size, "insert");
+
+	Measurement Epoch;
+	SetTy Set;
+	Epoch.start();
+	for(uint64_t Rep = 0; Rep != Reps; ++Rep) {
+		Set.clear();
+		fillSet(Set, IntervalsVect);
+	}
+	Epoch.stop(Reps * Size);
+	Epoch.print(SetName, Pattern, Size, "epoch");
+
+	benchSearch<SetTy, false>(SetName, Pattern, Set, IntervalsVect, "search<F>");
+	benchSearch<SetTy, true>(SetName, Pattern, Set, IntervalsVect, "search<T>");
+
+	Measurement Details;
+	Details.start();
+	for(uint64_t Rep = 0; Rep != Reps; ++Rep) {
+		for(auto &I : IntervalsVect)
+			Sink += Set.getSearchDetails(I.Start, I.End).getOverlapResult();
+	}
+	Details.stop(Reps * Size);
+	Details.print(SetName, Pattern, Size, "details");
+
+	benchRemove<SetTy, false>(SetName, Pattern, Set, IntervalsVect, "remove<F>");
+	benchRemove<SetTy, true>(SetName, Pattern, Set, IntervalsVect, "remove<T>");
+
+	Measurement Intervals;
+	uint64_t IntervalsReps = getRepetitions(Set.size());
+	Intervals.start();
+	for(uint64_t Rep = 0; Rep != IntervalsReps; ++Rep)
+		Sink += Set.getIntervals().size();
+	Intervals.stop(IntervalsReps * Set.size());
+	Intervals.print(SetName, Pattern, Size, "intervals");
+}
+
+template<typename SetTy>
+static void benchOpRecord(const char *SetName, PatternKind Pattern,
+													const std::vector<BenchInterval> &IntervalsVect) {
+	uint64_t Size = IntervalsVect.size();
+	uint64_t Reps = getRepetitions(Size);
+
+	Measurement Record;
+	OpRecord<SetTy> Records;
+	Record.start();
+	for(uint64_t Rep = 0; Rep != Reps; ++Rep) {
+		Records.clear();
+		for(uint64_t Index = 0; Index != Size; ++Index) {
+			auto &I = IntervalsVect[Index];
+			Sink += Records.insert(Index % 1024, I.Start, I.End - I.Start, Index, Index % 16);
+		}
+	}
+	Record.stop(Reps * Size);
+	Record.print(SetName, Pattern, Size, "record");
+
+	Measurement Lookup;
+	Lookup.start();
+	for(uint64_t Rep = 0; Rep != Reps; ++Rep) {
+		for(auto &I : IntervalsVect)
+			Sink += Records.getIdAndContextAndTimeStampFor(I.Start, I.End).size();
+	}
+	Lookup.stop(Reps * Size);
+	Lookup.print(SetName, Pattern, Size, "lookup");
+}
+
+static void printUsage(const char *Name) {
+	std::cerr << "Usage: " << Name << " [-min <size>] [-max <size>] [-filter <set name>]\n";
+}
+
+int main(int argc, char **argv) {
+	uint64_t MinSize = 1;
+	uint64_t MaxSize = DEFAULT_MAX_SIZE;
+	const char *Filter = nullptr;
+	for(int Index = 1; Index < argc; ++Index) {
+		if(!strcmp(argv[Index], "-min") && Index + 1 < argc) {
+			MinSize = strtoull(argv[++Index], nullptr, 0);
+			continue;
+		}
+		if(!strcmp(argv[Index], "-max") && Index + 1 < argc) {
+			MaxSize = strtoull(argv[++Index], nullptr, 0);
+			continue;
+		}
+		if(!strcmp(argv[Index], "-filter") && Index + 1 < argc) {
+			Filter = argv[++Index];
+			continue;
+		}
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	std::cout << std::left << std::setw(27) << "set" << std::setw(13) << "pattern"
+						<< std::right << std::setw(9) << "size" << "  " << std::left << std::setw(12)
+						<< "op" << std::right << std::setw(12) << "ns/op" << std::setw(12)
+						<< "allocs/op" << "\n";
+	auto Enabled = [Filter](const char *SetName) {
+		return !Filter || strstr(SetName, Filter);
+	};
+	for(uint64_t Size = 1; Size <= MaxSize; Size *= 16) {
+		if(Size < MinSize)
+			continue;
+		for(auto Pattern : {SequentialPattern, StridedPattern, RandomPattern, OverlappingPattern}) {
+			auto IntervalsVect = makePattern(Pattern, Size);
+			bool FlatTooSlow = Pattern == RandomPattern && Size > FLAT_RANDOM_MAX_SIZE;
+			if(Enabled("IntervalTree"))
+				benchSet<IntervalTree<true>>("IntervalTree", Pattern, IntervalsVect);
+			if(Enabled("FlatIntervalSet") && !FlatTooSlow)
+				benchSet<FlatIntervalSet<>>("FlatIntervalSet", Pattern, IntervalsVect);
+			if(Enabled("OpRecord<IntervalTree>"))
+				benchOpRecord<IntervalTree<true, OpList>>("OpRecord<IntervalTree>", Pattern, IntervalsVect);
+			if(Enabled("OpRecord<FlatIntervalSet>") && !FlatTooSlow)
+				benchOpRecord<FlatIntervalSet<OpList>>("OpRecord<FlatIntervalSet>", Pattern, IntervalsVect);
+		}
+	}
+	return 0;
+}
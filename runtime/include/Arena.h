@@ -0,0 +1,125 @@
+//============================== Bump Arena ===================================//
+//
+// Epoch-scoped bump allocator for PMCheck runtime. Records that live only until
+// the next fence allocate from an arena, and all of their memory is released at
+// once by resetting the arena at the fence.
+//
+//=============================================================================//
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#define ARENA_CHUNK_SIZE ((uint64_t)1 << 16)
+
+class BumpArena {
+	struct Chunk {
+		char *Begin;
+		uint64_t Size;
+	};
+
+// Chunks are kept across resets so that later epochs reuse them
+	std::vector<Chunk> ChunksVect;
+	unsigned CurChunk;
+	char *Ptr;
+	char *End;
+
+	void *allocateSlow(uint64_t Size, uint64_t Align);
+
+public:
+	BumpArena() : CurChunk(0), Ptr(nullptr), End(nullptr) {}
+
+	~BumpArena() {
+		for(auto &C : ChunksVect)
+			free(C.Begin);
+	}
+
+	BumpArena(const BumpArena &) = delete;
+	BumpArena &operator=(const BumpArena &) = delete;
+
+	void *allocate(uint64_t Size, uint64_t Align) {
+		uintptr_t Aligned = ((uintptr_t)Ptr + Align - 1) & ~(uintptr_t)(Align - 1);
+		if(Ptr && Aligned + Size <= (uintptr_t)End) {
+			Ptr = (char *)(Aligned + Size);
+			return (void *)Aligned;
+		}
+		return allocateSlow(Size, Align);
+	}
+
+// Release everything allocated from the arena. This does not touch the chunks.
+	void reset() {
+		CurChunk = 0;
+		if(ChunksVect.empty())
+			return;
+		Ptr = ChunksVect[0].Begin;
+		End = Ptr + ChunksVect[0].Size;
+	}
+};
+
+inline void *BumpArena::allocateSlow(uint64_t Size, uint64_t Align) {
+// Move on to the next chunk that fits or allocate a new one
+	while(!ChunksVect.empty() && CurChunk + 1 < ChunksVect.size()) {
+		auto &C = ChunksVect[++CurChunk];
+		Ptr = C.Begin;
+		End = C.Begin + C.Size;
+		uintptr_t Aligned = ((uintptr_t)Ptr + Align - 1) & ~(uintptr_t)(Align - 1);
+		if(Aligned + Size <= (uintptr_t)End) {
+			Ptr = (char *)(Aligned + Size);
+			return (void *)Aligned;
+		}
+	}
+	uint64_t ChunkSize = ARENA_CHUNK_SIZE;
+	while(ChunkSize < Size + Align)
+		ChunkSize <<= 1;
+	Chunk C;
+	C.Begin = (char *)malloc(ChunkSize);
+	if(!C.Begin)
+		throw std::bad_alloc();
+	C.Size = ChunkSize;
+	ChunksVect.push_back(C);
+	CurChunk = ChunksVect.size() - 1;
+	Ptr = C.Begin;
+	End = C.Begin + C.Size;
+	uintptr_t Aligned = ((uintptr_t)Ptr + Align - 1) & ~(uintptr_t)(Align - 1);
+	Ptr = (char *)(Aligned + Size);
+	return (void *)Aligned;
+}
+
+// Allocator for standard containers that allocates from an arena. Deallocation
+// does nothing since the arena is reset as a whole.
+template<typename T>
+class ArenaAllocator {
+	BumpArena *Arena;
+
+	template<typename U> friend class ArenaAllocator;
+
+public:
+	typedef T value_type;
+
+	ArenaAllocator(BumpArena &Arena) : Arena(&Arena) {}
+
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U> &Other) : Arena(Other.Arena) {}
+
+	T *allocate(size_t N) {
+		return (T *)Arena->allocate(N * sizeof(T), alignof(T));
+	}
+
+	void deallocate(T *, size_t) {}
+
+	template<typename U>
+	bool operator==(const ArenaAllocator<U> &Other) const {
+		return Arena == Other.Arena;
+	}
+
+	template<typename U>
+	bool operator!=(const ArenaAllocator<U> &Other) const {
+		return Arena != Other.Arena;
+	}
+};
+
+#endif  // ARENA_H_
@@ -0,0 +1,169 @@
+//========================== Cross-thread Epoch Checker ========================//
+//
+// Checks the persist ordering of writes and flushes that are executed by
+// different threads. It consumes the merged stream of events from all threads
+// in the order of their stamps and tracks every cache line with unpersisted data.
+//
+//=============================================================================//
+
+#ifndef CROSS_THREAD_CHECKER_H_
+#define CROSS_THREAD_CHECKER_H_
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "EventLog.h"
+#include "ShadowMemory.h"
+
+struct CrossThreadFinding {
+	enum FindingKind {
+	// A thread flushes a line holding a write of another thread
+		CrossThreadFlush,
+
+	// A thread writes to a line holding an unpersisted write of another thread
+		CrossThreadOverwrite,
+
+	// A thread writes to a line after another thread flushed it but before that
+	// thread fenced, so the write is not persisted by the fence.
+		CrossThreadWriteAfterFlush
+	};
+
+	FindingKind Kind;
+	uint64_t LineAddr;
+
+// The earlier operation and the operation that exposed the problem
+	uint32_t FirstThread;
+	uint32_t FirstId;
+	uint32_t FirstContext;
+	uint32_t SecondThread;
+	uint32_t SecondId;
+	uint32_t SecondContext;
+};
+
+class CrossThreadChecker {
+	struct LineState {
+		bool Dirty;
+		bool FlushPending;
+		uint32_t Writer;
+		uint32_t WriteId;
+		uint32_t WriteContext;
+		uint32_t Flusher;
+		uint32_t FlushId;
+		uint32_t FlushContext;
+
+		LineState() : Dirty(false), FlushPending(false), Writer(0), WriteId(0),
+									WriteContext(0), Flusher(0), FlushId(0), FlushContext(0) {}
+	};
+
+// Lines with unpersisted writes or pending flushes
+	std::unordered_map<uint64_t, LineState> LinesMap;
+
+// Lines flushed by each thread since its last fence
+	std::unordered_map<uint32_t, std::vector<uint64_t>> PendingFlushesMap;
+
+	std::function<void(const CrossThreadFinding &)> Report;
+
+	void report(CrossThreadFinding::FindingKind Kind, uint64_t LineAddr,
+							uint32_t FirstThread, uint32_t FirstId, uint32_t FirstContext,
+							const PersistEvent &Event) {
+		CrossThreadFinding Finding;
+		Finding.Kind = Kind;
+		Finding.LineAddr = LineAddr;
+		Finding.FirstThread = FirstThread;
+		Finding.FirstId = FirstId;
+		Finding.FirstContext = FirstContext;
+		Finding.SecondThread = Event.Thread;
+		Finding.SecondId = Event.Id;
+		Finding.SecondContext = Event.Context;
+		Report(Finding);
+	}
+
+	void write(const PersistEvent &Event);
+
+	void flush(const PersistEvent &Event);
+
+	void fence(const PersistEvent &Event);
+
+public:
+	CrossThreadChecker(std::function<void(const CrossThreadFinding &)> Report) :
+						LinesMap(), PendingFlushesMap(), Report(Report) {}
+
+	void operator()(const PersistEvent &Event) {
+		switch(Event.Kind) {
+			case WriteEvent:
+				write(Event);
+				break;
+
+			case FlushEvent:
+				flush(Event);
+				break;
+
+			case FenceEvent:
+				fence(Event);
+				break;
+		}
+	}
+};
+
+inline void CrossThreadChecker::write(const PersistEvent &Event) {
+	uint64_t End = Event.Addr + Event.Size;
+	for(uint64_t LineAddr = Event.Addr & ~CACHE_LINE_MASK;
+			LineAddr < End; LineAddr += CACHE_LINE_SIZE) {
+		auto &Line = LinesMap[LineAddr];
+		if(Line.Dirty && Line.Writer != Event.Thread) {
+			report(CrossThreadFinding::CrossThreadOverwrite, LineAddr,
+						 Line.Writer, Line.WriteId, Line.WriteContext, Event);
+		}
+		if(Line.FlushPending && Line.Flusher != Event.Thread) {
+			report(CrossThreadFinding::CrossThreadWriteAfterFlush, LineAddr,
+						 Line.Flusher, Line.FlushId, Line.FlushContext, Event);
+		}
+
+	// The pending flush does not cover this write anymore
+		Line.Dirty = true;
+		Line.FlushPending = false;
+		Line.Writer = Event.Thread;
+		Line.WriteId = Event.Id;
+		Line.WriteContext = Event.Context;
+	}
+}
+
+inline void CrossThreadChecker::flush(const PersistEvent &Event) {
+	uint64_t End = Event.Addr + Event.Size;
+	for(uint64_t LineAddr = Event.Addr & ~CACHE_LINE_MASK;
+			LineAddr < End; LineAddr += CACHE_LINE_SIZE) {
+		auto It = LinesMap.find(LineAddr);
+		if(It == LinesMap.end() || !It->second.Dirty)
+			continue;
+		auto &Line = It->second;
+		if(Line.Writer != Event.Thread) {
+			report(CrossThreadFinding::CrossThreadFlush, LineAddr,
+						 Line.Writer, Line.WriteId, Line.WriteContext, Event);
+		}
+		Line.FlushPending = true;
+		Line.Flusher = Event.Thread;
+		Line.FlushId = Event.Id;
+		Line.FlushContext = Event.Context;
+		PendingFlushesMap[Event.Thread].push_back(LineAddr);
+	}
+}
+
+inline void CrossThreadChecker::fence(const PersistEvent &Event) {
+// The lines this thread flushed are persisted now unless they were written again
+	auto It = PendingFlushesMap.find(Event.Thread);
+	if(It == PendingFlushesMap.end())
+		return;
+	for(auto LineAddr : It->second) {
+		auto LineIt = LinesMap.find(LineAddr);
+		if(LineIt == LinesMap.end())
+			continue;
+		auto &Line = LineIt->second;
+		if(Line.FlushPending && Line.Flusher == Event.Thread)
+			LinesMap.erase(LineIt);
+	}
+	It->second.clear();
+}
+
+#endif  // CROSS_THREAD_CHECKER_H_
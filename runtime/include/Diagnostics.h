@@ -0,0 +1,210 @@
+//============================ Diagnostic Sink =================================//
+//
+// Collects the findings of PMCheck runtime instead of terminating the program at
+// the first one. Findings are deduplicated by the instruction, its calling context
+// and the kind of finding. Every distinct finding keeps the message of its first
+// occurrence, the time it was first seen and how often it occurred.
+//
+//=============================================================================//
+
+#ifndef DIAGNOSTICS_H_
+#define DIAGNOSTICS_H_
+
+#include <cstdint>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum DiagnosticKind : uint32_t {
+	OverlappingWrite,
+	StrictPersistencyViolation,
+	UnflushedWrite,
+	PartiallyFlushedWrite,
+	FlushBeforeWrite,
+	RedundantFlush,
+	PartiallyRedundantFlush,
+	MergeableFlushes,
+	RedundantFence,
+	CrossThreadFlushFinding,
+	CrossThreadOverwriteFinding,
+	CrossThreadWriteAfterFlushFinding
+};
+
+static inline const char *getDiagnosticKindName(DiagnosticKind Kind) {
+	switch(Kind) {
+		case OverlappingWrite:
+			return "overlapping write";
+		case StrictPersistencyViolation:
+			return "strict persistency violation";
+		case UnflushedWrite:
+			return "unflushed write";
+		case PartiallyFlushedWrite:
+			return "partially flushed write";
+		case FlushBeforeWrite:
+			return "flush before write";
+		case RedundantFlush:
+			return "redundant flush";
+		case PartiallyRedundantFlush:
+			return "partially redundant flush";
+		case MergeableFlushes:
+			return "mergeable flushes";
+		case RedundantFence:
+			return "redundant fence";
+		case CrossThreadFlushFinding:
+			return "cross-thread flush";
+		case CrossThreadOverwriteFinding:
+			return "cross-thread overwrite";
+		case CrossThreadWriteAfterFlushFinding:
+			return "cross-thread write after flush";
+	}
+	return "unknown";
+}
+
+class DiagnosticSink;
+
+// Builds the message of a finding. Messages are only built for the first
+// occurrence of a finding, so repeated findings cost a lookup only.
+class DiagnosticBuilder {
+	DiagnosticSink *Sink;
+	uint64_t Index;
+	std::ostringstream *Stream;
+
+public:
+	DiagnosticBuilder(DiagnosticSink *Sink, uint64_t Index) :
+						Sink(Sink), Index(Index),
+						Stream(Sink ? new std::ostringstream() : nullptr) {}
+
+	DiagnosticBuilder(DiagnosticBuilder &&Other) :
+						Sink(Other.Sink), Index(Other.Index), Stream(Other.Stream) {
+		Other.Sink = nullptr;
+		Other.Stream = nullptr;
+	}
+
+	DiagnosticBuilder(const DiagnosticBuilder &) = delete;
+	DiagnosticBuilder &operator=(const DiagnosticBuilder &) = delete;
+
+	~DiagnosticBuilder();
+
+	template<typename T>
+	DiagnosticBuilder &operator<<(const T &Value) {
+		if(Stream)
+			*Stream << Value;
+		return *this;
+	}
+};
+
+class DiagnosticSink {
+	struct DiagnosticKey {
+		uint32_t Id;
+		uint32_t Context;
+		DiagnosticKind Kind;
+
+		bool operator==(const DiagnosticKey &Other) const {
+			return Id == Other.Id && Context == Other.Context && Kind == Other.Kind;
+		}
+	};
+
+	struct DiagnosticKeyHash {
+		size_t operator()(const DiagnosticKey &Key) const {
+			uint64_t Value = ((uint64_t)Key.Id << 32) | Key.Context;
+			return std::hash<uint64_t>()(Value * 31 + Key.Kind);
+		}
+	};
+
+	struct Diagnostic {
+		DiagnosticKey Key;
+		uint64_t Count;
+		uint64_t FirstSeen;
+		std::string Message;
+	};
+
+// Findings in the order they were first seen
+	std::vector<Diagnostic> DiagnosticsVect;
+	std::unordered_map<DiagnosticKey, uint64_t, DiagnosticKeyHash> DiagnosticsMap;
+	uint64_t NumOccurrences;
+	std::chrono::steady_clock::time_point StartTime;
+	mutable std::mutex DiagnosticsMutex;
+
+	friend class DiagnosticBuilder;
+
+	void setMessage(uint64_t Index, const std::string &Message) {
+		std::lock_guard<std::mutex> Lock(DiagnosticsMutex);
+		DiagnosticsVect[Index].Message = Message;
+	}
+
+public:
+	DiagnosticSink() : NumOccurrences(0), StartTime(std::chrono::steady_clock::now()) {}
+
+// Count a finding. The message streamed into the returned builder is kept if
+// this is the first time the finding is seen and dropped otherwise.
+	DiagnosticBuilder report(DiagnosticKind Kind, uint32_t Id, uint32_t Context) {
+		std::lock_guard<std::mutex> Lock(DiagnosticsMutex);
+		NumOccurrences++;
+		DiagnosticKey Key;
+		Key.Id = Id;
+		Key.Context = Context;
+		Key.Kind = Kind;
+		auto It = DiagnosticsMap.find(Key);
+		if(It != DiagnosticsMap.end()) {
+			DiagnosticsVect[It->second].Count++;
+			return DiagnosticBuilder(nullptr, 0);
+		}
+		Diagnostic Diag;
+		Diag.Key = Key;
+		Diag.Count = 1;
+		Diag.FirstSeen = std::chrono::duration_cast<std::chrono::microseconds>(
+											std::chrono::steady_clock::now() - StartTime).count();
+		DiagnosticsMap.insert(std::make_pair(Key, DiagnosticsVect.size()));
+		DiagnosticsVect.push_back(Diag);
+		return DiagnosticBuilder(this, DiagnosticsVect.size() - 1);
+	}
+
+	bool empty() const {
+		std::lock_guard<std::mutex> Lock(DiagnosticsMutex);
+		return DiagnosticsVect.empty();
+	}
+
+	void printSummary(std::ostream &OS) const {
+		printSummary(OS, 0, 0);
+	}
+
+// If only some of the epochs were checked, the occurrences in all the epochs are
+// estimated from the ones in the checked epochs as well.
+	void printSummary(std::ostream &OS, uint64_t NumCheckedEpochs, uint64_t NumEpochs) const {
+		std::lock_guard<std::mutex> Lock(DiagnosticsMutex);
+		bool Sampled = NumCheckedEpochs && NumCheckedEpochs < NumEpochs;
+		double Scale = Sampled ? (double)NumEpochs / NumCheckedEpochs : 1;
+		OS << "PMCheck found " << DiagnosticsVect.size() << " distinct issues in "
+			 << NumOccurrences << " occurrences";
+		if(Sampled) {
+			OS << " in " << NumCheckedEpochs << " of " << NumEpochs << " epochs, about "
+				 << (uint64_t)(NumOccurrences * Scale + 0.5) << " occurrences in all epochs";
+		}
+		OS << ".\n";
+		for(auto &Diag : DiagnosticsVect) {
+			OS << "[" << getDiagnosticKindName(Diag.Key.Kind) << "] seen " << Diag.Count
+				 << " times";
+			if(Sampled)
+				OS << " (about " << (uint64_t)(Diag.Count * Scale + 0.5) << " in all epochs)";
+			OS << ", first after " << Diag.FirstSeen / 1000000 << "."
+				 << std::setfill('0') << std::setw(3) << (Diag.FirstSeen % 1000000) / 1000
+				 << std::setfill(' ') << "s: " << Diag.Message;
+			if(Diag.Message.empty() || Diag.Message.back() != '\n')
+				OS << "\n";
+		}
+	}
+};
+
+inline DiagnosticBuilder::~DiagnosticBuilder() {
+	if(!Sink)
+		return;
+	Sink->setMessage(Index, Stream->str());
+	delete Stream;
+}
+
+#endif  // DIAGNOSTICS_H_
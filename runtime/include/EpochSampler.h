@@ -0,0 +1,107 @@
+//============================== Epoch Sampler ================================//
+//
+// Chooses the fence epochs PMCheck runtime checks when it only checks a sample
+// of them. Either every Nth epoch of a thread is checked, or every epoch is
+// checked with a given probability. Random choices are seeded with a fixed seed
+// and the index of the thread, so runs of the same program sample the same
+// epochs of every thread.
+//
+//=============================================================================//
+
+#ifndef EPOCH_SAMPLER_H_
+#define EPOCH_SAMPLER_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#define DEFAULT_SAMPLING_SEED 0x5eed
+
+struct SamplingPolicy {
+	enum PolicyKind {
+		CheckAll,
+		CheckEveryNth,
+		CheckRandom
+	};
+
+	PolicyKind Kind;
+	uint64_t Period;
+
+// Probability of checking an epoch, scaled to 2^32
+	uint64_t Threshold;
+	uint64_t Seed;
+
+	SamplingPolicy() : Kind(CheckAll), Period(1), Threshold(0), Seed(DEFAULT_SAMPLING_SEED) {}
+
+	bool enabled() const {
+		return Kind != CheckAll;
+	}
+
+// Policies are either "N" to check every Nth epoch or "P%" to check P percent
+// of the epochs. Anything else checks all the epochs.
+	static SamplingPolicy parse(const char *Policy, const char *Seed) {
+		SamplingPolicy SP;
+		if(!Policy || !*Policy)
+			return SP;
+		char *End = nullptr;
+		if(Seed && *Seed)
+			SP.Seed = strtoull(Seed, nullptr, 0);
+		if(Policy[strlen(Policy) - 1] == '%') {
+			double Percent = strtod(Policy, &End);
+			if(*End != '%' || Percent <= 0 || Percent >= 100)
+				return SP;
+			SP.Kind = CheckRandom;
+			SP.Threshold = (uint64_t)(Percent / 100 * ((uint64_t)1 << 32));
+			return SP;
+		}
+		uint64_t Period = strtoull(Policy, &End, 10);
+		if(*End || Period <= 1)
+			return SP;
+		SP.Kind = CheckEveryNth;
+		SP.Period = Period;
+		return SP;
+	}
+};
+
+// Sampling state of a thread
+class EpochSampler {
+	const SamplingPolicy *Policy;
+	uint64_t Epoch;
+	uint64_t State;
+	bool Checked;
+
+	uint64_t nextRandom() {
+	// splitmix64
+		uint64_t Value = (State += 0x9e3779b97f4a7c15ULL);
+		Value = (Value ^ (Value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		Value = (Value ^ (Value >> 27)) * 0x94d049bb133111ebULL;
+		return Value ^ (Value >> 31);
+	}
+
+	bool choose() {
+		if(Policy->Kind == SamplingPolicy::CheckEveryNth)
+			return !(Epoch % Policy->Period);
+		if(Policy->Kind == SamplingPolicy::CheckRandom)
+			return (nextRandom() >> 32) < Policy->Threshold;
+		return true;
+	}
+
+public:
+	EpochSampler(const SamplingPolicy &Policy, uint32_t Thread) :
+						Policy(&Policy), Epoch(0), State(Policy.Seed ^ ((uint64_t)Thread << 32)),
+						Checked(false) {
+		Checked = choose();
+	}
+
+	bool isChecked() const {
+		return Checked;
+	}
+
+// Move on to the next epoch of the thread
+	void nextEpoch() {
+		Epoch++;
+		Checked = choose();
+	}
+};
+
+#endif  // EPOCH_SAMPLER_H_
@@ -0,0 +1,283 @@
+//=========================== Per-thread Event Logs ============================//
+//
+// Lock-free per-thread logs of persist operations for PMCheck runtime. Every
+// application thread appends its writes, flushes and fences to its own single
+// producer single consumer ring buffer. A merger thread combines the buffers
+// into one stream ordered by a global clock.
+//
+//=============================================================================//
+
+#ifndef EVENT_LOG_H_
+#define EVENT_LOG_H_
+
+#include <sched.h>
+#include <stdlib.h>
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+enum PersistEventKind : uint32_t {
+	WriteEvent,
+	FlushEvent,
+	FenceEvent
+};
+
+struct PersistEvent {
+	uint64_t Stamp;
+	uint64_t Addr;
+	uint64_t Size;
+	uint32_t Id;
+	uint32_t Context;
+	uint32_t Thread;
+	PersistEventKind Kind;
+};
+
+// Clock shared by all threads. Every event takes a unique stamp from it.
+class EventClock {
+	alignas(64) std::atomic<uint64_t> Clock;
+
+public:
+	EventClock() : Clock(1) {}
+
+	uint64_t tick() {
+		return Clock.fetch_add(1, std::memory_order_seq_cst);
+	}
+
+	uint64_t now() const {
+		return Clock.load(std::memory_order_seq_cst);
+	}
+};
+
+class ThreadEventLog {
+	PersistEvent *Events;
+	uint64_t Mask;
+	uint32_t Thread;
+
+// Index of the next event the merger reads. Only the merger writes this.
+	alignas(64) std::atomic<uint64_t> Head;
+
+// Index of the next event the thread appends. Only the thread writes this.
+	alignas(64) std::atomic<uint64_t> Tail;
+
+// Producer side copy of the head so that the thread rarely reads the merger's line
+	uint64_t CachedHead;
+
+// Set while the thread has taken a stamp but has not published the event yet.
+// The merger cannot order events past a thread in this state.
+	std::atomic<uint32_t> InFlight;
+
+// Set when the thread exits. The merger frees the log once it is drained.
+	std::atomic<bool> Finished;
+
+	ThreadEventLog(uint32_t Thread, uint64_t Capacity) :
+						Events(new PersistEvent[Capacity]), Mask(Capacity - 1),
+						Thread(Thread), Head(0), Tail(0), CachedHead(0),
+						InFlight(0), Finished(false) {}
+
+	~ThreadEventLog() {
+		delete[] Events;
+	}
+
+public:
+// The head and the tail are aligned to cache lines, which plain new does not
+// respect before C++17, so logs are only created and destroyed through these.
+	static ThreadEventLog *create(uint32_t Thread, uint64_t Capacity) {
+		void *Mem;
+		if(posix_memalign(&Mem, alignof(ThreadEventLog), sizeof(ThreadEventLog)))
+			throw std::bad_alloc();
+		return new (Mem) ThreadEventLog(Thread, Capacity);
+	}
+
+	static void destroy(ThreadEventLog *Log) {
+		Log->~ThreadEventLog();
+		free(Log);
+	}
+
+	ThreadEventLog(const ThreadEventLog &) = delete;
+	ThreadEventLog &operator=(const ThreadEventLog &) = delete;
+
+// Called by the owning thread only. This never takes a lock. If the merger falls
+// a whole buffer behind, the thread spins until it catches up.
+	void append(EventClock &Clock, PersistEventKind Kind, uint32_t Id,
+							uint64_t Addr, uint64_t Size, uint32_t Context) {
+		InFlight.store(1, std::memory_order_seq_cst);
+		uint64_t Stamp = Clock.tick();
+		uint64_t CurTail = Tail.load(std::memory_order_relaxed);
+		if(CurTail - CachedHead > Mask) {
+			CachedHead = Head.load(std::memory_order_acquire);
+			while(CurTail - CachedHead > Mask) {
+				sched_yield();
+				CachedHead = Head.load(std::memory_order_acquire);
+			}
+		}
+		auto &Event = Events[CurTail & Mask];
+		Event.Stamp = Stamp;
+		Event.Addr = Addr;
+		Event.Size = Size;
+		Event.Id = Id;
+		Event.Context = Context;
+		Event.Thread = Thread;
+		Event.Kind = Kind;
+		Tail.store(CurTail + 1, std::memory_order_release);
+		InFlight.store(0, std::memory_order_release);
+	}
+
+	void finish() {
+		Finished.store(true, std::memory_order_release);
+	}
+
+// The rest is used by the merger only
+	bool isFinished() const {
+		return Finished.load(std::memory_order_acquire);
+	}
+
+	bool isInFlight() const {
+		return InFlight.load(std::memory_order_seq_cst);
+	}
+
+	bool empty() const {
+		return Head.load(std::memory_order_relaxed) == Tail.load(std::memory_order_acquire);
+	}
+
+	const PersistEvent &front() const {
+		return Events[Head.load(std::memory_order_relaxed) & Mask];
+	}
+
+	void pop() {
+		Head.store(Head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+};
+
+// Merges the per-thread logs into a single stream ordered by stamps and hands
+// every event to the consumer in that order.
+template<typename ConsumerTy>
+class EventLogMerger {
+	EventClock Clock;
+	ConsumerTy &Consumer;
+	uint64_t LogCapacity;
+
+// Logs of all threads. Threads only take this lock when they start.
+	std::vector<ThreadEventLog *> LogsVect;
+	std::mutex LogsMutex;
+	uint32_t NumThreads;
+
+	std::thread MergerThread;
+	std::atomic<bool> Stop;
+
+	bool mergeAvailable();
+
+	void run() {
+		while(!Stop.load(std::memory_order_acquire)) {
+			if(!mergeAvailable())
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
+	// Application threads are done at this point, so drain everything
+		while(mergeAvailable());
+	}
+
+public:
+	EventLogMerger(ConsumerTy &Consumer, uint64_t LogCapacity) :
+						Consumer(Consumer), LogCapacity(LogCapacity),
+						NumThreads(0), Stop(false) {}
+
+	~EventLogMerger() {
+		stop();
+		for(auto *Log : LogsVect)
+			ThreadEventLog::destroy(Log);
+	}
+
+	void start() {
+		MergerThread = std::thread(&EventLogMerger::run, this);
+	}
+
+	void stop() {
+		if(!MergerThread.joinable())
+			return;
+		Stop.store(true, std::memory_order_release);
+		MergerThread.join();
+	}
+
+	EventClock &getClock() {
+		return Clock;
+	}
+
+	ThreadEventLog *registerThread() {
+		std::lock_guard<std::mutex> Lock(LogsMutex);
+		auto *Log = ThreadEventLog::create(NumThreads++, LogCapacity);
+		LogsVect.push_back(Log);
+		return Log;
+	}
+};
+
+// Pass events to the consumer for as long as it is safe to do so. An event is
+// safe once no thread can still publish an event with a smaller stamp. Returns
+// false if no event could be merged.
+template<typename ConsumerTy>
+bool EventLogMerger<ConsumerTy>::mergeAvailable() {
+	std::vector<ThreadEventLog *> CurLogsVect;
+	{
+		std::lock_guard<std::mutex> Lock(LogsMutex);
+		CurLogsVect = LogsVect;
+	}
+
+// Any event published later by a thread that is idle now has a stamp larger
+// than this, because the thread has to tick the clock first. A log is checked
+// for a stamp in flight before it is checked for being empty, or an event
+// published in between could be missed.
+	uint64_t IdleBound = Clock.now();
+	std::vector<ThreadEventLog *> ActiveLogsVect;
+	for(auto *Log : CurLogsVect) {
+		bool InFlight = Log->isInFlight();
+		if(!Log->empty()) {
+			ActiveLogsVect.push_back(Log);
+			continue;
+		}
+		if(InFlight) {
+		// The thread holds a stamp we have not seen yet
+			return false;
+		}
+	}
+
+	bool Merged = false;
+	while(!ActiveLogsVect.empty()) {
+	// Pick the log with the smallest stamp at its front
+		unsigned MinIndex = 0;
+		for(unsigned Index = 1; Index != ActiveLogsVect.size(); ++Index) {
+			if(ActiveLogsVect[Index]->front().Stamp < ActiveLogsVect[MinIndex]->front().Stamp)
+				MinIndex = Index;
+		}
+		auto *Log = ActiveLogsVect[MinIndex];
+		if(Log->front().Stamp >= IdleBound)
+			break;
+		Consumer(Log->front());
+		Log->pop();
+		Merged = true;
+
+	// Once a log runs dry, the thread may be about to publish an earlier stamp
+		if(Log->empty()) {
+			if(Log->isInFlight())
+				break;
+			if(Log->empty())
+				ActiveLogsVect.erase(ActiveLogsVect.begin() + MinIndex);
+		}
+	}
+
+// Free the logs of the threads that exited once they are drained
+	std::lock_guard<std::mutex> Lock(LogsMutex);
+	for(auto It = LogsVect.begin(); It != LogsVect.end();) {
+		if((*It)->isFinished() && (*It)->empty()) {
+			ThreadEventLog::destroy(*It);
+			It = LogsVect.erase(It);
+			continue;
+		}
+		++It;
+	}
+	return Merged;
+}
+
+#endif  // EVENT_LOG_H_
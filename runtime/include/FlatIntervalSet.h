@@ -0,0 +1,410 @@
+//========================= Flat Interval Set ==================================//
+//
+// Interval set for PMCheck runtime that keeps disjoint intervals in a sorted
+// array. It has the same interface and results as the interval tree, but lookups
+// are binary searches over contiguous memory. This is much faster than walking
+// the tree for small sets. Inserts and removals move the intervals after them,
+// so the runtime only records with it when PMCHECK_FLAT_INTERVAL_SET is defined.
+//
+// Like the nodes of the tree, the intervals can carry a payload, which is merged
+// and split along with them.
+//
+//=============================================================================//
+
+#ifndef FLAT_INTERVAL_SET_H_
+#define FLAT_INTERVAL_SET_H_
+
+#include <cstdint>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <utility>
+#include <type_traits>
+
+#include "IntervalTree.h"
+#include "PayloadList.h"
+
+template<typename PayloadTy = NoPayload>
+class FlatIntervalSet {
+// Intervals without a payload take no space for it
+	struct Interval : public PayloadTy {
+		uint64_t Start;
+		uint64_t End;
+
+		PayloadTy &payload() {
+			return *this;
+		}
+
+		const PayloadTy &payload() const {
+			return *this;
+		}
+	};
+
+	typedef typename std::vector<Interval>::iterator IntervalIterator;
+	typedef typename std::vector<Interval>::const_iterator ConstIntervalIterator;
+
+// Disjoint intervals sorted by their start, and so by their end as well
+	std::vector<Interval> IntervalsVect;
+
+// Intervals looked at by all the lookups so far, for profiling
+	mutable uint64_t NumNodesVisited;
+
+// Payloads that do not fit in the intervals. It is released when the set is cleared.
+	BumpArena PayloadArena;
+
+// Payloads of the intervals before the last removal changed them, in the order of
+// the previous node ranges of its result
+	std::vector<PayloadTy> PreviousPayloadsVect;
+
+// Results refer to the intervals by their position plus one, since zero means
+// the interval was removed.
+	uint32_t indexOf(ConstIntervalIterator It) const {
+		return (It - IntervalsVect.begin()) + 1;
+	}
+
+	static ITResult::NodeOverlapInfo overlapInfo(uint32_t Index, ITResult::OverlapResult OR,
+																							 const Interval &I,
+																							 ITResult::NodeRange Range = ITResult::NodeRange()) {
+		return ITResult::makeNodeOverlapInfo(Index, OR, IntervalNodeConcept(I.Start, I.End), Range);
+	}
+
+// Record the range and the payload of an interval that a removal is about to change
+	void recordPreviousState(const Interval &I, ITResult::NodeRangeVectTy &NodesStatusVect) {
+		NodesStatusVect.push_back(ITResult::NodeRange(I.Start, I.End));
+		if(!std::is_empty<PayloadTy>::value)
+			PreviousPayloadsVect.push_back(I.payload());
+	}
+
+// Copy the payloads that are in the arena of another set into the arena of this
+	void copyPayloads() {
+		if(std::is_empty<PayloadTy>::value)
+			return;
+		for(auto &I : IntervalsVect) {
+			PayloadTy Payload;
+			Payload.append(I.payload(), PayloadArena);
+			I.payload() = std::move(Payload);
+		}
+	}
+
+// First interval that ends after the given address
+	IntervalIterator firstEndingAfter(uint64_t Addr) {
+		return std::upper_bound(IntervalsVect.begin(), IntervalsVect.end(), Addr,
+														[this](uint64_t Addr, const Interval &I) {
+			NumNodesVisited++;
+			return Addr < I.End;
+		});
+	}
+
+	ConstIntervalIterator firstEndingAfter(uint64_t Addr) const {
+		return std::upper_bound(IntervalsVect.begin(), IntervalsVect.end(), Addr,
+														[this](uint64_t Addr, const Interval &I) {
+			NumNodesVisited++;
+			return Addr < I.End;
+		});
+	}
+
+public:
+	FlatIntervalSet() : IntervalsVect(), NumNodesVisited(0) {}
+
+// Copies keep their payloads in their own arena
+	FlatIntervalSet(const FlatIntervalSet &Other) :
+									IntervalsVect(Other.IntervalsVect), NumNodesVisited(Other.NumNodesVisited) {
+		copyPayloads();
+	}
+
+	FlatIntervalSet &operator=(const FlatIntervalSet &Other) {
+		if(this == &Other)
+			return *this;
+		IntervalsVect = Other.IntervalsVect;
+		NumNodesVisited = Other.NumNodesVisited;
+		PayloadArena.reset();
+		PreviousPayloadsVect.clear();
+		copyPayloads();
+		return *this;
+	}
+
+	ITResult insert(uint64_t Start, uint64_t End);
+
+// The intervals are inserted in their order in the batch. Inserting into the
+// array is cheap enough that coalescing the batch first does not pay off.
+	template<typename FuncTy>
+	void insertBatch(std::vector<IntervalBatchElem> &BatchVect, FuncTy Func) {
+		for(auto &Elem : BatchVect)
+			Func(Elem.Index, insert(Elem.Start, Elem.End));
+	}
+
+	template<bool SearchInParts>
+	bool remove(uint64_t Start, uint64_t End) {
+		if(!SearchInParts) {
+			auto It = firstEndingAfter(Start);
+			if(It == IntervalsVect.end() || It->Start > Start || It->End < End)
+				return false;
+			IntervalsVect.erase(It);
+			return true;
+		}
+		auto Result = getRemoveDetails(Start, End);
+		return Result.getOverlapResult() != ITResult::NoOverlap;
+	}
+
+	template<bool SearchInParts>
+	bool search(uint64_t Start, uint64_t End) const {
+		if(SearchInParts) {
+			auto Result = getSearchDetails(Start, End);
+			if(Result.getOverlapResult() == ITResult::PartialCompleteOverlap
+			|| Result.getOverlapResult() == ITResult::CompleteOverlap) {
+				return true;
+			}
+			return false;
+		}
+		auto It = firstEndingAfter(Start);
+		return It != IntervalsVect.end() && It->Start <= Start && End <= It->End;
+	}
+
+	ITResult getSearchDetails(uint64_t Start, uint64_t End) const;
+
+	ITResult getRemoveDetails(uint64_t Start, uint64_t End);
+
+// Add an element to the payload of an interval in the result of the last change
+	template<typename ElemTy>
+	void addToPayload(uint32_t Index, const ElemTy &Elem) {
+		IntervalsVect[Index - 1].payload().push_back(Elem, PayloadArena);
+	}
+
+// Payload that the interval at the given previous node range of the result of
+// the last removal had before it. It stays valid until the next removal.
+	const PayloadTy &getPreviousPayload(unsigned Index) const {
+		return PreviousPayloadsVect[Index];
+	}
+
+// Payload of the interval that the given range lies in, if any
+	const PayloadTy *findPayload(uint64_t Start, uint64_t End) const {
+		auto It = firstEndingAfter(Start);
+		if(It == IntervalsVect.end() || It->Start > Start || It->End < End)
+			return nullptr;
+		return &It->payload();
+	}
+
+	bool empty() const {
+		return IntervalsVect.empty();
+	}
+
+	void clear() {
+		IntervalsVect.clear();
+		PayloadArena.reset();
+		PreviousPayloadsVect.clear();
+	}
+
+	uint64_t size() const {
+		return IntervalsVect.size();
+	}
+
+	uint64_t getNumNodesVisited() const {
+		return NumNodesVisited;
+	}
+
+// Iterator over the intervals in their order
+	class const_iterator {
+		ConstIntervalIterator It;
+
+	public:
+		const_iterator(ConstIntervalIterator It = ConstIntervalIterator()) : It(It) {}
+
+		std::pair<uint64_t, uint64_t> operator*() const {
+			return std::make_pair(It->Start, It->End);
+		}
+
+		const PayloadTy &getPayload() const {
+			return It->payload();
+		}
+
+		const_iterator &operator++() {
+			++It;
+			return *this;
+		}
+
+		const_iterator operator++(int) {
+			const_iterator Old = *this;
+			++It;
+			return Old;
+		}
+
+		bool operator==(const const_iterator &Other) const {
+			return It == Other.It;
+		}
+
+		bool operator!=(const const_iterator &Other) const {
+			return It != Other.It;
+		}
+	};
+
+	const_iterator begin() const {
+		return const_iterator(IntervalsVect.begin());
+	}
+
+	const_iterator end() const {
+		return const_iterator(IntervalsVect.end());
+	}
+
+	std::vector<std::pair<uint64_t, uint64_t>> getIntervals() const {
+		std::vector<std::pair<uint64_t, uint64_t>> IntervalPairsVect;
+		IntervalPairsVect.reserve(IntervalsVect.size());
+		for(auto &I : IntervalsVect)
+			IntervalPairsVect.push_back(std::make_pair(I.Start, I.End));
+		return IntervalPairsVect;
+	}
+
+	void print() const {
+		std::cout << "\nPRINTING INTERVAL SET\n";
+		for(auto &I : IntervalsVect)
+			std::cout << "INTERVAL: " << I.Start << " TO " << I.End << "\n";
+		std::cout << "----------------------\n";
+	}
+};
+
+// Note that the End is not inclusive in the range, unlike Start
+template<typename PayloadTy>
+ITResult FlatIntervalSet<PayloadTy>::insert(uint64_t Start, uint64_t End) {
+	auto It = firstEndingAfter(Start);
+	if(It != IntervalsVect.end() && It->Start < End) {
+	// Look for complete overlaps
+		if(It->Start <= Start && End <= It->End) {
+			auto OR = (It->Start == Start && It->End == End) ?
+								ITResult::CompletelyPerfectOverlap : ITResult::CompleteOverlap;
+			return ITResult(OR, indexOf(It), IntervalNodeConcept(It->Start, It->End));
+		}
+
+	// The interval partially overlaps, so merge it and all the intervals it
+	// overlaps with into the first one of them.
+		ITResult::NodeRangeVectTy NodesStatusVect;
+		uint64_t NewStart = std::min(Start, It->Start);
+		uint64_t NewEnd = End;
+		auto Last = It;
+		for(; Last != IntervalsVect.end() && Last->Start < NewEnd; ++Last) {
+			NodesStatusVect.push_back(ITResult::NodeRange(Last->Start, Last->End));
+			NewEnd = std::max(NewEnd, Last->End);
+		}
+		It->Start = NewStart;
+		It->End = NewEnd;
+		for(auto Merged = It + 1; Merged != Last; ++Merged)
+			It->payload().append(Merged->payload(), PayloadArena);
+		It = IntervalsVect.erase(It + 1, Last) - 1;
+		ITResult::NodeOverlapInfoVectTy InfoVect;
+		InfoVect.push_back(overlapInfo(indexOf(It), ITResult::PartialOverlap, *It));
+		return ITResult(ITResult::PartialOverlap, InfoVect, NodesStatusVect);
+	}
+
+// No overlap but contiguous cases
+	if(It != IntervalsVect.begin() && (It - 1)->End == Start) {
+		(It - 1)->End = End;
+		return ITResult(ITResult::NoOverlap, indexOf(It - 1),
+										IntervalNodeConcept((It - 1)->Start, End));
+	}
+	if(It != IntervalsVect.end() && It->Start == End) {
+		It->Start = Start;
+		return ITResult(ITResult::NoOverlap, indexOf(It), IntervalNodeConcept(Start, It->End));
+	}
+
+// Just add a new interval
+	Interval New;
+	New.Start = Start;
+	New.End = End;
+	It = IntervalsVect.insert(It, New);
+	return ITResult(ITResult::NoOverlap, indexOf(It), IntervalNodeConcept(Start, End));
+}
+
+// This looks for partial overlaps of given range
+template<typename PayloadTy>
+ITResult FlatIntervalSet<PayloadTy>::getSearchDetails(uint64_t Start, uint64_t End) const {
+	ITResult::NodeOverlapInfoVectTy InfoVect;
+	auto It = firstEndingAfter(Start);
+	if(It == IntervalsVect.end() || It->Start >= End)
+		return ITResult(ITResult::NoOverlap, InfoVect);
+
+// Look for complete overlaps
+	if(It->Start <= Start && End <= It->End) {
+		auto OR = (It->Start == Start && It->End == End) ?
+							ITResult::CompletelyPerfectOverlap : ITResult::CompleteOverlap;
+		InfoVect.push_back(overlapInfo(indexOf(It), OR, *It, ITResult::NodeRange(Start, End)));
+		return ITResult(OR, InfoVect);
+	}
+
+// The range overlaps several intervals or sticks out of one. Find whether the
+// intervals cover all of it.
+	bool Covered = It->Start <= Start;
+	uint64_t CoveredEnd = It->Start;
+	for(; It != IntervalsVect.end() && It->Start < End; ++It) {
+		if(It->Start != CoveredEnd && !InfoVect.empty())
+			Covered = false;
+		auto OR = (Start <= It->Start && It->End <= End) ?
+							ITResult::CompletelyPerfectOverlap : ITResult::PartialOverlap;
+		InfoVect.push_back(overlapInfo(indexOf(It), OR, *It, ITResult::NodeRange(Start, End)));
+		CoveredEnd = It->End;
+	}
+	if(CoveredEnd < End)
+		Covered = false;
+	if(Covered)
+		return ITResult(ITResult::PartialCompleteOverlap, InfoVect);
+	return ITResult(ITResult::PartialOverlap, InfoVect);
+}
+
+template<typename PayloadTy>
+ITResult FlatIntervalSet<PayloadTy>::getRemoveDetails(uint64_t Start, uint64_t End) {
+	PreviousPayloadsVect.clear();
+
+// Search for the intervals
+	auto Result = getSearchDetails(Start, End);
+	if(Result.getOverlapResult() == ITResult::NoOverlap)
+		return Result;
+
+// Only the first and the last interval that overlap can keep a part, so there
+// are at most two pieces. If the range is in the middle of an interval, it is
+// split into two pieces. The pieces share the payload of their interval.
+	auto First = firstEndingAfter(Start);
+	auto Last = First;
+	ITResult::NodeRangeVectTy NodesStatusVect;
+	Interval Pieces[2];
+	uint32_t NumAllPieces = 0;
+	InlineVector<uint32_t, 4> NumPiecesVect;
+	for(; Last != IntervalsVect.end() && Last->Start < End; ++Last) {
+		uint32_t NumPieces = 0;
+		if(Last->Start < Start) {
+			Interval &Piece = Pieces[NumAllPieces++];
+			Piece = *Last;
+			Piece.End = Start;
+			NumPieces++;
+		}
+		if(End < Last->End) {
+			Interval &Piece = Pieces[NumAllPieces++];
+			Piece = *Last;
+			Piece.Start = End;
+			NumPieces++;
+		}
+
+	// Record the previous state of the interval for every piece of it
+		recordPreviousState(*Last, NodesStatusVect);
+		if(NumPieces == 2)
+			recordPreviousState(*Last, NodesStatusVect);
+		NumPiecesVect.push_back(NumPieces);
+	}
+
+// Replace the intervals with the pieces that are left
+	auto Pos = First - IntervalsVect.begin();
+	IntervalsVect.erase(First, Last);
+	IntervalsVect.insert(IntervalsVect.begin() + Pos, Pieces, Pieces + NumAllPieces);
+
+	ITResult::NodeOverlapInfoVectTy InfoVect;
+	auto PieceIt = IntervalsVect.begin() + Pos;
+	for(unsigned Index = 0; Index != NumPiecesVect.size(); ++Index) {
+		auto &Info = Result.getNodesAndOverlapResults()[Index];
+		if(!NumPiecesVect[Index]) {
+			InfoVect.push_back(ITResult::makeNodeOverlapInfo(0, Info.OR, IntervalNodeConcept(),
+																												Info.Range));
+			continue;
+		}
+		for(uint32_t I = 0; I != NumPiecesVect[Index]; ++I, ++PieceIt)
+			InfoVect.push_back(overlapInfo(indexOf(PieceIt), Info.OR, *PieceIt, Info.Range));
+	}
+	return ITResult(Result.getOverlapResult(), InfoVect, NodesStatusVect);
+}
+
+#endif  // FLAT_INTERVAL_SET_H_
@@ -0,0 +1,44 @@
+//================================ ID Tables ==================================//
+//
+// Tables of what PMCheck runtime knows about instruction IDs, such as their line
+// numbers. The instrumenter numbers the instructions of every module densely and
+// modules get consecutive ranges of IDs, so the tables are arrays indexed by ID.
+//
+//=============================================================================//
+
+#ifndef ID_TABLE_H_
+#define ID_TABLE_H_
+
+#include <cstdint>
+#include <vector>
+
+template<typename T>
+class IdTable {
+	std::vector<T> Vect;
+
+// Returned for IDs nothing was registered for
+	T Missing;
+
+public:
+	IdTable() : Missing() {}
+
+	void reserve(uint32_t NumIds) {
+		if(NumIds > Vect.size())
+			Vect.resize(NumIds);
+	}
+
+	void set(uint32_t Id, const T &Value) {
+		reserve(Id + 1);
+		Vect[Id] = Value;
+	}
+
+	const T &operator[](uint32_t Id) const {
+		return Id < Vect.size() ? Vect[Id] : Missing;
+	}
+
+	uint32_t size() const {
+		return Vect.size();
+	}
+};
+
+#endif  // ID_TABLE_H_
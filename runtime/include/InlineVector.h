@@ -0,0 +1,136 @@
+//============================== Inline Vector ================================//
+//
+// A vector for trivially copyable elements that keeps the first few elements
+// inline and only allocates from the heap when it grows past them.
+//
+//=============================================================================//
+
+#ifndef INLINE_VECTOR_H_
+#define INLINE_VECTOR_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+
+template<typename T, unsigned N>
+class InlineVector {
+	static_assert(std::is_trivially_copyable<T>::value,
+								"Inline vector elements must be trivially copyable.");
+
+	T *Begin;
+	uint32_t Size;
+	uint32_t Capacity;
+	T InlineElems[N];
+
+	bool isInline() const {
+		return Begin == InlineElems;
+	}
+
+	void grow() {
+		uint32_t NewCapacity = Capacity * 2;
+		T *NewBegin = (T *)malloc(NewCapacity * sizeof(T));
+		memcpy((void *)NewBegin, (const void *)Begin, Size * sizeof(T));
+		if(!isInline())
+			free(Begin);
+		Begin = NewBegin;
+		Capacity = NewCapacity;
+	}
+
+	void copyFrom(const InlineVector &Other) {
+		if(Other.Size > N) {
+			Begin = (T *)malloc(Other.Size * sizeof(T));
+			Capacity = Other.Size;
+		}
+		memcpy((void *)Begin, (const void *)Other.Begin, Other.Size * sizeof(T));
+		Size = Other.Size;
+	}
+
+public:
+	InlineVector() : Begin(InlineElems), Size(0), Capacity(N) {}
+
+	InlineVector(const InlineVector &Other) :
+							Begin(InlineElems), Size(0), Capacity(N) {
+		copyFrom(Other);
+	}
+
+	InlineVector &operator=(const InlineVector &Other) {
+		if(this == &Other)
+			return *this;
+		if(!isInline())
+			free(Begin);
+		Begin = InlineElems;
+		Capacity = N;
+		copyFrom(Other);
+		return *this;
+	}
+
+	~InlineVector() {
+		if(!isInline())
+			free(Begin);
+	}
+
+	void push_back(const T &Elem) {
+		if(Size == Capacity) {
+		// The element may be in this vector, so copy it before it is moved
+			T Copy = Elem;
+			grow();
+			Begin[Size++] = Copy;
+			return;
+		}
+		Begin[Size++] = Elem;
+	}
+
+	void pop_back() {
+		--Size;
+	}
+
+	void clear() {
+		Size = 0;
+	}
+
+	uint32_t size() const {
+		return Size;
+	}
+
+	bool empty() const {
+		return !Size;
+	}
+
+	T &operator[](uint32_t Index) {
+		return Begin[Index];
+	}
+
+	const T &operator[](uint32_t Index) const {
+		return Begin[Index];
+	}
+
+	T &back() {
+		return Begin[Size - 1];
+	}
+
+	const T &back() const {
+		return Begin[Size - 1];
+	}
+
+	using iterator = T *;
+	using const_iterator = const T *;
+
+	iterator begin() {
+		return Begin;
+	}
+
+	iterator end() {
+		return Begin + Size;
+	}
+
+	const_iterator begin() const {
+		return Begin;
+	}
+
+	const_iterator end() const {
+		return Begin + Size;
+	}
+};
+
+#endif  // INLINE_VECTOR_H_
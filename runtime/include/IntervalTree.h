@@ -2,25 +2,57 @@
 //
 // Implementation of an AVL Interval Tree for PMCheck runtime.
 //
+// Nodes are ordered by the middles of their intervals. Every node also keeps the
+// lowest start and the highest end of the intervals in its subtree, so queries
+// for the intervals overlapping a range skip the subtrees that cannot have any.
+// Nodes keep their heights as well, and the tree is rebalanced on the way up
+// from every change.
+//
+// Ranges are removed by splitting the tree around the range and joining what is
+// left, so the tree is restructured once per removal instead of once for every
+// interval the range covers.
+//
+// Nodes can carry a payload, such as the operations recorded for their intervals.
+// The payloads of nodes that merge are merged, and the nodes a node is split into
+// share its payload.
+//
 //=============================================================================//
 
 #ifndef INTERVAL_TREE_H_
 #define INTERVAL_TREE_H_
 
+#include <cstdint>
+#include <algorithm>
 #include <iostream>
 #include <vector>
-#include <set>
 #include <utility>
 #include <tuple>
+#include <type_traits>
 
+#include "InlineVector.h"
+#include "PayloadList.h"
+
+// The interval tree traces every step of its operations to standard output if
+// INTERVAL_TREE_DEBUG is defined.
+#ifdef INTERVAL_TREE_DEBUG
+#define IT_DEBUG(X) X
+#else
+#define IT_DEBUG(X) do { } while(false)
+#endif
+
+// Interval of a node in the interval tree. Nodes are plain data so that they can
+// be kept in a pool and copied into results.
 struct IntervalNodeConcept {
 	uint64_t Start;
 	uint64_t End;
 	uint64_t Middle;
 
+	IntervalNodeConcept() : Start(0), End(0), Middle(0) {}
+
 	IntervalNodeConcept(uint64_t Start, uint64_t End) {
 		this->Start = Start;
 		this->End = End;
+		updateMiddle();
 	}
 
 	void print() const {
@@ -28,7 +60,10 @@ struct IntervalNodeConcept {
 		std::cout << Start << " TO " << End << "\n";
 	}
 
-	virtual void updateMiddle() = 0;
+	void updateMiddle() {
+	// Use arithmetic mean
+		Middle = (Start + End) >> 1;
+	}
 };
 
 class ITResult {
@@ -67,64 +102,94 @@ public:
 		}
 	};
 
+// Node that an operation overlapped with. The node is copied so that the result
+// stays valid after the tree changes. Index is zero if the node was removed.
+	struct NodeOverlapInfo {
+		uint32_t Index;
+		OverlapResult OR;
+		IntervalNodeConcept Node;
+		NodeRange Range;
+	};
+
 private:
-	typedef std::tuple<IntervalNodeConcept *, OverlapResult, NodeRange> NodeOverlapInfoTy;
+// Most operations overlap with one or two nodes, so keep those inline
+	typedef InlineVector<NodeOverlapInfo, 2> NodeOverlapInfoVectTy;
+	typedef InlineVector<NodeRange, 2> NodeRangeVectTy;
 
 // These results reflect the most recent changes make to the interval tree
 	OverlapResult OR;
-	std::vector<NodeOverlapInfoTy> NodeOverlapInfoVect;
+	NodeOverlapInfoVectTy NodeOverlapInfoVect;
 
 // This result reflects how the corresponding nodes previously were right before
 // some operation was performed on the interval tree. This is used especially when
 // there is some partial overlap and they are updated.
-	std::vector<NodeRange> PreviousNodeRangesVect;
+	NodeRangeVectTy PreviousNodeRangesVect;
+
+	static NodeOverlapInfo makeNodeOverlapInfo(uint32_t Index, OverlapResult Result,
+																						 const IntervalNodeConcept &Node,
+																						 NodeRange Range = NodeRange()) {
+		NodeOverlapInfo Info;
+		Info.Index = Index;
+		Info.OR = Result;
+		Info.Node = Node;
+		Info.Range = Range;
+		return Info;
+	}
 
 // ITResult constructors
-	ITResult(OverlapResult Result, IntervalNodeConcept *Ptr) {
+	ITResult(OverlapResult Result, uint32_t Index, const IntervalNodeConcept &Node) {
 		OR = Result;
-		NodeOverlapInfoVect.push_back(std::make_tuple(Ptr, Result, NodeRange()));
+		NodeOverlapInfoVect.push_back(makeNodeOverlapInfo(Index, Result, Node));
 	}
 
-	ITResult(OverlapResult Result, IntervalNodeConcept *Ptr,
+	ITResult(OverlapResult Result, uint32_t Index, const IntervalNodeConcept &Node,
 			 NodeRange State) {
 		OR = Result;
-		NodeOverlapInfoVect.push_back(std::make_tuple(Ptr, Result, NodeRange()));
+		NodeOverlapInfoVect.push_back(makeNodeOverlapInfo(Index, Result, Node));
 		PreviousNodeRangesVect.push_back(State);
 	}
 
 	ITResult(OverlapResult Result,
-			 std::vector<NodeOverlapInfoTy> PtrVect) {
+			 const NodeOverlapInfoVectTy &InfoVect) {
 		OR = Result;
-		NodeOverlapInfoVect = PtrVect;
+		NodeOverlapInfoVect = InfoVect;
 	}
 
 	ITResult(OverlapResult Result,
-			 std::vector<NodeOverlapInfoTy> PtrVect,
-			 std::vector<NodeRange> NodesStatusVect) {
+			 const NodeOverlapInfoVectTy &InfoVect,
+			 const NodeRangeVectTy &NodesStatusVect) {
 		OR = Result;
-		NodeOverlapInfoVect = PtrVect;
+		NodeOverlapInfoVect = InfoVect;
 		PreviousNodeRangesVect = NodesStatusVect;
 	}
 
 // Interval tree can access ITResult constructors
-	template<bool OptimizeSearch> friend class IntervalTree;
+	template<bool OptimizeSearch, typename PayloadTy> friend class IntervalTree;
+	template<typename PayloadTy> friend class FlatIntervalSet;
 
 public:
 	OverlapResult getOverlapResult() const {
 		return OR;
 	}
 
-	const std::vector<NodeOverlapInfoTy> &getNodesAndOverlapResults() const {
+	const NodeOverlapInfoVectTy &getNodesAndOverlapResults() const {
 		return NodeOverlapInfoVect;
 	}
 
-	IntervalNodeConcept *getNode(unsigned Index) const {
-		if(Index < NodeOverlapInfoVect.size())
-			return std::get<0>(NodeOverlapInfoVect[Index]);
+	const IntervalNodeConcept *getNode(unsigned Index) const {
+		if(Index < NodeOverlapInfoVect.size() && NodeOverlapInfoVect[Index].Index)
+			return &NodeOverlapInfoVect[Index].Node;
 		return nullptr;
 	}
 
-	const std::vector<NodeRange> &getPreviousNodeRanges() const {
+// Index of the node in the interval set, which is valid until the set changes
+	uint32_t getNodeIndex(unsigned Index) const {
+		if(Index < NodeOverlapInfoVect.size())
+			return NodeOverlapInfoVect[Index].Index;
+		return 0;
+	}
+
+	const NodeRangeVectTy &getPreviousNodeRanges() const {
 		return PreviousNodeRangesVect;
 	}
 
@@ -143,114 +208,297 @@ public:
 	}
 };
 
-template<bool OptimizeSearch>
-class IntervalTree {
-	struct IntervalNode : public IntervalNodeConcept {
-		IntervalNode *Parent;
-		IntervalNode *Left;
-		IntervalNode *Right;
+// Interval in a batch of intervals inserted at once. Index is the position of
+// the interval in the caller's batch.
+struct IntervalBatchElem {
+	uint64_t Start;
+	uint64_t End;
+	uint32_t Index;
 
-		void updateMiddle() override {
-			Middle = IntervalTree::getMiddle(IntervalNodeConcept::Start, IntervalNodeConcept::End);
-		}
+	IntervalBatchElem(uint64_t Start, uint64_t End, uint32_t Index) :
+						Start(Start), End(End), Index(Index) {}
+};
 
-		IntervalNode(uint64_t Start, uint64_t Len) :
-						IntervalNodeConcept(Start, Len) , Parent(nullptr),
-						Left(nullptr), Right(nullptr) {
-			updateMiddle();
-		}
+template<bool OptimizeSearch, typename PayloadTy = NoPayload>
+class IntervalTree {
+// Nodes live in a pool and refer to each other by their index in it. Index zero
+// is never allocated, so it stands for no node. Nodes without a payload take no
+// space for it.
+	struct IntervalNode : public IntervalNodeConcept, public PayloadTy {
+		uint32_t Parent;
+		uint32_t Left;
+		uint32_t Right;
+		uint32_t Height;
+
+	// Bounds of the intervals in the subtree of the node. Nodes are not ordered
+	// by their starts, so both bounds are needed to prune subtrees.
+		uint64_t MinStart;
+		uint64_t MaxEnd;
+
+		IntervalNode(uint64_t Start, uint64_t End) :
+						IntervalNodeConcept(Start, End), Parent(0),
+						Left(0), Right(0), Height(1), MinStart(Start), MaxEnd(End) {}
 
 		void reset() {
-			Parent = Left = Right = nullptr;
+			Parent = Left = Right = 0;
+			Height = 1;
 		}
 
-		void print() const {
-			std::cout << "\n----------------------\n";
-			std::cout << "PRINTING NODE\n";
-			IntervalNodeConcept::print();
-			if(Parent) {
-				std::cout << "PARENT ";
-				((IntervalNodeConcept *)Parent)->print();
-			} else {
-				std::cout << "NO PARENT NODE\n";
-			}
-			if(Left) {
-				std::cout << "LEFT ";
-				((IntervalNodeConcept *)Left)->print();
-			} else {
-				std::cout << "NO LEFT NODE\n";
-			}
-			if(Right) {
-				std::cout << "RIGHT ";
-				((IntervalNodeConcept *)Right)->print();
-			} else {
-				std::cout << "NO RIGHT NODE\n";
-			}
-			std::cout << "------------------------\n";
+		PayloadTy &payload() {
+			return *this;
+		}
+
+		const PayloadTy &payload() const {
+			return *this;
 		}
 	};
 
+	static const uint32_t NullNode = 0;
+
+// Removals that overlap with more nodes than this split the tree
+	static const uint32_t MaxNodesRemovedOneByOne = 4;
+
 	static uint64_t getMiddle(uint64_t Start, uint64_t End) {
 	// Use arithmetic mean
 		return (Start + End) >> 1;
 	}
 
 // Root of the interval tree
-	IntervalNode *Root;
+	uint32_t Root;
+
+// Pool of all nodes in the interval tree. Freed nodes are chained through
+// their right child index and reused before the pool grows. Growing the pool
+// may move the nodes, so references to nodes must not be held across it.
+	std::vector<IntervalNode> NodesVect;
+	uint32_t FreeNodes;
+	uint64_t NumNodes;
+
+// Nodes visited by all the lookups so far, for profiling
+	mutable uint64_t NumNodesVisited;
+
+// Payloads that do not fit in the nodes. It is released when the tree is cleared.
+	BumpArena PayloadArena;
+
+// Payloads of the nodes before the last removal changed them, in the order of
+// the previous node ranges of its result
+	std::vector<PayloadTy> PreviousPayloadsVect;
+
+// Scratch space for removals
+	std::vector<uint32_t> RemovedNodesVect;
+	std::vector<uint32_t> StrayNodesVect;
+
+	IntervalNode &node(uint32_t Index) {
+		return NodesVect[Index];
+	}
+
+	const IntervalNode &node(uint32_t Index) const {
+		return NodesVect[Index];
+	}
 
-// Vector of all nodes in the interval tree. This makes accessing
-// all of them easy for operations like destructing the tree, etc.
-	std::set<IntervalNode *> NodesSet;
+	uint32_t leftmostNode(uint32_t Index) const {
+		while(node(Index).Left != NullNode)
+			Index = node(Index).Left;
+		return Index;
+	}
+
+	uint32_t allocateNode(uint64_t Start, uint64_t End) {
+		NumNodes++;
+		if(FreeNodes != NullNode) {
+			uint32_t Index = FreeNodes;
+			FreeNodes = node(Index).Right;
+			node(Index) = IntervalNode(Start, End);
+			return Index;
+		}
+		NodesVect.push_back(IntervalNode(Start, End));
+		return NodesVect.size() - 1;
+	}
 
-	IntervalNode *insertNode(IntervalNode *Node);
+	void freeNode(uint32_t Index) {
+		NumNodes--;
+		node(Index).Right = FreeNodes;
+		FreeNodes = Index;
+	}
 
-	void removeNode(IntervalNode *Node);
+	void printNode(uint32_t Index) const;
 
-	IntervalNode *internalSearch(uint64_t Start, uint64_t End) const;
+// Record the range and the payload of a node that a removal is about to change
+	void recordPreviousState(uint32_t Index, ITResult::NodeRangeVectTy &NodesStatusVect) {
+		NodesStatusVect.push_back(ITResult::NodeRange(node(Index).Start, node(Index).End));
+		if(!std::is_empty<PayloadTy>::value)
+			PreviousPayloadsVect.push_back(node(Index).payload());
+	}
+
+// Recompute the height and the bounds of the subtree of a node from its children
+	void updateNode(uint32_t Index) {
+		IntervalNode &Node = node(Index);
+		Node.Height = std::max(nodeHeight(Node.Left), nodeHeight(Node.Right)) + 1;
+		Node.MinStart = Node.Start;
+		Node.MaxEnd = Node.End;
+		if(Node.Left != NullNode) {
+			Node.MinStart = std::min(Node.MinStart, node(Node.Left).MinStart);
+			Node.MaxEnd = std::max(Node.MaxEnd, node(Node.Left).MaxEnd);
+		}
+		if(Node.Right != NullNode) {
+			Node.MinStart = std::min(Node.MinStart, node(Node.Right).MinStart);
+			Node.MaxEnd = std::max(Node.MaxEnd, node(Node.Right).MaxEnd);
+		}
+	}
+
+// Update and rebalance a node whose interval or children changed, and all its
+// ancestors. This returns the root of the tree the node is in, which need not be
+// the tree rooted at Root.
+	uint32_t rebalanceUpwards(uint32_t Index) {
+		uint32_t Top = Index;
+		for(; Index != NullNode; Index = node(Top).Parent)
+			Top = balanceTree(Index);
+		return Top;
+	}
+
+// Same as above for a node in the tree rooted at Root
+	void updateUpwards(uint32_t Index) {
+		if(Index != NullNode)
+			Root = rebalanceUpwards(Index);
+	}
+
+// Make the given node take the place of a child of the given parent
+	void replaceChild(uint32_t Parent, uint32_t Child, uint32_t NewChild) {
+		if(NewChild != NullNode)
+			node(NewChild).Parent = Parent;
+		if(Parent == NullNode)
+			return;
+		if(node(Parent).Left == Child)
+			node(Parent).Left = NewChild;
+		else
+			node(Parent).Right = NewChild;
+	}
+
+	bool subtreeOverlaps(uint32_t Index, uint64_t Start, uint64_t End) const {
+		return Index != NullNode && node(Index).MinStart < End && node(Index).MaxEnd > Start;
+	}
+
+	void insertNode(uint32_t Node);
+
+	void removeNode(uint32_t Node);
+
+	void reinsertNode(uint32_t Node);
+
+	uint32_t internalSearch(uint64_t Start, uint64_t End) const;
+
+// Copy the payloads that are in the arena of another tree into the arena of this
+	void copyPayloads() {
+		if(std::is_empty<PayloadTy>::value)
+			return;
+		for(auto &Node : NodesVect) {
+			PayloadTy Payload;
+			Payload.append(Node.payload(), PayloadArena);
+			Node.payload() = std::move(Payload);
+		}
+	}
 
 	ITResult detailedInternalSearch(uint64_t Start, uint64_t End) const;
 
 	ITResult detailedInternalRemove(uint64_t Start, uint64_t End,
 									bool AllowPartialRemoval = true);
 
-	signed nodeHeight(IntervalNode *Node);
+	signed nodeHeight(uint32_t Node) const {
+		return Node != NullNode ? node(Node).Height : 0;
+	}
+
+	signed heightDiff(uint32_t Node) const {
+		return nodeHeight(node(Node).Left) - nodeHeight(node(Node).Right);
+	}
+
+	uint32_t rightRightRotate(uint32_t Node);
 
-	signed heightDiff(IntervalNode *Node);
+	uint32_t leftLeftRotate(uint32_t Node);
 
-	IntervalNode *rightRightRotate(IntervalNode *Node);
+	uint32_t leftRightRotate(uint32_t Node);
 
-	IntervalNode *leftLeftRotate(IntervalNode *Node);
+	uint32_t rightLeftRotate(uint32_t Node);
 
-	IntervalNode *leftRightRotate(IntervalNode *Node);
+	uint32_t balanceTree(uint32_t Node);
 
-	IntervalNode *rightLeftRotate(IntervalNode *Node);
+// Split and join trees that are not linked to a parent. These take and return
+// the roots of the trees.
+	std::pair<uint32_t, uint32_t> split(uint32_t Tree, uint64_t Key);
 
-	IntervalNode *balanceTree(IntervalNode *Node);
+	uint32_t joinWithPivot(uint32_t Left, uint32_t Pivot, uint32_t Right);
+
+	uint32_t join(uint32_t Left, uint32_t Right);
+
+// Call Func with the index of every node whose interval overlaps the given range.
+// Subtrees whose bounds do not overlap the range are skipped.
+	template<typename FuncTy>
+	void forEachOverlappingNode(uint64_t Start, uint64_t End, FuncTy Func) const {
+		InlineVector<uint32_t, 32> NodesStack;
+		uint32_t CurNode = Root;
+		while(subtreeOverlaps(CurNode, Start, End) || !NodesStack.empty()) {
+			while(subtreeOverlaps(CurNode, Start, End)) {
+				NumNodesVisited++;
+				NodesStack.push_back(CurNode);
+				CurNode = node(CurNode).Left;
+			}
+			CurNode = NodesStack.back();
+			NodesStack.pop_back();
+			const IntervalNode &Cur = node(CurNode);
+			if(Cur.Start < End && Cur.End > Start)
+				Func(CurNode);
+			CurNode = Cur.Right;
+		}
+	}
+
+	bool overlapsAnyNode(uint64_t Start, uint64_t End) const {
+		bool Overlaps = false;
+		forEachOverlappingNode(Start, End, [&](uint32_t) {
+			Overlaps = true;
+		});
+		return Overlaps;
+	}
 
 public:
-	IntervalTree() : Root(nullptr), NodesSet() {}
+	IntervalTree() : Root(NullNode), NodesVect(1, IntervalNode(0, 0)),
+									 FreeNodes(NullNode), NumNodes(0), NumNodesVisited(0) {}
+
+// Copies keep their payloads in their own arena
+	IntervalTree(const IntervalTree &Other) :
+							Root(Other.Root), NodesVect(Other.NodesVect), FreeNodes(Other.FreeNodes),
+							NumNodes(Other.NumNodes), NumNodesVisited(Other.NumNodesVisited) {
+		copyPayloads();
+	}
 
-	~IntervalTree() {
-		clear();
+	IntervalTree &operator=(const IntervalTree &Other) {
+		if(this == &Other)
+			return *this;
+		Root = Other.Root;
+		NodesVect = Other.NodesVect;
+		FreeNodes = Other.FreeNodes;
+		NumNodes = Other.NumNodes;
+		NumNodesVisited = Other.NumNodesVisited;
+		PayloadArena.reset();
+		PreviousPayloadsVect.clear();
+		copyPayloads();
+		return *this;
 	}
 
 	ITResult insert(uint64_t Start, uint64_t End);
 
+	template<typename FuncTy>
+	void insertBatch(std::vector<IntervalBatchElem> &BatchVect, FuncTy Func);
+
 	template<bool SearchInParts>
 	bool remove(uint64_t Start, uint64_t End) {
-		std::cout << "REMOVING RANGE: " << Start << " TO " << End << "\n";
+		IT_DEBUG(std::cout << "REMOVING RANGE: " << Start << " TO " << End << "\n");
 		if(!SearchInParts) {
-			auto *Node = internalSearch(Start, End);
-			if(!Node)
+			auto Node = internalSearch(Start, End);
+			if(Node == NullNode)
 				return false;
 			removeNode(Node);
-			NodesSet.erase(Node);
-			delete Node;
+			freeNode(Node);
 			return true;
 		} else {
 			auto Result = detailedInternalRemove(Start, End);
 			if(Result.getOverlapResult() == ITResult::NoOverlap) {
-				std::cout << "NO OVERLAP\n";
+				IT_DEBUG(std::cout << "NO OVERLAP\n");
 				return false;
 			}
 		}
@@ -261,12 +509,12 @@ public:
 	bool search(uint64_t Start, uint64_t End) const {
 		if(SearchInParts) {
 			auto Result = detailedInternalSearch(Start, End);
-			if(Result == ITResult::PartialCompleteOverlap
-			|| Result == ITResult::CompleteOverlap) {
+			if(Result.getOverlapResult() == ITResult::PartialCompleteOverlap
+			|| Result.getOverlapResult() == ITResult::CompleteOverlap) {
 				return true;
 			}
 		} else {
-			if(auto *Node = internalSearch(Start, End))
+			if(internalSearch(Start, End) != NullNode)
 				return true;
 		}
 		return false;
@@ -276,123 +524,234 @@ public:
 		return detailedInternalSearch(Start, End);
 	}
 
-	ITResult getRemoveDetails(uint64_t Start, uint64_t End) const {
+	ITResult getRemoveDetails(uint64_t Start, uint64_t End) {
 		return detailedInternalRemove(Start, End);
 	}
 
+// Add an element to the payload of a node in the result of the last change
+	template<typename ElemTy>
+	void addToPayload(uint32_t Index, const ElemTy &Elem) {
+		node(Index).payload().push_back(Elem, PayloadArena);
+	}
+
+// Payload that the node at the given previous node range of the result of the
+// last removal had before it. It stays valid until the next removal.
+	const PayloadTy &getPreviousPayload(unsigned Index) const {
+		return PreviousPayloadsVect[Index];
+	}
+
+// Payload of the node that the given range lies in, if any
+	const PayloadTy *findPayload(uint64_t Start, uint64_t End) const {
+		auto Node = internalSearch(Start, End);
+		if(Node == NullNode)
+			return nullptr;
+		return &node(Node).payload();
+	}
+
+// Iterator over the intervals in the order of the nodes. It follows the parent
+// links, so iterating does not allocate. The tree must not change while it is
+// iterated over.
+	class const_iterator {
+		const IntervalTree *Tree;
+		uint32_t Node;
+
+	public:
+		const_iterator(const IntervalTree *Tree = nullptr, uint32_t Node = NullNode) :
+									 Tree(Tree), Node(Node) {}
+
+		std::pair<uint64_t, uint64_t> operator*() const {
+			return std::make_pair(Tree->node(Node).Start, Tree->node(Node).End);
+		}
+
+		const PayloadTy &getPayload() const {
+			return Tree->node(Node).payload();
+		}
+
+		const_iterator &operator++() {
+			if(Tree->node(Node).Right != NullNode) {
+				Node = Tree->leftmostNode(Tree->node(Node).Right);
+				return *this;
+			}
+			uint32_t Child = Node;
+			Node = Tree->node(Node).Parent;
+			while(Node != NullNode && Tree->node(Node).Right == Child) {
+				Child = Node;
+				Node = Tree->node(Node).Parent;
+			}
+			return *this;
+		}
+
+		const_iterator operator++(int) {
+			const_iterator It = *this;
+			++*this;
+			return It;
+		}
+
+		bool operator==(const const_iterator &Other) const {
+			return Node == Other.Node;
+		}
+
+		bool operator!=(const const_iterator &Other) const {
+			return Node != Other.Node;
+		}
+	};
+
+	const_iterator begin() const {
+		return const_iterator(this, Root == NullNode ? NullNode : leftmostNode(Root));
+	}
+
+	const_iterator end() const {
+		return const_iterator(this, NullNode);
+	}
+
 	bool empty() const {
-		return Root == nullptr;
+		return Root == NullNode;
 	}
 
+// This keeps the memory of the pool and of the arena for the nodes inserted after
 	void clear() {
-	// Iterate over NodesSet and erase all the nodes from the tree
-		for(auto *Node : NodesSet)
-			delete Node;
-		NodesSet.clear();
-		Root = nullptr;
+		NodesVect.resize(1, IntervalNode(0, 0));
+		FreeNodes = NullNode;
+		NumNodes = 0;
+		Root = NullNode;
+		PayloadArena.reset();
+		PreviousPayloadsVect.clear();
 	}
 
 	uint64_t size() const {
-		return NodesSet.size();
+		return NumNodes;
+	}
+
+	uint64_t getNumNodesVisited() const {
+		return NumNodesVisited;
 	}
 
 	std::pair<uint64_t, uint64_t> getRootInterval() const {
-		if(!Root)
+		if(Root == NullNode)
 			return std::pair<uint64_t, uint64_t>();
-		return std::make_pair(Root->Start, Root->End);
+		return std::make_pair(node(Root).Start, node(Root).End);
 	}
 
 	std::vector<std::pair<uint64_t, uint64_t>> getIntervals() const {
 		std::vector<std::pair<uint64_t, uint64_t>> IntervalsVect;
-		for(auto *Node : NodesSet)
-			IntervalsVect.push_back(std::make_pair(Node->Start, Node->End));
+		IntervalsVect.reserve(NumNodes);
+		for(auto It = begin(); It != end(); ++It)
+			IntervalsVect.push_back(*It);
 		return IntervalsVect;
 	}
 
 	void print() const {
 		std::cout << "\nPRINTING INTERVAL TREE\n";
+		if(Root == NullNode) {
+			std::cout << "EMPTY TREE\n";
+			return;
+		}
 		std::cout << "ROOT: ";
-		Root->print();
-		for(auto *Node : NodesSet) {
-			if(Node != Root)
-				Node->print();
+		printNode(Root);
+		std::vector<uint32_t> NodesStack;
+		NodesStack.push_back(Root);
+		while(!NodesStack.empty()) {
+			uint32_t CurNode = NodesStack.back();
+			NodesStack.pop_back();
+			if(CurNode != Root)
+				printNode(CurNode);
+			if(node(CurNode).Left != NullNode)
+				NodesStack.push_back(node(CurNode).Left);
+			if(node(CurNode).Right != NullNode)
+				NodesStack.push_back(node(CurNode).Right);
 		}
 		std::cout << "----------------------\n";
 	}
 };
 
-template<bool OptimizeSearch>
-signed IntervalTree<OptimizeSearch>::nodeHeight(IntervalNode *Node) {
-	if(!Node) {
-		auto LeftHeight = nodeHeight(Node->Left);
-		auto RightHeight = nodeHeight(Node->Right);
-		if(LeftHeight > RightHeight)
-			return (LeftHeight + 1);
-		return (RightHeight + 1);
+template<bool OptimizeSearch, typename PayloadTy>
+void IntervalTree<OptimizeSearch, PayloadTy>::printNode(uint32_t Index) const {
+	const IntervalNode &Node = node(Index);
+	std::cout << "\n----------------------\n";
+	std::cout << "PRINTING NODE\n";
+	Node.IntervalNodeConcept::print();
+	if(Node.Parent != NullNode) {
+		std::cout << "PARENT ";
+		node(Node.Parent).IntervalNodeConcept::print();
+	} else {
+		std::cout << "NO PARENT NODE\n";
 	}
-	return 0;
-}
-
-template<bool OptimizeSearch>
-signed IntervalTree<OptimizeSearch>::heightDiff(IntervalNode *Node) {
-	return (nodeHeight(Node->Left) - nodeHeight(Node->Right));
+	if(Node.Left != NullNode) {
+		std::cout << "LEFT ";
+		node(Node.Left).IntervalNodeConcept::print();
+	} else {
+		std::cout << "NO LEFT NODE\n";
+	}
+	if(Node.Right != NullNode) {
+		std::cout << "RIGHT ";
+		node(Node.Right).IntervalNodeConcept::print();
+	} else {
+		std::cout << "NO RIGHT NODE\n";
+	}
+	std::cout << "------------------------\n";
 }
 
-template<bool OptimizeSearch>
-typename IntervalTree<OptimizeSearch>::IntervalNode *
-IntervalTree<OptimizeSearch>::rightRightRotate(IntervalNode *Node) {
-	IntervalNode *MoveNode = Node->Right;
-	Node->Right = MoveNode->Left;
-	MoveNode->Left->Parent = Node;
-	MoveNode->Left = Node;
-	Node->Parent = MoveNode;
-	std::cout<<"Right-Right Rotation";
+// Rotations keep the parent of the node linked to whichever node takes its place
+template<bool OptimizeSearch, typename PayloadTy>
+uint32_t IntervalTree<OptimizeSearch, PayloadTy>::rightRightRotate(uint32_t Node) {
+	uint32_t MoveNode = node(Node).Right;
+	uint32_t Parent = node(Node).Parent;
+	node(Node).Right = node(MoveNode).Left;
+	if(node(MoveNode).Left != NullNode)
+		node(node(MoveNode).Left).Parent = Node;
+	node(MoveNode).Left = Node;
+	node(Node).Parent = MoveNode;
+	replaceChild(Parent, Node, MoveNode);
+	updateNode(Node);
+	updateNode(MoveNode);
+	IT_DEBUG(std::cout<<"Right-Right Rotation");
 	return MoveNode;
 }
 
-template<bool OptimizeSearch>
-typename IntervalTree<OptimizeSearch>::IntervalNode *
-IntervalTree<OptimizeSearch>::leftLeftRotate(IntervalNode *Node) {
-	IntervalNode *MoveNode = Node->Left;
-	Node->Left = MoveNode->Right;
-	MoveNode->Right->Parent = Node;
-	MoveNode->Right = Node;
-	Node->Parent = MoveNode;
-	std::cout<<"Left-Left Rotation";
+template<bool OptimizeSearch, typename PayloadTy>
+uint32_t IntervalTree<OptimizeSearch, PayloadTy>::leftLeftRotate(uint32_t Node) {
+	uint32_t MoveNode = node(Node).Left;
+	uint32_t Parent = node(Node).Parent;
+	node(Node).Left = node(MoveNode).Right;
+	if(node(MoveNode).Right != NullNode)
+		node(node(MoveNode).Right).Parent = Node;
+	node(MoveNode).Right = Node;
+	node(Node).Parent = MoveNode;
+	replaceChild(Parent, Node, MoveNode);
+	updateNode(Node);
+	updateNode(MoveNode);
+	IT_DEBUG(std::cout<<"Left-Left Rotation");
 	return MoveNode;
 }
 
-template<bool OptimizeSearch>
-typename IntervalTree<OptimizeSearch>::IntervalNode *
-IntervalTree<OptimizeSearch>::leftRightRotate(IntervalNode *Node) {
-	IntervalNode *MoveNode = Node->Left;
-	Node->Left = rightRightRotate(MoveNode);
-	std::cout<<"Left-Right Rotation";
+template<bool OptimizeSearch, typename PayloadTy>
+uint32_t IntervalTree<OptimizeSearch, PayloadTy>::leftRightRotate(uint32_t Node) {
+	rightRightRotate(node(Node).Left);
+	IT_DEBUG(std::cout<<"Left-Right Rotation");
 	return leftLeftRotate(Node);
 }
 
-template<bool OptimizeSearch>
-typename IntervalTree<OptimizeSearch>::IntervalNode *
-IntervalTree<OptimizeSearch>::rightLeftRotate(IntervalNode *Node) {
-	IntervalNode *MoveNode = Node->Right;
-	Node->Right = leftLeftRotate(MoveNode);
-	std::cout<<"Right-Left Rotation";
+template<bool OptimizeSearch, typename PayloadTy>
+uint32_t IntervalTree<OptimizeSearch, PayloadTy>::rightLeftRotate(uint32_t Node) {
+	leftLeftRotate(node(Node).Right);
+	IT_DEBUG(std::cout<<"Right-Left Rotation");
 	return rightRightRotate(Node);
 }
 
-// Function to balance a binary tree
-template<bool OptimizeSearch>
-typename IntervalTree<OptimizeSearch>::IntervalNode *
-IntervalTree<OptimizeSearch>::balanceTree(IntervalNode *Node) {
+// Update a node whose children are balanced and balance it. This returns the node
+// that takes its place.
+template<bool OptimizeSearch, typename PayloadTy>
+uint32_t IntervalTree<OptimizeSearch, PayloadTy>::balanceTree(uint32_t Node) {
+	updateNode(Node);
 	auto BalFactor = heightDiff(Node);
-	auto *BalancedNode = Node;
+	auto BalancedNode = Node;
 	if(BalFactor > 1) {
-		if(heightDiff(Node->Left) > 0)
-			BalancedNode = leftLeftRotate(Node);
-		else
+		if(heightDiff(node(Node).Left) < 0)
 			BalancedNode = leftRightRotate(Node);
+		else
+			BalancedNode = leftLeftRotate(Node);
 	} else if(BalFactor < -1) {
-		if(heightDiff(Node->Right) > 0)
+		if(heightDiff(node(Node).Right) > 0)
 			BalancedNode = rightLeftRotate(Node);
 		else
 			BalancedNode = rightRightRotate(Node);
@@ -400,534 +759,491 @@ IntervalTree<OptimizeSearch>::balanceTree(IntervalNode *Node) {
 	return BalancedNode;
 }
 
-// This is similar to inserting a node in a binary tree
-template<bool OptimizeSearch>
-typename IntervalTree<OptimizeSearch>::IntervalNode *
-IntervalTree<OptimizeSearch>::insertNode(IntervalNode *Node) {
-	std::cout << "====================INSERTING NODE:\n";
-	Node->print();
-	std::cout << "==================== PRINTING TREE:";
-	this->print();
-	if(!Root) {
+// Join two trees with a node whose key lies between the keys of the trees. The
+// node is linked in where the taller tree is as tall as the other one, so this
+// costs the difference of their heights.
+template<bool OptimizeSearch, typename PayloadTy>
+uint32_t IntervalTree<OptimizeSearch, PayloadTy>::
+joinWithPivot(uint32_t Left, uint32_t Pivot, uint32_t Right) {
+	uint32_t Parent = NullNode;
+	if(nodeHeight(Left) > nodeHeight(Right) + 1) {
+		Parent = Left;
+		while(nodeHeight(node(Parent).Right) > nodeHeight(Right) + 1)
+			Parent = node(Parent).Right;
+		Left = node(Parent).Right;
+		node(Parent).Right = Pivot;
+	} else if(nodeHeight(Right) > nodeHeight(Left) + 1) {
+		Parent = Right;
+		while(nodeHeight(node(Parent).Left) > nodeHeight(Left) + 1)
+			Parent = node(Parent).Left;
+		Right = node(Parent).Left;
+		node(Parent).Left = Pivot;
+	}
+	node(Pivot).Parent = Parent;
+	node(Pivot).Left = Left;
+	node(Pivot).Right = Right;
+	if(Left != NullNode)
+		node(Left).Parent = Pivot;
+	if(Right != NullNode)
+		node(Right).Parent = Pivot;
+	return rebalanceUpwards(Pivot);
+}
+
+// Join two trees where the keys of the left one are all below the keys of the
+// right one, using the leftmost node of the right one as the pivot
+template<bool OptimizeSearch, typename PayloadTy>
+uint32_t IntervalTree<OptimizeSearch, PayloadTy>::join(uint32_t Left, uint32_t Right) {
+	if(Left == NullNode)
+		return Right;
+	if(Right == NullNode)
+		return Left;
+	uint32_t Pivot = leftmostNode(Right);
+	uint32_t Parent = node(Pivot).Parent;
+	replaceChild(Parent, Pivot, node(Pivot).Right);
+	if(Parent != NullNode)
+		Right = rebalanceUpwards(Parent);
+	else
+		Right = node(Pivot).Right;
+	node(Pivot).reset();
+	return joinWithPivot(Left, Pivot, Right);
+}
+
+// Split a tree into the nodes whose keys are below the given key and the rest.
+// This joins the subtrees hanging off the path to the key, which costs as much as
+// walking down the path.
+template<bool OptimizeSearch, typename PayloadTy>
+std::pair<uint32_t, uint32_t>
+IntervalTree<OptimizeSearch, PayloadTy>::split(uint32_t Tree, uint64_t Key) {
+	if(Tree == NullNode)
+		return std::make_pair(Tree, Tree);
+	NumNodesVisited++;
+	uint32_t Left = node(Tree).Left;
+	uint32_t Right = node(Tree).Right;
+	if(Left != NullNode)
+		node(Left).Parent = NullNode;
+	if(Right != NullNode)
+		node(Right).Parent = NullNode;
+	node(Tree).reset();
+	if(node(Tree).Middle < Key) {
+		auto Trees = split(Right, Key);
+		return std::make_pair(joinWithPivot(Left, Tree, Trees.first), Trees.second);
+	}
+	auto Trees = split(Left, Key);
+	return std::make_pair(Trees.first, joinWithPivot(Trees.second, Tree, Right));
+}
+
+// Remove a node whose interval changed and insert it back where its key belongs now
+template<bool OptimizeSearch, typename PayloadTy>
+void IntervalTree<OptimizeSearch, PayloadTy>::reinsertNode(uint32_t Node) {
+	removeNode(Node);
+	node(Node).updateMiddle();
+	insertNode(Node);
+}
+
+// This is similar to inserting a node in a binary tree. The node is linked in
+// where its key belongs and is never merged with other nodes, so the caller has
+// to make sure it does not overlap with them if overlaps are to be avoided.
+template<bool OptimizeSearch, typename PayloadTy>
+void IntervalTree<OptimizeSearch, PayloadTy>::insertNode(uint32_t Node) {
+	IT_DEBUG(std::cout << "====================INSERTING NODE:\n");
+	IT_DEBUG(printNode(Node));
+	IT_DEBUG(std::cout << "==================== PRINTING TREE:");
+	IT_DEBUG(this->print());
+	if(Root == NullNode) {
 		Root = Node;
-		return Node;
-	}
-
-	auto *CurNode = Root;
-	while(CurNode) {
-	// Look for complete overlaps
-		if(OptimizeSearch) {
-			std::cout << "OPTIMIZED SEARCH ON\n";
-			if(Node->Start >= CurNode->Start
-			&& Node->End < CurNode->End) {
-			// Found a node that we overlap with, so return
-				std::cout << "COMPLETE OVERLAP FOUND\n";
-				return CurNode;
-			}
-			if(Node->Start == CurNode->End) {
-				std::cout << "APPEND\n";
-				CurNode->End = Node->End;
-				CurNode->updateMiddle();
-
-			// Check if this node needs to be moved
-				if(CurNode->Right && CurNode->Middle > CurNode->Right->Middle) {
-					removeNode(CurNode);
-					auto *InsertedNode = insertNode(CurNode);
-					if(InsertedNode != CurNode) {
-					// This means a node was found to have been in the tree already
-					// so we do not need the current node anymore.
-						NodesSet.erase(CurNode);
-						delete CurNode;
-						CurNode = InsertedNode;
-					} else {
-					// Balance the tree
-						//CurNode = balanceTree(CurNode);
-					}
-				}
-				return CurNode;
-			}
-			if(Node->End == CurNode->Start) {
-				std::cout << "PREPEND\n";
-				CurNode->Start = Node->Start;
-				CurNode->updateMiddle();
-
-			// Check if this node needs to be moved
-				if(CurNode->Left && CurNode->Middle <= CurNode->Left->Middle) {
-				// This node needs to be removed and added back
-					removeNode(CurNode);
-					auto *InsertedNode = insertNode(CurNode);
-					if(InsertedNode != CurNode) {
-					// This means a node was found to have been in the tree already
-					// so we do not need the current node anymore.
-						NodesSet.erase(CurNode);
-						delete CurNode;
-						CurNode = InsertedNode;
-					} else {
-					// Balance the tree
-						//CurNode = balanceTree(CurNode);
-					}
-				}
-				return CurNode;
-			}
-			if(Node->Start < CurNode->Start && Node->End > CurNode->End) {
-			// Coalesce the nodes by merging it with existing node, removing it and
-			// reinserting it into the tree.
-				CurNode->Start = Node->Start;
-				CurNode->End = Node->End;
-				CurNode->updateMiddle();
-
-			// Check if this node needs to be moved
-				if((CurNode->Left && CurNode->Middle <= CurNode->Left->Middle)
-				|| (CurNode->Right && CurNode->Middle > CurNode->Right->Middle)) {
-					removeNode(CurNode);
-					auto *InsertedNode = insertNode(CurNode);
-					if(InsertedNode != CurNode) {
-					// This means a node was found to have been in the tree already
-					// so we do not need the current node anymore.
-						NodesSet.erase(CurNode);
-						delete CurNode;
-						CurNode = InsertedNode;
-					} else {
-					// Balance the tree
-						//CurNode = balanceTree(CurNode);
-					}
-				}
-				return CurNode;
-			}
-		}
+		updateNode(Node);
+		return;
+	}
 
-		if(CurNode->Middle > Node->Middle) {
-			if(!CurNode->Left) {
-			// Insert here
-				CurNode->Left = Node;
-				Node->Parent = CurNode;
-				return Node;
-			}
-			CurNode = CurNode->Left;
-		} else {
-			if(!CurNode->Right) {
-			// Insert here
-				CurNode->Right = Node;
-				Node->Parent = CurNode;
-				return Node;
-			}
-			CurNode = CurNode->Right;
+	uint32_t CurNode = Root;
+	while(true) {
+		NumNodesVisited++;
+		IntervalNode &Cur = node(CurNode);
+		uint32_t &Child = (Cur.Middle > node(Node).Middle) ? Cur.Left : Cur.Right;
+		if(Child == NullNode) {
+		// Insert here
+			Child = Node;
+			node(Node).Parent = CurNode;
+			updateUpwards(Node);
+			return;
 		}
+		CurNode = Child;
 	}
-	return Node; // Keep the compiler happy
 }
 
 // This is very similar to removing a node from a binary tree
-template<bool OptimizeSearch>
-void IntervalTree<OptimizeSearch>::removeNode(IntervalNode *Node) {
+template<bool OptimizeSearch, typename PayloadTy>
+void IntervalTree<OptimizeSearch, PayloadTy>::removeNode(uint32_t Node) {
 // If root does not exist, just exit
-	if(!Root)
+	if(Root == NullNode)
 		return;
 
+	IntervalNode &Removed = node(Node);
+
 // Check if the given node is a leaf
-	if(!Node->Left && !Node->Right) {
-		std::cout << "REMOVING LEAF NODE\n";
-		if(Node->Parent) {
-			if(Node->Parent->Left == Node)
-				Node->Parent->Left = nullptr;
+	if(Removed.Left == NullNode && Removed.Right == NullNode) {
+		IT_DEBUG(std::cout << "REMOVING LEAF NODE\n");
+		if(Removed.Parent != NullNode) {
+			if(node(Removed.Parent).Left == Node)
+				node(Removed.Parent).Left = NullNode;
 			else
-				Node->Parent->Right = nullptr;
+				node(Removed.Parent).Right = NullNode;
+			updateUpwards(Removed.Parent);
 		} else {
 		// This node is root
-			std::cout << "NODE TO BE REMOVED HAS NO PARENT\n";
-			Root = nullptr;
+			IT_DEBUG(std::cout << "NODE TO BE REMOVED HAS NO PARENT\n");
+			Root = NullNode;
 		}
 
 	// Reset the given node
-		Node->reset();
+		Removed.reset();
 		return;
 	}
 
 // The given node is not a leaf. So find the leftmost element in the
 // right subtree if it exists.
-	if(Node->Left && Node->Right) {
-		std::cout << "NODE HAS 2 CHILDREN\n";
-		IntervalNode *CurNode = Node->Right;
-		while(CurNode->Left)
-			CurNode = CurNode->Left;
+	if(Removed.Left != NullNode && Removed.Right != NullNode) {
+		IT_DEBUG(std::cout << "NODE HAS 2 CHILDREN\n");
+		uint32_t CurNode = Removed.Right;
+		while(node(CurNode).Left != NullNode)
+			CurNode = node(CurNode).Left;
+		IntervalNode &Cur = node(CurNode);
+
+	// Bounds change from where the current node is taken out of the tree
+		uint32_t BoundsNode = CurNode;
 
 	// Remove the current node from the tree
-		if(CurNode != Node->Right) {
-			if(CurNode->Parent->Left == CurNode)
-				CurNode->Parent->Left = CurNode->Right;
+		if(CurNode != Removed.Right) {
+			BoundsNode = Cur.Parent;
+			if(node(Cur.Parent).Left == CurNode)
+				node(Cur.Parent).Left = Cur.Right;
 			else
-				CurNode->Parent->Right = CurNode->Right;
-			if(CurNode->Right)
-				CurNode->Right->Parent = CurNode->Parent;
-			CurNode->Right = Node->Right;
-			Node->Right->Parent = CurNode;
+				node(Cur.Parent).Right = Cur.Right;
+			if(Cur.Right != NullNode)
+				node(Cur.Right).Parent = Cur.Parent;
+			Cur.Right = Removed.Right;
+			node(Removed.Right).Parent = CurNode;
 		}
-		CurNode->Left = Node->Left;
-		CurNode->Parent = Node->Parent;
-		Node->Left->Parent = CurNode;
+		Cur.Left = Removed.Left;
+		Cur.Parent = Removed.Parent;
+		node(Removed.Left).Parent = CurNode;
 
 	// Now remove the node to replace the given node
-		IntervalNode **CheckNode;
-		if(auto *Parent = Node->Parent) {
-			if(Parent->Left == Node)
-				Parent->Left = CurNode;
+		if(uint32_t Parent = Removed.Parent) {
+			if(node(Parent).Left == Node)
+				node(Parent).Left = CurNode;
 			else
-				Parent->Right = CurNode;
-			CheckNode = &Parent;
+				node(Parent).Right = CurNode;
 		} else {
 		// The given node is a root
 			Root = CurNode;
-			CheckNode = &Root;
 		}
 
-	// Reset the given node
-		Node->reset();
+	// Rebalance the tree from where the current node was taken out
+		updateUpwards(BoundsNode);
 
-	// Balance the tree
-		//*CheckNode = balanceTree(*CheckNode);
+	// Reset the given node
+		Removed.reset();
 		return;
 	}
 
 // In this case one child exists
-	std::cout << "NODE HAS ONE CHILD\n";
-	IntervalNode *SubNode;
-	IntervalNode **CheckNode;
-	if(Node->Right)
-		SubNode = Node->Right;
+	IT_DEBUG(std::cout << "NODE HAS ONE CHILD\n");
+	uint32_t SubNode;
+	if(Removed.Right != NullNode)
+		SubNode = Removed.Right;
 	else
-		SubNode = Node->Left;
-	if(Node->Parent) {
-		if(Node->Parent->Left == Node)
-			Node->Parent->Left = SubNode;
+		SubNode = Removed.Left;
+	if(Removed.Parent != NullNode) {
+		if(node(Removed.Parent).Left == Node)
+			node(Removed.Parent).Left = SubNode;
 		else
-			Node->Parent->Right = SubNode;
-		SubNode->Parent = Node->Parent;
-		*CheckNode = Node->Parent;
+			node(Removed.Parent).Right = SubNode;
+		node(SubNode).Parent = Removed.Parent;
 	} else {
 	// This node is root
 		Root = SubNode;
-		*CheckNode = Root;
-		std::cout << "NODE TO BE REMOVED IS A ROOT\n";
-		std::cout << "PRINTING ROOT:\n";
-		Root->print();
+		node(SubNode).Parent = NullNode;
+		IT_DEBUG(std::cout << "NODE TO BE REMOVED IS A ROOT\n");
+		IT_DEBUG(std::cout << "PRINTING ROOT:\n");
+		IT_DEBUG(printNode(Root));
 	}
+	updateUpwards(node(SubNode).Parent);
 
 // Reset the given node
-	Node->reset();
-
-// Balance the tree
-	//*CheckNode = balanceTree(*CheckNode);
+	Removed.reset();
 }
 
 // This does NOT look for partial overlaps of range
-template<bool OptimizeSearch>
-typename IntervalTree<OptimizeSearch>::IntervalNode *
-IntervalTree<OptimizeSearch>::internalSearch(uint64_t Start, uint64_t End) const {
-	std::cout << "INTERNAL SEARCH " << Start << " TO " << End << "\n";
+template<bool OptimizeSearch, typename PayloadTy>
+uint32_t IntervalTree<OptimizeSearch, PayloadTy>::internalSearch(uint64_t Start, uint64_t End) const {
+	IT_DEBUG(std::cout << "INTERNAL SEARCH " << Start << " TO " << End << "\n");
 
 // Find a node that completely overlaps
 	uint64_t Middle = getMiddle(Start, End);
-	auto *CurNode = Root;
-	while(CurNode) {
-		std::cout << "CHECKING NODE :";
-		CurNode->print();
+	uint32_t CurNode = Root;
+	while(CurNode != NullNode) {
+		IT_DEBUG(std::cout << "CHECKING NODE :");
+		IT_DEBUG(printNode(CurNode));
+		NumNodesVisited++;
+		const IntervalNode &Cur = node(CurNode);
 
 	// Look for complete overlap
-		if(Start >= CurNode->Start
-		&& End <= CurNode->End) {
-			std::cout << "NODE FOUND\n";
+		if(Start >= Cur.Start
+		&& End <= Cur.End) {
+			IT_DEBUG(std::cout << "NODE FOUND\n");
 			return CurNode;
 		}
 
-		if(CurNode->Middle > Middle)
-			CurNode = CurNode->Left;
+		if(Cur.Middle > Middle)
+			CurNode = Cur.Left;
 		else
-			CurNode = CurNode->Right;
+			CurNode = Cur.Right;
 	}
 
 // Node not found
-	return nullptr;
+	return NullNode;
 }
 
-template<bool OptimizeSearch>
-ITResult IntervalTree<OptimizeSearch>::
+// Remove a range from the intervals. The nodes whose keys are in the range are
+// split off the tree at once and the nodes that overlap the range from outside
+// are taken out one by one. What is left of the intervals of all of them is then
+// inserted back. The result has the nodes in the order of their starts.
+template<bool OptimizeSearch, typename PayloadTy>
+ITResult IntervalTree<OptimizeSearch, PayloadTy>::
 detailedInternalRemove(uint64_t Start, uint64_t End, bool AllowPartialRemoval) {
-// Search for the nodes
-	auto Result = detailedInternalSearch(Start, End);
-	std::cout << "INTERNAL SEARCH DONE\n";
-	if(Result.getOverlapResult() == ITResult::NoOverlap
-	|| (!AllowPartialRemoval && Result.getOverlapResult() == ITResult::PartialOverlap)) {
+	PreviousPayloadsVect.clear();
+
+// Find the nodes to remove the range from
+	RemovedNodesVect.clear();
+	forEachOverlappingNode(Start, End, [&](uint32_t Index) {
+		RemovedNodesVect.push_back(Index);
+	});
+	ITResult::NodeOverlapInfoVectTy OverlapIntervalNodesVect;
+	if(RemovedNodesVect.empty()) {
 	// Nothing to remove
-		std::cout << "NOTHING TO REMOVE\n";
-		return Result;
-	}
-
-// Iterate over all the nodes we found overlaps with
-	std::vector<std::tuple<IntervalNodeConcept *, ITResult::OverlapResult,
-						   ITResult::NodeRange>> OverlapIntervalNodesVect;
-	std::vector<ITResult::NodeRange> NodesStatusVect;
-	for(auto NodeAndOverlapTuple : Result.getNodesAndOverlapResults()) {
-	// Get the node
-		IntervalNode *Node = dynamic_cast<IntervalNode *>(std::get<0>(NodeAndOverlapTuple));
-
-		std::cout << "OVERLAP FOUND WITH: \n";
-		Node->print();
-
-	// Modify and remove it
-		ITResult::NodeRange OverlapRange = std::get<2>(NodeAndOverlapTuple);
-		std::cout << "OVERLAP RANGE\n";
-		OverlapRange.print();
-		switch(std::get<1>(NodeAndOverlapTuple)) {
-			case ITResult::PartialOverlap:
-				std::cout << "PARTIAL OVERLAP\n";
-			// Record the previous state of the node
-				NodesStatusVect.push_back(ITResult::NodeRange(Node->Start, Node->End));
-
-			// Adjust the range
-				if(OverlapRange.Start >= Node->Start && OverlapRange.Start < Node->End) {
-					Node->End = OverlapRange.Start;
-					Node->updateMiddle();
-
-				// Check if this node needs to be removed and reinserted
-					if(Node->Left && Node->Middle <= Node->Left->Middle) {
-					// This node needs to be removed and added back
-						removeNode(Node);
-						auto *NewNode = insertNode(Node);
-						if(NewNode != Node) {
-						// This means a node was found to have been in the tree already
-						// so we do not need the current node anymore.
-							NodesSet.erase(Node);
-							delete Node;
-							Node = NewNode;
-						}
-					}
-				} else if(OverlapRange.End > Node->Start && OverlapRange.End <= Node->End) {
-					Node->Start = OverlapRange.End;
-					Node->updateMiddle();
-
-				// Check if this node needs to be removed and reinserted
-					if(Node->Right && Node->Middle <= Node->Right->Middle) {
-					// This node needs to be removed and added back
-						removeNode(Node);
-						auto *NewNode = insertNode(Node);
-						if(NewNode != Node) {
-						// This means a node was found to have been in the tree already
-						// so we do not need the current node anymore.
-							NodesSet.erase(Node);
-							delete Node;
-							Node = NewNode;
-						}
-					}
-				}
-				OverlapIntervalNodesVect.push_back(std::make_tuple(Node,
-												   ITResult::PartialOverlap,
-												   OverlapRange));
-				break;
-
-			case ITResult::CompleteOverlap:
-				std::cout << "COMPLETE OVERLAP\n";
-			// Record the previous state of the node
-				NodesStatusVect.push_back(ITResult::NodeRange(Node->Start, Node->End));
-
-			// Check if the interval is on either end
-				if(OverlapRange.Start == Node->Start) {
-					Node->Start = OverlapRange.End;
-					Node->updateMiddle();
-
-				// Check if this node needs to be removed and reinserted
-					if(Node->Right && Node->Middle <= Node->Right->Middle) {
-					// This node needs to be removed and added back
-						removeNode(Node);
-						auto *NewNode = insertNode(Node);
-						if(NewNode != Node) {
-						// This means a node was found to have been in the tree already
-						// so we do not need the current node anymore.
-							NodesSet.erase(Node);
-							delete Node;
-							Node = NewNode;
-						}
-					}
-					OverlapIntervalNodesVect.push_back(std::make_tuple(Node,
-													   ITResult::CompleteOverlap,
-													   OverlapRange));
-				} else if(OverlapRange.End == Node->End) {
-					Node->End = OverlapRange.Start;
-					Node->updateMiddle();
-
-				// Check if this node needs to be removed and reinserted
-					if(Node->Left && Node->Middle <= Node->Left->Middle) {
-					// This node needs to be removed and added back
-						removeNode(Node);
-						auto *NewNode = insertNode(Node);
-						if(NewNode != Node) {
-						// This means a node was found to have been in the tree already
-						// so we do not need the current node anymore.
-							NodesSet.erase(Node);
-							delete Node;
-							Node = NewNode;
-						}
-					}
-					OverlapIntervalNodesVect.push_back(std::make_tuple(Node,
-									   	   	   	   	   ITResult::CompleteOverlap,
-													   OverlapRange));
-				} else {
-					std::cout << "SPLIT NODE\n";
-				// Overlap is somewhere in the middle so we split this node into two, so
-				// allocate one more node. But frst adjust this existing node.
-					auto OldNodeEnd = Node->End;
-					Node->End = OverlapRange.Start;
-					Node->updateMiddle();
-
-				// Check if this node needs to be removed and reinserted
-					if(Node->Left && Node->Middle <= Node->Left->Middle) {
-						removeNode(Node);
-						auto *InsertedNewNode = insertNode(Node);
-						if(InsertedNewNode != Node) {
-						// This means a node was found to have been in the tree already
-						// so we do not need the current node anymore.
-							NodesSet.erase(Node);
-							delete Node;
-							Node = InsertedNewNode;
-						}
-					}
-
-				// Now allocate the new node
-					auto *NewNode = new IntervalNode(OverlapRange.End, OldNodeEnd);
-					std::cout << "INSERTING RANGE: " << OverlapRange.End << " TO " << OldNodeEnd << "\n";
-					auto *InsertedNewNode = insertNode(NewNode);
-					if(InsertedNewNode != NewNode) {
-						std::cout << "DELETE NEW NODE\n";
-					// This means a node was found to have been in the tree already
-					// so we do not need the current node anymore.
-						delete NewNode;
-						NewNode = InsertedNewNode;
-					} else {
-					// Add this new node to the set
-						NodesSet.insert(NewNode);
-					}
-
-				// Add both the nodes to the result
-					OverlapIntervalNodesVect.push_back(std::make_tuple(Node,
-									   ITResult::CompleteOverlap,
-									   OverlapRange));
-					OverlapIntervalNodesVect.push_back(std::make_tuple(NewNode,
-									   ITResult::CompleteOverlap,
-									   OverlapRange));
-
-				// Add to node range again for the newly allocated node
-					NodesStatusVect.push_back(NodesStatusVect.back());
-				}
-				continue;
-				//return ITResult(Result.getOverlapResult(), OverlapIntervalNodesVect, NodesStatusVect);
-
-			case ITResult::CompletelyPerfectOverlap:
-				std::cout << "COMPLETELY PERFECT OVERLAP\n";
-			// Record the previous state of the node
-				NodesStatusVect.push_back(ITResult::NodeRange(Node->Start, Node->End));
-
-			// Remove the entire node and update result
-				removeNode(Node);
-				NodesSet.erase(Node);
-				delete Node;
-				OverlapIntervalNodesVect.push_back(std::make_tuple(nullptr,
-								   ITResult::CompletelyPerfectOverlap,
-								   OverlapRange));
-				continue;
-				//return ITResult(Result.getOverlapResult(), OverlapIntervalNodesVect, NodesStatusVect);
+		IT_DEBUG(std::cout << "NOTHING TO REMOVE\n");
+		return ITResult(ITResult::NoOverlap, OverlapIntervalNodesVect);
+	}
+	std::sort(RemovedNodesVect.begin(), RemovedNodesVect.end(),
+						[&](uint32_t A, uint32_t B) {
+		return node(A).Start < node(B).Start;
+	});
+
+// See how much of the range the nodes cover
+	ITResult::OverlapResult OR = ITResult::PartialCompleteOverlap;
+	uint64_t CoveredEnd = Start;
+	for(auto Node : RemovedNodesVect) {
+		const IntervalNode &Cur = node(Node);
+		if(Cur.Start <= Start && Cur.End >= End) {
+			OR = (Cur.Start == Start && Cur.End == End && RemovedNodesVect.size() == 1) ?
+						ITResult::CompletelyPerfectOverlap : ITResult::CompleteOverlap;
+			break;
+		}
+		if(Cur.Start > CoveredEnd)
+			OR = ITResult::PartialOverlap;
+		CoveredEnd = std::max(CoveredEnd, Cur.End);
+	}
+	if(CoveredEnd < End && OR == ITResult::PartialCompleteOverlap)
+		OR = ITResult::PartialOverlap;
+	if(!AllowPartialRemoval && OR == ITResult::PartialOverlap) {
+		IT_DEBUG(std::cout << "NOTHING TO REMOVE\n");
+		for(auto Node : RemovedNodesVect) {
+			OverlapIntervalNodesVect.push_back(ITResult::makeNodeOverlapInfo(Node,
+											   ITResult::PartialOverlap, node(Node),
+											   ITResult::NodeRange(std::max(node(Node).Start, Start),
+																						 std::min(node(Node).End, End))));
+		}
+		return ITResult(OR, OverlapIntervalNodesVect);
+	}
+
+// Split off the nodes whose keys are in the range, unless there are so few nodes
+// that taking them out one by one is cheaper. The nodes split off that do not
+// overlap with the range have keys out of order, so they go back into the tree,
+// unless they are empty.
+	StrayNodesVect.clear();
+	if(RemovedNodesVect.size() > MaxNodesRemovedOneByOne) {
+		auto LeftTrees = split(Root, Start);
+		auto RightTrees = split(LeftTrees.second, End);
+		Root = join(LeftTrees.first, RightTrees.second);
+		if(RightTrees.first != NullNode)
+			StrayNodesVect.push_back(RightTrees.first);
+	}
+	for(uint32_t I = 0; I != StrayNodesVect.size();) {
+		uint32_t Node = StrayNodesVect[I];
+		IntervalNode &Cur = node(Node);
+		if(Cur.Left != NullNode)
+			StrayNodesVect.push_back(Cur.Left);
+		if(Cur.Right != NullNode)
+			StrayNodesVect.push_back(Cur.Right);
+		Cur.reset();
+		if(Cur.Start < End && Cur.End > Start) {
+			StrayNodesVect[I] = StrayNodesVect.back();
+			StrayNodesVect.pop_back();
+			continue;
 		}
+		if(Cur.Start == Cur.End) {
+			freeNode(Node);
+			StrayNodesVect[I] = StrayNodesVect.back();
+			StrayNodesVect.pop_back();
+			continue;
+		}
+		++I;
+	}
+	for(auto Node : StrayNodesVect)
+		insertNode(Node);
+
+// Take out the rest of the nodes, which are still in the tree
+	for(auto Node : RemovedNodesVect) {
+		if(node(Node).Parent != NullNode || Node == Root)
+			removeNode(Node);
 	}
-	return ITResult(Result.getOverlapResult(), OverlapIntervalNodesVect, NodesStatusVect);
+
+// Put back what is left of the intervals of the nodes
+	ITResult::NodeRangeVectTy NodesStatusVect;
+	for(auto Node : RemovedNodesVect) {
+		IT_DEBUG(std::cout << "OVERLAP FOUND WITH: \n");
+		IT_DEBUG(printNode(Node));
+
+	// Record the previous state of the node
+		recordPreviousState(Node, NodesStatusVect);
+		uint64_t NodeStart = node(Node).Start;
+		uint64_t NodeEnd = node(Node).End;
+		ITResult::NodeRange OverlapRange(std::max(NodeStart, Start), std::min(NodeEnd, End));
+		if(NodeStart >= Start && NodeEnd <= End) {
+			IT_DEBUG(std::cout << "COMPLETELY PERFECT OVERLAP\n");
+			freeNode(Node);
+			OverlapIntervalNodesVect.push_back(ITResult::makeNodeOverlapInfo(NullNode,
+											   ITResult::CompletelyPerfectOverlap,
+											   IntervalNodeConcept(), OverlapRange));
+			continue;
+		}
+		auto NodeOR = (NodeStart <= Start && NodeEnd >= End) ?
+									ITResult::CompleteOverlap : ITResult::PartialOverlap;
+
+	// Keep the part before the range in the node, or the part after it if there
+	// is nothing before it
+		if(NodeStart < Start)
+			node(Node).End = Start;
+		else
+			node(Node).Start = End;
+		node(Node).updateMiddle();
+		insertNode(Node);
+		OverlapIntervalNodesVect.push_back(ITResult::makeNodeOverlapInfo(Node,
+										   NodeOR, node(Node), OverlapRange));
+		if(NodeStart >= Start || NodeEnd <= End)
+			continue;
+
+	// The range was in the middle of the node, so allocate one more node for the
+	// part after it. It shares the payload the node had.
+		IT_DEBUG(std::cout << "SPLIT NODE\n");
+		uint32_t NewNode = allocateNode(End, NodeEnd);
+		if(!std::is_empty<PayloadTy>::value)
+			node(NewNode).payload() = PreviousPayloadsVect.back();
+		insertNode(NewNode);
+		OverlapIntervalNodesVect.push_back(ITResult::makeNodeOverlapInfo(NewNode,
+										   NodeOR, node(NewNode), OverlapRange));
+
+	// Add to node range again for the newly allocated node
+		NodesStatusVect.push_back(NodesStatusVect.back());
+		if(!std::is_empty<PayloadTy>::value)
+			PreviousPayloadsVect.push_back(PreviousPayloadsVect.back());
+	}
+	return ITResult(OR, OverlapIntervalNodesVect, NodesStatusVect);
 }
 
 // This looks for partial overlaps of given range
-template<bool OptimizeSearch>
-ITResult IntervalTree<OptimizeSearch>::
+template<bool OptimizeSearch, typename PayloadTy>
+ITResult IntervalTree<OptimizeSearch, PayloadTy>::
 detailedInternalSearch(uint64_t Start, uint64_t End) const {
-	std::cout << "DETAILED SEARCHING NODE\n";
+	IT_DEBUG(std::cout << "DETAILED SEARCHING NODE\n");
 
-	std::vector<std::tuple<IntervalNodeConcept *, ITResult::OverlapResult,
-						   ITResult::NodeRange>> OverlapIntervalNodesVect;
-	std::vector<std::tuple<uint64_t, uint64_t, IntervalNode *>> IntervalWorklist;
+	ITResult::NodeOverlapInfoVectTy OverlapIntervalNodesVect;
+	std::vector<std::tuple<uint64_t, uint64_t, uint32_t>> IntervalWorklist;
 	IntervalWorklist.push_back(std::make_tuple(Start, End, Root));
 	bool IntervalNotFound = false;
 	while(!IntervalWorklist.empty()) {
 	// Look for complete and partial overlaps
-		std::cout << "LOOP BACK\n";
+		IT_DEBUG(std::cout << "LOOP BACK\n");
 		auto Tuple = IntervalWorklist.back();
 		IntervalWorklist.pop_back();
 		auto &Start = std::get<0>(Tuple);
 		auto &End = std::get<1>(Tuple);
-		auto *CurNode = std::get<2>(Tuple);
-		std::cout << "LOOKING AT INTERVAL: " << Start << " - " << End << "\n";
-		if(!CurNode) {
+		uint32_t CurNode = std::get<2>(Tuple);
+		IT_DEBUG(std::cout << "LOOKING AT INTERVAL: " << Start << " - " << End << "\n");
+		if(CurNode == NullNode) {
 			IntervalNotFound = true;
-			std::cout << "INTERVAL NOT FOUND\n";
+			IT_DEBUG(std::cout << "INTERVAL NOT FOUND\n");
 			continue;
 		}
 
-		std::cout << "SEARCHING NODE: ";
-		CurNode->print();
+		IT_DEBUG(std::cout << "SEARCHING NODE: ");
+		IT_DEBUG(printNode(CurNode));
+		NumNodesVisited++;
+		const IntervalNode &Cur = node(CurNode);
 
 	// Look for overlaps with existing intervals
-		if(Start == CurNode->Start && End == CurNode->End) {
-			std::cout << "COMPLETE OVERLAP\n";
-			OverlapIntervalNodesVect.push_back(std::make_tuple(CurNode,
-												ITResult::CompletelyPerfectOverlap,
+		if(Start == Cur.Start && End == Cur.End) {
+			IT_DEBUG(std::cout << "COMPLETE OVERLAP\n");
+			OverlapIntervalNodesVect.push_back(ITResult::makeNodeOverlapInfo(CurNode,
+												ITResult::CompletelyPerfectOverlap, Cur,
 												ITResult::NodeRange(Start, End)));
 			if(OverlapIntervalNodesVect.size() == 1)
 				return ITResult(ITResult::CompletelyPerfectOverlap, OverlapIntervalNodesVect);
 			continue;
-		} else if(Start >= CurNode->Start && End <= CurNode->End) {
-			std::cout << "COMPLETE OVERLAP\n";
-			OverlapIntervalNodesVect.push_back(std::make_tuple(CurNode, ITResult::CompleteOverlap,
+		} else if(Start >= Cur.Start && End <= Cur.End) {
+			IT_DEBUG(std::cout << "COMPLETE OVERLAP\n");
+			OverlapIntervalNodesVect.push_back(ITResult::makeNodeOverlapInfo(CurNode,
+												ITResult::CompleteOverlap, Cur,
 												ITResult::NodeRange(Start, End)));
 			if(OverlapIntervalNodesVect.size() == 1)
 				return ITResult(ITResult::CompleteOverlap, OverlapIntervalNodesVect);
 			continue;
-		} else if(Start < CurNode->Start && End > CurNode->End) {
-			std::cout << "LARGER PARTIAL OVERLAP\n";
+		} else if(Start < Cur.Start && End > Cur.End) {
+			IT_DEBUG(std::cout << "LARGER PARTIAL OVERLAP\n");
 		// Also consider the case where the given range could be larger than the node range
-			OverlapIntervalNodesVect.push_back(std::make_tuple(CurNode,
-															   ITResult::CompletelyPerfectOverlap,
+			OverlapIntervalNodesVect.push_back(ITResult::makeNodeOverlapInfo(CurNode,
+															   ITResult::CompletelyPerfectOverlap, Cur,
 															   ITResult::NodeRange(Start, End)));
 		// Push the new intervals to the wait list
-			IntervalNode *NextNode;
-			auto Middle = getMiddle(CurNode->End, End);
-			if(CurNode->Middle > Middle)
-				NextNode = CurNode->Left;
+			uint32_t NextNode;
+			auto Middle = getMiddle(Cur.End, End);
+			if(Cur.Middle > Middle)
+				NextNode = Cur.Left;
 			else
-				NextNode = CurNode->Right;
-			IntervalWorklist.push_back(std::make_tuple(CurNode->End, End, NextNode));
-			std::cout << "NEW INTERVAL: " << CurNode->End << " - " << End << "\n";
-			End = CurNode->Start;
+				NextNode = Cur.Right;
+			IntervalWorklist.push_back(std::make_tuple(Cur.End, End, NextNode));
+			IT_DEBUG(std::cout << "NEW INTERVAL: " << Cur.End << " - " << End << "\n");
+			End = Cur.Start;
 			//IntervalWorklist.push_back(std::make_tuple(Start, End, CurNode));
-			std::cout << "NEW INTERVAL: " << Start << " - " << End << "\n";
-		} else if(Start >= CurNode->Start && Start < CurNode->End) {
-			std::cout << "PARTIAL OVERLAP\n";
-		// Looked for partial overlap. Malloc bug found here if CurNode is used as a
-		// reference to the pointer and not a pure pointer. Bloody hell.
-			OverlapIntervalNodesVect.push_back(std::make_tuple(CurNode, ITResult::PartialOverlap,
+			IT_DEBUG(std::cout << "NEW INTERVAL: " << Start << " - " << End << "\n");
+		} else if(Start >= Cur.Start && Start < Cur.End) {
+			IT_DEBUG(std::cout << "PARTIAL OVERLAP\n");
+		// Looked for partial overlap
+			OverlapIntervalNodesVect.push_back(ITResult::makeNodeOverlapInfo(CurNode,
+															ITResult::PartialOverlap, Cur,
 															ITResult::NodeRange(Start, End)));
 		// Update Start and continue
-			Start = CurNode->End;
+			Start = Cur.End;
 			//IntervalWorklist.push_back(std::make_tuple(Start, End, CurNode));
-			std::cout << "NEW START: " << Start << "\n";
-		} else if(End > CurNode->Start && End <= CurNode->End) {
-			std::cout << "PARTIAL OVERLAP\n";
+			IT_DEBUG(std::cout << "NEW START: " << Start << "\n");
+		} else if(End > Cur.Start && End <= Cur.End) {
+			IT_DEBUG(std::cout << "PARTIAL OVERLAP\n");
 		// Looked for partial overlap
-			OverlapIntervalNodesVect.push_back(std::make_tuple(CurNode, ITResult::PartialOverlap,
+			OverlapIntervalNodesVect.push_back(ITResult::makeNodeOverlapInfo(CurNode,
+															ITResult::PartialOverlap, Cur,
 															ITResult::NodeRange(Start, End)));
 		// Update End and continue
-			End = CurNode->Start;
+			End = Cur.Start;
 			//IntervalWorklist.push_back(std::make_tuple(Start, End, CurNode));
-			std::cout << "NEW END: " << End << "\n";
+			IT_DEBUG(std::cout << "NEW END: " << End << "\n");
 		}
 
 		auto Middle = getMiddle(Start, End);
-		if(CurNode->Middle > Middle)
-			IntervalWorklist.push_back(std::make_tuple(Start, End, CurNode->Left));
+		if(Cur.Middle > Middle)
+			IntervalWorklist.push_back(std::make_tuple(Start, End, Cur.Left));
 		else
-			IntervalWorklist.push_back(std::make_tuple(Start, End, CurNode->Right));
+			IntervalWorklist.push_back(std::make_tuple(Start, End, Cur.Right));
 	}
 	if(OverlapIntervalNodesVect.empty())
 		return ITResult(ITResult::NoOverlap, OverlapIntervalNodesVect);
@@ -938,165 +1254,151 @@ detailedInternalSearch(uint64_t Start, uint64_t End) const {
 		return ITResult(ITResult::PartialOverlap, OverlapIntervalNodesVect);
 }
 
-// Note that the End is not inclusive in the range, unlike Start
-template<bool OptimizeSearch>
-ITResult IntervalTree<OptimizeSearch>::insert(uint64_t Start, uint64_t End) {
-	std::cout << "INSERTING INTERVAL IN INTERVAL TREE: "  << Start << " TO " << End << "\n";
-	uint64_t Middle = getMiddle(Start, End);
-	std::cout << "MIDDLE: " << Middle << "\n";
-	IntervalNode **CurNodeAddr = &Root;
-	IntervalNode *ParentNode = nullptr;
-	while(IntervalNode *CurNode = *CurNodeAddr) {
-		std::cout << "PRINTING CURRENT NODE: ";
-		CurNode->print();
-
-		if(OptimizeSearch) {
-		// If complete overlap is found
-			if(Start == CurNode->Start && End == CurNode->End) {
-				std::cout << "COMPLETE OVERLAP\n";
-				return ITResult(ITResult::CompletelyPerfectOverlap, CurNode);
-			}
-			if(Start >= CurNode->Start && End <= CurNode->End) {
-				std::cout << "COMPLETE OVERLAP\n";
-				return ITResult(ITResult::CompleteOverlap, CurNode);
-			}
+// Note that the End is not inclusive in the range, unlike Start. With optimized
+// search the intervals stay disjoint: all the nodes the new interval overlaps with
+// are merged into one, and a node it only touches is extended by it. The results
+// are the same as those of the flat interval set.
+template<bool OptimizeSearch, typename PayloadTy>
+ITResult IntervalTree<OptimizeSearch, PayloadTy>::insert(uint64_t Start, uint64_t End) {
+	IT_DEBUG(std::cout << "INSERTING INTERVAL IN INTERVAL TREE: "  << Start << " TO " << End << "\n");
+	if(OptimizeSearch) {
+	// Find all the nodes the interval overlaps with
+		RemovedNodesVect.clear();
+		forEachOverlappingNode(Start, End, [&](uint32_t Index) {
+			RemovedNodesVect.push_back(Index);
+		});
+		if(!RemovedNodesVect.empty()) {
+			std::sort(RemovedNodesVect.begin(), RemovedNodesVect.end(),
+								[&](uint32_t A, uint32_t B) {
+				return node(A).Start < node(B).Start;
+			});
+			uint32_t FirstNode = RemovedNodesVect.front();
 
-		// No overlap but contiguous cases
-			if(Start == CurNode->End) {
-				std::cout << "APPEND NODE\n";
-				CurNode->End = End;
-				CurNode->updateMiddle();
-
-			// Check if this node needs to be moved
-				if(CurNode->Right && CurNode->Middle > CurNode->Right->Middle) {
-				// This node needs to be removed and added back
-					removeNode(CurNode);
-					std::cout << "CURRENT NODE REMOVED\n";
-					auto *Node = insertNode(CurNode);
-					std::cout << "CURRENT NODE REINSERTED\n";
-					if(Node != CurNode) {
-					// This means a node was found to have been in the tree already
-					// so we do not need the current node anymore.
-						NodesSet.erase(CurNode);
-						delete CurNode;
-						CurNode = Node;
-					}
-				}
-				return ITResult(ITResult::NoOverlap, CurNode);
-			}
-			if(End == CurNode->Start) {
-				std::cout << "PREPEND NODE\n";
-				CurNode->Start = Start;
-				CurNode->updateMiddle();
-
-			// Check if this node needs to be moved
-				if(CurNode->Left && CurNode->Middle <= CurNode->Left->Middle) {
-				// This node needs to be removed and added back
-					removeNode(CurNode);
-					auto *Node = insertNode(CurNode);
-					if(Node != CurNode) {
-					// This means a node was found to have been in the tree already
-					// so we do not need the current node anymore.
-						NodesSet.erase(CurNode);
-						delete CurNode;
-						CurNode = Node;
-					}
-				}
-				return ITResult(ITResult::NoOverlap, CurNode);
+		// If complete overlap is found
+			const IntervalNode &First = node(FirstNode);
+			if(First.Start <= Start && End <= First.End) {
+				IT_DEBUG(std::cout << "COMPLETE OVERLAP\n");
+				auto OR = (Start == First.Start && End == First.End) ?
+								ITResult::CompletelyPerfectOverlap : ITResult::CompleteOverlap;
+				return ITResult(OR, FirstNode, First);
 			}
 
-		// If partial overlap is found
-			if(Start >= CurNode->Start && Start < CurNode->End) {
-			// Record current state	of node that is about to be updated
-				auto State = ITResult::NodeRange(CurNode->Start, CurNode->End);
-
-			// Update the node
-				CurNode->End = End;
-				CurNode->updateMiddle();
-
-			// Check if this node needs to be moved
-				if(CurNode->Right && CurNode->Middle > CurNode->Right->Middle) {
-				// This node needs to be removed and added back
-					removeNode(CurNode);
-					auto *Node = insertNode(CurNode);
-					if(Node != CurNode) {
-					// This means a node was found to have been in the tree already
-					// so we do not need the current node anymore.
-						NodesSet.erase(CurNode);
-						delete CurNode;
-						CurNode = Node;
-					}
-				}
-				return ITResult(ITResult::PartialOverlap, CurNode, State);
-			}
-			if(End > CurNode->Start && End <= CurNode->End) {
-			// Record current state	of node that is about to be updated
-				auto State = ITResult::NodeRange(CurNode->Start, CurNode->End);
-
-			// Update the node
-				CurNode->Start = Start;
-				CurNode->updateMiddle();
-
-			// Check if this node needs to be moved
-				if(CurNode->Left && CurNode->Middle <= CurNode->Left->Middle) {
-				// This node needs to be removed and added back
-					removeNode(CurNode);
-					auto *Node = insertNode(CurNode);
-					if(Node != CurNode) {
-					// This means a node was found to have been in the tree already
-					// so we do not need the current node anymore.
-						NodesSet.erase(CurNode);
-						delete CurNode;
-						CurNode = Node;
-					}
-				}
-				return ITResult(ITResult::PartialOverlap, CurNode, State);
+		// Partial overlap, so merge the overlapping nodes into the first one. Record
+		// the current state of the nodes that are about to be updated.
+			IT_DEBUG(std::cout << "PARTIAL OVERLAP\n");
+			ITResult::NodeRangeVectTy NodesStatusVect;
+			uint64_t NewEnd = End;
+			for(auto Node : RemovedNodesVect) {
+				NodesStatusVect.push_back(ITResult::NodeRange(node(Node).Start, node(Node).End));
+				NewEnd = std::max(NewEnd, node(Node).End);
 			}
-			if(Start < CurNode->Start && End > CurNode->End) {
-			// Record current state	of node that is about to be updated
-				auto State = ITResult::NodeRange(CurNode->Start, CurNode->End);
-				CurNode->Start = Start;
-				CurNode->End = End;
-				CurNode->updateMiddle();
-
-			// Check if this node needs to be moved
-				if((CurNode->Left && CurNode->Middle <= CurNode->Left->Middle)
-				|| (CurNode->Right && CurNode->Middle > CurNode->Right->Middle)) {
-					removeNode(CurNode);
-					auto *Node = insertNode(CurNode);
-					if(Node != CurNode) {
-					// This means a node was found to have been in the tree already
-					// so we do not need the current node anymore.
-						NodesSet.erase(CurNode);
-						delete CurNode;
-						CurNode = Node;
-					}
-				}
+			for(uint32_t I = 1; I != RemovedNodesVect.size(); ++I) {
+				uint32_t Node = RemovedNodesVect[I];
+				node(FirstNode).payload().append(node(Node).payload(), PayloadArena);
+				removeNode(Node);
+				freeNode(Node);
 			}
+			node(FirstNode).Start = std::min(Start, node(FirstNode).Start);
+			node(FirstNode).End = NewEnd;
+			reinsertNode(FirstNode);
+			ITResult::NodeOverlapInfoVectTy OverlapIntervalNodesVect;
+			OverlapIntervalNodesVect.push_back(ITResult::makeNodeOverlapInfo(FirstNode,
+											   ITResult::PartialOverlap, node(FirstNode)));
+			return ITResult(ITResult::PartialOverlap, OverlapIntervalNodesVect, NodesStatusVect);
 		}
 
-	// No overlap cases
-		ParentNode = CurNode;
-		std::cout << "CURRENT NODE MIDDDLE: " << CurNode->Middle << "\n";
-		if(Middle < CurNode->Middle) {
-			CurNodeAddr = &(CurNode->Left);
-			std::cout << "LEFT\n";
-		} else {
-			CurNodeAddr = &(CurNode->Right);
-			std::cout << "RIGHT\n";
+	// No overlap but contiguous cases. A node that holds the byte right before the
+	// interval ends where it starts, or it would overlap with it.
+		uint32_t PrevNode = NullNode;
+		if(Start != 0) {
+			forEachOverlappingNode(Start - 1, Start, [&](uint32_t Index) {
+				PrevNode = Index;
+			});
+		}
+		if(PrevNode != NullNode) {
+			IT_DEBUG(std::cout << "APPEND NODE\n");
+			node(PrevNode).End = End;
+			reinsertNode(PrevNode);
+			return ITResult(ITResult::NoOverlap, PrevNode, node(PrevNode));
+		}
+		uint32_t NextNode = NullNode;
+		if(End != UINT64_MAX) {
+			forEachOverlappingNode(End, End + 1, [&](uint32_t Index) {
+				NextNode = Index;
+			});
+		}
+		if(NextNode != NullNode) {
+			IT_DEBUG(std::cout << "PREPEND NODE\n");
+			node(NextNode).Start = Start;
+			reinsertNode(NextNode);
+			return ITResult(ITResult::NoOverlap, NextNode, node(NextNode));
 		}
-		std::cout << "PRINTING PARENT NODE:\n";
-		ParentNode->print();
 	}
 
 // Just add a new node
-	std::cout << "NODE INSERTED AT ROOT\n";
-	*CurNodeAddr = new IntervalNode(Start, End);
-	std::cout << "INTERVAL NODE ALLOCATED\n";
-	NodesSet.insert(*CurNodeAddr);
-	(*CurNodeAddr)->Parent = ParentNode;
-	return ITResult(ITResult::NoOverlap, *CurNodeAddr);
+	uint32_t NewNode = allocateNode(Start, End);
+	IT_DEBUG(std::cout << "INTERVAL NODE ALLOCATED\n");
+	insertNode(NewNode);
+	return ITResult(ITResult::NoOverlap, NewNode, node(NewNode));
 }
 
 
+// Insert a batch of intervals. The batch is sorted by address and runs of adjacent
+// intervals are coalesced, so a run that does not overlap with anything and is in
+// the order of the batch is added with two walks down the tree. Other runs are
+// inserted one interval at a time in their original order, so that every interval
+// gets the same result and ends up in the same node as if the batch was inserted
+// in order. Func is called with the index of every interval in the batch and the
+// result of the insertion that added it.
+template<bool OptimizeSearch, typename PayloadTy>
+template<typename FuncTy>
+void IntervalTree<OptimizeSearch, PayloadTy>::insertBatch(std::vector<IntervalBatchElem> &BatchVect,
+																							 FuncTy Func) {
+	std::sort(BatchVect.begin(), BatchVect.end(),
+						[](const IntervalBatchElem &A, const IntervalBatchElem &B) {
+		return A.Start < B.Start || (A.Start == B.Start && A.Index < B.Index);
+	});
+
+	uint32_t RunBegin = 0;
+	while(RunBegin != BatchVect.size()) {
+	// Find the run of adjacent intervals that starts here
+		uint64_t RunStart = BatchVect[RunBegin].Start;
+		uint64_t RunEnd = BatchVect[RunBegin].End;
+		bool RunInOrder = true;
+		uint32_t RunLast = RunBegin + 1;
+		for(; RunLast != BatchVect.size() && BatchVect[RunLast].Start <= RunEnd; ++RunLast) {
+			if(BatchVect[RunLast].Start < RunEnd
+			|| BatchVect[RunLast].Index < BatchVect[RunLast - 1].Index) {
+				RunInOrder = false;
+			}
+			if(BatchVect[RunLast].End > RunEnd)
+				RunEnd = BatchVect[RunLast].End;
+		}
+
+		if(RunLast == RunBegin + 1) {
+			auto &Elem = BatchVect[RunBegin];
+			Func(Elem.Index, insert(Elem.Start, Elem.End));
+		} else if(OptimizeSearch && RunInOrder && !overlapsAnyNode(RunStart, RunEnd)) {
+		// None of the intervals in the run overlap and each one appends to the one
+		// before it. The last one is inserted on its own so that, like in order, it
+		// does not join the run with a node that starts where the run ends.
+			auto &Last = BatchVect[RunLast - 1];
+			auto Result = insert(RunStart, Last.Start);
+			for(uint32_t Index = RunBegin; Index != RunLast - 1; ++Index)
+				Func(BatchVect[Index].Index, Result);
+			Func(Last.Index, insert(Last.Start, Last.End));
+		} else {
+			std::sort(BatchVect.begin() + RunBegin, BatchVect.begin() + RunLast,
+								[](const IntervalBatchElem &A, const IntervalBatchElem &B) {
+				return A.Index < B.Index;
+			});
+			for(uint32_t Index = RunBegin; Index != RunLast; ++Index) {
+				auto &Elem = BatchVect[Index];
+				Func(Elem.Index, insert(Elem.Start, Elem.End));
+			}
+		}
+		RunBegin = RunLast;
+	}
+}
+
 #endif  // INTERVAL_TREE_H_
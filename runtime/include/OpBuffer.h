@@ -0,0 +1,65 @@
+//============================== Op Buffer ===================================//
+//
+// Buffer that the instrumented code appends the writes and flushes of a thread
+// to. Appending an operation is a few stores into the buffer of the thread and
+// an increment of its count, so the instrumented code only calls into the
+// runtime when the buffer is full. The runtime drains the buffer at fences and
+// when it is full, in the order the operations were appended.
+//
+// The buffer counts as full when it holds PMCheckOpBufferLimit operations. The
+// runtime sets the limit to one when it checks persist ordering across threads,
+// so that every operation is drained, and given its stamp on the global event
+// clock, as soon as it runs. The stamps would not reflect how the operations of
+// threads interleave if they were taken when a whole buffer is drained. The
+// stores of a group are all stamped where the last of them runs, since they are
+// appended as one operation there.
+//
+// The buffer is a thread local variable of C linkage that is set up without any
+// code, so that instrumented code can address it directly. The layout has to
+// match the instrumenter.
+//
+//=============================================================================//
+
+#ifndef OP_BUFFER_H_
+#define OP_BUFFER_H_
+
+#include <cstdint>
+#include <type_traits>
+
+// Number of operations the buffer of every thread holds
+#define PMCHECK_OP_BUFFER_CAPACITY 1024
+
+enum BufferedOpKind : uint32_t {
+	BufferedWrite,
+	BufferedFlush,
+
+// The runtime also appends the changes of the calling context, so that the
+// operations are recorded in the contexts they ran in. The ID is the context.
+	BufferedAddContext,
+	BufferedRemoveContext,
+
+// Consecutive stores to constant offsets of the same address are appended as
+// one operation. The ID is the ID of the first store, the address is its
+// address and the size is the mask of the stores that may be to persistent
+// memory. The store groups of the module the ID is in give the rest.
+	BufferedWriteGroup
+};
+
+struct BufferedOp {
+	uint64_t Addr;
+	uint64_t Size;
+	uint32_t Id;
+	BufferedOpKind Kind;
+};
+
+struct OpBuffer {
+	uint32_t NumOps;
+	uint32_t Reserved;
+	BufferedOp Ops[PMCHECK_OP_BUFFER_CAPACITY];
+};
+
+static_assert(sizeof(BufferedOp) == 24, "Buffered operations must be 24 bytes.");
+static_assert(std::is_trivial<OpBuffer>::value,
+							"The op buffer must not need code to be set up.");
+
+#endif  // OP_BUFFER_H_
@@ -0,0 +1,154 @@
+//============================ Persist Op Records =============================//
+//
+// Records of the persist operations, i.e. writes and flushes, of an epoch for
+// PMCheck runtime. Along with the intervals the operations cover, the records
+// keep the instruction IDs, calling contexts and time stamps of the operations.
+//
+// The operations are kept in the nodes of the interval set as their payload, so
+// recording an operation is a single update of the set, and the operations are
+// merged and split along with the intervals.
+//
+//=============================================================================//
+
+#ifndef OP_RECORD_H_
+#define OP_RECORD_H_
+
+#include <cstdint>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "IntervalTree.h"
+#include "PayloadList.h"
+
+// Tuple containing instruction ID, context ID, time stamp and the interval of
+// an operation
+typedef std::tuple<uint32_t, uint32_t, uint64_t, std::pair<uint64_t, uint64_t>> OpInfoTy;
+
+// Operations recorded for an interval. The interval set of a record must have
+// these as the payload of its nodes.
+typedef PayloadList<OpInfoTy> OpList;
+
+// This class records information about persist operations i.e. writes and flushes.
+// It contains all the necessary information regarding instruction IDs, addresses
+// ranges, context IDs and time stamp of when those instructions were executed.
+// The intervals are kept in the given interval set.
+template<typename IntervalSetTy>
+class OpRecord {
+// Interval set to record intervals and the operations on them
+	IntervalSetTy OpIntervalTree;
+
+// Scratch space for inserting batches of operations
+	std::vector<IntervalBatchElem> BatchVect;
+	std::vector<ITResult::OverlapResult> BatchResultsVect;
+
+// Number of operations recorded since the record was last cleared
+	uint64_t NumOps;
+
+// Add the operation to the node that the interval set put it in
+	void recordResult(const ITResult &Result, uint32_t Id, uint64_t StartAddr,
+										uint64_t EndAddr, uint64_t TimeStamp, uint32_t Context) {
+		OpIntervalTree.addToPayload(Result.getNodeIndex(0),
+																OpInfoTy(Id, Context, TimeStamp,
+																				 std::make_pair(StartAddr, EndAddr)));
+		NumOps++;
+	}
+
+public:
+	OpRecord() : OpIntervalTree(), NumOps(0) {}
+
+	OpRecord(const OpRecord &) = delete;
+	OpRecord &operator=(const OpRecord &) = delete;
+
+	ITResult::OverlapResult insert(uint32_t Id, uint64_t StartAddr, uint64_t Size,
+																 uint64_t TimeStamp, uint32_t Context) {
+		ITResult Result = OpIntervalTree.insert(StartAddr, StartAddr + Size);
+		recordResult(Result, Id, StartAddr, StartAddr + Size, TimeStamp, Context);
+		return Result.getOverlapResult();
+	}
+
+// Insert the operations at the given indices of the arrays all at once. The
+// overlap result of the operation at IndexVect[I] is at index I of the returned
+// vector.
+	const std::vector<ITResult::OverlapResult> &
+	insertBatch(uint32_t *IdArray, uint64_t *AddrArray, uint64_t *SizeArray,
+							uint64_t *TimeArray, const std::vector<uint32_t> &IndexVect,
+							uint32_t Context) {
+		BatchVect.clear();
+		BatchResultsVect.resize(IndexVect.size());
+		for(uint32_t I = 0; I != IndexVect.size(); ++I) {
+			auto Index = IndexVect[I];
+			BatchVect.push_back(IntervalBatchElem(AddrArray[Index],
+																						AddrArray[Index] + SizeArray[Index], I));
+		}
+		OpIntervalTree.insertBatch(BatchVect, [&](uint32_t I, const ITResult &Result) {
+			auto Index = IndexVect[I];
+			recordResult(Result, IdArray[Index], AddrArray[Index],
+									 AddrArray[Index] + SizeArray[Index], TimeArray[Index], Context);
+			BatchResultsVect[I] = Result.getOverlapResult();
+		});
+		return BatchResultsVect;
+	}
+
+	ITResult searchInterval(uint64_t StartAddr, uint64_t EndAddr) const {
+		return OpIntervalTree.getSearchDetails(StartAddr, EndAddr);
+	}
+
+// Operations of the interval that the given range lies in. The list stays as it
+// is when the record changes, but only until the record is cleared.
+	OpList getIdAndContextAndTimeStampFor(uint64_t Start, uint64_t End) const {
+		auto *Ops = OpIntervalTree.findPayload(Start, End);
+		return Ops ? *Ops : OpList();
+	}
+
+// Operations that the node at the given previous node range of the result of the
+// last removal had. They stay valid until the next removal.
+	const OpList &getPreviousOps(unsigned Index) const {
+		return OpIntervalTree.getPreviousPayload(Index);
+	}
+
+	void clear() {
+	// The operations that do not fit in the nodes are in the arena of the set,
+	// which is reset along with it
+		OpIntervalTree.clear();
+		NumOps = 0;
+	}
+
+	bool empty() const {
+	// The record depends on the interval tree primarily
+		return OpIntervalTree.empty();
+	}
+
+	uint64_t size() const {
+		return OpIntervalTree.size();
+	}
+
+	uint64_t getNumOps() const {
+		return NumOps;
+	}
+
+	uint64_t getNumNodesVisited() const {
+		return OpIntervalTree.getNumNodesVisited();
+	}
+
+// Remove the range from the intervals. The operations of the nodes that are left
+// of the intervals it overlapped are kept. The intervals are split along with
+// their operations if the range was in the middle of them.
+	ITResult remove(uint64_t Start, uint64_t End) {
+		return OpIntervalTree.getRemoveDetails(Start, End);
+	}
+
+// Iterators for the interval tree. The intervals and their operations are read
+// from the set as it is iterated over, so the record must not change while it is.
+		using IT_iterator = typename IntervalSetTy::const_iterator;
+
+		IT_iterator IT_begin() const {
+			return OpIntervalTree.begin();
+		}
+
+		IT_iterator IT_end() const {
+			return OpIntervalTree.end();
+		}
+};
+
+#endif  // OP_RECORD_H_
@@ -0,0 +1,135 @@
+//============================== Payload List =================================//
+//
+// Lists of elements that the nodes of interval sets carry along with their
+// intervals, such as the operations recorded for an interval. The first few
+// elements are kept inline in the node and longer lists are kept in an arena
+// of the interval set, which is released as a whole when the set is cleared.
+//
+// When an interval merges with another, the list of the other is appended to
+// its own. When an interval is split, the pieces share its list. Copies of a
+// list share the elements in the arena and have no spare capacity, so that
+// appending to either copies them, and a copy stays as it was when it was made.
+//
+//=============================================================================//
+
+#ifndef PAYLOAD_LIST_H_
+#define PAYLOAD_LIST_H_
+
+#include <cstdint>
+#include <algorithm>
+
+#include "Arena.h"
+
+// Payload of interval sets that only keep intervals
+struct NoPayload {
+	void append(const NoPayload &, BumpArena &) {}
+};
+
+template<typename ElemTy, unsigned NumInlineElems = 1>
+class PayloadList {
+// Elements in the arena, or null if they are inline
+	ElemTy *External;
+	uint32_t Size;
+	uint32_t Capacity;
+	ElemTy Inline[NumInlineElems];
+
+	ElemTy *data() {
+		return External ? External : Inline;
+	}
+
+	const ElemTy *data() const {
+		return External ? External : Inline;
+	}
+
+	void copyFrom(const PayloadList &Other) {
+		External = Other.External;
+		Size = Other.Size;
+		if(External) {
+			Capacity = Size;
+			return;
+		}
+		Capacity = NumInlineElems;
+		std::copy(Other.Inline, Other.Inline + Size, Inline);
+	}
+
+	void moveFrom(const PayloadList &Other) {
+		External = Other.External;
+		Size = Other.Size;
+		Capacity = Other.Capacity;
+		if(!External)
+			std::copy(Other.Inline, Other.Inline + Size, Inline);
+	}
+
+// Make room for more elements in the arena
+	void reserve(uint32_t NewSize, BumpArena &Arena) {
+		if(NewSize <= Capacity)
+			return;
+		uint32_t NewCapacity = Capacity ? Capacity * 2 : 4;
+		while(NewCapacity < NewSize)
+			NewCapacity *= 2;
+		auto *Elems = (ElemTy *)Arena.allocate(NewCapacity * sizeof(ElemTy), alignof(ElemTy));
+		std::copy(data(), data() + Size, Elems);
+		External = Elems;
+		Capacity = NewCapacity;
+	}
+
+public:
+	PayloadList() : External(nullptr), Size(0), Capacity(NumInlineElems) {}
+
+	PayloadList(const PayloadList &Other) {
+		copyFrom(Other);
+	}
+
+	PayloadList &operator=(const PayloadList &Other) {
+		if(this != &Other)
+			copyFrom(Other);
+		return *this;
+	}
+
+// Moving a list hands its spare capacity over, since the old list is dropped
+	PayloadList(PayloadList &&Other) noexcept {
+		moveFrom(Other);
+	}
+
+	PayloadList &operator=(PayloadList &&Other) noexcept {
+		if(this != &Other)
+			moveFrom(Other);
+		return *this;
+	}
+
+	void push_back(const ElemTy &Elem, BumpArena &Arena) {
+		reserve(Size + 1, Arena);
+		data()[Size++] = Elem;
+	}
+
+// Add the elements of the list of an interval that merged into this one
+	void append(const PayloadList &Other, BumpArena &Arena) {
+		if(Other.empty())
+			return;
+		reserve(Size + Other.Size, Arena);
+		std::copy(Other.data(), Other.data() + Other.Size, data() + Size);
+		Size += Other.Size;
+	}
+
+	uint32_t size() const {
+		return Size;
+	}
+
+	bool empty() const {
+		return !Size;
+	}
+
+	const ElemTy &operator[](uint32_t Index) const {
+		return data()[Index];
+	}
+
+	const ElemTy *begin() const {
+		return data();
+	}
+
+	const ElemTy *end() const {
+		return data() + Size;
+	}
+};
+
+#endif  // PAYLOAD_LIST_H_
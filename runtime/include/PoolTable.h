@@ -0,0 +1,162 @@
+//================================ Pool Table =================================//
+//
+// Ranges of the persistent memory pools of the application, which PMCheck runtime
+// looks up for every write and flush to see whether it is to persistent memory.
+//
+// The ranges are kept in a sorted array that is never changed once it is
+// published. Adding a pool builds a new array and publishes it in place of the
+// old one, so threads look up ranges without locks or copies of their own. Every
+// thread also remembers the range it found last, since programs mostly write to
+// the same pool over and over.
+//
+// The instrumented code checks writes against a few coarse bounds of the pools
+// before it records them, so that writes to volatile memory never reach the
+// runtime. The bounds only ever grow, so code that reads them while a pool is
+// added still sees every pool that was added before.
+//
+//=============================================================================//
+
+#ifndef POOL_TABLE_H_
+#define POOL_TABLE_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <atomic>
+
+// Number of bounds the instrumented code checks. This has to match the
+// instrumenter.
+#define PMCHECK_NUM_POOL_BOUNDS 4
+
+// Bounds that the instrumented code loads as pairs of 64-bit integers. Unused
+// bounds are empty, since no address is both at or above the start and below
+// the end.
+struct PoolBounds {
+	std::atomic<uint64_t> Start;
+	std::atomic<uint64_t> End;
+
+	constexpr PoolBounds() : Start(UINT64_MAX), End(0) {}
+
+	bool empty() const {
+		return Start.load(std::memory_order_relaxed)
+					>= End.load(std::memory_order_relaxed);
+	}
+};
+
+static_assert(sizeof(PoolBounds) == 2 * sizeof(uint64_t),
+							"Pool bounds must be laid out as two 64-bit integers.");
+
+// Widen the bounds so that they cover the given pool. The pool goes in bounds
+// that already cover it, or else in unused bounds, or else in the bounds that
+// grow the least. Widening the bounds must be serialized by the caller.
+static inline void AddPoolBounds(PoolBounds *BoundsArray,
+																 uint64_t Start, uint64_t End) {
+	PoolBounds *Best = nullptr;
+	uint64_t BestGrowth = UINT64_MAX;
+	for(uint32_t Index = 0; Index != PMCHECK_NUM_POOL_BOUNDS; ++Index) {
+		auto &Bounds = BoundsArray[Index];
+		if(Bounds.empty()) {
+			if(!Best || !Best->empty())
+				Best = &Bounds;
+			BestGrowth = 0;
+			continue;
+		}
+		uint64_t OldStart = Bounds.Start.load(std::memory_order_relaxed);
+		uint64_t OldEnd = Bounds.End.load(std::memory_order_relaxed);
+		uint64_t Growth = (Start < OldStart ? OldStart - Start : 0)
+										+ (End > OldEnd ? End - OldEnd : 0);
+		if(!Growth)
+			return;
+		if(Growth < BestGrowth) {
+			Best = &Bounds;
+			BestGrowth = Growth;
+		}
+	}
+	if(Start < Best->Start.load(std::memory_order_relaxed))
+		Best->Start.store(Start, std::memory_order_relaxed);
+	if(End > Best->End.load(std::memory_order_relaxed))
+		Best->End.store(End, std::memory_order_relaxed);
+}
+
+class PoolTable {
+	struct Range {
+		uint64_t Start;
+		uint64_t End;
+	};
+
+// Ranges are sorted by their starts, and ranges that overlap or touch are merged
+	struct Table {
+		uint32_t NumRanges;
+		const Range *Ranges;
+	};
+
+	std::atomic<const Table *> Current;
+
+	static Table *allocateTable(uint32_t NumRanges) {
+		auto *NewTable = (Table *)malloc(sizeof(Table) + NumRanges * sizeof(Range));
+		NewTable->NumRanges = NumRanges;
+		NewTable->Ranges = (const Range *)(NewTable + 1);
+		return NewTable;
+	}
+
+public:
+// The table has to be usable by constructors that run before its own
+	constexpr PoolTable() : Current(nullptr) {}
+
+	PoolTable(const PoolTable &) = delete;
+	PoolTable &operator=(const PoolTable &) = delete;
+
+// Whether the given range lies in a pool. LastHit is where the caller found the
+// range it looked up last, and it is updated on a hit.
+	bool contains(uint64_t Addr, uint64_t Size, uint32_t &LastHit) const {
+		auto *CurTable = Current.load(std::memory_order_acquire);
+		if(!CurTable)
+			return false;
+		const Range *Ranges = CurTable->Ranges;
+		uint32_t NumRanges = CurTable->NumRanges;
+		if(LastHit < NumRanges
+		&& Ranges[LastHit].Start <= Addr && Addr + Size <= Ranges[LastHit].End)
+			return true;
+
+	// Find the last range that starts at or before the address. This halves the
+	// ranges without branching on the comparisons.
+		const Range *Base = Ranges;
+		while(NumRanges > 1) {
+			uint32_t Half = NumRanges >> 1;
+			Base = (Base[Half].Start <= Addr) ? Base + Half : Base;
+			NumRanges -= Half;
+		}
+		if(Base->Start > Addr || Addr + Size > Base->End)
+			return false;
+		LastHit = Base - Ranges;
+		return true;
+	}
+
+// Add a pool. Adding pools must be serialized by the caller. The table that is
+// replaced is never freed, since threads may still be looking at it. Pools are
+// added rarely, so the old tables take little memory.
+	void add(uint64_t Start, uint64_t End) {
+		auto *OldTable = Current.load(std::memory_order_relaxed);
+		uint32_t NumOldRanges = OldTable ? OldTable->NumRanges : 0;
+		auto *NewTable = allocateTable(NumOldRanges + 1);
+		auto *Ranges = (Range *)NewTable->Ranges;
+		uint32_t NumRanges = 0;
+		auto Append = [&](const Range &Next) {
+			if(NumRanges && Next.Start <= Ranges[NumRanges - 1].End) {
+				if(Next.End > Ranges[NumRanges - 1].End)
+					Ranges[NumRanges - 1].End = Next.End;
+				return;
+			}
+			Ranges[NumRanges++] = Next;
+		};
+		uint32_t Index = 0;
+		for(; Index != NumOldRanges && OldTable->Ranges[Index].Start <= Start; ++Index)
+			Append(OldTable->Ranges[Index]);
+		Append(Range{Start, End});
+		for(; Index != NumOldRanges; ++Index)
+			Append(OldTable->Ranges[Index]);
+		NewTable->NumRanges = NumRanges;
+		Current.store(NewTable, std::memory_order_release);
+	}
+};
+
+#endif  // POOL_TABLE_H_
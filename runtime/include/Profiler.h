@@ -0,0 +1,227 @@
+//=========================== Runtime Self-Profiler ===========================//
+//
+// Measures where PMCheck runtime spends its time. Every thread accumulates the
+// time spent in the entry points of the runtime and histograms of its records in
+// its own profile, which is merged into the profile of the runtime when the
+// thread exits. Time is measured with the time stamp counter where there is one,
+// and converted to nanoseconds when the profile is printed.
+//
+//=============================================================================//
+
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+
+enum ProfiledEntryPoint : uint32_t {
+	ProfileRecordNonStrictWrites,
+	ProfileRecordStrictWrites,
+	ProfileRecordFlushes,
+	ProfileFenceEncountered,
+	ProfileAllocatePM,
+	ProfileDrainOpBuffer,
+	NumProfiledEntryPoints
+};
+
+static inline const char *getProfiledEntryPointName(ProfiledEntryPoint EntryPoint) {
+	switch(EntryPoint) {
+		case ProfileRecordNonStrictWrites:
+			return "RecordNonStrictWrites";
+		case ProfileRecordStrictWrites:
+			return "RecordStrictsWrites";
+		case ProfileRecordFlushes:
+			return "RecordFlushes";
+		case ProfileFenceEncountered:
+			return "FenceEncountered";
+		case ProfileAllocatePM:
+			return "AllocatePM";
+		case ProfileDrainOpBuffer:
+			return "DrainOpBuffer";
+		default:
+			return "unknown";
+	}
+}
+
+static inline uint64_t readProfileTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec Time;
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return (uint64_t)Time.tv_sec * 1000000000 + Time.tv_nsec;
+#endif
+}
+
+static inline uint64_t readProfileNanoseconds() {
+	struct timespec Time;
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return (uint64_t)Time.tv_sec * 1000000000 + Time.tv_nsec;
+}
+
+// Histogram with a bucket for every power of two
+class ProfileHistogram {
+	uint64_t Buckets[65];
+
+public:
+	ProfileHistogram() : Buckets() {}
+
+	void add(uint64_t Value) {
+		Buckets[Value ? 64 - __builtin_clzll(Value) : 0]++;
+	}
+
+	void merge(const ProfileHistogram &Other) {
+		for(unsigned Index = 0; Index != 65; ++Index)
+			Buckets[Index] += Other.Buckets[Index];
+	}
+
+// Values are scaled before printing, so that ticks are printed as nanoseconds.
+// Buckets are printed as half-open ranges, so a bucket ends where the next one
+// starts even after scaling.
+	void print(std::ostream &OS, const char *Title, double Scale = 1) const {
+		OS << Title << ":\n";
+		for(unsigned Index = 0; Index != 65; ++Index) {
+			if(!Buckets[Index])
+				continue;
+			uint64_t Low = Index ? (uint64_t)1 << (Index - 1) : 0;
+			OS << "  [" << (uint64_t)(Low * Scale) << ", ";
+			if(Index == 64)
+				OS << "inf";
+			else
+				OS << (uint64_t)(((uint64_t)1 << Index) * Scale);
+			OS << "): " << Buckets[Index] << "\n";
+		}
+	}
+};
+
+struct EntryPointProfile {
+	uint64_t NumCalls;
+	uint64_t NumOps;
+	uint64_t Ticks;
+	ProfileHistogram Latency;
+
+	EntryPointProfile() : NumCalls(0), NumOps(0), Ticks(0) {}
+
+	void merge(const EntryPointProfile &Other) {
+		NumCalls += Other.NumCalls;
+		NumOps += Other.NumOps;
+		Ticks += Other.Ticks;
+		Latency.merge(Other.Latency);
+	}
+};
+
+struct ThreadProfile {
+	EntryPointProfile EntryPoints[NumProfiledEntryPoints];
+
+// Sizes of the records of writes and flushes at every fence
+	ProfileHistogram WriteRecordSizes;
+	ProfileHistogram FlushRecordSizes;
+
+// Interval set nodes visited between fences
+	ProfileHistogram NodesVisited;
+	uint64_t LastNumNodesVisited;
+
+	ThreadProfile() : LastNumNodesVisited(0) {}
+
+	void merge(const ThreadProfile &Other) {
+		for(unsigned Index = 0; Index != NumProfiledEntryPoints; ++Index)
+			EntryPoints[Index].merge(Other.EntryPoints[Index]);
+		WriteRecordSizes.merge(Other.WriteRecordSizes);
+		FlushRecordSizes.merge(Other.FlushRecordSizes);
+		NodesVisited.merge(Other.NodesVisited);
+	}
+
+	void addEpoch(uint64_t NumWrites, uint64_t NumFlushes, uint64_t NumNodesVisited) {
+		WriteRecordSizes.add(NumWrites);
+		FlushRecordSizes.add(NumFlushes);
+		NodesVisited.add(NumNodesVisited - LastNumNodesVisited);
+		LastNumNodesVisited = NumNodesVisited;
+	}
+};
+
+class RuntimeProfiler {
+	std::mutex ProfileMutex;
+	ThreadProfile Profile;
+	uint32_t NumThreads;
+	uint64_t StartTicks;
+	uint64_t StartNanoseconds;
+
+public:
+	RuntimeProfiler() : NumThreads(0), StartTicks(readProfileTicks()),
+										 StartNanoseconds(readProfileNanoseconds()) {}
+
+	void merge(const ThreadProfile &ThreadProf) {
+		std::lock_guard<std::mutex> Lock(ProfileMutex);
+		Profile.merge(ThreadProf);
+		NumThreads++;
+	}
+
+	void print(std::ostream &OS) {
+		std::lock_guard<std::mutex> Lock(ProfileMutex);
+
+	// Calibrate the ticks against the time passed since the runtime started
+		uint64_t Ticks = readProfileTicks() - StartTicks;
+		uint64_t Nanoseconds = readProfileNanoseconds() - StartNanoseconds;
+		double NanosecondsPerTick = Ticks ? (double)Nanoseconds / Ticks : 1;
+
+		OS << "PMCheck runtime profile of " << NumThreads << " threads:\n";
+		OS << std::left << std::setw(24) << "entry point" << std::right << std::setw(12)
+			 << "calls" << std::setw(14) << "ops" << std::setw(12) << "total ms"
+			 << std::setw(10) << "ns/call" << std::setw(10) << "ns/op" << "\n";
+		for(unsigned Index = 0; Index != NumProfiledEntryPoints; ++Index) {
+			auto &EntryPoint = Profile.EntryPoints[Index];
+			double Total = EntryPoint.Ticks * NanosecondsPerTick;
+			OS << std::left << std::setw(24) << getProfiledEntryPointName((ProfiledEntryPoint)Index)
+				 << std::right << std::setw(12) << EntryPoint.NumCalls << std::setw(14)
+				 << EntryPoint.NumOps << std::setw(12) << (uint64_t)(Total / 1000000)
+				 << std::setw(10) << (uint64_t)(EntryPoint.NumCalls ? Total / EntryPoint.NumCalls : 0)
+				 << std::setw(10) << (uint64_t)(EntryPoint.NumOps ? Total / EntryPoint.NumOps : 0)
+				 << "\n";
+		}
+		for(unsigned Index = 0; Index != NumProfiledEntryPoints; ++Index) {
+			if(!Profile.EntryPoints[Index].NumCalls)
+				continue;
+			std::string Title = std::string("Latency of ")
+								+ getProfiledEntryPointName((ProfiledEntryPoint)Index) + " in ns";
+			Profile.EntryPoints[Index].Latency.print(OS, Title.c_str(), NanosecondsPerTick);
+		}
+		Profile.WriteRecordSizes.print(OS, "Writes recorded per epoch");
+		Profile.FlushRecordSizes.print(OS, "Flushes recorded per epoch");
+		Profile.NodesVisited.print(OS, "Interval set nodes visited per epoch");
+	}
+};
+
+// Times a call to an entry point. Nothing is measured without a profile.
+class ProfileScope {
+	EntryPointProfile *EntryPoint;
+	uint64_t StartTicks;
+
+public:
+	ProfileScope(ThreadProfile *Profile, ProfiledEntryPoint Index, uint64_t NumOps) :
+						EntryPoint(nullptr), StartTicks(0) {
+		if(!Profile)
+			return;
+		EntryPoint = &Profile->EntryPoints[Index];
+		EntryPoint->NumCalls++;
+		EntryPoint->NumOps += NumOps;
+		StartTicks = readProfileTicks();
+	}
+
+	~ProfileScope() {
+		if(!EntryPoint)
+			return;
+		uint64_t Ticks = readProfileTicks() - StartTicks;
+		EntryPoint->Ticks += Ticks;
+		EntryPoint->Latency.add(Ticks);
+	}
+};
+
+#endif  // PROFILER_H_
@@ -0,0 +1,346 @@
+//========================= Cache Line Shadow Memory ==========================//
+//
+// Shadow memory engine for PMCheck runtime. This keeps the state of writes and
+// flushes to persistent memory at the granularity of cache lines instead of
+// address ranges in an interval tree.
+//
+// Every thread keeps its own shadow memory for all the pools. The shadow of a
+// pool is split into chunks that are only mapped when the thread first touches
+// a line in them, so a thread only pays for the parts of the pools it writes
+// and flushes. The chunks are unmapped when the thread exits.
+//
+//=============================================================================//
+
+#ifndef SHADOW_MEMORY_H_
+#define SHADOW_MEMORY_H_
+
+#include <sys/mman.h>
+
+#include <cstdint>
+#include <new>
+#include <vector>
+#include <algorithm>
+
+#define CACHE_LINE_SHIFT 6
+#define CACHE_LINE_SIZE  ((uint64_t)1 << CACHE_LINE_SHIFT)
+#define CACHE_LINE_MASK  (CACHE_LINE_SIZE - 1)
+
+// Number of lines in a chunk of shadow memory, which shadows 1 MB of a pool
+#define SHADOW_CHUNK_SHIFT 14
+#define SHADOW_CHUNK_LINES ((uint64_t)1 << SHADOW_CHUNK_SHIFT)
+#define SHADOW_CHUNK_MASK  (SHADOW_CHUNK_LINES - 1)
+
+// State of a cache line since the last fence. Entries are zero until the line
+// is touched, so untouched shadow pages never need to be committed.
+struct ShadowLine {
+// Bytes of the line written in this epoch, one bit per byte
+	uint64_t DirtyMask;
+
+// Indices of the most recent write and flush on this line in the op logs
+	uint32_t LastWriteOp;
+	uint32_t LastFlushOp;
+
+// Time stamps of the most recent write and flush on this line
+	uint64_t LastWriteTimeStamp;
+	uint64_t LastFlushTimeStamp;
+
+// Number of flushes of this line in this epoch
+	uint32_t NumFlushes;
+
+// Set when the line is in the list of touched lines
+	uint32_t Touched;
+
+	bool isDirty() const {
+		return DirtyMask != 0;
+	}
+
+	bool isFlushed() const {
+		return NumFlushes != 0;
+	}
+};
+
+// Information about a write or flush executed in the current epoch
+struct ShadowOp {
+	uint64_t Start;
+	uint64_t Size;
+	uint64_t TimeStamp;
+	uint32_t Id;
+	uint32_t Context;
+
+// Number of dirty lines that a flush flushed again without a write in between
+	uint32_t NumDuplicateLines;
+
+	ShadowOp(uint32_t Id, uint64_t Start, uint64_t Size,
+					 uint64_t TimeStamp, uint32_t Context) :
+					 Start(Start), Size(Size), TimeStamp(TimeStamp), Id(Id),
+					 Context(Context), NumDuplicateLines(0) {}
+
+	uint64_t end() const {
+		return Start + Size;
+	}
+};
+
+class ShadowResult {
+public:
+	enum OverlapResult {
+	// The operation does not touch persistent memory
+		NotPersistent,
+		NoOverlap,
+
+	// The write writes bytes already written in this epoch
+		Overlap
+	};
+
+private:
+	OverlapResult OR;
+
+// Index of the earlier write that this write overlaps with
+	uint32_t OverlapOp;
+
+public:
+	ShadowResult(OverlapResult Result, uint32_t Op = 0) :
+							 OR(Result), OverlapOp(Op) {}
+
+	OverlapResult getOverlapResult() const {
+		return OR;
+	}
+
+	uint32_t getOverlapOp() const {
+		return OverlapOp;
+	}
+};
+
+class ShadowMemory {
+// The shadow of one persistent memory pool. The table of chunks is only made
+// when the thread first touches the pool, and a chunk is only mapped when the
+// thread first touches a line in it. The kernel commits the pages of a chunk
+// as they are written.
+	struct PoolShadow {
+		uint64_t Start;
+		uint64_t End;
+		uint64_t LineBase;
+		uint64_t NumLines;
+		std::vector<ShadowLine *> ChunksVect;
+
+	// Line of the address, or null if the thread never touched its chunk
+		const ShadowLine *findLine(uint64_t Addr) const {
+			uint64_t Index = (Addr - LineBase) >> CACHE_LINE_SHIFT;
+			uint64_t Chunk = Index >> SHADOW_CHUNK_SHIFT;
+			if(Chunk >= ChunksVect.size() || !ChunksVect[Chunk])
+				return nullptr;
+			return ChunksVect[Chunk] + (Index & SHADOW_CHUNK_MASK);
+		}
+
+		ShadowLine &getLine(uint64_t Addr) {
+			uint64_t Index = (Addr - LineBase) >> CACHE_LINE_SHIFT;
+			uint64_t Chunk = Index >> SHADOW_CHUNK_SHIFT;
+			if(ChunksVect.empty())
+				ChunksVect.resize((NumLines + SHADOW_CHUNK_MASK) >> SHADOW_CHUNK_SHIFT);
+			if(!ChunksVect[Chunk]) {
+				void *Region = mmap(nullptr, SHADOW_CHUNK_LINES * sizeof(ShadowLine),
+														PROT_READ | PROT_WRITE,
+														MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+				if(Region == MAP_FAILED)
+					throw std::bad_alloc();
+				ChunksVect[Chunk] = (ShadowLine *)Region;
+			}
+			return ChunksVect[Chunk][Index & SHADOW_CHUNK_MASK];
+		}
+
+		void unmapChunks() {
+			for(auto *Chunk : ChunksVect) {
+				if(Chunk)
+					munmap(Chunk, SHADOW_CHUNK_LINES * sizeof(ShadowLine));
+			}
+			ChunksVect.clear();
+		}
+	};
+
+// Pools sorted by their start addresses
+	std::vector<PoolShadow> PoolsVect;
+
+// Lines touched in this epoch. Fences only look at these.
+	std::vector<ShadowLine *> TouchedLinesVect;
+
+// Operation logs of this epoch
+	std::vector<ShadowOp> WriteOpsVect;
+	std::vector<ShadowOp> FlushOpsVect;
+
+	static uint64_t getByteMask(uint64_t LineAddr, uint64_t Start, uint64_t End) {
+		uint64_t First = (Start > LineAddr) ? Start - LineAddr : 0;
+		uint64_t Last = (End < LineAddr + CACHE_LINE_SIZE) ?
+										 End - LineAddr : CACHE_LINE_SIZE;
+		if(Last - First == CACHE_LINE_SIZE)
+			return ~(uint64_t)0;
+		return (((uint64_t)1 << (Last - First)) - 1) << First;
+	}
+
+	const PoolShadow *findPool(uint64_t Addr) const {
+	// Pools are few, so a binary search over the sorted vector is enough
+		auto It = std::upper_bound(PoolsVect.begin(), PoolsVect.end(), Addr,
+										[](uint64_t Addr, const PoolShadow &Pool) {
+											return Addr < Pool.Start;
+										});
+		if(It == PoolsVect.begin())
+			return nullptr;
+		--It;
+		if(Addr >= It->End)
+			return nullptr;
+		return &(*It);
+	}
+
+	PoolShadow *findPool(uint64_t Addr) {
+		return const_cast<PoolShadow *>(
+							static_cast<const ShadowMemory *>(this)->findPool(Addr));
+	}
+
+	void touchLine(ShadowLine &Line) {
+		if(!Line.Touched) {
+			Line.Touched = 1;
+			TouchedLinesVect.push_back(&Line);
+		}
+	}
+
+public:
+	ShadowMemory() {}
+
+// The shadow memory of a thread is destroyed when the thread exits, which
+// returns all the chunks it mapped
+	~ShadowMemory() {
+		for(auto &Pool : PoolsVect)
+			Pool.unmapChunks();
+	}
+
+	ShadowMemory(const ShadowMemory &) = delete;
+	ShadowMemory &operator=(const ShadowMemory &) = delete;
+
+	bool addPool(uint64_t Start, uint64_t Size);
+
+	bool isPersistent(uint64_t Start, uint64_t Size) const {
+		auto *Pool = findPool(Start);
+		return Pool && Start + Size <= Pool->End;
+	}
+
+	ShadowResult recordWrite(uint32_t Id, uint64_t Start, uint64_t Size,
+													 uint64_t TimeStamp, uint32_t Context);
+
+	ShadowResult recordFlush(uint32_t Id, uint64_t Start, uint64_t Size,
+													 uint64_t TimeStamp, uint32_t Context);
+
+// Call the given function on the shadow state of every line in given range.
+// Lines in chunks that were never touched are clean.
+	template<typename FuncTy>
+	void forEachLine(uint64_t Start, uint64_t End, FuncTy Func) const {
+		static const ShadowLine UntouchedLine = ShadowLine();
+		auto *Pool = findPool(Start);
+		if(!Pool)
+			return;
+		End = std::min(End, Pool->End);
+		for(uint64_t LineAddr = Start & ~CACHE_LINE_MASK;
+				LineAddr < End; LineAddr += CACHE_LINE_SIZE) {
+			auto *Line = Pool->findLine(LineAddr);
+			Func(LineAddr, Line ? *Line : UntouchedLine,
+					 getByteMask(LineAddr, Start, End));
+		}
+	}
+
+	const std::vector<ShadowOp> &getWriteOps() const {
+		return WriteOpsVect;
+	}
+
+	const std::vector<ShadowOp> &getFlushOps() const {
+		return FlushOpsVect;
+	}
+
+	uint64_t getNumTouchedLines() const {
+		return TouchedLinesVect.size();
+	}
+
+	bool empty() const {
+		return TouchedLinesVect.empty();
+	}
+
+// Reset all the lines touched in this epoch
+	void clear() {
+		for(auto *Line : TouchedLinesVect)
+			*Line = ShadowLine();
+		TouchedLinesVect.clear();
+		WriteOpsVect.clear();
+		FlushOpsVect.clear();
+	}
+};
+
+inline bool ShadowMemory::addPool(uint64_t Start, uint64_t Size) {
+	if(!Size)
+		return false;
+
+// Nothing is mapped for the pool until a line in it is touched
+	PoolShadow Pool;
+	Pool.Start = Start;
+	Pool.End = Start + Size;
+	Pool.LineBase = Start & ~CACHE_LINE_MASK;
+	Pool.NumLines = ((Pool.End - Pool.LineBase) + CACHE_LINE_MASK) >> CACHE_LINE_SHIFT;
+
+// Keep the pools sorted
+	auto It = std::upper_bound(PoolsVect.begin(), PoolsVect.end(), Start,
+										[](uint64_t Addr, const PoolShadow &Pool) {
+											return Addr < Pool.Start;
+										});
+	PoolsVect.insert(It, Pool);
+	return true;
+}
+
+inline ShadowResult ShadowMemory::recordWrite(uint32_t Id, uint64_t Start,
+													uint64_t Size, uint64_t TimeStamp, uint32_t Context) {
+	auto *Pool = findPool(Start);
+	if(!Pool || !Size)
+		return ShadowResult(ShadowResult::NotPersistent);
+
+// Writes running past the end of a pool are clipped to the pool
+	uint64_t End = std::min(Start + Size, Pool->End);
+	uint32_t OpIndex = WriteOpsVect.size();
+	WriteOpsVect.push_back(ShadowOp(Id, Start, End - Start, TimeStamp, Context));
+
+	ShadowResult Result(ShadowResult::NoOverlap);
+	for(uint64_t LineAddr = Start & ~CACHE_LINE_MASK;
+			LineAddr < End; LineAddr += CACHE_LINE_SIZE) {
+		auto &Line = Pool->getLine(LineAddr);
+		uint64_t Mask = getByteMask(LineAddr, Start, End);
+		if((Line.DirtyMask & Mask) && Result.getOverlapResult() == ShadowResult::NoOverlap)
+			Result = ShadowResult(ShadowResult::Overlap, Line.LastWriteOp);
+		touchLine(Line);
+		Line.DirtyMask |= Mask;
+		Line.LastWriteOp = OpIndex;
+		Line.LastWriteTimeStamp = TimeStamp;
+	}
+	return Result;
+}
+
+inline ShadowResult ShadowMemory::recordFlush(uint32_t Id, uint64_t Start,
+													uint64_t Size, uint64_t TimeStamp, uint32_t Context) {
+	auto *Pool = findPool(Start);
+	if(!Pool || !Size)
+		return ShadowResult(ShadowResult::NotPersistent);
+
+	uint64_t End = std::min(Start + Size, Pool->End);
+	uint32_t OpIndex = FlushOpsVect.size();
+	FlushOpsVect.push_back(ShadowOp(Id, Start, End - Start, TimeStamp, Context));
+
+	for(uint64_t LineAddr = Start & ~CACHE_LINE_MASK;
+			LineAddr < End; LineAddr += CACHE_LINE_SIZE) {
+		auto &Line = Pool->getLine(LineAddr);
+		touchLine(Line);
+
+	// Flushing a dirty line again without writing to it in between is redundant.
+	// Flushes of clean lines are caught when the fence is encountered.
+		if(Line.isDirty() && Line.isFlushed()
+		&& Line.LastWriteTimeStamp <= Line.LastFlushTimeStamp)
+			FlushOpsVect[OpIndex].NumDuplicateLines++;
+		Line.NumFlushes++;
+		Line.LastFlushOp = OpIndex;
+		Line.LastFlushTimeStamp = TimeStamp;
+	}
+	return ShadowResult(ShadowResult::NoOverlap);
+}
+
+#endif  // SHADOW_MEMORY_H_
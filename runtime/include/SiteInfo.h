@@ -0,0 +1,165 @@
+//================================ Site Info ==================================//
+//
+// Where the instrumented instructions are in the source. The instrumenter emits
+// the line numbers and the names of the files and functions of the instructions
+// of every module as constant tables, along with a record of the module in the
+// pmcheck_modules section. The record also points to the groups of stores that
+// the instrumented code appends as one operation. At startup the runtime only
+// walks these records to give every module its range of IDs. The tables are
+// read when a report has to show where an instruction is or when a group is
+// drained, so startup does not depend on the number of instrumented
+// instructions.
+//
+//=============================================================================//
+
+#ifndef SITE_INFO_H_
+#define SITE_INFO_H_
+
+#include <cstdint>
+#include <ostream>
+
+#include "IdTable.h"
+
+// Layout of the tables the instrumenter emits for every module
+struct PMCheckSiteInfo {
+	uint32_t Line;
+
+// Offsets of the names in the names table of the module
+	uint32_t FileNameOffset;
+	uint32_t FuncNameOffset;
+};
+
+// Stores that the instrumented code appends as one operation. The members have
+// consecutive IDs from the ID of the first member.
+struct PMCheckStoreGroup {
+	uint32_t FirstId;
+
+// Index of the first member in the members table of the module
+	uint32_t FirstMember;
+	uint32_t NumMembers;
+};
+
+struct PMCheckGroupMember {
+// Offset of the address of the member from the address of the first member
+	int64_t Offset;
+	uint64_t Size;
+};
+
+struct PMCheckModuleInfo {
+// Where the instrumented code of the module loads its base ID from
+	uint32_t *IdBase;
+	uint32_t NumIds;
+	uint32_t NumStoreGroups;
+	const PMCheckSiteInfo *Sites;
+	const char *Names;
+
+// Store groups in the order of the IDs of their first members
+	const PMCheckStoreGroup *StoreGroups;
+	const PMCheckGroupMember *GroupMembers;
+};
+
+// The linker defines these for the section, if any module put a record in it
+extern "C" {
+extern const PMCheckModuleInfo __start_pmcheck_modules[] __attribute__((weak));
+extern const PMCheckModuleInfo __stop_pmcheck_modules[] __attribute__((weak));
+}
+
+// Where an instruction is. Instructions without debug info only have a line of 0.
+struct SiteLocation {
+	uint32_t Line;
+	const char *FileName;
+	const char *FuncName;
+
+	SiteLocation(uint32_t Line = 0, const char *FileName = nullptr,
+							 const char *FuncName = nullptr) :
+							 Line(Line), FileName(FileName), FuncName(FuncName) {}
+};
+
+static inline std::ostream &operator<<(std::ostream &OS, const SiteLocation &Location) {
+	OS << Location.Line;
+	if(Location.FileName && *Location.FileName)
+		OS << " (" << Location.FileName << ", " << Location.FuncName << ")";
+	return OS;
+}
+
+class SiteInfoRecord {
+// Line numbers registered at runtime for IDs outside of the modules
+	IdTable<uint32_t> LinesTable;
+
+	static const PMCheckModuleInfo *modulesBegin() {
+		return __start_pmcheck_modules;
+	}
+
+	static const PMCheckModuleInfo *modulesEnd() {
+		return __start_pmcheck_modules ? __stop_pmcheck_modules : __start_pmcheck_modules;
+	}
+
+public:
+// Give the modules consecutive ranges of IDs, starting at the given ID, in the
+// order of their records. This returns the ID after the last range. It only
+// uses the records, so it may run before any other constructor.
+	static uint32_t assignModuleIds(uint32_t FirstId) {
+		for(auto *Module = modulesBegin(); Module != modulesEnd(); ++Module) {
+			*Module->IdBase = FirstId;
+			FirstId += Module->NumIds;
+		}
+		return FirstId;
+	}
+
+// Modules are in the order of their base IDs, so the module of an ID is found
+// with a binary search.
+	static const PMCheckModuleInfo *findModule(uint32_t Id) {
+		auto *Begin = modulesBegin();
+		auto *End = modulesEnd();
+		while(Begin != End) {
+			auto *Middle = Begin + (End - Begin) / 2;
+			if(Id < *Middle->IdBase) {
+				End = Middle;
+			} else if(Id - *Middle->IdBase >= Middle->NumIds) {
+				Begin = Middle + 1;
+			} else {
+				return Middle;
+			}
+		}
+		return nullptr;
+	}
+
+// Find the group of stores whose first member has the given ID, along with
+// its members
+	static const PMCheckStoreGroup *findStoreGroup(uint32_t Id,
+																const PMCheckGroupMember *&Members) {
+		auto *Module = findModule(Id);
+		if(!Module)
+			return nullptr;
+		uint32_t FirstId = Id - *Module->IdBase;
+		auto *Begin = Module->StoreGroups;
+		auto *End = Begin + Module->NumStoreGroups;
+		while(Begin != End) {
+			auto *Middle = Begin + (End - Begin) / 2;
+			if(FirstId < Middle->FirstId) {
+				End = Middle;
+			} else if(FirstId > Middle->FirstId) {
+				Begin = Middle + 1;
+			} else {
+				Members = Module->GroupMembers + Middle->FirstMember;
+				return Middle;
+			}
+		}
+		return nullptr;
+	}
+
+	void set(uint32_t Id, uint32_t Line) {
+		LinesTable.set(Id, Line);
+	}
+
+	SiteLocation operator[](uint32_t Id) const {
+		if(auto *Module = findModule(Id)) {
+			auto &Site = Module->Sites[Id - *Module->IdBase];
+			return SiteLocation(Site.Line, Module->Names + Site.FileNameOffset,
+													Module->Names + Site.FuncNameOffset);
+		}
+		return SiteLocation(LinesTable[Id]);
+	}
+};
+
+#endif  // SITE_INFO_H_
@@ -0,0 +1,89 @@
+//============================ Persist Trace Format ===========================//
+//
+// Binary format of the persist traces that PMCheck runtime records when it runs
+// in record-only mode. The trace is split into fixed-size blocks and every block
+// belongs to one thread, so threads append to their own blocks without locks.
+//
+// A block starts with its header and is followed by records. Every record is a
+// kind byte followed by varint fields, so records are never larger than
+// TRACE_MAX_RECORD_SIZE. Addresses are offsets into the persistent memory pool
+// the operation accesses, delta encoded against the end of the previous access
+// in the block. Time stamps are delta encoded against the previous time stamp in
+// the block. Both are reset at the start of every block, so blocks can be decoded
+// independently of each other.
+//
+//=============================================================================//
+
+#ifndef TRACE_FORMAT_H_
+#define TRACE_FORMAT_H_
+
+#include <cstdint>
+
+#define TRACE_MAGIC 0x4543415254434d50ULL  // "PMCTRACE"
+#define TRACE_VERSION 1
+
+#define TRACE_BLOCK_SIZE ((uint64_t)1 << 16)
+#define TRACE_MAX_RECORD_SIZE 64
+
+// Kind byte of records. The pool of an access is only encoded if it differs from
+// the pool of the previous access in the block, which is marked in the kind byte.
+enum TraceRecordKind : uint8_t {
+	TraceWrite,
+	TraceStrictWrite,
+	TraceFlush,
+	TraceFence,
+	TracePool,
+	TraceAddContext,
+	TraceRemoveContext
+};
+
+#define TRACE_KIND_MASK 0x0f
+#define TRACE_POOL_CHANGED 0x80
+
+// The file header takes the first block of the trace
+struct TraceFileHeader {
+	uint64_t Magic;
+	uint32_t Version;
+	uint32_t BlockSize;
+};
+
+struct TraceBlockHeader {
+	uint32_t Thread;
+
+// Number of bytes of records in the block. This is updated after every record,
+// so the trace of a program that crashed can be read as well.
+	uint32_t Used;
+};
+
+// Encode the value in 7 bit groups, lowest first
+static inline uint8_t *encodeVarint(uint8_t *Ptr, uint64_t Value) {
+	while(Value >= 0x80) {
+		*Ptr++ = (uint8_t)Value | 0x80;
+		Value >>= 7;
+	}
+	*Ptr++ = (uint8_t)Value;
+	return Ptr;
+}
+
+// Returns false if the value runs past the end of the buffer
+static inline bool decodeVarint(const uint8_t *&Ptr, const uint8_t *End, uint64_t &Value) {
+	Value = 0;
+	for(unsigned Shift = 0; Ptr != End && Shift < 64; Shift += 7) {
+		uint8_t Byte = *Ptr++;
+		Value |= (uint64_t)(Byte & 0x7f) << Shift;
+		if(!(Byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+// Deltas may be negative, so map them to small unsigned values first
+static inline uint64_t encodeZigZag(int64_t Value) {
+	return ((uint64_t)Value << 1) ^ (uint64_t)(Value >> 63);
+}
+
+static inline int64_t decodeZigZag(uint64_t Value) {
+	return (int64_t)(Value >> 1) ^ -(int64_t)(Value & 1);
+}
+
+#endif  // TRACE_FORMAT_H_
@@ -0,0 +1,196 @@
+//============================ Persist Trace Reader ===========================//
+//
+// Reads persist traces recorded by PMCheck runtime. The trace is memory mapped
+// and its blocks are grouped by the thread that wrote them. A cursor decodes the
+// records of one thread in order, across the blocks of the thread.
+//
+//=============================================================================//
+
+#ifndef TRACE_READER_H_
+#define TRACE_READER_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <atomic>
+#include <vector>
+
+#include "TraceFormat.h"
+
+struct TraceRecord {
+	TraceRecordKind Kind;
+	uint32_t Id;
+
+// Pool index and offset of accesses. Pools have their address in Offset.
+	uint32_t Pool;
+	uint64_t Offset;
+	uint64_t Size;
+	uint64_t TimeStamp;
+};
+
+// Position in the records of a thread along with the state to decode from there
+struct TraceCursor {
+	uint32_t Thread;
+	uint32_t BlockIndex;
+	uint32_t Pos;
+	uint32_t LastPool;
+	uint64_t LastOffset;
+	uint64_t LastTimeStamp;
+
+	TraceCursor(uint32_t Thread = 0) :
+					Thread(Thread), BlockIndex(0), Pos(0), LastPool(0),
+					LastOffset(0), LastTimeStamp(0) {}
+};
+
+class TraceReader {
+	int FD;
+	const uint8_t *Begin;
+	uint64_t Size;
+	std::atomic<bool> Corrupt;
+
+// Blocks written by every thread, in the order they were written
+	std::vector<std::vector<const uint8_t *>> ThreadBlocksVect;
+
+public:
+	TraceReader() : FD(-1), Begin(nullptr), Size(0), Corrupt(false) {}
+
+	~TraceReader() {
+		if(Begin)
+			munmap((void *)Begin, Size);
+		if(FD >= 0)
+			close(FD);
+	}
+
+	TraceReader(const TraceReader &) = delete;
+	TraceReader &operator=(const TraceReader &) = delete;
+
+	bool open(const char *Path) {
+		FD = ::open(Path, O_RDONLY);
+		if(FD < 0)
+			return false;
+		struct stat Stat;
+		if(fstat(FD, &Stat) || (uint64_t)Stat.st_size < TRACE_BLOCK_SIZE)
+			return false;
+		Size = Stat.st_size;
+		void *Mapping = mmap(nullptr, Size, PROT_READ, MAP_SHARED, FD, 0);
+		if(Mapping == MAP_FAILED)
+			return false;
+		Begin = (const uint8_t *)Mapping;
+		auto *Header = (const TraceFileHeader *)Begin;
+		if(Header->Magic != TRACE_MAGIC || Header->Version != TRACE_VERSION
+		|| Header->BlockSize != TRACE_BLOCK_SIZE) {
+			return false;
+		}
+		madvise(Mapping, Size, MADV_SEQUENTIAL);
+		for(uint64_t Index = 1; Index < Size / TRACE_BLOCK_SIZE; ++Index) {
+			const uint8_t *Block = Begin + Index * TRACE_BLOCK_SIZE;
+			auto *BlockHeader = (const TraceBlockHeader *)Block;
+			if(!BlockHeader->Used)
+				continue;
+			if(BlockHeader->Used > TRACE_BLOCK_SIZE - sizeof(TraceBlockHeader))
+				return false;
+			if(BlockHeader->Thread >= ThreadBlocksVect.size())
+				ThreadBlocksVect.resize(BlockHeader->Thread + 1);
+			ThreadBlocksVect[BlockHeader->Thread].push_back(Block);
+		}
+		return true;
+	}
+
+	uint32_t getNumThreads() const {
+		return ThreadBlocksVect.size();
+	}
+
+	uint64_t getSize() const {
+		return Size;
+	}
+
+// Set if a record could not be decoded
+	bool isCorrupt() const {
+		return Corrupt;
+	}
+
+	bool next(TraceCursor &Cursor, TraceRecord &Record);
+};
+
+inline bool TraceReader::next(TraceCursor &Cursor, TraceRecord &Record) {
+	auto &BlocksVect = ThreadBlocksVect[Cursor.Thread];
+	const uint8_t *Block = nullptr;
+	uint32_t Used = 0;
+	for(; Cursor.BlockIndex != BlocksVect.size(); ++Cursor.BlockIndex) {
+		Block = BlocksVect[Cursor.BlockIndex];
+		Used = ((const TraceBlockHeader *)Block)->Used;
+		if(Cursor.Pos < Used)
+			break;
+
+	// The delta encoding starts over in every block
+		Cursor.Pos = 0;
+		Cursor.LastPool = 0;
+		Cursor.LastOffset = 0;
+		Cursor.LastTimeStamp = 0;
+	}
+	if(Cursor.BlockIndex == BlocksVect.size())
+		return false;
+
+	const uint8_t *Records = Block + sizeof(TraceBlockHeader);
+	const uint8_t *Ptr = Records + Cursor.Pos;
+	const uint8_t *End = Records + Used;
+	uint8_t KindByte = *Ptr++;
+	Record.Kind = (TraceRecordKind)(KindByte & TRACE_KIND_MASK);
+	uint64_t Value = 0;
+	bool Valid = true;
+	switch(Record.Kind) {
+		case TraceWrite:
+		case TraceStrictWrite:
+		case TraceFlush: {
+			if(KindByte & TRACE_POOL_CHANGED) {
+				Valid &= decodeVarint(Ptr, End, Value);
+				Cursor.LastPool = Value;
+				Cursor.LastOffset = 0;
+			}
+			uint64_t Delta = 0, TimeDelta = 0;
+			Valid &= decodeVarint(Ptr, End, Value);
+			Valid &= decodeVarint(Ptr, End, Delta);
+			Valid &= decodeVarint(Ptr, End, Record.Size);
+			Valid &= decodeVarint(Ptr, End, TimeDelta);
+			Record.Id = Value;
+			Record.Pool = Cursor.LastPool;
+			Record.Offset = Cursor.LastOffset + decodeZigZag(Delta);
+			Record.TimeStamp = Cursor.LastTimeStamp + decodeZigZag(TimeDelta);
+			Cursor.LastOffset = Record.Offset + Record.Size;
+			Cursor.LastTimeStamp = Record.TimeStamp;
+			break;
+		}
+
+		case TraceFence:
+		case TraceAddContext:
+			Valid &= decodeVarint(Ptr, End, Value);
+			Record.Id = Value;
+			break;
+
+		case TracePool:
+			Valid &= decodeVarint(Ptr, End, Value);
+			Valid &= decodeVarint(Ptr, End, Record.Offset);
+			Valid &= decodeVarint(Ptr, End, Record.Size);
+			Record.Pool = Value;
+			break;
+
+		case TraceRemoveContext:
+			break;
+
+		default:
+			Valid = false;
+			break;
+	}
+	if(!Valid) {
+		Corrupt = true;
+		Cursor.BlockIndex = BlocksVect.size();
+		return false;
+	}
+	Cursor.Pos = Ptr - Records;
+	return true;
+}
+
+#endif  // TRACE_READER_H_
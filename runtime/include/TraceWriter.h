@@ -0,0 +1,263 @@
+//============================ Persist Trace Writer ===========================//
+//
+// Writes persist traces for PMCheck runtime in record-only mode. The trace file is
+// memory mapped and grows by whole segments. Threads take blocks of the file one
+// at a time and append records to them without synchronizing with each other, so
+// recording costs little more than encoding the records.
+//
+//=============================================================================//
+
+#ifndef TRACE_WRITER_H_
+#define TRACE_WRITER_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#include "TraceFormat.h"
+
+#define TRACE_SEGMENT_SIZE ((uint64_t)1 << 26)
+#define TRACE_MAX_SEGMENTS 16384
+
+class TraceFile {
+	int FD;
+	bool Closed;
+
+// Index of the next block handed out. Block zero holds the file header.
+	uint64_t NextBlock;
+	uint32_t NumThreads;
+	std::vector<uint8_t *> SegmentsVect;
+	std::mutex TraceMutex;
+
+	bool mapSegment() {
+		if(SegmentsVect.size() == TRACE_MAX_SEGMENTS)
+			return false;
+		uint64_t Offset = SegmentsVect.size() * TRACE_SEGMENT_SIZE;
+		if(ftruncate(FD, Offset + TRACE_SEGMENT_SIZE))
+			return false;
+		void *Segment = mmap(nullptr, TRACE_SEGMENT_SIZE, PROT_READ | PROT_WRITE,
+												 MAP_SHARED, FD, Offset);
+		if(Segment == MAP_FAILED)
+			return false;
+		SegmentsVect.push_back((uint8_t *)Segment);
+		return true;
+	}
+
+public:
+	TraceFile() : FD(-1), Closed(true), NextBlock(1), NumThreads(0) {}
+
+	~TraceFile() {
+		close();
+	}
+
+	TraceFile(const TraceFile &) = delete;
+	TraceFile &operator=(const TraceFile &) = delete;
+
+	bool open(const char *Path) {
+		FD = ::open(Path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if(FD < 0)
+			return false;
+		if(!mapSegment()) {
+			::close(FD);
+			FD = -1;
+			return false;
+		}
+		auto *Header = (TraceFileHeader *)SegmentsVect[0];
+		Header->Magic = TRACE_MAGIC;
+		Header->Version = TRACE_VERSION;
+		Header->BlockSize = TRACE_BLOCK_SIZE;
+		Closed = false;
+		return true;
+	}
+
+// Cut off the blocks that were never handed out. The segments stay mapped, since
+// threads may still be writing to their blocks while the program exits.
+	void close() {
+		std::lock_guard<std::mutex> Lock(TraceMutex);
+		if(Closed)
+			return;
+		Closed = true;
+		if(ftruncate(FD, NextBlock * TRACE_BLOCK_SIZE))
+			std::cerr << "PMCheck: could not truncate the persist trace.\n";
+		::close(FD);
+	}
+
+	uint32_t registerThread() {
+		std::lock_guard<std::mutex> Lock(TraceMutex);
+		return NumThreads++;
+	}
+
+// Returns null once the trace is closed
+	uint8_t *allocateBlock(uint32_t Thread) {
+		std::lock_guard<std::mutex> Lock(TraceMutex);
+		if(Closed)
+			return nullptr;
+		uint64_t BlocksPerSegment = TRACE_SEGMENT_SIZE / TRACE_BLOCK_SIZE;
+		if(NextBlock == SegmentsVect.size() * BlocksPerSegment && !mapSegment()) {
+			std::cerr << "PMCheck: could not grow the persist trace.\n";
+			abort();
+		}
+		uint8_t *Block = SegmentsVect[NextBlock / BlocksPerSegment]
+									 + (NextBlock % BlocksPerSegment) * TRACE_BLOCK_SIZE;
+		NextBlock++;
+		auto *Header = (TraceBlockHeader *)Block;
+		Header->Thread = Thread;
+		Header->Used = 0;
+		return Block;
+	}
+};
+
+// Appends the records of one thread to its current block
+class TraceThreadWriter {
+	struct PoolInfo {
+		uint64_t Start;
+		uint64_t End;
+		uint32_t Index;
+	};
+
+	TraceFile *File;
+	uint32_t Thread;
+	uint8_t *Block;
+	uint32_t Used;
+
+// Delta encoding state. It is reset whenever a new block is taken.
+	uint32_t LastPool;
+	uint64_t LastOffset;
+	uint64_t LastTimeStamp;
+
+// Pools this thread knows of, sorted by their start
+	std::vector<PoolInfo> PoolsVect;
+	uint32_t LastHit;
+
+	uint8_t *begin() {
+		if(!Block || Used + TRACE_MAX_RECORD_SIZE > TRACE_BLOCK_SIZE - sizeof(TraceBlockHeader)) {
+			if(!File)
+				return nullptr;
+			if(!Block)
+				Thread = File->registerThread();
+			Block = File->allocateBlock(Thread);
+			if(!Block) {
+				File = nullptr;
+				return nullptr;
+			}
+			Used = 0;
+			LastPool = (uint32_t)-1;
+			LastOffset = 0;
+			LastTimeStamp = 0;
+		}
+		return Block + sizeof(TraceBlockHeader) + Used;
+	}
+
+	void commit(uint8_t *End) {
+		Used = End - (Block + sizeof(TraceBlockHeader));
+		((TraceBlockHeader *)Block)->Used = Used;
+	}
+
+	const PoolInfo *findPool(uint64_t Addr, uint64_t Size) {
+		if(LastHit < PoolsVect.size()) {
+			auto &Pool = PoolsVect[LastHit];
+			if(Pool.Start <= Addr && Addr + Size <= Pool.End)
+				return &Pool;
+		}
+		auto It = std::upper_bound(PoolsVect.begin(), PoolsVect.end(), Addr,
+															 [](uint64_t Addr, const PoolInfo &Pool) {
+			return Addr < Pool.Start;
+		});
+		if(It == PoolsVect.begin())
+			return nullptr;
+		--It;
+		if(Addr + Size > It->End)
+			return nullptr;
+		LastHit = It - PoolsVect.begin();
+		return &*It;
+	}
+
+public:
+	TraceThreadWriter(TraceFile *File) :
+					File(File), Thread(0), Block(nullptr), Used(0), LastPool((uint32_t)-1),
+					LastOffset(0), LastTimeStamp(0), LastHit(0) {}
+
+	void addPool(uint32_t Index, uint64_t Start, uint64_t End) {
+		PoolInfo Pool;
+		Pool.Start = Start;
+		Pool.End = End;
+		Pool.Index = Index;
+		auto It = std::upper_bound(PoolsVect.begin(), PoolsVect.end(), Start,
+															 [](uint64_t Start, const PoolInfo &Pool) {
+			return Start < Pool.Start;
+		});
+		PoolsVect.insert(It, Pool);
+		LastHit = 0;
+	}
+
+// Accesses outside the persistent memory pools are not recorded
+	void recordAccess(TraceRecordKind Kind, uint32_t Id, uint64_t Addr,
+										uint64_t Size, uint64_t TimeStamp) {
+		auto *Pool = findPool(Addr, Size);
+		if(!Pool)
+			return;
+		uint8_t *Ptr = begin();
+		if(!Ptr)
+			return;
+		uint64_t Offset = Addr - Pool->Start;
+		if(Pool->Index != LastPool) {
+			*Ptr++ = Kind | TRACE_POOL_CHANGED;
+			Ptr = encodeVarint(Ptr, Pool->Index);
+			LastPool = Pool->Index;
+			LastOffset = 0;
+		} else {
+			*Ptr++ = Kind;
+		}
+		Ptr = encodeVarint(Ptr, Id);
+		Ptr = encodeVarint(Ptr, encodeZigZag(Offset - LastOffset));
+		Ptr = encodeVarint(Ptr, Size);
+		Ptr = encodeVarint(Ptr, encodeZigZag(TimeStamp - LastTimeStamp));
+		LastOffset = Offset + Size;
+		LastTimeStamp = TimeStamp;
+		commit(Ptr);
+	}
+
+	void recordFence(uint32_t Id) {
+		uint8_t *Ptr = begin();
+		if(!Ptr)
+			return;
+		*Ptr++ = TraceFence;
+		commit(encodeVarint(Ptr, Id));
+	}
+
+	void recordPool(uint32_t Index, uint64_t Addr, uint64_t Size) {
+		uint8_t *Ptr = begin();
+		if(!Ptr)
+			return;
+		*Ptr++ = TracePool;
+		Ptr = encodeVarint(Ptr, Index);
+		Ptr = encodeVarint(Ptr, Addr);
+		commit(encodeVarint(Ptr, Size));
+	}
+
+	void recordAddContext(uint32_t Context) {
+		uint8_t *Ptr = begin();
+		if(!Ptr)
+			return;
+		*Ptr++ = TraceAddContext;
+		commit(encodeVarint(Ptr, Context));
+	}
+
+	void recordRemoveContext() {
+		uint8_t *Ptr = begin();
+		if(!Ptr)
+			return;
+		*Ptr++ = TraceRemoveContext;
+		commit(Ptr);
+	}
+};
+
+#endif  // TRACE_WRITER_H_
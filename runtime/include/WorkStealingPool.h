@@ -0,0 +1,102 @@
+//============================ Work Stealing Pool =============================//
+//
+// Thread pool for the offline tools of PMCheck. Every worker has its own queue
+// of tasks. Workers run tasks from the back of their own queue and steal from the
+// front of the queues of other workers when their queue runs dry, so uneven tasks
+// still keep all the workers busy.
+//
+//=============================================================================//
+
+#ifndef WORK_STEALING_POOL_H_
+#define WORK_STEALING_POOL_H_
+
+#include <sched.h>
+
+#include <cstdint>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool {
+	struct WorkQueue {
+		std::mutex QueueMutex;
+		std::deque<std::function<void()>> TasksDeque;
+	};
+
+	std::vector<std::unique_ptr<WorkQueue>> QueuesVect;
+
+// Tasks submitted but not finished yet
+	std::atomic<uint64_t> NumPending;
+	std::atomic<uint32_t> NextQueue;
+
+	bool popTask(unsigned Worker, std::function<void()> &Task) {
+		auto &Queue = *QueuesVect[Worker];
+		std::lock_guard<std::mutex> Lock(Queue.QueueMutex);
+		if(Queue.TasksDeque.empty())
+			return false;
+		Task = std::move(Queue.TasksDeque.back());
+		Queue.TasksDeque.pop_back();
+		return true;
+	}
+
+	bool stealTask(unsigned Worker, std::function<void()> &Task) {
+		for(unsigned I = 1; I != QueuesVect.size(); ++I) {
+			auto &Queue = *QueuesVect[(Worker + I) % QueuesVect.size()];
+			std::lock_guard<std::mutex> Lock(Queue.QueueMutex);
+			if(Queue.TasksDeque.empty())
+				continue;
+			Task = std::move(Queue.TasksDeque.front());
+			Queue.TasksDeque.pop_front();
+			return true;
+		}
+		return false;
+	}
+
+	void work(unsigned Worker) {
+		std::function<void()> Task;
+		while(NumPending.load(std::memory_order_acquire)) {
+			if(!popTask(Worker, Task) && !stealTask(Worker, Task)) {
+				sched_yield();
+				continue;
+			}
+			Task();
+			Task = nullptr;
+			NumPending.fetch_sub(1, std::memory_order_acq_rel);
+		}
+	}
+
+public:
+	WorkStealingPool(unsigned NumWorkers) : NumPending(0), NextQueue(0) {
+		if(!NumWorkers)
+			NumWorkers = 1;
+		for(unsigned I = 0; I != NumWorkers; ++I)
+			QueuesVect.emplace_back(new WorkQueue());
+	}
+
+	unsigned getNumWorkers() const {
+		return QueuesVect.size();
+	}
+
+// Tasks are spread over the queues. Tasks may submit more tasks.
+	void submit(std::function<void()> Task) {
+		NumPending.fetch_add(1, std::memory_order_acq_rel);
+		auto &Queue = *QueuesVect[NextQueue.fetch_add(1) % QueuesVect.size()];
+		std::lock_guard<std::mutex> Lock(Queue.QueueMutex);
+		Queue.TasksDeque.push_back(std::move(Task));
+	}
+
+// Run all the tasks submitted so far on new worker threads and wait for them
+	void run() {
+		std::vector<std::thread> WorkersVect;
+		for(unsigned I = 0; I != QueuesVect.size(); ++I)
+			WorkersVect.emplace_back(&WorkStealingPool::work, this, I);
+		for(auto &Worker : WorkersVect)
+			Worker.join();
+	}
+};
+
+#endif  // WORK_STEALING_POOL_H_
@@ -5,314 +5,681 @@
 // This has all the interval trees for runtime checks for looking
 // for performance bugs and looking for persistent memory mapping ranges.
 //
+// Records of writes, flushes and calling contexts are kept per thread, so
+// application threads do not synchronize with each other while recording or
+// checking. Only the rare operations, i.e. registering persistent memory pools
+// and debug info, and printing reports use shared state.
+//
+// Instrumented code appends the writes and flushes of a thread to a buffer of
+// the thread. The buffer is drained into the records at fences and when it is
+// full, so the runtime is not called for every set of operations.
+//
+// Persist ordering across threads is checked by logging the operations of every
+// thread to its own lock-free buffer. A merger thread orders them by their stamps
+// and passes them to the cross-thread checker.
+//
+// Only a sample of the fence epochs of every thread may be checked to bound the
+// overhead. Nothing is recorded in the epochs that are not checked.
+//
+// In record-only mode nothing is checked. The operations are appended to a persist
+// trace on disk instead, so that they can be checked offline.
+//
 //============================================================================//
 
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <atomic>
+#include <mutex>
 #include <string>
-#include <unordered_map>
+#include <map>
+#include <new>
+#include <scoped_allocator>
 #include <vector>
 #include <utility>
+#include <tuple>
 
 #include "IntervalTree.h"
+#include "FlatIntervalSet.h"
+#include "OpRecord.h"
+#include "PoolTable.h"
+#include "IdTable.h"
+#include "SiteInfo.h"
+#include "ShadowMemory.h"
+#include "EventLog.h"
+#include "CrossThreadChecker.h"
+#include "Diagnostics.h"
+#include "TraceWriter.h"
+#include "EpochSampler.h"
+#include "Profiler.h"
+#include "OpBuffer.h"
+
+// Number of events each thread can log before the merger has to catch up
+#define EVENT_LOG_CAPACITY ((uint64_t)1 << 16)
+
+// The runtime is linked into the application, so print to standard error
+// directly instead of using LLVM's raw streams.
+static inline std::ostream &errs() {
+	return std::cerr;
+}
 
-
-// This maps the instruction IDs with their line numbers
-using DebugInfoRecord = std::unordered_map<uint32_t, uint32_t>;
+// This maps the instruction IDs with where they are in the source
+using DebugInfoRecord = SiteInfoRecord;
 
 // This maps the context (call site) id to the name of the function is being invoked
-using ContextNameRecord = std::unordered_map<uint32_t, std::string>;
+using ContextNameRecord = IdTable<std::string>;
+
+// Interval sets used by the records. Inserting into or removing from the sorted
+// array moves the intervals after the position, so an epoch with many writes
+// would take quadratic time. The interval tree is used unless
+// PMCHECK_FLAT_INTERVAL_SET is defined to use the sorted array, which is faster
+// for programs whose epochs only hold a few dozen intervals.
+#ifdef PMCHECK_FLAT_INTERVAL_SET
+using OpIntervalSet = FlatIntervalSet<OpList>;
+#else
+using OpIntervalSet = IntervalTree<true, OpList>;
+#endif
+
+// This puts all the memory ranges allocated in persistent memory in a table. This
+// is essentially shadow memory for us to make sure which addresses being written
+// to lie in persistent memory.
+using PMRecord = PoolTable;
+
+// Instantiate the records shared by all threads as globals. These are only
+// updated at startup and read when reports are printed.
+DebugInfoRecord DIR;
+ContextNameRecord CNR;
 
-// This puts all the memory ranges allocated in persistent memory in an interval
-// tree. This is essentially shadow memory for us to make sure which addresses being
-// written to lie in persistent memory.
-using PMRecord = IntervalTree<true>;
+// Threads look up whether writes are to persistent memory in the same table, which
+// is republished whenever a pool is allocated
+PMRecord PMR;
 
-// This class records information about persist operations i.e. writes and flushes.
-// It contains all the necessary information regarding instruction IDs, addresses
-// ranges, context IDs and time stamp of when those instructions were executed.
-class OpRecord {
-// Vector of tuples containing instruction ID, time stamp and context ID
-	typedef std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> OpIdInfoTy;
+// Coarse bounds of the pools that the instrumented code checks writes against
+// before it records them
+extern "C" PoolBounds PMCheckPoolBounds[PMCHECK_NUM_POOL_BOUNDS];
+PoolBounds PMCheckPoolBounds[PMCHECK_NUM_POOL_BOUNDS];
+
+// The instrumenter numbers the instructions of every module from zero, and every
+// module gets the next range of IDs before any constructor of the application
+// runs. ID 0 stands for no context.
+__attribute__((constructor(101)))
+static void AssignModuleIds() {
+	SiteInfoRecord::assignModuleIds(1);
+}
 
-// Tuple containing interval pair, time stamp, and context ID
-	typedef std::tuple<std::pair<uint64_t, uint64_t>, uint32_t, uint32_t> OpIdTupleInfoTy;
+// Every thread records its own writes and flushes and checks them at its fences
+thread_local OpRecord<OpIntervalSet> WR;
+thread_local OpRecord<OpIntervalSet> FR;
 
-// Interval Tree to record intervals
-	IntervalTree<true> OpIntervalTree;
+// Shadow memory for the persistent memory pools. This is used instead of the
+// write and flush records when the shadow memory engine is selected.
+thread_local ShadowMemory SM;
 
-// Use a hash table for recording instruction IDs, their context and their
-// corresponding intervals. It records a history of all the operations performed
-// on interval trees.
-	std::unordered_map<std::pair<uint64_t, uint64_t>, OpIdInfoTy> RangeToOpIdsHashMap;
+// Index of the pool range this thread found a write in last
+thread_local uint32_t ThreadLastPool;
 
-// Maintain a map that maintains the flushes and their ranges. This is for the slow
-// access to information, when the information from the hash map is not enough.
-// A single instruction can operate on multiple intervals.
-	std::map<uint32_t , std::vector<OpIdTupleInfoTy>> OpIdToInfoMap;
+// A vecrtor to keep track of all the calling contexts of this thread
+thread_local std::vector<uint32_t> ContextVect;
 
-// Vector of intervals. This is not used until interval tree iterators are used.
-	std::vector<std::pair<uint64_t, uint64_t>> IntervalVect;
+// Indices of the operations of a batch that are recorded in the interval trees
+thread_local std::vector<uint32_t> BatchIndexVect;
 
-public:
-	OpRecord() : OpIntervalTree(), RangeToOpIdsHashMap() , OpIdToInfoMap() {}
+// Operations the instrumented code appended that are not recorded yet, and the
+// number of them that makes it drain the buffer
+extern "C" {
+thread_local OpBuffer PMCheckOps;
+uint32_t PMCheckOpBufferLimit = PMCHECK_OP_BUFFER_CAPACITY;
+}
 
-	~OpRecord() {
-		~RangeToOpIdsHashMap();
-		~OpIdToInfoMap();
-		~OpIntervalTree();
-	}
+// Runs of drained operations are laid out as arrays, as the instrumented code
+// used to pass them. They are stamped in the order they were appended, from the
+// start of the epoch.
+thread_local uint32_t DrainedIdArray[PMCHECK_OP_BUFFER_CAPACITY];
+thread_local uint64_t DrainedAddrArray[PMCHECK_OP_BUFFER_CAPACITY];
+thread_local uint64_t DrainedSizeArray[PMCHECK_OP_BUFFER_CAPACITY];
+thread_local uint64_t DrainedTimeArray[PMCHECK_OP_BUFFER_CAPACITY];
+thread_local uint64_t ThreadOpTimeStamp;
+
+// All the persistent memory pools allocated by the application. Threads that
+// trace or use shadow memory copy new pools when the generation changes.
+static std::vector<std::pair<uint64_t, uint64_t>> PoolsVect;
+static std::mutex PoolsMutex;
+static std::atomic<uint64_t> PoolsGeneration(0);
+thread_local uint64_t ThreadPoolsGeneration;
+thread_local uint64_t ThreadNumPools;
+
+// Serializes printing of reports and accesses to debug info from threads
+static std::recursive_mutex ReportMutex;
+
+// The engine that records writes and flushes is chosen when the runtime starts
+// with PMCHECK_ENGINE environment variable set to "tree" (default) or "shadow".
+static bool UseShadowEngine() {
+	const char *Engine = getenv("PMCHECK_ENGINE");
+	return Engine && !strcmp(Engine, "shadow");
+}
 
-	ITResult::OverlapResult insert(uint32_t Id, uint64_t StartAddr, uint64_t Size,
-																 uint32_t TimeStamp, uint32_t Context) {
-	// Add the interval to the interval tree
-		ITResult Result = OpIntervalTree.insert(Start, Start + Size);
+static const bool ShadowEngine = UseShadowEngine();
 
-	// Add the information to the map
-		auto Pair = std::make_pair(StartAddr, Start + Size);
-		OpIdToInfoMap[Id].push_back(std::make_tuple(Pair, TimeStamp, Context));
+// Persist ordering across threads is also checked if PMCHECK_CROSS_THREAD
+// environment variable is set to a non-zero value.
+static bool UseCrossThreadChecking() {
+	const char *CrossThread = getenv("PMCHECK_CROSS_THREAD");
+	return CrossThread && strcmp(CrossThread, "0");
+}
 
-	// Add the new interval	to the hash map
-		auto OR = Result.getOverlapResult();
-		switch(OR)) {
-			case ITResult::CompleteOverlap:
+static const bool CrossThreadChecking = UseCrossThreadChecking();
 
-			case ITResult::CompletlyPerfectOverlap:
-
-			case ITResult::NoOverlap:
-				auto Pair = std::make_pair(Result.getNode(0)->Start, Result.getNode(0)->End);
-				RangeToOpIdsHashMap[Pair].push_back(std::make_tuple(Id, TimeStamp, Context));
-				return OR;
-
-			case ITResult::PartialOverlap:
-			// This is trickier because we will have to update the interval as well
-				ITResult::NodeState PrevState = Result.getPreviousNodeRange(0);
-				auto OldPair = std::make_pair(PrevState.Start, PrevState.End);
-				auto NewPair = std::make_pair(Result.getNode(0)->Start, Result.getNode(0)->End);
-				RangeToOpIdsHashMap[NewPair] = RangeToOpIdsHashMap[OldPair];
-				RangeToOpIdsHashMap[OldPair].clear();
-				RangeToOpIdsHashMap[NewPair].push_back(std::make_tuple(Id, TimeStamp, Context));
-				return OR;
-		}
-		return OR;
-	}
+// Operations are only recorded to a persist trace if PMCHECK_TRACE environment
+// variable names the file to write the trace to.
+static TraceFile Trace;
 
-	ITResult searchInterval(uint64_t StartAddr, uint64_t EndAddr) const {
-		return OpIntervalTree.getSearchDetails(StartAddr, EndAddr);
+static bool StartTraceRecording() {
+	const char *Path = getenv("PMCHECK_TRACE");
+	if(!Path || !*Path)
+		return false;
+	if(!Trace.open(Path)) {
+		errs() << "PMCheck: could not open persist trace " << Path
+					 << ", checking operations instead.\n";
+		return false;
 	}
+	return true;
+}
+
+static const bool TraceRecording = StartTraceRecording();
+
+thread_local TraceThreadWriter ThreadTrace(&Trace);
+
+// Only a sample of the epochs is checked if PMCHECK_SAMPLE environment variable
+// is set to "N" to check every Nth epoch of a thread, or to "P%" to check an epoch
+// with a probability of P percent. Random samples are seeded by PMCHECK_SAMPLE_SEED.
+static const SamplingPolicy Sampling = SamplingPolicy::parse(getenv("PMCHECK_SAMPLE"),
+																														 getenv("PMCHECK_SAMPLE_SEED"));
+
+// Epochs seen and checked by all threads, to extrapolate the findings from
+static std::atomic<uint64_t> NumEpochs(0);
+static std::atomic<uint64_t> NumCheckedEpochs(0);
+static std::atomic<uint32_t> NumSampledThreads(0);
 
-	std::vector<std::pair<uint64_t, uint64_t>> &getIntervalsFor(uint32_t Id) const {
-		std::vector<std::pair<uint64_t, uint64_t>> IntervalPairVect;
-		for(auto &Tuple : OpIdToInfoMap[Id)
-			IntervalPairVect.push_back(std::get<0>(Tuple));
-		return IntervalPairVect;
+thread_local EpochSampler ThreadSampler(Sampling, NumSampledThreads.fetch_add(1));
+
+static inline bool IsEpochChecked() {
+	return !Sampling.enabled() || ThreadSampler.isChecked();
+}
+
+// The runtime profiles itself if PMCHECK_PROFILE environment variable is set to a
+// non-zero value. The profile is printed when the program exits.
+static bool UseProfiling() {
+	const char *Profile = getenv("PMCHECK_PROFILE");
+	return Profile && strcmp(Profile, "0");
+}
+
+static const bool Profiling = UseProfiling();
+
+static RuntimeProfiler Profiler;
+
+struct ProfilePrinter {
+	~ProfilePrinter() {
+		if(Profiling)
+			Profiler.print(errs());
 	}
+};
+
+static ProfilePrinter ProfPrinter;
 
-	std::vector<uint32_t> getTimeStampsFor(uint32_t Id) const {
-		std::vector<uint32_t> TimeStampsVect;
-		for(auto &Tuple : OpIdToInfoMap[Id)
-			TimeStampsVect.push_back(std::get<1>(Tuple));
-		return TimeStampsVect;
+// Profile of this thread. It is merged into the profile of the runtime when the
+// thread exits.
+struct ThreadProfileHandle {
+	ThreadProfile Profile;
+
+	~ThreadProfileHandle() {
+		Profiler.merge(Profile);
 	}
+};
 
-	std::vector<uint32_t> getContextsFor(uint32_t Id) const {
-		std::vector<uint32_t> ContextsVect;
-		for(auto &Tuple : OpIdToInfoMap[Id)
-			ContextsVect.push_back(std::get<2>(Tuple));
-		return ContextsVect;
+thread_local ThreadProfileHandle ThreadProf;
+
+static inline ThreadProfile *CurrentThreadProfile() {
+	return Profiling ? &ThreadProf.Profile : nullptr;
+}
+
+// Findings of all threads. They are printed when the program exits or when the
+// application asks for them.
+static DiagnosticSink Diags;
+
+static void PrintDiagnosticsSummary() {
+	if(Sampling.enabled()) {
+		Diags.printSummary(errs(), NumCheckedEpochs.load(), NumEpochs.load());
+		return;
 	}
+	Diags.printSummary(errs());
+}
 
-	OpIdInfoTy &getIdAndContextAndTimeStampFor(uint64_t Start, uint64_t End) const {
-		return RangeToOpIdsHashMap[std::make_pair(Start, End)];
+struct DiagnosticsSummaryPrinter {
+	~DiagnosticsSummaryPrinter() {
+		if(!Diags.empty())
+			PrintDiagnosticsSummary();
 	}
+};
 
-	void clear() {
-	// Clear everything
-		RangeToOpIdsHashMap.clear();
-		OpIntervalTree.clear();
-		OpIdToInfoMap.clear();
+// This is destroyed after the event log merger, so it sees its last findings
+static DiagnosticsSummaryPrinter DiagsPrinter;
+
+static void ReportCrossThreadFinding(const CrossThreadFinding &Finding) {
+	std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+	switch(Finding.Kind) {
+		case CrossThreadFinding::CrossThreadFlush:
+			Diags.report(CrossThreadFlushFinding, Finding.SecondId, Finding.SecondContext)
+						 << "Flush at line " << DIR[Finding.SecondId] << " in thread "
+						 << Finding.SecondThread << " flushes cache line at " << Finding.LineAddr
+						 << " written by write at line " << DIR[Finding.FirstId]
+						 << " in thread " << Finding.FirstThread << ".\n";
+			break;
+
+		case CrossThreadFinding::CrossThreadOverwrite:
+			Diags.report(CrossThreadOverwriteFinding, Finding.SecondId, Finding.SecondContext)
+						 << "Write at line " << DIR[Finding.SecondId] << " in thread "
+						 << Finding.SecondThread << " writes to cache line at " << Finding.LineAddr
+						 << " holding unpersisted write at line " << DIR[Finding.FirstId]
+						 << " in thread " << Finding.FirstThread << ".\n";
+			break;
+
+		case CrossThreadFinding::CrossThreadWriteAfterFlush:
+			Diags.report(CrossThreadWriteAfterFlushFinding, Finding.SecondId, Finding.SecondContext)
+						 << "Write at line " << DIR[Finding.SecondId] << " in thread "
+						 << Finding.SecondThread << " writes to cache line at " << Finding.LineAddr
+						 << " after flush at line " << DIR[Finding.FirstId] << " in thread "
+						 << Finding.FirstThread << ", so it is not persisted by the fence"
+						 << " in that thread.\n";
+			break;
 	}
+}
 
-	bool empty() {
-	// The record depends on the interval tree primarily
-		return OpIntervalTree.empty();
+// The checker runs on the merger thread only
+static CrossThreadChecker CTC(ReportCrossThreadFinding);
+static EventLogMerger<CrossThreadChecker> ELM(CTC, EVENT_LOG_CAPACITY);
+
+// Events are stamped when they are logged, so operations are not buffered when
+// they are checked across threads. Otherwise every epoch of a thread would be
+// stamped at once when the buffer is drained.
+static bool StartEventLogMerger() {
+	if(CrossThreadChecking) {
+		PMCheckOpBufferLimit = 1;
+		ELM.start();
 	}
+	return CrossThreadChecking;
+}
 
-	ITResult remove(uint64_t Start, uint64_t End) {
-		auto Result = OpIntervalTree.getRemoveDetails(Start, End);
-		auto OR = Result.getOverlapResult();
-		switch(OR) {
-			case ITResult::CompletlyPerfectOverlap:
-			// Entire range is removed. Remove node info too.
-				auto PrevState = Result.getPreviousNodeRange(0);
-				auto OldPair = std::make_pair(PrevState.Start, PrevState.End);
-				//RangeToOpIdsHashMap[OldPair].clear();
-				return Result;
+static const bool EventLogMergerStarted = StartEventLogMerger();
 
-			case ITResult::CompleteOverlap:
-			// Update the node info. Note that if there is an ID where the interval
-			// associated with it is removed from the interval tree, we do not remove
-			// the ID from the hash map because that would require standard map look up
-			// which can be really slow.
-				auto PrevState = Result.getPreviousNodeRanges(0);
-				auto OldPair = std::make_pair(PrevState.Start, PrevState.End);
-				if(PrevState.size() == 2) {
-				// The interval was split somewhere in the middle
-					auto NewPair1 = std::make_pair(Result.getNode(0)->Start, Result.getNode(0)->End);
-					auto NewPair2 = std::make_pair(Result.getNode(1)->Start, Result.getNode(1)->End);
-					RangeToOpIdsHashMap[NewPair1] = RangeToOpIdsHashMap[OldPair];
-					RangeToOpIdsHashMap[NewPair2] = RangeToOpIdsHashMap[OldPair];
-				} else {
-					auto NewPair = std::make_pair(Result.getNode(0)->Start, Result.getNode(0)->End);
-					RangeToOpIdsHashMap[NewPair] = RangeToOpIdsHashMap[OldPair];
-				}
-				//RangeToOpIdsHashMap[OldPair].clear();
-				return Result;
-
-			case ITResult::PartialCompleteOverlap:
-			// Update the nodes info. Note that if there is an ID where the interval
-			// associated with it is removed from the interval tree, we do not remove
-			// the ID from the hash map because that would require standard map look up
-			// which can be really slow.
-				for(uint32_t Index = 0; Index != Result.getNumOverlapNodes(); ++Index) {
-					auto PrevState = Result.getPreviousNodeRange(Index);
-					auto OldPair = std::make_pair(PrevState.Start, PrevState.End);
-					auto NewPair = std::make_pair(Result.getNode(Index)->Start,
-																				Result.getNode(Index)->End);
-					RangeToOpIdsHashMap[NewPair] = RangeToOpIdsHashMap[OldPair];
-					//RangeToOpIdsHashMap[OldPair].clear();
-				}
-				return Result;
-		}
-		return Result;
-	}
+// Event log of this thread. It is registered with the merger when the thread
+// logs its first event and handed back to the merger when the thread exits.
+struct ThreadEventLogHandle {
+	ThreadEventLog *Log;
 
-// Iterators for the standard map
-	using iterator =
-			typename std::map<uint32_t , OpIdTupleInfoTy>::iterator;
-	using reverse_iterator =
-			typename std::map<uint32_t , OpIdTupleInfoTy>>::reverse_iterator;
-	using const_iterator =
-			typename std::map<uint32_t , OpIdTupleInfoTy>::const_iterator;
+	ThreadEventLogHandle() : Log(nullptr) {}
 
-	iterator begin() {
-		return OpIdToInfoMap.begin();
+	~ThreadEventLogHandle() {
+		if(Log)
+			Log->finish();
 	}
+};
 
-	iterator end() {
-		return OpIdToInfoMap.end();
-	}
+thread_local ThreadEventLogHandle ThreadLog;
 
-	reverse_iterator rbegin() {
-		return OpIdToInfoMap.rbegin();
-	}
+static uint32_t CurrentContext() {
+	if(ContextVect.empty())
+		return 0;
+	return ContextVect.back();
+}
+
+static inline void LogEvent(PersistEventKind Kind, uint32_t Id,
+														uint64_t Addr, uint64_t Size) {
+	if(!ThreadLog.Log)
+		ThreadLog.Log = ELM.registerThread();
+	ThreadLog.Log->append(ELM.getClock(), Kind, Id, Addr, Size, CurrentContext());
+}
 
-	reverse_iterator rend() {
-		return OpIdToInfoMap.rend();
+// Copy the pools allocated since the last time this thread looked
+static inline void SyncPools() {
+	if(!TraceRecording && !ShadowEngine)
+		return;
+	if(ThreadPoolsGeneration == PoolsGeneration.load(std::memory_order_acquire))
+		return;
+	std::lock_guard<std::mutex> Lock(PoolsMutex);
+	for(; ThreadNumPools != PoolsVect.size(); ++ThreadNumPools) {
+		auto &Pool = PoolsVect[ThreadNumPools];
+		if(TraceRecording)
+			ThreadTrace.addPool(ThreadNumPools, Pool.first, Pool.second);
+		else
+			SM.addPool(Pool.first, Pool.second - Pool.first);
 	}
+	ThreadPoolsGeneration = PoolsGeneration.load(std::memory_order_relaxed);
+}
 
-// Iterators for the interval tree
-		using IT_iterator = typename std::vector<std::pair<uint64_t, uint64_t>>::iterator;
+extern "C" void DrainOpBuffer();
+
+// The runtime appends operations to the buffer like the instrumented code does
+static inline void AppendOp(BufferedOpKind Kind, uint32_t Id) {
+	auto &Op = PMCheckOps.Ops[PMCheckOps.NumOps++];
+	Op.Addr = 0;
+	Op.Size = 0;
+	Op.Id = Id;
+	Op.Kind = Kind;
+	if(PMCheckOps.NumOps >= PMCheckOpBufferLimit)
+		DrainOpBuffer();
+}
 
-		IT_iterator IT_begin() {
-			IntervalVect = OpIntervalTree.getIntervals();
-			return IntervalVect.begin();
-		}
+// Operations that are still in the buffer have to be recorded before any that
+// are passed to the runtime directly
+static inline void DrainPendingOps() {
+	if(PMCheckOps.NumOps)
+		DrainOpBuffer();
+}
 
-		IT_iterator IT_end() {
-			return IntervalVect.end();
-		}
-};
+static void ChangeToContext(uint32_t Context) {
+	if(TraceRecording) {
+		ThreadTrace.recordAddContext(Context);
+		return;
+	}
+	ContextVect.push_back(Context);
+}
 
-// Instantiate all the records as globals
-OpRecord WR;
-OpRecord FR;
-DebugInfoRecord DIR;
-ContextNameRecord CNR;
-PMRecord PMR;
+static void ChangeToPreviousContext() {
+	if(TraceRecording) {
+		ThreadTrace.recordRemoveContext();
+		return;
+	}
+	ContextVect.pop_back();
+}
 
-// A vecrtor to keep track of all the calling contexts
-std::vector<uint32_t> ContextVect;
+extern "C" {
 
 void AddContext(uint32_t Context) {
-	ContextVect.push_back(Context);
+	AppendOp(BufferedAddContext, Context);
 }
 
 void RemoveContext() {
-	ContextVect.pop_back();
+	AppendOp(BufferedRemoveContext, 0);
 }
 
 void RegisterDebugInfo(uint32_t *OpArray, uint32_t *LineNumArray, uint32_t N) {
+	std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
 	for(uint32_t Index = 0; Index != N; ++Index)
-		DIR.insert(std::make_pair(OpArray[Index], LineNumArray[Index]));
+		DIR.set(OpArray[Index], LineNumArray[Index]);
+}
+
+void RegisterContextNameInfo(uint32_t *CallSiteIdArray, char **NamesArray, uint32_t N) {
+	std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+	for(uint32_t Index = 0; Index != N; ++Index)
+		CNR.set(CallSiteIdArray[Index], std::string(NamesArray[Index]));
+}
+
+void AllocatePM(uint64_t Addr, uint64_t Size) {
+	ProfileScope Scope(CurrentThreadProfile(), ProfileAllocatePM, 1);
+	std::lock_guard<std::mutex> Lock(PoolsMutex);
+	PoolsVect.push_back(std::make_pair(Addr, Addr + Size));
+	PMR.add(Addr, Addr + Size);
+	AddPoolBounds(PMCheckPoolBounds, Addr, Addr + Size);
+	if(TraceRecording)
+		ThreadTrace.recordPool(PoolsVect.size() - 1, Addr, Size);
+	PoolsGeneration.fetch_add(1, std::memory_order_release);
+}
+
+// Print the findings so far. Applications can call this to see the findings of
+// long runs before they exit.
+void PrintDiagnostics() {
+	PrintDiagnosticsSummary();
 }
 
-void RegisterContextNameInfo(uint32_t *CallSiteIdArray, char *[] NamesArray, uint32_t N) {
-	for(uint32_t Index = 0; Index != N; ++Index) {
+}  // extern "C"
+
+static bool IsPersistent(uint64_t Addr, uint64_t Size) {
+	if(ShadowEngine)
+		return SM.isPersistent(Addr, Size);
+	return PMR.contains(Addr, Size, ThreadLastPool);
+}
 
+// Log the operations on persistent memory for the cross-thread checker
+static void LogEvents(PersistEventKind Kind, uint32_t *IdArray, uint64_t *AddrArray,
+											uint64_t *SizeArray, uint32_t N) {
+	for(uint32_t Index = 0; Index != N ; ++Index) {
+		if(IsPersistent(AddrArray[Index], SizeArray[Index]))
+			LogEvent(Kind, IdArray[Index], AddrArray[Index], SizeArray[Index]);
 	}
 }
 
-void AllocatePM(uint64_t Addr, uint64_t Size) {
-	PMR.insert(Addr, Addr + Size);
+// Append the operations to the persist trace of this thread
+static void TraceOperations(TraceRecordKind Kind, uint32_t *IdArray, uint64_t *AddrArray,
+														uint64_t *SizeArray, uint64_t *TimeArray, uint32_t N) {
+	SyncPools();
+	for(uint32_t Index = 0; Index != N ; ++Index) {
+		ThreadTrace.recordAccess(Kind, IdArray[Index], AddrArray[Index],
+														 SizeArray[Index], TimeArray[Index]);
+	}
+}
+
+static void ShadowRecordWrites(uint32_t *IdArray, uint64_t *AddrArray,
+								uint64_t *SizeArray, uint64_t *TimeArray, uint32_t N) {
+	for(uint32_t Index = 0; Index != N ; ++Index) {
+		auto Result = SM.recordWrite(IdArray[Index], AddrArray[Index], SizeArray[Index],
+																 TimeArray[Index], CurrentContext());
+
+	// Check if the write overlaps with any executed write, report an error
+		if(Result.getOverlapResult() == ShadowResult::Overlap) {
+			std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+			auto &PrevWrite = SM.getWriteOps()[Result.getOverlapOp()];
+			Diags.report(OverlappingWrite, IdArray[Index], CurrentContext())
+						 << "Write at line " << DIR[IdArray[Index]] << " that writes from "
+						 << AddrArray[Index] << " upto size " << SizeArray[Index] << " in a function "
+						 << CNR[CurrentContext()] << " invoked from line"
+						 << DIR[CurrentContext()] << " writes to a location written by write at line "
+						 << DIR[PrevWrite.Id] << " that is not persisted yet.\n";
+		}
+	}
+}
+
+// Add the sizes of the records of the epoch that ends to the profile
+static void ProfileEpoch() {
+	if(ShadowEngine) {
+		ThreadProf.Profile.addEpoch(SM.getWriteOps().size(), SM.getFlushOps().size(), 0);
+		return;
+	}
+	ThreadProf.Profile.addEpoch(WR.size(), FR.size(), WR.getNumNodesVisited()
+															+ FR.getNumNodesVisited());
 }
 
+extern "C" {
+
 // Use this for writes that are not supposed to follow strict persistency
 void RecordNonStrictWrites(uint32_t *IdArray, uint64_t *AddrArray,
-													 uint64_t *SizeArray, uint32_t *TimeArray, uint32_t N) {
+													 uint64_t *SizeArray, uint64_t *TimeArray, uint32_t N) {
+	ProfileScope Scope(CurrentThreadProfile(), ProfileRecordNonStrictWrites, N);
+	DrainPendingOps();
+	if(TraceRecording) {
+		TraceOperations(TraceWrite, IdArray, AddrArray, SizeArray, TimeArray, N);
+		return;
+	}
+	if(!IsEpochChecked())
+		return;
+	SyncPools();
+	if(CrossThreadChecking)
+		LogEvents(WriteEvent, IdArray, AddrArray, SizeArray, N);
+	if(ShadowEngine) {
+		ShadowRecordWrites(IdArray, AddrArray, SizeArray, TimeArray, N);
+		return;
+	}
+	BatchIndexVect.clear();
 	for(uint32_t Index = 0; Index != N ; ++Index) {
-		if(!PMR.search<true>(AddrArray[Index], SizeArray[Index]))
-			continue;
-		auto OR = WR.insert(IdArray[Index], AddrArray[Index], SizeArray[Index],
-				  							TimeArray[Index], ContextVect.back());
-
-	// Check if the write overlaps with any executed write, throw an error
-		if(OR != ITResult::NoOverlap) {
-			errs() << "Write at line " << DIR[IdArray[Index]] << " that writes from "
+		if(PMR.contains(AddrArray[Index], SizeArray[Index], ThreadLastPool))
+			BatchIndexVect.push_back(Index);
+	}
+	auto &ResultsVect = WR.insertBatch(IdArray, AddrArray, SizeArray, TimeArray,
+																		 BatchIndexVect, CurrentContext());
+	for(uint32_t I = 0; I != BatchIndexVect.size(); ++I) {
+		auto Index = BatchIndexVect[I];
+
+	// Check if the write overlaps with any executed write, report an error
+		if(ResultsVect[I] != ITResult::NoOverlap) {
+			std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+			Diags.report(OverlappingWrite, IdArray[Index], CurrentContext())
+					   << "Write at line " << DIR[IdArray[Index]] << " that writes from "
 					   << AddrArray[Index] << " upto size " << SizeArray[Index] << " in a function "
-					   << CNR[ContextVect.back()] << " invoked from line"
-					   << DIR[ContextVect.back()] << " writes .\n";
-			exit(-1);
+					   << CNR[CurrentContext()] << " invoked from line"
+					   << DIR[CurrentContext()] << " writes .\n";
 		}
 	}
 }
 
 // Use this for writes that are supposed to follow strict persistency
 void RecordStrictsWrites(uint32_t *IdArray, uint64_t *AddrArray,
-	  	   	   	   	     	 uint64 *SizeArray, uint32_t *TimeArray, uint32_t N) {
+	  	   	   	   	     	 uint64_t *SizeArray, uint64_t *TimeArray, uint32_t N) {
+	ProfileScope Scope(CurrentThreadProfile(), ProfileRecordStrictWrites, N);
+	DrainPendingOps();
+	if(TraceRecording) {
+		TraceOperations(TraceStrictWrite, IdArray, AddrArray, SizeArray, TimeArray, N);
+		return;
+	}
+	if(!IsEpochChecked())
+		return;
+	SyncPools();
+	if(CrossThreadChecking)
+		LogEvents(WriteEvent, IdArray, AddrArray, SizeArray, N);
 	for(uint32_t Index = 0; Index != N ; ++Index) {
-		if(!PMR.search<true>(AddrArray[Index], SizeArray[Index]))
+		if(!IsPersistent(AddrArray[Index], SizeArray[Index]))
 			continue;
-		if(WR.size() == 1) {
-		// Throw an error since strict persistency requires one write to persist
+		uint64_t NumWrites = ShadowEngine ? SM.getWriteOps().size() : WR.getNumOps();
+		if(NumWrites == 1) {
+		// Report an error since strict persistency requires one write to persist
 		// at a time.
-			errs() << "Write at line " << DIR[IdArray[Index]] << " that writes from "
+			std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+			Diags.report(StrictPersistencyViolation, IdArray[Index], CurrentContext())
+				   << "Write at line " << DIR[IdArray[Index]] << " that writes from "
 				   << AddrArray[Index] << " upto size " << SizeArray[Index] << " in a function "
-				   << CNR[Context] << " invoked from line"
-				   << DIR[Context] << " is immediately preceded by a perisistent write "
+				   << CNR[CurrentContext()] << " invoked from line"
+				   << DIR[CurrentContext()] << " is immediately preceded by a perisistent write "
 				   << "and therefore does not conform with strict persistency as required.\n";
-			exit(-1);
+		}
+		if(ShadowEngine) {
+			ShadowRecordWrites(IdArray + Index, AddrArray + Index, SizeArray + Index,
+												 TimeArray + Index, 1);
+			continue;
 		}
 		auto OR = WR.insert(IdArray[Index], AddrArray[Index], SizeArray[Index],
-				  		TimeArray[Index], ContextVect.back());
+				  		TimeArray[Index], CurrentContext());
 
 	// Check if the write address range overlaps with other writes
 		if(OR != ITResult::NoOverlap) {
-			errs() << "Write at line " << DIR[IdArray[Index]] << " that writes from "
+			std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+			Diags.report(OverlappingWrite, IdArray[Index], CurrentContext())
+						 << "Write at line " << DIR[IdArray[Index]] << " that writes from "
 						 << AddrArray[Index] << " upto size " << SizeArray[Index] << " in a function "
-						 << CNR[ContextVect.back()] << " invoked from line"
-						 << DIR[ContextVect.back()] << " writes .\n";
-			exit(-1);
+						 << CNR[CurrentContext()] << " invoked from line"
+						 << DIR[CurrentContext()] << " writes .\n";
 		}
 	}
 }
 
-void RecordFlushes(uint32_t *IdArray, uint64_t *AddrArray, uint64 *SizeArray,
-									 uint32_t *TimeArray, uint32_t N) {
-	for(uint32_t Index = 0; Index != N ; ++Index) {
-		FR.insert(IdArray[Index], AddrArray[Index], SizeArray[Index],
-				  		TimeArray[Index], ContextVect.back());
+void RecordFlushes(uint32_t *IdArray, uint64_t *AddrArray, uint64_t *SizeArray,
+									 uint64_t *TimeArray, uint32_t N) {
+	ProfileScope Scope(CurrentThreadProfile(), ProfileRecordFlushes, N);
+	DrainPendingOps();
+	if(TraceRecording) {
+		TraceOperations(TraceFlush, IdArray, AddrArray, SizeArray, TimeArray, N);
+		return;
 	}
+	if(!IsEpochChecked())
+		return;
+	SyncPools();
+	if(CrossThreadChecking)
+		LogEvents(FlushEvent, IdArray, AddrArray, SizeArray, N);
+	if(ShadowEngine) {
+		for(uint32_t Index = 0; Index != N ; ++Index) {
+			SM.recordFlush(IdArray[Index], AddrArray[Index], SizeArray[Index],
+										 TimeArray[Index], CurrentContext());
+		}
+		return;
+	}
+	BatchIndexVect.clear();
+	for(uint32_t Index = 0; Index != N ; ++Index)
+		BatchIndexVect.push_back(Index);
+	FR.insertBatch(IdArray, AddrArray, SizeArray, TimeArray, BatchIndexVect, CurrentContext());
 }
 
+// Record the operations in the buffer of this thread in the order they were
+// appended. Runs of writes and of flushes are recorded as batches.
+void DrainOpBuffer() {
+	uint32_t NumOps = PMCheckOps.NumOps;
+	ProfileScope Scope(CurrentThreadProfile(), ProfileDrainOpBuffer, NumOps);
+
+// The buffer is empty while it is drained, so the entry points do not drain it
+// again
+	PMCheckOps.NumOps = 0;
+	BufferedOpKind RunKind = BufferedWrite;
+	uint32_t RunSize = 0;
+	auto RecordRun = [&]() {
+		if(!RunSize)
+			return;
+		if(RunKind == BufferedWrite) {
+			RecordNonStrictWrites(DrainedIdArray, DrainedAddrArray, DrainedSizeArray,
+														DrainedTimeArray, RunSize);
+		} else {
+			RecordFlushes(DrainedIdArray, DrainedAddrArray, DrainedSizeArray,
+										DrainedTimeArray, RunSize);
+		}
+		RunSize = 0;
+	};
+	auto AddToRun = [&](BufferedOpKind Kind, uint32_t Id, uint64_t Addr,
+											uint64_t Size) {
+		if(Kind != RunKind || RunSize == PMCHECK_OP_BUFFER_CAPACITY) {
+			RecordRun();
+			RunKind = Kind;
+		}
+		DrainedIdArray[RunSize] = Id;
+		DrainedAddrArray[RunSize] = Addr;
+		DrainedSizeArray[RunSize] = Size;
+		DrainedTimeArray[RunSize] = ThreadOpTimeStamp++;
+		++RunSize;
+	};
+	for(uint32_t Index = 0; Index != NumOps; ++Index) {
+		auto &Op = PMCheckOps.Ops[Index];
+		switch(Op.Kind) {
+			case BufferedAddContext:
+				RecordRun();
+				ChangeToContext(Op.Id);
+				break;
+
+			case BufferedRemoveContext:
+				RecordRun();
+				ChangeToPreviousContext();
+				break;
+
+		// The stores of a group are recorded as if they were appended one by one,
+		// so they are reported with their own IDs
+			case BufferedWriteGroup: {
+				const PMCheckGroupMember *Members = nullptr;
+				auto *Group = SiteInfoRecord::findStoreGroup(Op.Id, Members);
+				if(!Group)
+					break;
+				for(uint32_t Member = 0; Member != Group->NumMembers; ++Member) {
+					if(Op.Size & (1ULL << Member)) {
+						AddToRun(BufferedWrite, Op.Id + Member, Op.Addr + Members[Member].Offset,
+										 Members[Member].Size);
+					}
+				}
+				break;
+			}
+
+			default:
+				AddToRun(Op.Kind, Op.Id, Op.Addr, Op.Size);
+				break;
+		}
+	}
+	RecordRun();
+}
+
+}  // extern "C"
+
 static void PrintForRedundancyFlushes() {
 	// Print redundant flushes
 		for(auto It = FR.IT_begin(); It != FR.IT_end(); It++) {
@@ -321,66 +688,68 @@ static void PrintForRedundancyFlushes() {
 			uint64_t End = std::get<1>(IntervalPair);
 
 		// Get the ids of the flushes that this interval corresponds to
-			auto FlushIdAndContextAndTimeStampVect = FR.getIdAndContextAndTimeStampFor(Start, End);
+			auto &FlushIdAndContextAndTimeStampVect = It.getPayload();
 			if(FlushIdAndContextAndTimeStampVect.size() == 1) {
 				auto FlushId = std::get<0>(FlushIdAndContextAndTimeStampVect[0]);
 				auto ContextId = std::get<1>(FlushIdAndContextAndTimeStampVect[0]);
-				errs() << "Flush at line " << DIR[FlushId] << "in a function "
+				std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+				Diags.report(RedundantFlush, FlushId, ContextId)
+							 << "Flush at line " << DIR[FlushId] << "in a function "
 							 << CNR[ContextId] << " invoked from line " << DIR[ContextId]
 							 << " is completely redudant.\n";
 				continue;
 			}
 
-		// Look up for the what ids actually that flush this interval
-			for(auto FlushIdAndContextAndTimeStampTuple : FlushIdAndContextAndTimeStampVect) {
-			// See if the interval for this Id actually overlaps with this interval
+		// Look at every flush in the interval
+			for(auto &FlushIdAndContextAndTimeStampTuple : FlushIdAndContextAndTimeStampVect) {
 				auto FlushId = std::get<0>(FlushIdAndContextAndTimeStampTuple);
-				for(auto &IdIntervalPair : FR.getIntervalsFor(FlushId)) {
-					auto IdIntervalStart = std::get<0>(IdIntervalPair);
-					auto IdIntervalEnd = std::get<1>(IdIntervalPair);
-
-				// Look for complete overlap
-					if(Start < IdIntervalEnd && IdIntervalStart < End) {
-						auto ContextId = std::get<1>(FlushIdAndContextAndTimeStampTuple);
-						errs() << "Flush at line " << DIR[FlushId] << " flushing between "
-									 << IdIntervalStart << " and " << IdIntervalEnd
-									 << " in a function " << CNR[ContextId] << " invoked from line "
-							   	 << DIR[ContextId] << " is completely redudant.\n";
-						continue;
-					}
-
-				// Look for partial overlap
-					if(Start < IdIntervalEnd || IdIntervalStart < End) {
-						auto ContextId = std::get<1>(FlushIdAndContextAndTimeStampTuple);
-						errs() << "Flush at line " << DIR[FlushId] << " flushing between "
-									 << IdIntervalStart << " and " << IdIntervalEnd
-									 << " in a function " << CNR[ContextId] << " invoked from line "
-							   	 << DIR[ContextId] << " is partially redudant.\n";
-						continue;
-					}
-
-				// This means that there is no overlap, so we can just move on.
+				auto ContextId = std::get<1>(FlushIdAndContextAndTimeStampTuple);
+				auto IdIntervalStart = std::get<3>(FlushIdAndContextAndTimeStampTuple).first;
+				auto IdIntervalEnd = std::get<3>(FlushIdAndContextAndTimeStampTuple).second;
+
+			// The part of the interval that this flush covered may have been removed
+				if(IdIntervalEnd <= Start || End <= IdIntervalStart)
+					continue;
+
+			// Look for complete overlap
+				if(Start <= IdIntervalStart && IdIntervalEnd <= End) {
+					std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+					Diags.report(RedundantFlush, FlushId, ContextId)
+								 << "Flush at line " << DIR[FlushId] << " flushing between "
+								 << IdIntervalStart << " and " << IdIntervalEnd
+								 << " in a function " << CNR[ContextId] << " invoked from line "
+						   	 << DIR[ContextId] << " is completely redudant.\n";
+					continue;
 				}
+
+			// Otherwise the overlap is partial
+				std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+				Diags.report(PartiallyRedundantFlush, FlushId, ContextId)
+							 << "Flush at line " << DIR[FlushId] << " flushing between "
+							 << IdIntervalStart << " and " << IdIntervalEnd
+							 << " in a function " << CNR[ContextId] << " invoked from line "
+					   	 << DIR[ContextId] << " is partially redudant.\n";
 			}
 		}
 }
 
 static bool CheckOutOfOrderPersistOps(ITResult Result, uint32_t WriteId,
-								uint64_t WriteStart, uint64_t WriteEnd, uint32_t WriteTimeStamp,
+								uint64_t WriteStart, uint64_t WriteEnd, uint64_t WriteTimeStamp,
 								std::vector<std::pair<uint32_t,
 														std::pair<uint64_t, uint64_t>>> *FlushesInfoVectPtr = nullptr) {
 	bool Ret = false;
 	for(uint32_t Index = 0; Index != Result.getPreviousNodeRangeSize(); Index++) {
-		auto PrevState = Result.getPreviousNodeRange(Index);
-		auto FlushIdAndContextAndTimeStampVect =
-						FR.getIdAndContextAndTimeStampFor(PrevState.Start, PrevState.End);
+	// Get the flushes that the interval had before the write range was removed
+		auto &FlushIdAndContextAndTimeStampVect = FR.getPreviousOps(Index);
 		if(FlushIdAndContextAndTimeStampVect.size() == 1) {
 			auto FlushId = std::get<0>(FlushIdAndContextAndTimeStampVect[0]);
 			auto ContextId = std::get<1>(FlushIdAndContextAndTimeStampVect[0]);
 			auto FlushTimeStamp = std::get<2>(FlushIdAndContextAndTimeStampVect[0]);
 			if(FlushTimeStamp < WriteTimeStamp) {
 			// The flush executes before writes
-				errs() << "Flush at line " << DIR[FlushId] << "in a function "
+				std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+				Diags.report(FlushBeforeWrite, FlushId, ContextId)
+							 << "Flush at line " << DIR[FlushId] << "in a function "
 							 << CNR[ContextId] << " invoked from line "
 							 << DIR[ContextId] << " executes before write at "
 						 	 << DIR[WriteId] << "\n";
@@ -389,72 +758,186 @@ static bool CheckOutOfOrderPersistOps(ITResult Result, uint32_t WriteId,
 			continue;
 		}
 
-		for(auto FlushIdAndContextAndTimeStampTuple : FlushIdAndContextAndTimeStampVect) {
-		// See if the interval for this Id actually overlaps with this interval
+	// Look at the flushes that overlap with the write
+		for(auto &FlushIdAndContextAndTimeStampTuple : FlushIdAndContextAndTimeStampVect) {
+			auto IdInterval = std::get<3>(FlushIdAndContextAndTimeStampTuple);
+			auto IdIntervalStart = std::get<0>(IdInterval);
+			auto IdIntervalEnd = std::get<1>(IdInterval);
+			if(IdIntervalEnd <= WriteStart || WriteEnd <= IdIntervalStart)
+				continue;
 			auto FlushId = std::get<0>(FlushIdAndContextAndTimeStampTuple);
-			for(auto &IdIntervalPair : FR.getIntervalsFor(FlushId)) {
-				auto IdIntervalStart = std::get<0>(IdIntervalPair);
-				auto IdIntervalEnd = std::get<1>(IdIntervalPair);
-
-			// Look for some overlap
-				if((WriteStart < IdIntervalEnd && IdIntervalStart < WriteEnd)
-				|| (WriteStart < IdIntervalEnd || IdIntervalStart < WriteEnd)) {
-					if(FlushesInfoVectPtr) {
-						auto Pair = std::make_pair(FlushId,
-																	std::make_pair(IdIntervalStart, IdIntervalEnd);
-						(*FlushesInfoVectPtr).push_back(Pair));
-					}
-					auto ContextId = std::get<1>(FlushIdAndContextAndTimeStampTuple);
-					auto FlushTimeStamp = std::get<2>(FlushIdAndContextAndTimeStampTuple);
-					if(FlushTimeStamp < WriteTimeStamp) {
-					// The flush executes before writes
-						errs() << "Flush at line " << DIR[FlushId] << " flushing between "
-									 << IdIntervalStart << " and " << IdIntervalEnd
-									 << "in a function " << CNR[ContextId] << " invoked from line "
-									 << DIR[ContextId] << " executes before write at "
-									 << DIR[WriteId] << " writing between " << WriteStart
-									 << " and " << WriteEnd << "\n";
-						Ret = true;
-					}
-				}
-
-			// This means that there is no overlap, so we can just move on.
+			auto ContextId = std::get<1>(FlushIdAndContextAndTimeStampTuple);
+			auto FlushTimeStamp = std::get<2>(FlushIdAndContextAndTimeStampTuple);
+			if(FlushesInfoVectPtr)
+				(*FlushesInfoVectPtr).push_back(std::make_pair(FlushId, IdInterval));
+			if(FlushTimeStamp < WriteTimeStamp) {
+			// The flush executes before writes
+				std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+				Diags.report(FlushBeforeWrite, FlushId, ContextId)
+							 << "Flush at line " << DIR[FlushId] << " flushing between "
+							 << IdIntervalStart << " and " << IdIntervalEnd
+							 << "in a function " << CNR[ContextId] << " invoked from line "
+							 << DIR[ContextId] << " executes before write at "
+							 << DIR[WriteId] << " writing between " << WriteStart
+							 << " and " << WriteEnd << "\n";
+				Ret = true;
 			}
 		}
 	}
 	return Ret;
 }
 
+// Check the writes and flushes recorded in the shadow memory in this epoch. This
+// only looks at the lines touched by the operations in this epoch.
+static void ShadowFenceEncountered(uint32_t FenceId) {
+	auto &WriteOpsVect = SM.getWriteOps();
+	auto &FlushOpsVect = SM.getFlushOps();
+	if(WriteOpsVect.empty() && FlushOpsVect.empty()) {
+	// This is a redundant fence
+		std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+		Diags.report(RedundantFence, FenceId, CurrentContext())
+					 << "Fence at line " << DIR[FenceId] << " is redundant.\n";
+		return;
+	}
+
+// Iterate over all writes and see whether they have been flushed after they executed
+	for(auto &WriteOp : WriteOpsVect) {
+		uint64_t NumLines = 0;
+		uint64_t NumFlushedLines = 0;
+		const ShadowOp *EarlyFlushOp = nullptr;
+		SM.forEachLine(WriteOp.Start, WriteOp.end(),
+							[&](uint64_t, const ShadowLine &Line, uint64_t) {
+			NumLines++;
+			if(!Line.isFlushed())
+				return;
+			if(Line.LastFlushTimeStamp < WriteOp.TimeStamp) {
+			// The last flush of this line executes before this write
+				EarlyFlushOp = &FlushOpsVect[Line.LastFlushOp];
+				return;
+			}
+			NumFlushedLines++;
+		});
+		if(NumFlushedLines == NumLines)
+			continue;
+
+		std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+		Diags.report(NumFlushedLines ? PartiallyFlushedWrite : UnflushedWrite,
+								 WriteOp.Id, WriteOp.Context)
+					 << "Write at line " << DIR[WriteOp.Id] << " that writes from "
+					 << WriteOp.Start << " upto size " << WriteOp.Size
+					 << " in a function " << CNR[WriteOp.Context] << " invoked from line"
+					 << DIR[WriteOp.Context]
+					 << (NumFlushedLines ? " is partially flushed.\n" : " is not flushed.\n");
+		if(EarlyFlushOp) {
+			Diags.report(FlushBeforeWrite, EarlyFlushOp->Id, EarlyFlushOp->Context)
+						 << "Flush at line " << DIR[EarlyFlushOp->Id] << " flushing between "
+						 << EarlyFlushOp->Start << " and " << EarlyFlushOp->end()
+						 << " in a function " << CNR[EarlyFlushOp->Context] << " invoked from line "
+						 << DIR[EarlyFlushOp->Context] << " executes before write at "
+						 << DIR[WriteOp.Id] << "\n";
+		}
+	}
+
+// Print the flushes that flush lines that are not dirty or already flushed
+	for(auto &FlushOp : FlushOpsVect) {
+		uint64_t NumLines = 0;
+		uint64_t NumCleanLines = 0;
+		SM.forEachLine(FlushOp.Start, FlushOp.end(),
+							[&](uint64_t, const ShadowLine &Line, uint64_t) {
+			NumLines++;
+			if(!Line.isDirty())
+				NumCleanLines++;
+		});
+		uint64_t NumRedundantLines = NumCleanLines + FlushOp.NumDuplicateLines;
+		if(!NumRedundantLines)
+			continue;
+		bool Complete = NumRedundantLines >= NumLines;
+		std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+		Diags.report(Complete ? RedundantFlush : PartiallyRedundantFlush,
+								 FlushOp.Id, FlushOp.Context)
+					 << "Flush at line " << DIR[FlushOp.Id] << " flushing between "
+					 << FlushOp.Start << " and " << FlushOp.end()
+					 << " in a function " << CNR[FlushOp.Context] << " invoked from line "
+					 << DIR[FlushOp.Context]
+					 << (Complete ? " is completely redudant.\n" : " is partially redudant.\n");
+	}
+
+// Reset the lines touched in this epoch
+	SM.clear();
+}
+
+extern "C" {
+
 // This is the slowest way of dealing with persists when fences are encountered
 void FenceEncountered(uint32_t FenceId) {
+	ProfileScope Scope(CurrentThreadProfile(), ProfileFenceEncountered, 1);
+	DrainPendingOps();
+	ThreadOpTimeStamp = 0;
+	if(TraceRecording) {
+		ThreadTrace.recordFence(FenceId);
+		return;
+	}
+	if(Sampling.enabled()) {
+		bool Checked = ThreadSampler.isChecked();
+		NumEpochs.fetch_add(1, std::memory_order_relaxed);
+		ThreadSampler.nextEpoch();
+
+	// Nothing was recorded in the epoch, so there is no state to reset
+		if(!Checked)
+			return;
+		NumCheckedEpochs.fetch_add(1, std::memory_order_relaxed);
+	}
+	if(Profiling)
+		ProfileEpoch();
+	if(CrossThreadChecking)
+		LogEvent(FenceEvent, FenceId, 0, 0);
+	if(ShadowEngine) {
+		ShadowFenceEncountered(FenceId);
+		return;
+	}
+
 	if(WR.empty() && FR.empty()) {
 	// This is a redundant fence
-		errs() << "Fence at line " << DIR[FenceId] << " is redundant.\n";
-		exit(-1);
+		std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+		Diags.report(RedundantFence, FenceId, CurrentContext())
+					 << "Fence at line " << DIR[FenceId] << " is redundant.\n";
+		return;
 	}
 
 	if(WR.empty()) {
 	// All the recorded flushes are redundant
-		for(auto MapElem : FR) {
-			auto FlushId = MapElem.first;
-			auto ContextId = std::get<2>(MapElem.second);
-			errs() << "Flush at line " << DIR[FlushId] << " is redundant "
-				   << "in a function " << CNR[ContextId] << " invoked from line "
-				   << DIR[ContextId] << " is redudant.\n";
+		for(auto It = FR.IT_begin(); It != FR.IT_end(); It++) {
+			for(auto &Tuple : It.getPayload()) {
+				auto FlushId = std::get<0>(Tuple);
+				auto ContextId = std::get<1>(Tuple);
+				std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+				Diags.report(RedundantFlush, FlushId, ContextId)
+					   << "Flush at line " << DIR[FlushId] << " is redundant "
+					   << "in a function " << CNR[ContextId] << " invoked from line "
+					   << DIR[ContextId] << " is redudant.\n";
+			}
 		}
-		exit(-1);
+		FR.clear();
+		return;
 	}
 
 	if(FR. empty ()) {
 	// Writes have not been flushed
-		for(auto WriteInfo : WR) {
-			auto Tuple = std::get<1>(WriteInfo);
-			errs() << "Write at line " << DIR[std::get<0>(WriteInfo)] << " that writes from "
-				   << std::get<0>(Tuple) << " upto size " << std::get<1>(Tuple) - std::get<0>(Tuple)
-				   << " in a function " << CNR[std::get<2>(Tuple)] << " invoked from line"
-				   << DIR[std::get<2>(Tuple)] << " is not flushed.\n";
+		for(auto It = WR.IT_begin(); It != WR.IT_end(); It++) {
+			for(auto &Tuple : It.getPayload()) {
+				auto WriteId = std::get<0>(Tuple);
+				auto Interval = std::get<3>(Tuple);
+				std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+				Diags.report(UnflushedWrite, WriteId, std::get<1>(Tuple))
+					   << "Write at line " << DIR[WriteId] << " that writes from "
+					   << std::get<0>(Interval) << " upto size "
+					   << std::get<1>(Interval) - std::get<0>(Interval)
+					   << " in a function " << CNR[std::get<1>(Tuple)] << " invoked from line"
+					   << DIR[std::get<1>(Tuple)] << " is not flushed.\n";
+			}
 		}
-		exit(-1);
+		WR.clear();
+		return;
 	}
 
 // Iterate over all writes and see whether they have been flushed
@@ -464,14 +947,15 @@ void FenceEncountered(uint32_t FenceId) {
 		uint64_t WriteEndAddr = std::get<1>(IntervalPair);
 		auto Result = FR.remove(WriteStartAddr, WriteEndAddr);
 		switch(Result.getOverlapResult()) {
-			case ITResult::NoOverlap:
-			// Since there is no overlap, throw an error
-				auto WriteIdAndContextAndTimeStampVect =
-										WR.getIdAndContextAndTimeStampFor(WriteStart, WriteEndAddr);
+			case ITResult::NoOverlap: {
+			// Since there is no overlap, report an error
+				auto &WriteIdAndContextAndTimeStampVect = It.getPayload();
 				if(WriteIdAndContextAndTimeStampVect.size() == 1) {
 					auto WriteId = std::get<0>(WriteIdAndContextAndTimeStampVect[0]);
 					auto ContextId = std::get<1>(WriteIdAndContextAndTimeStampVect[0]);
-					errs() << "Write at line " << DIR[WriteId] << " that writes from "
+					std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+					Diags.report(UnflushedWrite, WriteId, ContextId)
+						   	 << "Write at line " << DIR[WriteId] << " that writes from "
 						   	 << WriteStartAddr << " upto size " << WriteEndAddr - WriteStartAddr
 						   	 << " in a function " << CNR[ContextId] << " invoked from line"
 						   	 << DIR[ContextId] << " is not flushed.\n";
@@ -480,21 +964,25 @@ void FenceEncountered(uint32_t FenceId) {
 					// See if the interval for this Id actually overlaps with this interval
 						auto WriteId = std::get<0>(WriteIdAndContextAndTimeStampTuple);
 						auto ContextId = std::get<1>(WriteIdAndContextAndTimeStampTuple);
-						errs() << "Write at line " << DIR[WriteId] << " in a function "
+						std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+						Diags.report(UnflushedWrite, WriteId, ContextId)
+							   	 << "Write at line " << DIR[WriteId] << " in a function "
 						       << CNR[ContextId] << " invoked from line"
 							   	 << DIR[ContextId] << " is not flushed.\n";
 					}
 				}
-				exit(-1);
+				break;
+			}
 
-			case ITResult::PartialOverlap:
-			// Since there is partial overlap, throw an error
-				auto WriteIdAndContextAndTimeStampVect =
-										WR.getIdAndContextAndTimeStampFor(WriteStart, WriteEndAddr);
+			case ITResult::PartialOverlap: {
+			// Since there is partial overlap, report an error
+				auto &WriteIdAndContextAndTimeStampVect = It.getPayload();
 				if(WriteIdAndContextAndTimeStampVect.size() == 1) {
 					auto WriteId = std::get<0>(WriteIdAndContextAndTimeStampVect[0]);
 					auto ContextId = std::get<1>(WriteIdAndContextAndTimeStampVect[0]);
-					errs() << "Write at line " << DIR[WriteId] << " that writes from "
+					std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+					Diags.report(PartiallyFlushedWrite, WriteId, ContextId)
+						   	 << "Write at line " << DIR[WriteId] << " that writes from "
 						   	 << WriteStartAddr << " upto size " << WriteEndAddr - WriteStartAddr
 						   	 << " in a function " << CNR[ContextId] << " invoked from line"
 						   	 << DIR[ContextId] << " is partially flushed.\n";
@@ -504,93 +992,86 @@ void FenceEncountered(uint32_t FenceId) {
 				 	CheckOutOfOrderPersistOps(Result, WriteId, WriteStartAddr,
 																		WriteEndAddr, WriteTimeStamp);
 				} else {
-					for(auto WriteIdAndContextAndTimeStampTuple : WriteIdAndContextAndTimeStampVect) {
-					// See if the interval for this Id actually overlaps with this interval
+					std::vector<std::pair<uint32_t, std::pair<uint64_t, uint64_t>>> FlushesInfoVect;
+				// Every write in this interval is partially flushed
+					for(auto &WriteIdAndContextAndTimeStampTuple : WriteIdAndContextAndTimeStampVect) {
 						auto WriteId = std::get<0>(WriteIdAndContextAndTimeStampTuple);
 						auto ContextId = std::get<1>(WriteIdAndContextAndTimeStampTuple);
-						for(auto &IdIntervalPair : WR.getIntervalsFor(WriteId)) {
-							auto IdIntervalStart = std::get<0>(IdIntervalPair);
-							auto IdIntervalEnd = std::get<1>(IdIntervalPair);
-							if(IdIntervalStart < WriteEndAddr && IdIntervalEnd > WriteStartAddr) {
-								errs() << "Write at line " << DIR[WriteId] << " that writes from "
-											 << IdIntervalStart << " upto size " << IdIntervalEnd - IdIntervalStart
-											 << " in a function " << CNR[ContextId] << " invoked from line"
-											 << DIR[ContextId] << " is partially flushed.\n";
-
-							 // Also check if the flushes happened before the writes did
-							 	auto WriteTimeStamp = std::get<2>(WriteIdAndContextAndTimeStampTuple);
-								CheckOutOfOrderPersistOps(Result, WriteId, IdIntervalStart,
-																					IdIntervalEnd, WriteTimeStamp);
-							}
-						}
+						auto IdIntervalStart = std::get<3>(WriteIdAndContextAndTimeStampTuple).first;
+						auto IdIntervalEnd = std::get<3>(WriteIdAndContextAndTimeStampTuple).second;
+						std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+						Diags.report(PartiallyFlushedWrite, WriteId, ContextId)
+									 << "Write at line " << DIR[WriteId] << " that writes from "
+									 << IdIntervalStart << " upto size " << IdIntervalEnd - IdIntervalStart
+									 << " in a function " << CNR[ContextId] << " invoked from line"
+									 << DIR[ContextId] << " is partially flushed.\n";
+
+					// Also check if the flushes happened before the writes did
+						auto WriteTimeStamp = std::get<2>(WriteIdAndContextAndTimeStampTuple);
+						CheckOutOfOrderPersistOps(Result, WriteId, IdIntervalStart,
+																			IdIntervalEnd, WriteTimeStamp, &FlushesInfoVect);
 					}
 
 				// Print any flushes that could possibly me merged
-					if(FlushesVect.size() > 1) {
+					if(FlushesInfoVect.size() > 1) {
 						for(auto FlushesInfoPair : FlushesInfoVect) {
 							auto FlushId = std::get<0>(FlushesInfoPair);
 							auto FlushIntervalPair = std::get<1>(FlushesInfoPair);
 							auto FlushStartAddr = std::get<0>(FlushIntervalPair);
 							auto FlushEndAddr = std::get<1>(FlushIntervalPair);
-							errs() << "Flushes at line " << DIR[FlushId]
+							std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+							Diags.report(MergeableFlushes, FlushId, 0)
+										 << "Flushes at line " << DIR[FlushId]
 										 << " flushing between " << FlushStartAddr << " and "
 										 << FlushEndAddr << " can be merged.\n";
 						}
 					}
 				}
-				exit(-1);
+				break;
+			}
 
-			case ITResult::CompletlyPerfectOverlap:
+			case ITResult::CompletelyPerfectOverlap:
 
 			case ITResult::CompleteOverlap:
 
-			case ITResult::PartialCompleteOverlap:
-				bool Ret;
-				auto WriteIdAndContextAndTimeStampVect =
-									WR.getIdAndContextAndTimeStampFor(WriteStart, WriteEndAddr);
+			case ITResult::PartialCompleteOverlap: {
+				auto &WriteIdAndContextAndTimeStampVect = It.getPayload();
 				if(WriteIdAndContextAndTimeStampVect.size() == 1) {
 					auto WriteId = std::get<0>(WriteIdAndContextAndTimeStampVect[0]);
 				 	auto WriteTimeStamp = std::get<2>(WriteIdAndContextAndTimeStampVect[0]);
-				 	Ret = CheckOutOfOrderPersistOps(Result, WriteId, WriteStartAddr,
+				 	CheckOutOfOrderPersistOps(Result, WriteId, WriteStartAddr,
 																					WriteEndAddr, WriteTimeStamp);
 				} else {
 				// This means that the write range is written by multiple write IDs.
 				// So now we need to spit the flush IDs that overlap with specific writes.
 				// We record the flushes that
 					std::vector<std::pair<uint32_t, std::pair<uint64_t, uint64_t>>> FlushesInfoVect;
-					for(auto WriteIdAndContextAndTimeStampTuple : WriteIdAndContextAndTimeStampVect) {
+					for(auto &WriteIdAndContextAndTimeStampTuple : WriteIdAndContextAndTimeStampVect) {
 						auto WriteId = std::get<0>(WriteIdAndContextAndTimeStampTuple);
-						for(auto &IdIntervalPair : WR.getIntervalsFor(WriteId)) {
-							auto IdIntervalStart = std::get<0>(IdIntervalPair);
-							auto IdIntervalEnd = std::get<1>(IdIntervalPair);
-							if(IdIntervalStart < WriteEndAddr && IdIntervalEnd > WriteStartAddr) {
-								auto WriteTimeStamp = std::get<2>(WriteIdAndContextAndTimeStampTuple);
-								Ret = CheckOutOfOrderPersistOps(Result, WriteId, IdIntervalStart,
-																			IdIntervalEnd, WriteTimeStamp, &FlushesInfoVect);
-							}
-						}
+						auto IdInterval = std::get<3>(WriteIdAndContextAndTimeStampTuple);
+						auto WriteTimeStamp = std::get<2>(WriteIdAndContextAndTimeStampTuple);
+						CheckOutOfOrderPersistOps(Result, WriteId, std::get<0>(IdInterval),
+																			std::get<1>(IdInterval), WriteTimeStamp,
+																			&FlushesInfoVect);
 					}
 
 				// Print any flushes that could possibly me merged
-					if(FlushesVect.size() > 1) {
+					if(FlushesInfoVect.size() > 1) {
 						for(auto FlushesInfoPair : FlushesInfoVect) {
 							auto FlushId = std::get<0>(FlushesInfoPair);
 							auto FlushIntervalPair = std::get<1>(FlushesInfoPair);
 							auto FlushStartAddr = std::get<0>(FlushIntervalPair);
 							auto FlushEndAddr = std::get<1>(FlushIntervalPair);
-							errs() << "Flushes at line " << DIR[FlushId]
+							std::lock_guard<std::recursive_mutex> Lock(ReportMutex);
+							Diags.report(MergeableFlushes, FlushId, 0)
+										 << "Flushes at line " << DIR[FlushId]
 										 << " flushing between " << FlushStartAddr << " and "
 										 << FlushEndAddr << " can be merged.\n";
-							Ret = true;
 						}
 					}
 				}
-
-			// Terminate if we threw any errors
-				if(Ret)
-					exit(-1);
-
 				break;
+			}
 		}
 	}
 
@@ -601,3 +1082,5 @@ void FenceEncountered(uint32_t FenceId) {
 	WR.clear();
 	FR.clear();
 }
+
+}  // extern "C"
@@ -0,0 +1,196 @@
+//=========================== Interval Tree Test ==============================//
+//
+//============================================================================//
+//
+// This checks the interval tree against the flat interval set, which keeps its
+// intervals in a sorted array and is simple enough to serve as the reference.
+// Both sets get the same random inserts, batches, searches and removals of
+// small intervals in a small address space, so that the intervals overlap and
+// touch often. After every operation the results, the intervals and the
+// payloads of the intervals of the two sets have to be the same.
+//
+// Usage: IntervalTreeTest [seed] [rounds]
+//
+//============================================================================//
+
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "IntervalTree.h"
+#include "FlatIntervalSet.h"
+#include "PayloadList.h"
+
+typedef PayloadList<uint32_t> IdList;
+typedef IntervalTree<true, IdList> TreeTy;
+typedef FlatIntervalSet<IdList> FlatTy;
+
+static const char *OverlapResultNames[] = {
+	"NoOverlap",
+	"PartialOverlap",
+	"CompleteOverlap",
+	"CompletelyPerfectOverlap",
+	"PartialCompleteOverlap"
+};
+
+// Intervals of a set with the ids in their payloads. Both sets merge payloads in
+// the order of the intervals, so the ids have to be in the same order too.
+template<typename SetTy>
+static std::vector<std::pair<std::pair<uint64_t, uint64_t>, std::vector<uint32_t>>>
+getContents(const SetTy &Set) {
+	std::vector<std::pair<std::pair<uint64_t, uint64_t>, std::vector<uint32_t>>> ContentsVect;
+	for(auto It = Set.begin(); It != Set.end(); ++It) {
+		std::vector<uint32_t> IdsVect(It.getPayload().begin(), It.getPayload().end());
+		ContentsVect.push_back(std::make_pair(*It, IdsVect));
+	}
+	std::sort(ContentsVect.begin(), ContentsVect.end());
+	return ContentsVect;
+}
+
+class Tester {
+	TreeTy Tree;
+	FlatTy Flat;
+	std::mt19937_64 Rand;
+	uint64_t AddressSpace;
+	uint32_t NextId;
+	unsigned NumFailures;
+
+	uint64_t random(uint64_t Bound) {
+		return Rand() % Bound;
+	}
+
+	std::pair<uint64_t, uint64_t> randomInterval() {
+		uint64_t Start = random(AddressSpace);
+		return std::make_pair(Start, Start + 1 + random(24));
+	}
+
+	bool fail(const char *Op, uint64_t Start, uint64_t End, const char *What) {
+		if(NumFailures++ < 10) {
+			std::cout << "FAILED: " << Op << " [" << Start << ", " << End << "): "
+								<< What << "\n";
+		}
+		return false;
+	}
+
+	bool checkResults(const char *Op, uint64_t Start, uint64_t End,
+										const ITResult &TreeResult, const ITResult &FlatResult) {
+		if(TreeResult.getOverlapResult() == FlatResult.getOverlapResult())
+			return true;
+		fail(Op, Start, End, "results differ");
+		if(NumFailures <= 10) {
+			std::cout << "  tree: " << OverlapResultNames[TreeResult.getOverlapResult()]
+								<< ", flat: " << OverlapResultNames[FlatResult.getOverlapResult()] << "\n";
+		}
+		return false;
+	}
+
+	bool checkContents(const char *Op, uint64_t Start, uint64_t End) {
+		auto TreeIntervalsVect = Tree.getIntervals();
+		std::sort(TreeIntervalsVect.begin(), TreeIntervalsVect.end());
+		for(unsigned I = 1; I < TreeIntervalsVect.size(); ++I) {
+			if(TreeIntervalsVect[I - 1].second > TreeIntervalsVect[I].first)
+				return fail(Op, Start, End, "tree has overlapping intervals");
+		}
+		if(getContents(Tree) != getContents(Flat))
+			return fail(Op, Start, End, "intervals or payloads differ");
+		return true;
+	}
+
+	bool insert() {
+		auto Interval = randomInterval();
+		auto TreeResult = Tree.insert(Interval.first, Interval.second);
+		auto FlatResult = Flat.insert(Interval.first, Interval.second);
+		Tree.addToPayload(TreeResult.getNodeIndex(0), NextId);
+		Flat.addToPayload(FlatResult.getNodeIndex(0), NextId);
+		NextId++;
+		return checkResults("insert", Interval.first, Interval.second, TreeResult, FlatResult)
+				&& checkContents("insert", Interval.first, Interval.second);
+	}
+
+	bool insertBatch() {
+		std::vector<IntervalBatchElem> BatchVect;
+		uint64_t Start = random(AddressSpace);
+		uint32_t BatchSize = 1 + random(8);
+		for(uint32_t Index = 0; Index != BatchSize; ++Index) {
+			IntervalBatchElem Elem(Start, Start + 1 + random(8), Index);
+			BatchVect.push_back(Elem);
+			Start = random(4) ? Elem.End : Elem.End - random(Elem.End - Elem.Start);
+		}
+		std::shuffle(BatchVect.begin(), BatchVect.end(), Rand);
+		for(uint32_t Index = 0; Index != BatchSize; ++Index)
+			BatchVect[Index].Index = Index;
+		uint64_t BatchStart = BatchVect.front().Start;
+		std::vector<ITResult::OverlapResult> TreeResultsVect(BatchVect.size());
+		std::vector<ITResult::OverlapResult> FlatResultsVect(BatchVect.size());
+		auto TreeBatchVect = BatchVect;
+		Tree.insertBatch(TreeBatchVect, [&](uint32_t Index, const ITResult &Result) {
+			TreeResultsVect[Index] = Result.getOverlapResult();
+			Tree.addToPayload(Result.getNodeIndex(0), NextId + Index);
+		});
+		Flat.insertBatch(BatchVect, [&](uint32_t Index, const ITResult &Result) {
+			FlatResultsVect[Index] = Result.getOverlapResult();
+			Flat.addToPayload(Result.getNodeIndex(0), NextId + Index);
+		});
+		NextId += BatchVect.size();
+		if(TreeResultsVect != FlatResultsVect)
+			return fail("insertBatch", BatchStart, Start, "results differ");
+		return checkContents("insertBatch", BatchStart, Start);
+	}
+
+	bool search() {
+		auto Interval = randomInterval();
+		return checkResults("search", Interval.first, Interval.second,
+												Tree.getSearchDetails(Interval.first, Interval.second),
+												Flat.getSearchDetails(Interval.first, Interval.second));
+	}
+
+	bool remove() {
+		auto Interval = randomInterval();
+		auto TreeResult = Tree.getRemoveDetails(Interval.first, Interval.second);
+		auto FlatResult = Flat.getRemoveDetails(Interval.first, Interval.second);
+		return checkResults("remove", Interval.first, Interval.second, TreeResult, FlatResult)
+				&& checkContents("remove", Interval.first, Interval.second);
+	}
+
+public:
+	Tester(uint64_t Seed) : Rand(Seed), AddressSpace(256), NextId(0), NumFailures(0) {}
+
+	unsigned run(unsigned NumRounds) {
+		for(unsigned Round = 0; Round != NumRounds; ++Round) {
+			Tree.clear();
+			Flat.clear();
+			AddressSpace = 64 << random(4);
+			for(unsigned Op = 0; Op != 200; ++Op) {
+				unsigned Choice = random(10);
+				bool Passed;
+				if(Choice < 5)
+					Passed = insert();
+				else if(Choice < 6)
+					Passed = insertBatch();
+				else if(Choice < 8)
+					Passed = search();
+				else
+					Passed = remove();
+				if(!Passed)
+					break;
+			}
+		}
+		return NumFailures;
+	}
+};
+
+int main(int argc, char *argv[]) {
+	uint64_t Seed = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1;
+	unsigned NumRounds = argc > 2 ? strtoul(argv[2], nullptr, 10) : 2000;
+	unsigned NumFailures = Tester(Seed).run(NumRounds);
+	if(NumFailures) {
+		std::cout << NumFailures << " OF " << NumRounds << " ROUNDS FAILED\n";
+		return 1;
+	}
+	std::cout << "ALL " << NumRounds << " ROUNDS PASSED\n";
+	return 0;
+}
@@ -0,0 +1,302 @@
+//============================= Trace Analyzer ===============================//
+//
+//============================================================================//
+//
+// This checks the persist traces recorded by PMCheck runtime in record-only mode.
+//
+// The records of every thread are split at fences. Since the records of writes
+// and flushes are cleared at every fence, the epochs between fences are checked
+// independently of each other. Runs of epochs are checked in parallel on a work
+// stealing pool by replaying them through the runtime, so the findings are the
+// same as those the runtime reports when it checks the program as it runs.
+// The runtime keeps its records per thread, so every worker checks with its own
+// records and the findings of all workers end up in the same deduplicated summary.
+//
+//============================================================================//
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TraceReader.h"
+#include "WorkStealingPool.h"
+
+// Number of records replayed by a task, rounded up to the next fence
+#define TASK_NUM_RECORDS ((uint64_t)1 << 16)
+
+// Accesses of the same kind are replayed in batches of this size at most
+#define REPLAY_BATCH_SIZE 64
+
+extern "C" {
+void AddContext(uint32_t Context);
+void RemoveContext();
+void AllocatePM(uint64_t Addr, uint64_t Size);
+void RecordNonStrictWrites(uint32_t *IdArray, uint64_t *AddrArray,
+													 uint64_t *SizeArray, uint64_t *TimeArray, uint32_t N);
+void RecordStrictsWrites(uint32_t *IdArray, uint64_t *AddrArray,
+												 uint64_t *SizeArray, uint64_t *TimeArray, uint32_t N);
+void RecordFlushes(uint32_t *IdArray, uint64_t *AddrArray, uint64_t *SizeArray,
+									 uint64_t *TimeArray, uint32_t N);
+void FenceEncountered(uint32_t FenceId);
+}
+
+// Run of epochs of a thread. The calling contexts active at its start are kept
+// since the records only have the changes to them.
+struct EpochsTask {
+	TraceCursor Begin;
+	uint64_t NumFences;
+	std::vector<uint32_t> ContextVect;
+};
+
+struct PoolInfo {
+	uint32_t Index;
+	uint64_t Addr;
+	uint64_t Size;
+};
+
+struct ThreadScanInfo {
+	std::vector<EpochsTask> TasksVect;
+	std::vector<PoolInfo> PoolsVect;
+	uint64_t NumRecords;
+	uint64_t NumFences;
+};
+
+static TraceReader Reader;
+
+// Base address of every pool by its index
+static std::vector<uint64_t> PoolAddrVect;
+
+// Find where the tasks of the thread start and the pools it allocated
+static void ScanThread(uint32_t Thread, ThreadScanInfo &Info) {
+	TraceCursor Cursor(Thread);
+	TraceRecord Record;
+	std::vector<uint32_t> ContextVect;
+	EpochsTask Task;
+	Task.Begin = Cursor;
+	Task.NumFences = 0;
+	uint64_t NumTaskRecords = 0;
+	Info.NumRecords = 0;
+	Info.NumFences = 0;
+	while(Reader.next(Cursor, Record)) {
+		Info.NumRecords++;
+		NumTaskRecords++;
+		switch(Record.Kind) {
+			case TraceFence:
+				Info.NumFences++;
+				Task.NumFences++;
+				if(NumTaskRecords < TASK_NUM_RECORDS)
+					break;
+				Info.TasksVect.push_back(Task);
+				Task.Begin = Cursor;
+				Task.NumFences = 0;
+				Task.ContextVect = ContextVect;
+				NumTaskRecords = 0;
+				break;
+
+			case TraceAddContext:
+				ContextVect.push_back(Record.Id);
+				break;
+
+			case TraceRemoveContext:
+				if(!ContextVect.empty())
+					ContextVect.pop_back();
+				break;
+
+			case TracePool: {
+				PoolInfo Pool;
+				Pool.Index = Record.Pool;
+				Pool.Addr = Record.Offset;
+				Pool.Size = Record.Size;
+				Info.PoolsVect.push_back(Pool);
+				break;
+			}
+
+			default:
+				break;
+		}
+	}
+
+// Operations after the last fence are not checked, just as in the runtime
+	if(Task.NumFences)
+		Info.TasksVect.push_back(Task);
+}
+
+class ReplayBatch {
+	TraceRecordKind Kind;
+	uint32_t N;
+	uint32_t IdArray[REPLAY_BATCH_SIZE];
+	uint64_t AddrArray[REPLAY_BATCH_SIZE];
+	uint64_t SizeArray[REPLAY_BATCH_SIZE];
+	uint64_t TimeArray[REPLAY_BATCH_SIZE];
+
+public:
+	ReplayBatch() : Kind(TraceWrite), N(0) {}
+
+	void flush() {
+		if(!N)
+			return;
+		switch(Kind) {
+			case TraceWrite:
+				RecordNonStrictWrites(IdArray, AddrArray, SizeArray, TimeArray, N);
+				break;
+
+			case TraceStrictWrite:
+				RecordStrictsWrites(IdArray, AddrArray, SizeArray, TimeArray, N);
+				break;
+
+			case TraceFlush:
+				RecordFlushes(IdArray, AddrArray, SizeArray, TimeArray, N);
+				break;
+
+			default:
+				break;
+		}
+		N = 0;
+	}
+
+	void add(const TraceRecord &Record) {
+		if(N == REPLAY_BATCH_SIZE || (N && Kind != Record.Kind))
+			flush();
+		Kind = Record.Kind;
+		IdArray[N] = Record.Id;
+		AddrArray[N] = PoolAddrVect[Record.Pool] + Record.Offset;
+		SizeArray[N] = Record.Size;
+		TimeArray[N] = Record.TimeStamp;
+		N++;
+	}
+};
+
+static void ReplayEpochs(const EpochsTask &Task) {
+	for(auto Context : Task.ContextVect)
+		AddContext(Context);
+	uint64_t Depth = Task.ContextVect.size();
+	TraceCursor Cursor = Task.Begin;
+	TraceRecord Record;
+	ReplayBatch Batch;
+	uint64_t NumFences = 0;
+	while(NumFences != Task.NumFences && Reader.next(Cursor, Record)) {
+		switch(Record.Kind) {
+			case TraceWrite:
+			case TraceStrictWrite:
+			case TraceFlush:
+				if(Record.Pool >= PoolAddrVect.size())
+					break;
+				Batch.add(Record);
+				break;
+
+			case TraceFence:
+				Batch.flush();
+				FenceEncountered(Record.Id);
+				NumFences++;
+				break;
+
+			case TraceAddContext:
+				Batch.flush();
+				AddContext(Record.Id);
+				Depth++;
+				break;
+
+			case TraceRemoveContext:
+				Batch.flush();
+				if(Depth) {
+					RemoveContext();
+					Depth--;
+				}
+				break;
+
+			default:
+				break;
+		}
+	}
+	Batch.flush();
+
+// Workers run tasks of other threads next, so leave no contexts behind
+	for(; Depth; --Depth)
+		RemoveContext();
+}
+
+static void PrintUsage(const char *Name) {
+	std::cerr << "Usage: " << Name << " [-j <number of workers>] <trace file>\n";
+}
+
+int main(int argc, char **argv) {
+	unsigned NumWorkers = std::thread::hardware_concurrency();
+	const char *Path = nullptr;
+	for(int Index = 1; Index < argc; ++Index) {
+		if(!strcmp(argv[Index], "-j") && Index + 1 < argc) {
+			NumWorkers = atoi(argv[++Index]);
+			continue;
+		}
+		if(Path) {
+			PrintUsage(argv[0]);
+			return 1;
+		}
+		Path = argv[Index];
+	}
+	if(!Path) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+// The runtime the analyzer replays into must check the operations itself
+	if(getenv("PMCHECK_TRACE") || getenv("PMCHECK_CROSS_THREAD")) {
+		std::cerr << "PMCHECK_TRACE and PMCHECK_CROSS_THREAD must not be set when "
+							<< "analyzing a trace.\n";
+		return 1;
+	}
+	if(!Reader.open(Path)) {
+		std::cerr << "Could not read persist trace " << Path << ".\n";
+		return 1;
+	}
+
+	auto StartTime = std::chrono::steady_clock::now();
+	WorkStealingPool Pool(NumWorkers);
+
+// Scan the threads first, since accesses of any thread may be in the pools
+// allocated by other threads.
+	std::vector<ThreadScanInfo> ScanInfoVect(Reader.getNumThreads());
+	for(uint32_t Thread = 0; Thread != Reader.getNumThreads(); ++Thread)
+		Pool.submit([Thread, &ScanInfoVect]() { ScanThread(Thread, ScanInfoVect[Thread]); });
+	Pool.run();
+
+	std::vector<PoolInfo> PoolsVect;
+	uint64_t NumRecords = 0, NumFences = 0, NumTasks = 0;
+	for(auto &Info : ScanInfoVect) {
+		PoolsVect.insert(PoolsVect.end(), Info.PoolsVect.begin(), Info.PoolsVect.end());
+		NumRecords += Info.NumRecords;
+		NumFences += Info.NumFences;
+		NumTasks += Info.TasksVect.size();
+	}
+	std::sort(PoolsVect.begin(), PoolsVect.end(), [](const PoolInfo &A, const PoolInfo &B) {
+		return A.Index < B.Index;
+	});
+	for(auto &PMPool : PoolsVect) {
+		if(PMPool.Index != PoolAddrVect.size())
+			continue;
+		AllocatePM(PMPool.Addr, PMPool.Size);
+		PoolAddrVect.push_back(PMPool.Addr);
+	}
+
+	for(auto &Info : ScanInfoVect) {
+		for(auto &Task : Info.TasksVect)
+			Pool.submit([&Task]() { ReplayEpochs(Task); });
+	}
+	Pool.run();
+
+	auto Duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+														std::chrono::steady_clock::now() - StartTime).count();
+	std::cerr << "Checked " << NumRecords << " records in " << NumFences << " epochs of "
+						<< Reader.getNumThreads() << " threads in " << NumTasks << " tasks on "
+						<< Pool.getNumWorkers() << " workers in " << Duration << " ms.\n";
+	if(Reader.isCorrupt())
+		std::cerr << "The trace is truncated or corrupt, so some records were not checked.\n";
+
+// The runtime prints the findings when the analyzer exits
+	return Reader.isCorrupt();
+}